@@ -1,6 +1,8 @@
 ﻿#include "benchmark.h"
 #include "numa.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 
@@ -218,4 +220,111 @@ BenchmarkSetup setup_benchmark(std::istream& is) {
 	return setup;
 }
 
+/*
+	🌈 Lazy SMPのスケーリング計測
+
+	scalingbench [threads 1,2,4,..] [hash 1024,..] [movetime 5000] [file default|current|ファイル名]
+	             [format csv|json] [output ファイル名]
+
+	threads、hashはカンマ区切りで複数指定できて、そのすべての組み合わせについて計測する。
+	threadsを省略した時は、1からハードウェアスレッド数まで2倍ずつ増やしたもの(最後はハードウェアスレッド数)になる。
+
+	例)
+		scalingbench threads 1,2,4,8 hash 256,1024 movetime 3000 format json output scaling.json
+*/
+ScalingBenchmarkSetup setup_scaling_benchmark(const std::string& currentFen, std::istream& is) {
+
+	ScalingBenchmarkSetup setup{};
+
+	// "1,2,4"のようなカンマ区切りの数値を配列にする。
+	auto parse_list = [](const std::string& str) {
+		std::vector<size_t> v;
+		size_t              pos = 0;
+		while (pos < str.size())
+		{
+			size_t next = str.find(',', pos);
+			if (next == std::string::npos)
+				next = str.size();
+			const std::string item = str.substr(pos, next - pos);
+			if (!item.empty())
+				v.push_back(size_t(std::max(1LL, std::atoll(item.c_str()))));
+			pos = next + 1;
+		}
+		return v;
+	};
+
+	auto join_list = [](const std::vector<size_t>& v) {
+		std::string str;
+		for (size_t i = 0; i < v.size(); ++i)
+			str += (i ? "," : "") + std::to_string(v[i]);
+		return str;
+	};
+
+	std::string fenFile = "default";
+	setup.movetime      = 5000;
+	setup.format        = "csv";
+
+	std::string token;
+	while (is >> token)
+	{
+		if (token == "threads" && is >> token)
+			setup.threads = parse_list(token);
+		else if (token == "hash" && is >> token)
+			setup.ttSizes = parse_list(token);
+		else if (token == "movetime")
+			is >> setup.movetime;
+		else if (token == "file")
+			is >> fenFile;
+		else if (token == "format")
+			is >> setup.format;
+		else if (token == "output")
+			is >> setup.outputFile;
+		else
+			std::cerr << "Warning : unknown option " << token << std::endl;
+	}
+
+	if (setup.threads.empty())
+	{
+		const size_t hw = std::max<size_t>(get_hardware_concurrency(), 1);
+		for (size_t t = 1; t < hw; t *= 2)
+			setup.threads.push_back(t);
+		setup.threads.push_back(hw);
+	}
+
+	if (setup.ttSizes.empty())
+		setup.ttSizes.push_back(1024);
+
+	setup.movetime = std::max(setup.movetime, 1);
+
+	if (setup.format != "json")
+		setup.format = "csv";
+
+	if (fenFile == "default")
+		setup.sfens = Defaults;
+
+	else if (fenFile == "current")
+		setup.sfens.push_back(currentFen);
+
+	else
+	{
+		std::string   fen;
+		std::ifstream file(fenFile);
+
+		// 💡 benchと違って、対局中のエンジンを落とさないように、局面なしで返す。
+		//     呼び出し側は、sfensが空なら何もせずに終了する。
+		if (!file.is_open())
+			std::cerr << "Unable to open file " << fenFile << std::endl;
+
+		while (getline(file, fen))
+			if (!fen.empty())
+				setup.sfens.push_back(fen);
+	}
+
+	setup.filledInvocation = "threads " + join_list(setup.threads) + " hash " + join_list(setup.ttSizes)
+		+ " movetime " + std::to_string(setup.movetime) + " file " + fenFile + " format " + setup.format
+		+ (setup.outputFile.empty() ? "" : " output " + setup.outputFile);
+
+	return setup;
+}
+
 } // namespace YaneuraOu
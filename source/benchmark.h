@@ -35,6 +35,35 @@ namespace YaneuraOu::Benchmark {
 	// benchコマンドのコマンドラインからBenchmarkSetupの構造体に情報を詰め込んで返す。
 	BenchmarkSetup setup_benchmark(std::istream& is);
 
+	// 🌈 Lazy SMPのスケーリング計測(scalingbenchコマンド)のセットアップの構造体
+	struct ScalingBenchmarkSetup {
+		// 計測するスレッド数の一覧。先頭のものが速度向上率の基準となる。
+		std::vector<size_t>      threads;
+
+		// 計測する置換表サイズ[MB]の一覧
+		std::vector<size_t>      ttSizes;
+
+		// 1局面あたりの思考時間[ms]
+		int                      movetime;
+
+		// 計測に用いる局面(sfen文字列)
+		std::vector<std::string> sfens;
+
+		// 出力形式。"csv" or "json"
+		std::string              format;
+
+		// 出力先のファイル名。空なら標準出力に出力する。
+		std::string              outputFile;
+
+		// 省略されていたところを埋めた引数の情報
+		std::string              filledInvocation;
+	};
+
+	// scalingbenchコマンドのコマンドラインからScalingBenchmarkSetupの構造体に情報を詰め込んで返す。
+	//  currentFen : 現在のSfen文字列("file current"のときに用いる)
+	//  is         : コマンドライン("scalingbench"に続くパラメーターを取得するためのもの)
+	ScalingBenchmarkSetup setup_scaling_benchmark(const std::string& currentFen, std::istream& is);
+
 }  // namespace YaneuraOu
 
 #endif  // #ifndef BENCHMARK_H_INCLUDED
@@ -6,6 +6,7 @@
 #include <iomanip>		// std::setprecision()
 #include <limits>
 #include <numeric>      // std::accumulate()
+#include <queue>
 
 #include "book.h"
 #include "apery_book.h"
@@ -148,16 +149,109 @@ namespace Book
 		sorted = false; // sort関係が崩れたのでフラグをfalseに戻しておく。
 	}
 
-	// [ASYNC] 他のbookをmergeする。
+	// ----------------------------------
+	//			ShardedBookType
+	// ----------------------------------
+
+	size_t ShardedBookType::shard_of(const std::string& sfen)
+	{
+		// std::hashの下位bitは偏ることがあるので、乗算して上位bitを用いる。
+		const u64 h = u64(std::hash<std::string>()(sfen)) * 0x9E3779B97F4A7C15ULL;
+		return size_t(h >> 56) & (SHARD_NUM - 1);
+	}
+
+	BookMovesPtr ShardedBookType::find(const std::string& sfen) const
+	{
+		const auto& shard = shards[shard_of(sfen)];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.body.find(sfen);
+		return it == shard.body.end() ? BookMovesPtr() : it->second;
+	}
+
+	void ShardedBookType::set(const std::string& sfen, const BookMovesPtr& ptr)
+	{
+		auto& shard = shards[shard_of(sfen)];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.body[sfen] = ptr;
+	}
+
+	BookMovesPtr ShardedBookType::get_or_create(const std::string& sfen)
+	{
+		auto& shard = shards[shard_of(sfen)];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto& ptr = shard.body[sfen];
+		if (!ptr)
+			ptr = BookMovesPtr(new BookMoves());
+		return ptr;
+	}
+
+	size_t ShardedBookType::size() const
+	{
+		size_t total = 0;
+		for (auto& shard : shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			total += shard.body.size();
+		}
+		return total;
+	}
+
+	void ShardedBookType::clear()
+	{
+		for (auto& shard : shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.body.clear();
+		}
+	}
+
+	void ShardedBookType::foreach(const std::function<void(const std::string&, const BookMovesPtr&)>& f) const
+	{
+		for (size_t i = 0; i < SHARD_NUM; ++i)
+			foreach_in_shard(i, f);
+	}
+
+	void ShardedBookType::foreach_in_shard(size_t shard_index, const std::function<void(const std::string&, const BookMovesPtr&)>& f) const
+	{
+		const auto& shard = shards[shard_index];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		for (auto& it : shard.body)
+			f(it.first, it.second);
+	}
+
 	void MemoryBook::merge(MemoryBook& book2)
 	{
-		std::lock_guard<std::recursive_mutex> lock(mutex_);
-		book2.foreach([&](const std::string& sfen, const Book::BookMovesPtr book_moves)
+		// 同じsfenは同じshard番号に入るので、book2のshardを一つずつthisの同じshardに追加していけば良い。
+		book2.book_body.foreach([&](const std::string& sfen, const BookMovesPtr& book_moves)
 		{
-			this->append(sfen, book_moves);
+			book_body.set(sfen, book_moves);
 		});
 	}
 
+	void MemoryBook::merge(MemoryBook& book2, ThreadPool& threads, size_t thread_count)
+	{
+		// スレッドがまだ生成されていなければ、呼び出したスレッドでmergeする。
+		if (threads.num_threads() == 0)
+		{
+			merge(book2);
+			return;
+		}
+		thread_count = std::max(size_t(1), std::min(thread_count, threads.num_threads()));
+
+		// shard単位で分担するので、各スレッドが触るshardは他のスレッドと重ならない。
+		// 📝 shardごとの局面数は偏りうるので、1shardずつ取り出して処理させる。
+		threads.parallel_for(0, ShardedBookType::SHARD_NUM, 1, [&](size_t /*thread_id*/, size_t begin, size_t end) {
+			for (size_t shard = begin; shard < end; ++shard)
+				book2.book_body.foreach_in_shard(shard, [&](const std::string& sfen, const BookMovesPtr& book_moves)
+				{
+					book_body.set(sfen, book_moves);
+				});
+		}, thread_count);
+	}
+
 	// [ASYNC] このクラスの持つ指し手集合に対して、それぞれの局面を列挙する時に用いる
 	void BookMoves::foreach(std::function<void(BookMove&)> f)
 	{
@@ -169,30 +263,16 @@ namespace Book
 
 	void MemoryBook::insert(const std::string& sfen, const BookMove& bp , bool overwrite)
 	{
-		std::lock_guard<std::recursive_mutex> lock(mutex_);
-
-		auto it = book_body.find(sfen);
-		if (it == book_body.end())
-		{
-			// 存在しないので要素を作って追加。
-			BookMovesPtr move_list(new BookMoves());
-			move_list->push_back(bp);
-			book_body[sfen] = move_list;
-		}
-		else {
-			// この局面での指し手のリスト
-			auto& book_moves = *it->second;
-			book_moves.insert(bp, overwrite);
-		}
+		// この局面での指し手のリスト。存在しなければ空の要素が作られて追加される。
+		// shardのlockはget_or_create()の間だけ。指し手の追加はBookMoves自身のlockで行う。
+		auto book_moves = book_body.get_or_create(sfen);
+		book_moves->insert(bp, overwrite);
 	}
 
 	// [ASYNC] このクラスの持つ定跡DBに対して、それぞれの局面を列挙する時に用いる
 	void MemoryBook::foreach(std::function<void(const std::string& /*sfen*/, const BookMovesPtr)> f)
 	{
-		std::lock_guard<std::recursive_mutex> lock(mutex_);
-
-		for(auto& it : book_body)
-			f(it.first,it.second);
+		book_body.foreach([&](const std::string& sfen, const BookMovesPtr& book_moves) { f(sfen, book_moves); });
 	}
 
 	// ----------------------------------
@@ -210,6 +290,9 @@ namespace Book
 	static constexpr uint64_t YbbFlagMoveDepth = 1;
 	static constexpr uint64_t YbbKnownFlags = YbbFlagMoveDepth;
 
+	// write_book()で.ybbを書き出す時に、YbbBuilderが局面を溜めておくbufferの上限[byte]
+	static constexpr uint64_t YbbWriteBookMemoryLimit = 1024ULL * 1024 * 1024;
+
 	static bool ends_with(const std::string& text, const std::string& suffix)
 	{
 		return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
@@ -312,6 +395,22 @@ namespace Book
 		return true;
 	}
 
+	static bool write_u16_le(std::ostream& os, uint16_t value)
+	{
+		const std::array<unsigned char, 2> bytes{ uint8_t(value), uint8_t(value >> 8) };
+		os.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		return bool(os);
+	}
+
+	static bool write_u64_le(std::ostream& os, uint64_t value)
+	{
+		std::array<unsigned char, 8> bytes{};
+		for (size_t i = 0; i < bytes.size(); ++i)
+			bytes[i] = uint8_t(value >> (i * 8));
+		os.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		return bool(os);
+	}
+
 	static bool read_file_to_memory(const std::string& filename, std::vector<unsigned char>& data)
 	{
 		std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
@@ -329,7 +428,23 @@ namespace Book
 		return bool(file) || data.empty();
 	}
 
-	static bool read_u16_le_from_memory(const std::vector<unsigned char>& data, uint64_t offset, uint16_t& value)
+	// .ybbのbyte列。メモリに丸読みしたbufferとmemory mapしたファイルの両方をこれで参照する。
+	struct YbbBytes
+	{
+		YbbBytes() {}
+		YbbBytes(const unsigned char* data, uint64_t size) : bytes(data), length(size) {}
+		YbbBytes(const std::vector<unsigned char>& v) : bytes(v.data()), length(v.size()) {}
+
+		const unsigned char* data() const { return bytes; }
+		uint64_t size() const { return length; }
+		unsigned char operator[](size_t i) const { return bytes[i]; }
+
+	private:
+		const unsigned char* bytes = nullptr;
+		uint64_t length = 0;
+	};
+
+	static bool read_u16_le_from_memory(const YbbBytes& data, uint64_t offset, uint16_t& value)
 	{
 		if (offset > data.size() || data.size() - offset < 2)
 			return false;
@@ -337,7 +452,7 @@ namespace Book
 		return true;
 	}
 
-	static bool read_u64_le_from_memory(const std::vector<unsigned char>& data, uint64_t offset, uint64_t& value)
+	static bool read_u64_le_from_memory(const YbbBytes& data, uint64_t offset, uint64_t& value)
 	{
 		if (offset > data.size() || data.size() - offset < 8)
 			return false;
@@ -399,7 +514,7 @@ namespace Book
 		return true;
 	}
 
-	static bool read_ybb_header_from_memory(const std::vector<unsigned char>& data, uint64_t& record_count, uint64_t& flags)
+	static bool read_ybb_header_from_memory(const YbbBytes& data, uint64_t& record_count, uint64_t& flags)
 	{
 		if (data.size() < YbbHeaderSize)
 			return false;
@@ -419,7 +534,7 @@ namespace Book
 		return true;
 	}
 
-	static bool read_ybb_index_entry_from_memory(const std::vector<unsigned char>& data, uint64_t record_index, YbbIndexEntry& entry)
+	static bool read_ybb_index_entry_from_memory(const YbbBytes& data, uint64_t record_index, YbbIndexEntry& entry)
 	{
 		if (record_index > (std::numeric_limits<uint64_t>::max() - YbbHeaderSize) / YbbIndexRecordSize)
 			return false;
@@ -476,7 +591,7 @@ namespace Book
 		return book_moves;
 	}
 
-	static BookMovesPtr read_ybb_moves_from_memory(const std::vector<unsigned char>& moves_data, const YbbIndexEntry& entry, uint64_t flags, uint64_t moves_base)
+	static BookMovesPtr read_ybb_moves_from_memory(const YbbBytes& moves_data, const YbbIndexEntry& entry, uint64_t flags, uint64_t moves_base)
 	{
 		if (moves_base > moves_data.size() || entry.moves_offset > moves_data.size() - moves_base)
 			return BookMovesPtr();
@@ -505,6 +620,36 @@ namespace Book
 		book_moves->sort_moves();
 		return book_moves;
 	}
+	// .ybbのindexの[position, record_count)の範囲からtargetを二分探索する。
+	// 見つかればtrueを返し、positionにそのrecordの番号、entryにそのrecordが入る。
+	// 見つからなければfalseを返し、positionにはtarget以上となる最初のrecordの番号が入る。
+	static bool search_ybb_index_in_memory(const YbbBytes& data, uint64_t record_count, const PackedSfen& target,
+		uint64_t& position, YbbIndexEntry& entry)
+	{
+		uint64_t left  = position;
+		uint64_t right = record_count;
+		while (left < right)
+		{
+			const uint64_t middle = left + (right - left) / 2;
+			if (!read_ybb_index_entry_from_memory(data, middle, entry))
+				break;
+
+			const int compare = compare_packed_sfen(target, entry.packed_sfen);
+			if (compare < 0)
+				right = middle;
+			else if (compare > 0)
+				left = middle + 1;
+			else
+			{
+				position = middle;
+				return true;
+			}
+		}
+
+		position = left;
+		return false;
+	}
+
 	void MemoryBook::set_options(OptionsMap& options)
 	{
 		this->options.set_ref(options);
@@ -541,11 +686,13 @@ namespace Book
 		this->on_the_fly = false;
 		this->ybb_book = false;
 		this->ybb_memory_book = false;
+		this->ybb_mapped_book = false;
 		this->ybb_record_count = 0;
 		this->ybb_flags = 0;
 		this->ybb_moves_base = 0;
 		this->ybb_moves_name.clear();
 		this->ybb_index_data.clear();
+		ybb_mapped_file.Close();
 		if (ybb_index_fs.is_open())
 			ybb_index_fs.close();
 		if (ybb_moves_fs.is_open())
@@ -585,6 +732,33 @@ namespace Book
 			{
 				if (ybb_book_file)
 				{
+					// まずmemory mapを試みる。
+					// mapしたpageはOSのpage cacheとして同じ定跡を開いている他のエンジンのプロセスと共有されるので、
+					// 丸読みのようにプロセスごとにメモリを消費することがなく、find()もファイルのseekなしに
+					// メモリ上で二分探索するだけで済む。
+					if (ybb_mapped_file.Open(actual_filename).is_ok())
+					{
+						const YbbBytes mapped(ybb_mapped_file.data(), ybb_mapped_file.size());
+						if (!read_ybb_header_from_memory(mapped, ybb_record_count, ybb_flags)
+							|| !ybb_index_size(ybb_record_count, ybb_moves_base))
+						{
+							ybb_mapped_file.Close();
+							sync_cout << "info string Error! : invalid ybb file : " << actual_filename << sync_endl;
+							return Tools::Result(Tools::ResultCode::FileReadError);
+						}
+
+						this->ybb_book = true;
+						this->ybb_mapped_book = true;
+						this->ybb_moves_name = actual_filename;
+						this->on_the_fly = true;
+						this->book_name = filename;
+						this->pure_book_name = actual_pure_filename;
+
+						sync_cout << "info string map book file : " << actual_filename << " , number of positions = " << size() << sync_endl;
+						return Tools::Result::Ok();
+					}
+
+					// mapできない環境では、従来どおりfind()のたびにファイルを読みに行く。
 					ybb_index_fs.open(actual_filename, std::ios::in | std::ios::binary);
 					if (ybb_index_fs.fail())
 					{
@@ -793,6 +967,43 @@ namespace Book
 		// →　この関数はbookコマンドからしか呼び出さず、bookコマンドの処理の先頭付近でis_ready()を
 		// 呼び出しているため、この関数のなかでのis_ready()は呼び出さないことにする。
 
+		if (is_ybb_book(filename))
+		{
+			// .ybbはPackedSfen順に並んでいる必要があるので、並べ替えと手数違いの重複局面の除去はYbbBuilderに任せる。
+			YbbBuilder builder;
+			auto result = builder.open(filename, YbbWriteBookMemoryLimit);
+			if (result.is_not_ok())
+				return result;
+
+			std::cout << "write " + filename << std::endl;
+
+			u64 counter = 0;
+			Tools::ProgressBar progress(book_body.size());
+			Position pos;
+
+			book_body.foreach([&](const std::string& sfen, const BookMovesPtr& book_moves)
+			{
+				// 指し手のない空っぽのentryは書き出さないように。
+				if (result.is_not_ok() || book_moves->size() == 0)
+					return;
+
+				StateInfo si;
+				pos.set(sfen, &si);
+				PackedSfen packed;
+				pos.sfen_pack(packed);
+
+				book_moves->sort_moves();
+				std::vector<BookMove> moves(book_moves->begin(), book_moves->end());
+				result = builder.add(packed, uint16_t(pos.game_ply()), moves);
+
+				progress.check(++counter);
+			});
+
+			if (result.is_not_ok())
+				return result;
+			return builder.close();
+		}
+
 		SystemIO::TextWriter writer;
 		if (writer.Open(filename).is_not_ok())
 			return Tools::Result(Tools::ResultCode::FileOpenError);
@@ -812,13 +1023,13 @@ namespace Book
 		// sfenの手数の手前までの文字列とそのときの手数
 		std::unordered_map<std::string, int> book_ply;
 
-		for (auto& it : book_body)
+		book_body.foreach([&](const std::string& sfen, const BookMovesPtr& book_moves)
 		{
 			// 指し手のない空っぽのentryは書き出さないように。
-			if (it.second->size() == 0)
-				continue;
-			vectored_book.push_back(it);
-		}
+			if (book_moves->size() == 0)
+				return;
+			vectored_book.emplace_back(sfen, book_moves);
+		});
 
 		// sfen文字列は手駒の表記に揺れがある。
 		// (USI原案のほうでは規定されているのだが、将棋所が採用しているUSIプロトコルではこの規定がない。)
@@ -897,10 +1108,7 @@ namespace Book
 	// sfen : sfen文字列(末尾にplyまで書かれているものとする)
 	BookMovesPtr MemoryBook::find(const std::string& sfen) const
 	{
-		std::lock_guard<std::recursive_mutex> lock(const_cast<MemoryBook*>(this)->mutex_);
-
-		auto it = book_body.find(trim(sfen));
-		return it == book_body.end() ? BookMovesPtr() : it->second;
+		return book_body.find(trim(sfen));
 	}
 
 	// [ASYNC] メモリに保持している定跡に局面を一つ追加する。
@@ -908,8 +1116,7 @@ namespace Book
 	// と等価。
 	void MemoryBook::append(const std::string& sfen, const Book::BookMovesPtr ptr)
 	{
-		std::lock_guard<std::recursive_mutex> lock(mutex_);
-		book_body[sfen] = ptr;
+		book_body.set(sfen, ptr);
 	}
 
 	// 反転された指し手を登録した新規エントリーを作成するヘルパー関数。
@@ -1118,32 +1325,90 @@ namespace Book
 
 	BookMovesPtr MemoryBook::find_ybb_bookmoves_in_memory(const PackedSfen& target, uint16_t game_ply)
 	{
-		if (!ybb_memory_book)
+		if (!ybb_memory_book && !ybb_mapped_book)
 			return BookMovesPtr();
 
-		uint64_t left  = 0;
-		uint64_t right = ybb_record_count;
-		while (left < right)
-		{
-			const uint64_t middle = left + (right - left) / 2;
-			YbbIndexEntry entry;
-			if (!read_ybb_index_entry_from_memory(ybb_index_data, middle, entry))
-				return BookMovesPtr();
+		// memory mapしている時は、mapされたpageの上で直接二分探索とmoves recordのdecodeを行う。
+		const YbbBytes bytes(ybb_data(), ybb_data_size());
 
-			const int compare = compare_packed_sfen(target, entry.packed_sfen);
-			if (compare < 0)
-				right = middle;
-			else if (compare > 0)
-				left = middle + 1;
-			else
+		uint64_t position = 0;
+		YbbIndexEntry entry;
+		if (!search_ybb_index_in_memory(bytes, ybb_record_count, target, position, entry))
+			return BookMovesPtr();
+
+		if (!ignoreBookPly && entry.ply != game_ply)
+			return BookMovesPtr();
+		return read_ybb_moves_from_memory(bytes, entry, ybb_flags, ybb_moves_base);
+	}
+
+	// 局面を一括でprobeする。
+	Tools::Result MemoryBook::probe_bulk(ThreadPool& threads, size_t thread_count, std::vector<BulkQuery>& queries,
+		const std::function<void(size_t, const BulkQuery&, const BookMoves&)>& on_hit)
+	{
+		if (!ybb_memory_book && !ybb_mapped_book)
+			return Tools::Result(Tools::ResultCode::NotImplementedError);
+
+		// スレッドがまだ生成されていなければ、呼び出したスレッドで探索する。
+		const bool run_inline = threads.num_threads() == 0;
+		thread_count = run_inline ? 1 : std::max(size_t(1), std::min(thread_count, threads.num_threads()));
+
+		// .ybbのindexと同じ順に並べておけば、各スレッドは前回見つけた位置より後ろだけを探せば良い。
+		std::sort(queries.begin(), queries.end(), [](const BulkQuery& lhs, const BulkQuery& rhs) {
+			return compare_packed_sfen(lhs.sfen, rhs.sfen) < 0;
+		});
+
+		const YbbBytes bytes(ybb_data(), ybb_data_size());
+		const bool flipped_book = options["FlippedBook"];
+
+		// queriesをPROBE_BULK_GRAIN個ずつの連続区間に分けて、スレッドで分担する。
+		// 📝 定跡にhitした局面だけ指し手のdecodeがあって処理時間に偏りがあるので、
+		//     早く終わったスレッドに残りの区間を手伝わせる。
+		constexpr size_t PROBE_BULK_GRAIN = 4096;
+
+		auto work = [&](size_t thread_id, size_t begin, size_t end) {
+
+			uint64_t hint = 0;
+			for (size_t i = begin; i < end; ++i)
 			{
-				if (!ignoreBookPly && entry.ply != game_ply)
-					return BookMovesPtr();
-				return read_ybb_moves_from_memory(ybb_index_data, entry, ybb_flags, ybb_moves_base);
+				const auto& query = queries[i];
+
+				uint64_t position = hint;
+				YbbIndexEntry entry;
+				bool found = search_ybb_index_in_memory(bytes, ybb_record_count, query.sfen, position, entry);
+				hint = position;
+
+				if (found && !ignoreBookPly && query.game_ply != 0 && entry.ply != query.game_ply)
+					found = false;
+
+				if (found)
+				{
+					auto moves = read_ybb_moves_from_memory(bytes, entry, ybb_flags, ybb_moves_base);
+					if (moves != nullptr)
+						on_hit(thread_id, query, *moves);
+					continue;
+				}
+
+				if (!flipped_book)
+					continue;
+
+				// 反転させた局面は並び順が異なるので、先頭から二分探索する。
+				PackedSfen flipped = query.sfen;
+				flipped.flip();
+				position = 0;
+				if (!search_ybb_index_in_memory(bytes, ybb_record_count, flipped, position, entry))
+					continue;
+				if (!ignoreBookPly && query.game_ply != 0 && entry.ply != query.game_ply)
+					continue;
+
+				auto moves = read_ybb_moves_from_memory(bytes, entry, ybb_flags, ybb_moves_base);
+				if (moves != nullptr)
+					on_hit(thread_id, query, *make_flipped_bookmoves(moves));
 			}
-		}
+		};
 
-		return BookMovesPtr();
+		threads.parallel_for(0, queries.size(), PROBE_BULK_GRAIN, work, thread_count);
+
+		return Tools::Result::Ok();
 	}
 
 	BookMovesPtr MemoryBook::find(const Position& pos)
@@ -1202,7 +1467,7 @@ namespace Book
 			if (!on_the_fly && !ybb_memory_book && book_body.size() == 0)
 				return BookMovesPtr();
 
-			BookType::iterator it;
+			BookMovesPtr it;
 
 			// "sfen lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1"のような文字列である。
 			// IgnoreBookPlyがtrueのときは、
@@ -1213,13 +1478,19 @@ namespace Book
 			{
 				if (ybb_book)
 				{
+					// memory mapしているなら、ファイルを読みに行かずにmapされたメモリ上を探す。
+					auto find_ybb = [&](const PackedSfen& target) {
+						return ybb_mapped_book ? find_ybb_bookmoves_in_memory(target, uint16_t(pos.game_ply()))
+						                       : find_ybb_bookmoves_on_the_fly(target, uint16_t(pos.game_ply()));
+					};
+
 					PackedSfen target{};
 					const_cast<Position&>(pos).sfen_pack(target);
-					auto entry = find_ybb_bookmoves_on_the_fly(target, uint16_t(pos.game_ply()));
+					auto entry = find_ybb(target);
 					if (entry == nullptr && options["FlippedBook"])
 					{
 						target.flip();
-						entry = find_ybb_bookmoves_on_the_fly(target, uint16_t(pos.game_ply()));
+						entry = find_ybb(target);
 						if (entry != nullptr)
 							entry = make_flipped_bookmoves(entry);
 					}
@@ -1261,21 +1532,21 @@ namespace Book
 
 				auto sfen = pos.sfen();
 				it = book_body.find(trim(sfen));
-				if (it != book_body.end())
+				if (it != nullptr)
 				{
 					// メモリ上に丸読みしてあるので参照透明だと思って良い。
-					it->second->sort_moves();
-					return BookMovesPtr(it->second);
+					it->sort_moves();
+					return it;
 				}
 
 				// FlippedBookが有効なら、反転させた局面にhitするか調べる。
 				if (options["FlippedBook"])
 				{
 					it = book_body.find(trim(Position::sfen_to_flipped_sfen(sfen)));
-					if (it != book_body.end())
+					if (it != nullptr)
 					{
 						// hitしたので反転された指し手を登録した新規エントリーを作成してそれを返す。
-						return make_flipped_bookmoves(it->second);
+						return make_flipped_bookmoves(it);
 					}
 				}
 
@@ -1860,6 +2131,328 @@ namespace Book
 	}
 
 
+	// ----------------------------------
+	//			YbbBuilder
+	// ----------------------------------
+
+	// 一度にmergeするrunの数の上限。これより多ければ、何段階かに分けてmergeする。
+	// (同時に開くファイル数を抑えるため)
+	static constexpr size_t YbbMaxMergeWays = 256;
+
+	// runの1record分。
+	struct YbbRunRecord
+	{
+		PackedSfen sfen{};
+		uint16_t ply = 0;
+		// (move, value, depth)×指し手の数
+		std::vector<uint16_t> words;
+
+		size_t move_count() const { return words.size() / 3; }
+
+		bool read(std::istream& is)
+		{
+			uint16_t count;
+			is.read(reinterpret_cast<char*>(sfen.data), 32);
+			if (!is || !read_u16_le(is, ply) || !read_u16_le(is, count))
+				return false;
+			words.resize(size_t(count) * 3);
+			for (auto& w : words)
+				if (!read_u16_le(is, w))
+					return false;
+			return true;
+		}
+
+		bool write(std::ostream& os) const
+		{
+			os.write(reinterpret_cast<const char*>(sfen.data), 32);
+			if (!os || !write_u16_le(os, ply) || !write_u16_le(os, uint16_t(move_count())))
+				return false;
+			for (auto w : words)
+				if (!write_u16_le(os, w))
+					return false;
+			return true;
+		}
+	};
+
+	YbbBuilder::~YbbBuilder()
+	{
+		// close()されずに破棄されたなら、テンポラリファイルだけは消しておく。
+		remove_temporary_files();
+	}
+
+	Tools::Result YbbBuilder::open(const std::string& filename_, uint64_t memory_limit_)
+	{
+		remove_temporary_files();
+
+		filename     = filename_;
+		memory_limit = std::max(memory_limit_, uint64_t(1));
+		buffer.clear();
+		offsets.clear();
+		runs.clear();
+		run_serial = 0;
+		added = written = 0;
+
+		// 書き出し先が開けるかだけ先に確認しておく。
+		std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+		if (!ofs)
+			return Tools::Result(Tools::ResultCode::FileOpenError);
+
+		opened = true;
+		return Tools::Result::Ok();
+	}
+
+	Tools::Result YbbBuilder::add(const PackedSfen& sfen, uint16_t ply, const std::vector<BookMove>& moves)
+	{
+		if (!opened)
+			return Tools::Result(Tools::ResultCode::SomeError);
+		if (moves.size() > std::numeric_limits<uint16_t>::max())
+			return Tools::Result(Tools::ResultCode::FileWriteError);
+
+		offsets.push_back(buffer.size());
+
+		auto put_u16 = [&](uint16_t v) { buffer.push_back(uint8_t(v)); buffer.push_back(uint8_t(v >> 8)); };
+		buffer.insert(buffer.end(), sfen.data, sfen.data + 32);
+		put_u16(ply);
+		put_u16(uint16_t(moves.size()));
+		for (auto& m : moves)
+		{
+			put_u16(m.move.to_u16());
+			put_u16(uint16_t(int16_t(std::clamp(m.value, -VALUE_INFINITE, int(VALUE_INFINITE)))));
+			put_u16(uint16_t(std::clamp(m.depth, 0, int(std::numeric_limits<uint16_t>::max()))));
+		}
+		++added;
+
+		if (buffer.size() + offsets.size() * sizeof(uint64_t) >= memory_limit)
+			return flush_run();
+
+		return Tools::Result::Ok();
+	}
+
+	std::string YbbBuilder::next_run_filename()
+	{
+		auto name = filename + ".run" + std::to_string(run_serial++) + ".tmp";
+		temporary_files.push_back(name);
+		return name;
+	}
+
+	void YbbBuilder::remove_temporary_files()
+	{
+		for (auto& name : temporary_files)
+			std::remove(name.c_str());
+		temporary_files.clear();
+	}
+
+	Tools::Result YbbBuilder::flush_run()
+	{
+		if (offsets.empty())
+			return Tools::Result::Ok();
+
+		// (PackedSfen, ply)の順に並べる。同じ局面で同じ手数ならadd()された順のまま。
+		// 💡 merge_runs()は同じ局面の最初のrecordだけを書き出すので、plyでも並べておかないと
+		//     手数の最も小さいものが書き出されない。plyはrecordの32,33 byte目(little endian)。
+		auto ply_of = [&](uint64_t offset) {
+			const uint8_t* p = &buffer[size_t(offset)];
+			return uint16_t(p[32] | (p[33] << 8));
+		};
+		std::stable_sort(offsets.begin(), offsets.end(), [&](uint64_t lhs, uint64_t rhs) {
+			const int c = std::memcmp(&buffer[size_t(lhs)], &buffer[size_t(rhs)], 32);
+			if (c != 0)
+				return c < 0;
+			return ply_of(lhs) < ply_of(rhs);
+		});
+
+		const auto run_name = next_run_filename();
+		std::ofstream ofs(run_name, std::ios::binary | std::ios::trunc);
+		if (!ofs)
+			return Tools::Result(Tools::ResultCode::FileOpenError);
+
+		for (auto offset : offsets)
+		{
+			const uint8_t* p = &buffer[size_t(offset)];
+			const size_t count = size_t(p[34] | (p[35] << 8));
+			ofs.write(reinterpret_cast<const char*>(p), std::streamsize(36 + count * 6));
+		}
+		if (!ofs)
+			return Tools::Result(Tools::ResultCode::FileWriteError);
+
+		runs.push_back(run_name);
+
+		// 解放しておかないとbufferのcapacityだけメモリを使い続ける。
+		std::vector<uint8_t>().swap(buffer);
+		std::vector<uint64_t>().swap(offsets);
+
+		return Tools::Result::Ok();
+	}
+
+	Tools::Result YbbBuilder::merge_runs(const std::vector<std::string>& inputs, std::ostream* index_os, std::ostream& moves_os)
+	{
+		// runごとに先頭のrecordを読み込んでおき、(PackedSfen, ply, runの順番)が最小のものから取り出す。
+		// 各runは(PackedSfen, ply)の順に並んでいて(flush_run()を参照のこと)、runもadd()された順に並んでいるので、
+		// 同じ局面で同じ手数なら先にadd()されたものが先に出てくる。
+		struct Reader
+		{
+			std::ifstream is;
+			YbbRunRecord record;
+		};
+
+		std::vector<std::unique_ptr<Reader>> readers;
+		for (auto& input : inputs)
+		{
+			auto reader = std::make_unique<Reader>();
+			reader->is.open(input, std::ios::binary);
+			if (!reader->is)
+				return Tools::Result(Tools::ResultCode::FileOpenError);
+			readers.emplace_back(std::move(reader));
+		}
+
+		auto greater = [&](size_t lhs, size_t rhs) {
+			const auto& a = readers[lhs]->record;
+			const auto& b = readers[rhs]->record;
+			const int c = compare_packed_sfen(a.sfen, b.sfen);
+			if (c != 0)
+				return c > 0;
+			if (a.ply != b.ply)
+				return a.ply > b.ply;
+			return lhs > rhs;
+		};
+		std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> queue(greater);
+
+		for (size_t i = 0; i < readers.size(); ++i)
+			if (readers[i]->record.read(readers[i]->is))
+				queue.push(i);
+
+		PackedSfen last_sfen{};
+		bool has_last = false;
+		uint64_t moves_offset = 0;
+
+		while (!queue.empty())
+		{
+			const size_t i = queue.top();
+			queue.pop();
+
+			auto& record = readers[i]->record;
+
+			// 同じ局面は最初に出てきたもの以外は捨てる。
+			if (!has_last || compare_packed_sfen(last_sfen, record.sfen) != 0)
+			{
+				last_sfen = record.sfen;
+				has_last = true;
+
+				if (index_os == nullptr)
+				{
+					if (!record.write(moves_os))
+						return Tools::Result(Tools::ResultCode::FileWriteError);
+				}
+				else
+				{
+					index_os->write(reinterpret_cast<const char*>(record.sfen.data), 32);
+					if (!*index_os
+						|| !write_u64_le(*index_os, moves_offset)
+						|| !write_u16_le(*index_os, record.ply)
+						|| !write_u16_le(*index_os, uint16_t(record.move_count())))
+						return Tools::Result(Tools::ResultCode::FileWriteError);
+
+					for (auto w : record.words)
+						if (!write_u16_le(moves_os, w))
+							return Tools::Result(Tools::ResultCode::FileWriteError);
+
+					moves_offset += record.words.size() * sizeof(uint16_t);
+					++written;
+				}
+			}
+
+			if (record.read(readers[i]->is))
+				queue.push(i);
+			else if (!readers[i]->is.eof())
+				return Tools::Result(Tools::ResultCode::FileReadError);
+		}
+
+		return Tools::Result::Ok();
+	}
+
+	Tools::Result YbbBuilder::close()
+	{
+		if (!opened)
+			return Tools::Result(Tools::ResultCode::SomeError);
+		opened = false;
+
+		auto result = flush_run();
+		if (result.is_not_ok())
+		{
+			remove_temporary_files();
+			return result;
+		}
+
+		// runが多すぎるなら、YbbMaxMergeWays個ずつmergeしてrunの数を減らす。
+		// 連続するrunをまとめるので、add()された順序は保たれる。
+		while (runs.size() > YbbMaxMergeWays)
+		{
+			std::vector<std::string> merged;
+			for (size_t i = 0; i < runs.size(); i += YbbMaxMergeWays)
+			{
+				std::vector<std::string> inputs(runs.begin() + i, runs.begin() + std::min(runs.size(), i + YbbMaxMergeWays));
+				const auto run_name = next_run_filename();
+				{
+					std::ofstream ofs(run_name, std::ios::binary | std::ios::trunc);
+					result = ofs ? merge_runs(inputs, nullptr, ofs) : Tools::Result(Tools::ResultCode::FileOpenError);
+				}
+				for (auto& input : inputs)
+					std::remove(input.c_str());
+				if (result.is_not_ok())
+				{
+					remove_temporary_files();
+					return result;
+				}
+				merged.push_back(run_name);
+			}
+			runs.swap(merged);
+		}
+
+		// indexは書き出す.ybbのheaderの直後に直接書き出し、指し手はテンポラリファイルに書き出しておく。
+		// 局面数はmergeし終わるまでわからないので、headerはあとから書き直す。
+		const auto moves_name = filename + ".moves.tmp";
+		temporary_files.push_back(moves_name);
+		{
+			std::ofstream index_os(filename, std::ios::binary | std::ios::trunc);
+			std::ofstream moves_os(moves_name, std::ios::binary | std::ios::trunc);
+			if (!index_os || !moves_os)
+				result = Tools::Result(Tools::ResultCode::FileOpenError);
+			else
+			{
+				index_os.write(YbbMagic.data(), YbbMagic.size());
+				write_u64_le(index_os, 0);
+				write_u64_le(index_os, YbbFlagMoveDepth);
+				result = merge_runs(runs, &index_os, moves_os);
+			}
+		}
+
+		// indexの後ろに指し手を連結して、headerの局面数を書き直す。
+		if (result.is_ok())
+		{
+			std::fstream os(filename, std::ios::binary | std::ios::in | std::ios::out);
+			std::ifstream moves_is(moves_name, std::ios::binary);
+			os.seekp(0, std::ios::end);
+			if (!os || !moves_is)
+				result = Tools::Result(Tools::ResultCode::FileOpenError);
+			else
+			{
+				std::vector<char> chunk(1024 * 1024);
+				while (moves_is)
+				{
+					moves_is.read(chunk.data(), std::streamsize(chunk.size()));
+					os.write(chunk.data(), moves_is.gcount());
+				}
+				os.seekp(std::streamoff(YbbMagic.size()), std::ios::beg);
+				if (!write_u64_le(os, written))
+					result = Tools::Result(Tools::ResultCode::FileWriteError);
+			}
+		}
+
+		remove_temporary_files();
+		runs.clear();
+		return result;
+	}
+
 	// 定跡部のUnitTest
 	void UnitTest(Test::UnitTester& tester, IEngine& engine)
 	{
@@ -1901,6 +2494,243 @@ namespace Book
 			moves2 += (moves2.empty() ? "" : " ") + to_usi_string(Move(m));
 
 		tester.test("feed_position_string" , moves1 == moves2);
+
+		{
+			// shardに分割されたbook_bodyへの追加とmergeのテスト
+			auto s2 = tester.section("sharded book");
+
+			OptionsMap book_options;
+			book_options.add("IgnoreBookPly", Option(false));
+
+			MemoryBook book1, book2;
+			book1.set_options(book_options);
+			book2.set_options(book_options);
+
+			// shardを跨ぐように、適当に局面を登録する。
+			const int N = 1000;
+			for (int i = 0; i < N; ++i)
+			{
+				auto& book = (i & 1) ? book2 : book1;
+				book.insert("sfen " + std::to_string(i) + " 1", BookMove(USIEngine::to_move16("7g7f"), Move16::none(), i, 0, 1));
+			}
+			// 同じ指し手をoverwriteで追加すると採択回数が合算される。
+			book1.insert("sfen 0 1", BookMove(USIEngine::to_move16("7g7f"), Move16::none(), 0, 0, 2), true);
+			book1.insert("sfen 0 1", BookMove(USIEngine::to_move16("2g2f"), Move16::none(), 0, 0, 1), true);
+
+			tester.test("insert", book1.size() == N / 2 && book2.size() == N / 2);
+
+			auto moves = book1.find("sfen 0 1");
+			tester.test("find", moves != nullptr && moves->size() == 2 && moves->find_move(USIEngine::to_move16("7g7f"))->move_count == 3);
+			tester.test("not found", book1.find("sfen 1 1") == nullptr);
+
+			book1.merge(book2, engine.get_threads(), 4);
+			tester.test("merge", book1.size() == N && book1.find("sfen 1 1") != nullptr && book1.find("sfen 999 1")->find_move(USIEngine::to_move16("7g7f"))->value == 999);
+		}
+
+		{
+			// .ybbの読み込みテスト
+			// 平手の局面とそこから1手進めた局面だけを登録した小さな.ybbを書き出して、
+			// 丸読み(BookOnTheFly=false)とmemory map(BookOnTheFly=true)の両方で同じ指し手が返るかを調べる。
+			auto s2 = tester.section("ybb");
+
+			struct TestRecord { PackedSfen packed; uint16_t ply; std::vector<std::array<uint16_t, 3>> moves; };
+			std::vector<TestRecord> records;
+
+			std::deque<StateInfo> si2;
+			auto add_record = [&](const std::string& sfen, std::vector<std::array<uint16_t, 3>> moves) {
+				Position p;
+				BookTools::feed_position_string(p, sfen, si2);
+				TestRecord r;
+				p.sfen_pack(r.packed);
+				r.ply = uint16_t(p.game_ply());
+				r.moves = moves;
+				records.push_back(r);
+			};
+			auto m16 = [](const char* usi) { return USIEngine::to_move16(usi).to_u16(); };
+			add_record("startpos", { { m16("7g7f"), uint16_t(int16_t(50)), 20 }, { m16("2g2f"), uint16_t(int16_t(40)), 18 } });
+			add_record("startpos moves 7g7f", { { m16("3c3d"), uint16_t(int16_t(-30)), 20 } });
+
+			// .ybbのindexはPackedSfenの昇順に並んでいなければならない。
+			std::sort(records.begin(), records.end(), [](const TestRecord& a, const TestRecord& b) {
+				return compare_packed_sfen(a.packed, b.packed) < 0; });
+
+			std::vector<unsigned char> bytes;
+			auto put_u16 = [&](uint16_t v) { bytes.push_back(uint8_t(v)); bytes.push_back(uint8_t(v >> 8)); };
+			auto put_u64 = [&](uint64_t v) { for (int i = 0; i < 8; ++i) bytes.push_back(uint8_t(v >> (i * 8))); };
+
+			bytes.insert(bytes.end(), YbbMagic.begin(), YbbMagic.end());
+			put_u64(records.size());
+			put_u64(YbbFlagMoveDepth);
+			uint64_t moves_offset = 0;
+			for (auto& r : records)
+			{
+				bytes.insert(bytes.end(), r.packed.data, r.packed.data + 32);
+				put_u64(moves_offset);
+				put_u16(r.ply);
+				put_u16(uint16_t(r.moves.size()));
+				moves_offset += r.moves.size() * ybb_move_record_size(YbbFlagMoveDepth);
+			}
+			for (auto& r : records)
+				for (auto& m : r.moves)
+					for (auto v : m)
+						put_u16(v);
+
+			const std::string ybb_path = Path::Combine(Directory::GetBinaryFolder(), "book_unittest.ybb");
+			{
+				std::ofstream ofs(ybb_path, std::ios::out | std::ios::binary);
+				ofs.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			}
+
+			OptionsMap ybb_options;
+			ybb_options.add("IgnoreBookPly", Option(false));
+			ybb_options.add("FlippedBook", Option(false));
+
+			for (bool on_the_fly : { false, true })
+			{
+				auto s3 = tester.section(on_the_fly ? "on the fly" : "in memory");
+
+				MemoryBook book;
+				book.set_options(ybb_options);
+				tester.test("read_book", book.read_book(ybb_path, on_the_fly).is_ok());
+				tester.test("size", book.size() == 2);
+
+				std::deque<StateInfo> si3;
+				Position p;
+				BookTools::feed_position_string(p, "startpos", si3);
+				auto moves = book.find(p);
+				tester.test("find startpos", moves != nullptr && moves->size() == 2
+					&& (*moves)[0].move == USIEngine::to_move16("7g7f") && (*moves)[0].value == 50 && (*moves)[0].depth == 20
+					&& (*moves)[1].move == USIEngine::to_move16("2g2f") && (*moves)[1].value == 40);
+
+				BookTools::feed_position_string(p, "startpos moves 7g7f", si3);
+				moves = book.find(p);
+				tester.test("find 7g7f", moves != nullptr && moves->size() == 1
+					&& (*moves)[0].move == USIEngine::to_move16("3c3d") && (*moves)[0].value == -30);
+
+				BookTools::feed_position_string(p, "startpos moves 7g7f 3c3d", si3);
+				tester.test("not found", book.find(p) == nullptr);
+
+				// 一括probe。手数の異なる局面(index 3)はhitしてはならない。
+				std::vector<MemoryBook::BulkQuery> queries;
+				for (auto sfen : { "startpos moves 7g7f 3c3d", "startpos moves 7g7f", "startpos", "startpos moves 2g2f 8c8d 2f2e 8d8e" })
+				{
+					BookTools::feed_position_string(p, sfen, si3);
+					MemoryBook::BulkQuery q;
+					p.sfen_pack(q.sfen);
+					q.index = queries.size();
+					q.game_ply = uint16_t(p.game_ply());
+					queries.push_back(q);
+				}
+				queries[3].sfen = queries[2].sfen;
+
+				std::vector<std::pair<uint64_t, size_t>> hits;
+				std::mutex hits_mutex;
+				auto result = book.probe_bulk(engine.get_threads(), 2, queries,
+					[&](size_t, const MemoryBook::BulkQuery& q, const BookMoves& moves) {
+						std::lock_guard<std::mutex> lk(hits_mutex);
+						hits.emplace_back(q.index, moves.size());
+					});
+				std::sort(hits.begin(), hits.end());
+				tester.test("probe_bulk", result.is_ok() && hits.size() == 2
+					&& hits[0] == std::make_pair(uint64_t(1), size_t(1)) && hits[1] == std::make_pair(uint64_t(2), size_t(2)));
+			}
+
+			std::remove(ybb_path.c_str());
+		}
+
+		{
+			// YbbBuilderのテスト
+			// memory_limitを極端に小さくして1局面ごとにrunを書き出させ、多段のmergeまで通るようにする。
+			auto s2 = tester.section("ybb builder");
+
+			const std::string ybb_path = Path::Combine(Directory::GetBinaryFolder(), "book_unittest_builder.ybb");
+
+			YbbBuilder builder;
+			bool ok = builder.open(ybb_path, 1).is_ok();
+
+			// 平手から2手進めた局面を、merge 1回では収まらない数だけ登録する。
+			std::deque<StateInfo> si2;
+			Position p;
+			BookTools::feed_position_string(p, "startpos", si2);
+			const size_t N = YbbMaxMergeWays + 44;
+			size_t added = 0;
+			for (auto m1 : MoveList<LEGAL_ALL>(p))
+			{
+				StateInfo st1;
+				p.do_move(m1, st1);
+				for (auto m2 : MoveList<LEGAL_ALL>(p))
+				{
+					if (added >= N)
+						break;
+					StateInfo st2;
+					p.do_move(m2, st2);
+					PackedSfen packed;
+					p.sfen_pack(packed);
+					ok &= builder.add(packed, uint16_t(p.game_ply()), { BookMove(Move(m2).to_move16(), Move16::none(), int(added), 10, 1) }).is_ok();
+					++added;
+					p.undo_move(m2);
+				}
+				p.undo_move(m1);
+			}
+
+			// 手数違いの同一局面は、手数の若い方だけが残る。
+			PackedSfen root;
+			p.sfen_pack(root);
+			ok &= builder.add(root, 5, { BookMove(USIEngine::to_move16("2g2f"), Move16::none(), -1, 0, 1) }).is_ok();
+			ok &= builder.add(root, 1, { BookMove(USIEngine::to_move16("7g7f"), Move16::none(), 30, 20, 1) }).is_ok();
+			ok &= builder.close().is_ok();
+
+			tester.test("build", ok && builder.added_count() == N + 2 && builder.written_count() == N + 1 && builder.run_count() > N + 2);
+
+			OptionsMap ybb_options;
+			ybb_options.add("IgnoreBookPly", Option(false));
+			ybb_options.add("FlippedBook", Option(false));
+
+			MemoryBook book;
+			book.set_options(ybb_options);
+			tester.test("read_book", book.read_book(ybb_path, false).is_ok() && book.size() == N + 1);
+
+			auto moves = book.find(p);
+			tester.test("dedupe", moves != nullptr && moves->size() == 1
+				&& (*moves)[0].move == USIEngine::to_move16("7g7f") && (*moves)[0].value == 30 && (*moves)[0].depth == 20);
+
+			std::remove(ybb_path.c_str());
+		}
+		{
+			auto s2 = tester.section("ybb builder single run");
+
+			// すべて1つのrunに収まる時も、手数違いの同一局面は手数の若い方だけが残る。
+			// (手数の大きい方を先にadd()する)
+			const std::string ybb_path = Path::Combine(Directory::GetBinaryFolder(), "book_unittest_builder_single.ybb");
+
+			std::deque<StateInfo> si2;
+			Position p;
+			BookTools::feed_position_string(p, "startpos", si2);
+			PackedSfen root;
+			p.sfen_pack(root);
+
+			YbbBuilder builder;
+			bool ok = builder.open(ybb_path, 1024 * 1024).is_ok();
+			ok &= builder.add(root, 5, { BookMove(USIEngine::to_move16("2g2f"), Move16::none(), -1, 0, 1) }).is_ok();
+			ok &= builder.add(root, 1, { BookMove(USIEngine::to_move16("7g7f"), Move16::none(), 30, 20, 1) }).is_ok();
+			ok &= builder.close().is_ok();
+
+			tester.test("build", ok && builder.added_count() == 2 && builder.written_count() == 1 && builder.run_count() == 1);
+
+			OptionsMap ybb_options;
+			ybb_options.add("IgnoreBookPly", Option(false));
+			ybb_options.add("FlippedBook", Option(false));
+
+			MemoryBook book;
+			book.set_options(ybb_options);
+			tester.test("read_book", book.read_book(ybb_path, false).is_ok() && book.size() == 1);
+
+			auto moves = book.find(p);
+			tester.test("lowest ply", moves != nullptr && moves->size() == 1
+				&& (*moves)[0].move == USIEngine::to_move16("7g7f") && (*moves)[0].value == 30 && (*moves)[0].depth == 20);
+
+			std::remove(ybb_path.c_str());
+		}
 	}
 }
 
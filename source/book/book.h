@@ -7,6 +7,7 @@
 #include "../usi.h"
 #include "../testcmd/unit_test.h"
 
+#include <array>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -166,6 +167,54 @@ typedef std::shared_ptr<BookMoves> BookMovesPtr;
 // sfen文字列からBookMovesPtrへの写像。(これが定跡データがメモリ上に存在するときの構造)
 typedef std::unordered_map<std::string /* sfen */, BookMovesPtr > BookType;
 
+// BookTypeをsfen文字列のhash値でSHARD_NUM個に分割して保持するもの。
+// ・shardごとにmutexを持つので、異なるshardに対するinsert/appendは複数スレッドから同時に行える。
+// ・定跡の生成やmergeのときに、全スレッドから同時に局面を追加する用途を想定している。
+// ・同じsfenは必ず同じshardに入る。(shard番号はsfen文字列だけから決まる)
+// 💡 keyはsfen文字列のまま。.dbの読み込みやIgnoreBookPlyのときの手数の除去がsfen文字列を前提としているため。
+class ShardedBookType
+{
+public:
+	// shardの数。2の累乗であること。
+	static constexpr size_t SHARD_NUM = 256;
+
+	// [ASYNC] sfenの局面を探す。見つからなければnullptrが返る。
+	BookMovesPtr find(const std::string& sfen) const;
+
+	// [ASYNC] sfenの局面に対してptrを登録する。すでに登録されていれば置き換える。
+	void set(const std::string& sfen, const BookMovesPtr& ptr);
+
+	// [ASYNC] sfenの局面のBookMovesPtrを返す。
+	// 登録されていなければ空のBookMovesを作って登録し、それを返す。
+	BookMovesPtr get_or_create(const std::string& sfen);
+
+	// [ASYNC] 保持している局面数を返す。
+	size_t size() const;
+
+	// [ASYNC] 全shardを空にする。
+	void clear();
+
+	// [ASYNC] 全局面を列挙する。
+	// 📝 列挙中はそのshardのlockを保持しているので、fのなかからこのbookに局面を追加してはならない。
+	void foreach(const std::function<void(const std::string& /*sfen*/, const BookMovesPtr&)>& f) const;
+
+	// [ASYNC] shard番号を指定して、そのshardの局面だけを列挙する。
+	// 複数スレッドでshardを分担して列挙する時に用いる。
+	void foreach_in_shard(size_t shard, const std::function<void(const std::string& /*sfen*/, const BookMovesPtr&)>& f) const;
+
+	// sfen文字列に対応するshard番号を返す。
+	static size_t shard_of(const std::string& sfen);
+
+private:
+	struct Shard
+	{
+		BookType body;
+		mutable std::mutex mutex;
+	};
+
+	std::array<Shard, SHARD_NUM> shards;
+};
+
 // メモリ上にある定跡ファイル
 // ・sfen文字列をkeyとして、局面の指し手へ変換するのが主な役割。(このとき重複した指し手は除外するものとする)
 // ・on the flyが指定されているときは実際はメモリ上にはないがこれを透過的に扱う。
@@ -194,6 +243,7 @@ struct MemoryBook
 	// →　必ずソートするように変更した。
 	// ・ファイルへの書き出しは、*thisを書き換えないという意味においてconst性があるので関数にconstを付与しておく。
 	// また、事前にis_ready()は呼び出されているものとする。
+	// ・filenameの拡張子が".ybb"ならば、YbbBuilderを用いて.ybbで書き出す。
 	Tools::Result write_book(const std::string& filename /*, bool sort = false*/) const;
 
 	// --------------------------------------------------------------------------
@@ -217,13 +267,47 @@ struct MemoryBook
 	void insert(const std::string& sfen, const BookMove& bp , bool overwrite = true);
 
 	// [ASYNC] 他のbookをmergeする。
+	// book2の局面は、同じshard番号のshardに追加されるので、shardごとにlockを取るだけで済む。
 	void merge(MemoryBook& book2);
 
+	// [ASYNC] 他のbookを、threadsのうち先頭からthread_count個のスレッドで並列にmergeする。
+	// 各スレッドはshardを分担するので、スレッド間でlockの競合は起きない。
+	// threadsにスレッドがない時は、呼び出したスレッドでmergeする。
+	void merge(MemoryBook& book2, ThreadPool& threads, size_t thread_count);
+
 	// [ASYNC] このクラスの持つ定跡DBに対して、それぞれの局面を列挙する時に用いる
 	void foreach(std::function<void(const std::string& /*sfen*/, const Book::BookMovesPtr)> f);
 
+	// 局面の一括probe(probe_bulk())の1局面分の問い合わせ。
+	struct BulkQuery
+	{
+		// 調べる局面
+		PackedSfen sfen;
+
+		// 呼び出し元が結果を対応付けるための番号。(入力ファイル上で何番目のrecordであるかなど)
+		uint64_t index;
+
+		// 局面の手数。IgnoreBookPlyがfalseの時は、これが定跡DB上の手数と一致しなければhitしない。
+		// 手数が不明な時は0を指定する。このときは手数を照合しない。
+		uint16_t game_ply;
+	};
+
+	// [ASYNC] 局面を一括でprobeする。
+	// ・.ybbを丸読み(BookOnTheFly=false)、もしくはmemory mapしている時のみ有効。それ以外はNotImplementedErrorが返る。
+	// ・queriesは.ybbのindexと同じPackedSfen昇順に並び替えられる。各スレッドはその連続区間を受け持ち、
+	// 　直前の局面の探索位置から二分探索を始めるので、1局面ずつfind()するより速い。
+	// ・mutexは取らない。threadsのうち、先頭からthread_count個のスレッドで並列に探索する。
+	// ・hitするごとに、そのスレッドからon_hit(thread_id, query, moves)が呼び出される。
+	// ・FlippedBookがtrueなら反転させた局面も調べる。この時、movesの指し手は反転されたものになっている。
+	Tools::Result probe_bulk(ThreadPool& threads, size_t thread_count, std::vector<BulkQuery>& queries,
+		const std::function<void(size_t /*thread_id*/, const BulkQuery&, const BookMoves&)>& on_hit);
+
 	// 保持している局面数を返す。これは、on the flyではない状態でread_book()した時にのみ有効。
-	size_t size() const { return ybb_memory_book ? static_cast<size_t>(ybb_record_count) : book_body.size(); }
+	// .ybbをmemory mapしている時も局面数を返す。
+	size_t size() const { return (ybb_memory_book || ybb_mapped_book) ? static_cast<size_t>(ybb_record_count) : book_body.size(); }
+
+	// .ybbを読み込んでいるならtrue。この時、局面はbook_bodyには読み込まれていないので、merge()などはできない。
+	bool is_ybb() const { return ybb_book || ybb_memory_book; }
 
 protected:
 
@@ -231,9 +315,10 @@ protected:
 	// book_body.find()の直接呼び出しは禁止
 	// (Options["IgnoreBookPly"]==trueのときにplyの部分を削ってメモリに読み込んでいるため、一致しないから)
 	// このクラス(MemoryBookクラス)のfind()メソッドを用いること。
-	BookType book_body;
+	// shardごとにlockを取るので、book_bodyへのinsert/append/find(sfen)はmutex_を必要としない。
+	ShardedBookType book_body;
 
-	// ↑を操作するときのmutex
+	// 定跡ファイルの読み書き、on the flyで開いているファイルを操作するときのmutex
 	std::recursive_mutex mutex_;
 
 	// 末尾のスペース、"\t","\r","\n"を除去する。
@@ -247,6 +332,10 @@ protected:
 	BookMovesPtr find_ybb_bookmoves_on_the_fly(const PackedSfen& target, uint16_t game_ply);
 	BookMovesPtr find_ybb_bookmoves_in_memory(const PackedSfen& target, uint16_t game_ply);
 
+	// 丸読み、もしくはmemory mapしている.ybbのbyte列の先頭と長さを返す。
+	const unsigned char* ybb_data() const { return ybb_mapped_book ? ybb_mapped_file.data() : ybb_index_data.data(); }
+	uint64_t ybb_data_size() const { return ybb_mapped_book ? ybb_mapped_file.size() : ybb_index_data.size(); }
+
 	// メモリに丸読みせずにfind()のごとにファイルを調べにいくのか。
 	// これは思考エンジン設定のOptions["BookOnTheFly"]の値を反映したもの。
 	// ただし、read_book()のタイミングで定跡ファイルのopenに失敗したならfalseのままである。
@@ -271,6 +360,9 @@ protected:
 	// ybb_memory_book == trueのときに、.ybb 全体を丸読みして保持するバッファ。
 	std::vector<unsigned char> ybb_index_data;
 
+	// ybb_mapped_book == trueのときに、.ybb 全体を読み込み専用でmapしているファイル。
+	SystemIO::MemoryMappedFile ybb_mapped_file;
+
 	// moves record の先頭位置。
 	// .ybb の index 領域の直後。
 	uint64_t ybb_moves_base = 0;
@@ -288,6 +380,10 @@ protected:
 	// BookOnTheFly=falseで.ybbをメモリに丸読みしている状態ならtrue。
 	bool ybb_memory_book = false;
 
+	// BookOnTheFly=trueで.ybbをmemory mapしている状態ならtrue。(このときybb_bookもtrue)
+	// find()はybb_index_fs/ybb_moves_fsを使わず、mapされたメモリ上を二分探索する。
+	bool ybb_mapped_book = false;
+
 	// 開いている/丸読みしている.ybb名。エラー表示やデバッグ用。
 	std::string ybb_moves_name;
 
@@ -302,6 +398,67 @@ protected:
 	OptionsMapRef options;
 };
 
+// やねうら王 バイナリ定跡DB(.ybb)を、メモリに収まらない大きさであっても書き出すためのbuilder。
+// ・add()した局面はメモリ上に溜めておき、memory_limitを超えるごとに(PackedSfen, ply)順に並べ替えて
+// 　テンポラリファイル(run)に書き出す。
+// ・close()で全runをk-way mergeして.ybbを書き出す。
+// ・同じ局面が複数回add()された場合、手数(ply)の最も小さいものだけを書き出す。手数も同じなら先にadd()されたもの。
+// ・テンポラリファイルは書き出す.ybbと同じフォルダに作る。
+class YbbBuilder
+{
+public:
+	~YbbBuilder();
+
+	// filename     : 書き出す.ybbのpath
+	// memory_limit : add()した局面を溜めておくbufferの上限[byte]
+	Tools::Result open(const std::string& filename, uint64_t memory_limit);
+
+	// 局面を一つ追加する。movesのmove,value,depthだけが書き出される。
+	Tools::Result add(const PackedSfen& sfen, uint16_t ply, const std::vector<BookMove>& moves);
+
+	// runをmergeして.ybbを書き出す。
+	Tools::Result close();
+
+	// add()された局面数と、close()で書き出された(重複を除いた)局面数
+	uint64_t added_count()   const { return added; }
+	uint64_t written_count() const { return written; }
+	// 書き出したrunの数(多段mergeの途中で書き出したrunも含む)
+	size_t run_count() const { return run_serial; }
+
+private:
+	// bufferの内容を並べ替えてrunとして書き出す。
+	Tools::Result flush_run();
+
+	// inputsのrunをmergeする。
+	//   index_os != nullptr : .ybbのindexをindex_osに、指し手をmoves_osに書き出す。
+	//   index_os == nullptr : runとしてmoves_osに書き出す。
+	Tools::Result merge_runs(const std::vector<std::string>& inputs, std::ostream* index_os, std::ostream& moves_os);
+
+	// 次のrunのファイル名
+	std::string next_run_filename();
+
+	// 作ったテンポラリファイルをすべて削除する。
+	void remove_temporary_files();
+
+	std::string filename;
+	uint64_t memory_limit = 0;
+
+	// add()された局面のrecord。[PackedSfen 32][ply 2][指し手の数 2][(move,value,depth) 6 × 指し手の数]
+	std::vector<uint8_t> buffer;
+	// bufferのなかの各recordの先頭位置
+	std::vector<uint64_t> offsets;
+
+	// 未mergeのrun。add()された順に並んでいる。
+	std::vector<std::string> runs;
+	// これまでに作ったテンポラリファイル
+	std::vector<std::string> temporary_files;
+	size_t run_serial = 0;
+
+	uint64_t added   = 0;
+	uint64_t written = 0;
+	bool     opened  = false;
+};
+
 // 思考エンジンにおいて定跡の指し手の選択をする部分を切り出したもの。
 struct BookMoveSelector
 {
@@ -3,8 +3,12 @@
 #if defined (ENABLE_MAKEBOOK_CMD)
 
 #include "book.h"
+#include "../engine.h"
 #include "../misc.h"
 #include "../position.h"
+#include "../thread.h"
+#include <algorithm>
+#include <fstream>
 #include <sstream>
 
 using namespace std;
@@ -19,7 +23,372 @@ namespace Book
 	// 定跡生成用の関数はplug-inのようになっていて、その関数は、自分の知っているコマンドを処理した場合、1を返す。
 
 	// 定跡生成コマンド2025年度版。ペタショック化コマンド。
-    int makebook2025(istringstream& is, const string& token, const OptionsMap& options);
+    int makebook2025(istringstream& is, const string& token, const OptionsMap& options, ThreadPool& threads);
+
+	// ----------------------------------
+	// USI拡張コマンド "makebook probe_psv"
+	// ----------------------------------
+
+	// .psv(PsvRecord列)、もしくはPackedSfen列の各局面を定跡DB(.ybb)から一括で探して、
+	// hitした局面の定跡の指し手をbinary形式で書き出す。棋譜DBの序盤解析などで大量の局面を調べる用。
+	//
+	// コマンド例)
+	//   makebook probe_psv user_book1.ybb input.psv hits.bin
+	//   makebook probe_psv user_book1.ybb input.bin hits.bin packed threads 16
+	//
+	// ・定跡ファイルはBookDir相対。BookOnTheFlyがtrueならmemory map、falseならメモリに丸読みする。
+	// ・packed    : 入力を32 bytesのPackedSfenの列とみなす。(手数は照合しない)
+	// ・threads N : N個のスレッドで探索する。省略時は思考エンジンオプションのThreadsの値。
+	// ・IgnoreBookPly, FlippedBookは通常の定跡probeと同じ意味を持つ。
+	//
+	// 出力ファイルは、hitした局面ごとに入力ファイルでの順番で以下を並べたもの。(little endian)
+	//   u64 入力ファイル上で何番目の局面か(0 origin)
+	//   u16 指し手の数 N
+	//   N × { u16 指し手(Move16) , s16 評価値 , u16 depth }
+	static void probe_psv(IEngine& engine, istringstream& is)
+	{
+		string book_path, input_path, output_path;
+		is >> book_path >> input_path >> output_path;
+		if (book_path.empty() || input_path.empty() || output_path.empty())
+		{
+			cout << "Error! : usage : makebook probe_psv book.ybb input.psv output.bin [packed] [threads N]" << endl;
+			return;
+		}
+
+		auto& options = engine.get_options();
+		auto& threads = engine.get_threads();
+
+		bool   packed       = false;
+		size_t thread_count = threads.num_threads();
+		string token;
+		while (is >> token)
+		{
+			if (token == "packed")
+				packed = true;
+			else if (token == "threads")
+				is >> thread_count;
+		}
+		thread_count = std::max(size_t(1), std::min(thread_count, threads.num_threads()));
+
+		book_path = Path::Combine(string(options["BookDir"]), book_path);
+
+		cout << "[ makebook probe_psv ]" << endl;
+		cout << "book_path    : " << book_path << endl;
+		cout << "input_path   : " << input_path << (packed ? " (PackedSfen)" : " (PsvRecord)") << endl;
+		cout << "output_path  : " << output_path << endl;
+		cout << "threads      : " << thread_count << endl;
+
+		MemoryBook book;
+		book.set_options(options);
+		if (book.read_book(book_path, bool(options["BookOnTheFly"])).is_not_ok())
+			return;
+
+		ifstream input(input_path, ios::binary);
+		if (!input)
+		{
+			cout << "Error! : can't open " << input_path << endl;
+			return;
+		}
+
+		ofstream output(output_path, ios::binary);
+		if (!output)
+		{
+			cout << "Error! : can't open " << output_path << endl;
+			return;
+		}
+
+		// hitした局面1つ分。指し手はスレッドごとのmove_wordsの[offset, offset + 3 * count)に格納している。
+		struct Hit
+		{
+			u64 index;
+			u32 offset;
+			u16 count;
+		};
+		vector<vector<Hit>> hits(thread_count);
+		vector<vector<u16>> move_words(thread_count);
+
+		// 一度に読み込んで処理する局面数
+		constexpr size_t CHUNK_RECORDS = 1 << 20;
+
+		const size_t record_size = packed ? sizeof(PackedSfen) : sizeof(PsvRecord);
+		vector<u8> buffer(CHUNK_RECORDS * record_size);
+		vector<MemoryBook::BulkQuery> queries;
+		vector<pair<u64, pair<size_t, size_t>>> order; // (index, (thread_id, hits上の位置))
+		vector<u8> out;
+
+		u64 total_records = 0, total_hits = 0;
+		TimePoint start_time = now();
+
+		while (true)
+		{
+			input.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(buffer.size()));
+			const size_t bytes_read = size_t(input.gcount());
+			if (bytes_read == 0)
+				break;
+
+			if (bytes_read % record_size != 0)
+			{
+				cout << "Error! : truncated record at end of " << input_path << endl;
+				return;
+			}
+
+			const size_t count = bytes_read / record_size;
+			queries.resize(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const u8* p = buffer.data() + i * record_size;
+				auto& q = queries[i];
+				std::memcpy(q.sfen.data, p, sizeof(PackedSfen));
+				q.index    = total_records + i;
+				q.game_ply = packed ? 0 : reinterpret_cast<const PsvRecord*>(p)->gamePly;
+			}
+
+			for (size_t t = 0; t < thread_count; ++t)
+			{
+				hits[t].clear();
+				move_words[t].clear();
+			}
+
+			auto result = book.probe_bulk(threads, thread_count, queries,
+				[&](size_t thread_id, const MemoryBook::BulkQuery& query, const BookMoves& moves) {
+					auto& words = move_words[thread_id];
+					hits[thread_id].push_back(Hit{ query.index, u32(words.size()), u16(moves.size()) });
+					for (size_t i = 0; i < moves.size(); ++i)
+					{
+						words.push_back(moves[i].move.to_u16());
+						words.push_back(u16(s16(moves[i].value)));
+						words.push_back(u16(moves[i].depth));
+					}
+				});
+
+			if (result.is_not_ok())
+			{
+				cout << "Error! : makebook probe_psv requires a .ybb book. : " << book_path << endl;
+				return;
+			}
+
+			// 入力ファイルの順番で書き出す。
+			order.clear();
+			for (size_t t = 0; t < thread_count; ++t)
+				for (size_t i = 0; i < hits[t].size(); ++i)
+					order.emplace_back(hits[t][i].index, make_pair(t, i));
+			std::sort(order.begin(), order.end());
+
+			out.clear();
+			auto put = [&](const void* p, size_t size) { out.insert(out.end(), (const u8*)p, (const u8*)p + size); };
+			for (auto& o : order)
+			{
+				const auto& hit   = hits[o.second.first][o.second.second];
+				const auto& words = move_words[o.second.first];
+				put(&hit.index, sizeof(u64));
+				put(&hit.count, sizeof(u16));
+				put(words.data() + hit.offset, sizeof(u16) * 3 * hit.count); // 💡 wordsは空のこともある(hit.count == 0)ので、operator[]は使わない。
+			}
+			output.write(reinterpret_cast<const char*>(out.data()), std::streamsize(out.size()));
+			if (!output)
+			{
+				cout << "Error! : can't write " << output_path << endl;
+				return;
+			}
+
+			total_records += count;
+			total_hits    += order.size();
+		}
+
+		const TimePoint elapsed = std::max(TimePoint(1), now() - start_time);
+		cout << "records      : " << total_records << endl;
+		cout << "hits         : " << total_hits << endl;
+		cout << "elapsed      : " << elapsed << " [ms] , " << total_records * 1000 / elapsed << " records/s" << endl;
+		cout << "makebook probe_psv done." << endl;
+	}
+
+	// ----------------------------------
+	// USI拡張コマンド "makebook db_to_ybb"
+	// ----------------------------------
+
+	// .db形式の定跡ファイルを.ybbに変換する。
+	// 変換元の定跡ファイルがメモリに収まらない大きさであっても、YbbBuilderでテンポラリファイルに
+	// 書き出しながら変換するので、使用するメモリは概ね memory で指定した量に収まる。
+	//
+	// コマンド例)
+	//   makebook db_to_ybb user_book1.db user_book1.ybb
+	//   makebook db_to_ybb user_book1.db user_book1.ybb memory 4096
+	//
+	// ・定跡ファイルはBookDir相対。テンポラリファイルは書き出す.ybbと同じフォルダに作られる。
+	// ・memory N : 局面を溜めておくbufferの上限[MB]。省略時は1024。
+	// ・手数違いの重複局面は、手数の一番若いものだけを書き出す。(MemoryBook::write_book()と同じ)
+	static void db_to_ybb(IEngine& engine, istringstream& is)
+	{
+		string db_path, ybb_path;
+		is >> db_path >> ybb_path;
+		if (db_path.empty() || ybb_path.empty())
+		{
+			cout << "Error! : usage : makebook db_to_ybb book.db book.ybb [memory MB]" << endl;
+			return;
+		}
+
+		u64 memory_mb = 1024;
+		string token;
+		while (is >> token)
+		{
+			if (token == "memory")
+				is >> memory_mb;
+		}
+
+		auto& options = engine.get_options();
+		db_path  = Path::Combine(string(options["BookDir"]), db_path);
+		ybb_path = Path::Combine(string(options["BookDir"]), ybb_path);
+
+		cout << "[ makebook db_to_ybb ]" << endl;
+		cout << "db_path      : " << db_path << endl;
+		cout << "ybb_path     : " << ybb_path << endl;
+		cout << "memory       : " << memory_mb << " [MB]" << endl;
+
+		SystemIO::TextReader reader;
+		reader.SetTrim(true);
+		reader.SkipEmptyLine(true);
+		if (reader.Open(db_path).is_not_ok())
+		{
+			cout << "Error! : can't open " << db_path << endl;
+			return;
+		}
+
+		YbbBuilder builder;
+		if (builder.open(ybb_path, memory_mb * 1024 * 1024).is_not_ok())
+		{
+			cout << "Error! : can't open " << ybb_path << endl;
+			return;
+		}
+
+		const TimePoint start_time = now();
+		Tools::ProgressBar progress(reader.GetSize());
+
+		Position pos;
+		PackedSfen packed;
+		u16 ply = 0;
+		bool has_position = false;
+		vector<BookMove> moves;
+
+		// 直前の"sfen"行の局面を書き出す。
+		auto flush = [&]() {
+			if (!has_position || moves.empty())
+				return true;
+			return builder.add(packed, ply, moves).is_ok();
+		};
+
+		string line;
+		while (reader.ReadLine(line).is_ok())
+		{
+			progress.check(reader.GetFilePos());
+
+			// "#"で始まる行とコメント行は読み飛ばす。
+			if (line.empty() || line[0] == '#' || (line.length() >= 2 && line.substr(0, 2) == "//"))
+				continue;
+
+			if (line.length() >= 5 && line.substr(0, 5) == "sfen ")
+			{
+				if (!flush())
+				{
+					cout << "Error! : can't write " << ybb_path << endl;
+					return;
+				}
+
+				StateInfo si;
+				pos.set(line.substr(5), &si);
+				pos.sfen_pack(packed);
+				ply = u16(pos.game_ply());
+				has_position = true;
+				moves.clear();
+				continue;
+			}
+
+			moves.emplace_back(BookMove::from_string(line));
+		}
+		if (!flush() || builder.close().is_not_ok())
+		{
+			cout << "Error! : can't write " << ybb_path << endl;
+			return;
+		}
+
+		const TimePoint elapsed = std::max(TimePoint(1), now() - start_time);
+		cout << "positions    : " << builder.added_count() << endl;
+		cout << "written      : " << builder.written_count() << endl;
+		cout << "runs         : " << builder.run_count() << endl;
+		cout << "elapsed      : " << elapsed << " [ms]" << endl;
+		cout << "makebook db_to_ybb done." << endl;
+	}
+
+	// ----------------------------------
+	// USI拡張コマンド "makebook merge"
+	// ----------------------------------
+
+	// 2つの定跡ファイルをmergeして書き出す。
+	// 局面はshardごとにスレッドで分担して追加する。(MemoryBook::merge()を参照のこと)
+	//
+	// コマンド例)
+	//   makebook merge user_book1.db user_book2.db user_book3.db
+	//   makebook merge user_book1.db user_book2.db user_book3.db threads 16
+	//
+	// ・定跡ファイルはBookDir相対。.ybbはmergeできない。
+	// ・両方にある局面は、2つ目の定跡ファイルの方の指し手で置き換える。
+	// ・threads N : N個のスレッドでmergeする。省略時は思考エンジンオプションのThreadsの値。
+	static void merge_book(IEngine& engine, istringstream& is)
+	{
+		string book1_path, book2_path, output_path;
+		is >> book1_path >> book2_path >> output_path;
+		if (book1_path.empty() || book2_path.empty() || output_path.empty())
+		{
+			cout << "Error! : usage : makebook merge book1.db book2.db output.db [threads N]" << endl;
+			return;
+		}
+
+		auto& options = engine.get_options();
+		auto& threads = engine.get_threads();
+
+		size_t thread_count = threads.num_threads();
+		string token;
+		while (is >> token)
+		{
+			if (token == "threads")
+				is >> thread_count;
+		}
+		thread_count = std::max(size_t(1), std::min(thread_count, threads.num_threads()));
+
+		book1_path  = Path::Combine(string(options["BookDir"]), book1_path);
+		book2_path  = Path::Combine(string(options["BookDir"]), book2_path);
+		output_path = Path::Combine(string(options["BookDir"]), output_path);
+
+		cout << "[ makebook merge ]" << endl;
+		cout << "book1_path   : " << book1_path << endl;
+		cout << "book2_path   : " << book2_path << endl;
+		cout << "output_path  : " << output_path << endl;
+		cout << "threads      : " << thread_count << endl;
+
+		MemoryBook book1, book2;
+		book1.set_options(options);
+		book2.set_options(options);
+		if (book1.read_book(book1_path).is_not_ok() || book2.read_book(book2_path).is_not_ok())
+			return;
+		if (book1.is_ybb() || book2.is_ybb())
+		{
+			cout << "Error! : .ybb can't be merged. Convert it to .db first." << endl;
+			return;
+		}
+
+		const TimePoint start_time = now();
+		book1.merge(book2, threads, thread_count);
+
+		if (book1.write_book(output_path).is_not_ok())
+		{
+			cout << "Error! : can't write " << output_path << endl;
+			return;
+		}
+
+		const TimePoint elapsed = std::max(TimePoint(1), now() - start_time);
+		cout << "positions    : " << book1.size() << endl;
+		cout << "elapsed      : " << elapsed << " [ms]" << endl;
+		cout << "makebook merge done." << endl;
+	}
 
 	// ---------------------------------------------------------------------------------------------
 
@@ -36,8 +405,32 @@ namespace Book
 		is >> token;
 
 		// 2025年に作ったmakebook拡張コマンド
-        if (makebook2025(is, token, engine.get_options()))
+        if (makebook2025(is, token, engine.get_options(), engine.get_threads()))
+		{
+			Tools::ProgressBar::enable(false);
+			return;
+		}
+
+		// 定跡DBに対する局面の一括probe
+		if (token == "probe_psv")
+		{
+			probe_psv(engine, is);
+			Tools::ProgressBar::enable(false);
+			return;
+		}
+
+		// .db形式の定跡ファイルを.ybbに変換する
+		if (token == "db_to_ybb")
+		{
+			db_to_ybb(engine, is);
+			Tools::ProgressBar::enable(false);
+			return;
+		}
+
+		// 2つの定跡ファイルをmergeする
+		if (token == "merge")
 		{
+			merge_book(engine, is);
 			Tools::ProgressBar::enable(false);
 			return;
 		}
@@ -46,6 +439,9 @@ namespace Book
 
 		cout << "usage" << endl;
 		cout << "> makebook peta_shock book.db user_book1.db" << endl;
+		cout << "> makebook probe_psv user_book1.ybb input.psv output.bin" << endl;
+		cout << "> makebook db_to_ybb user_book1.db user_book1.ybb" << endl;
+		cout << "> makebook merge user_book1.db user_book2.db user_book3.db" << endl;
 		Tools::ProgressBar::enable(false);
 	}
 
@@ -488,13 +488,9 @@ namespace MakeBook2025
 
 	// 定跡の1つの局面を表現する構造体。
 	// 高速化のために、BookNodeIndexで行き来をする。
+	// 📝 : この局面での指し手は、BookMovesStoreに格納されている。
 	struct BookNode
 	{
-		// この局面での指し手
-		// 📝 : read_book(), convergence_check()で初期化している。
-		// ⚠ この局面は先手化された局面であるから、movesは先手番としての指し手
-		SmallVector<BookMove> moves;
-
 		// この局面の親に伝播させる時のValueとDepth。
 		//   value = -best_value
 		//   depth =  best_valueのdepth + 1
@@ -523,7 +519,217 @@ namespace MakeBook2025
 
 		//u8 reserved;
 
-		// 16(moves) + 4(vd) + 1(color) + 1*3(flags) = 24 bytes
+		// 4(vd) + 1(color) + 1*3(flags) = 8 bytes
+	};
+
+	// ある局面の指し手の集合。BookMovesStoreが保持している指し手を指している。
+	struct BookMoveSpan
+	{
+		BookMove* first;
+		BookMove* last;
+
+		BookMove* begin() const { return first; }
+		BookMove* end()   const { return last;  }
+		size_t    size()  const { return size_t(last - first); }
+		BookMove& operator[](size_t i) const { return first[i]; }
+	};
+
+	// 全局面の指し手を保持する。
+	// ・standard : 局面ごとにSmallVector<BookMove>を確保する。
+	// ・compact  : 全局面の指し手を局面順に、固定サイズのchunkの連続領域に詰めて格納する。(CSR形式)
+	//              局面ごとには、その局面の指し手の先頭位置と指し手の数を8 bytesに詰めたものを持つ。
+	//   ⇨ compactのほうは、局面ごとのheap確保(malloc管理領域)とSmallVectorの余分なcapacityがない分だけ
+	//      使用メモリが少なくて済む。ただし、指し手の追加は最後に追加した局面に対してしかできない。
+	class BookMovesStore
+	{
+	public:
+		void init(bool compact_)
+		{
+			compact = compact_;
+			node_moves.clear();
+			chunks.clear();
+			node_refs.clear();
+			old_chunks.clear();
+			old_refs.clear();
+			move_count = 0;
+		}
+
+		// 局面数の分だけ事前に確保しておく。
+		void reserve(size_t nodes)
+		{
+			if (compact)
+				node_refs.reserve(nodes);
+			else
+				node_moves.reserve(nodes);
+		}
+
+		// 局面を一つ追加する。
+		void add_node()
+		{
+			if (compact)
+				node_refs.push_back(u64(next_offset()) << 16);
+			else
+				node_moves.emplace_back();
+		}
+
+		// 局面iに指し手を一つ追加する。
+		// ⚠ compactの時は、iは最後に追加した局面でなければならない。
+		void push_back(BookNodeIndex i, const BookMove& move)
+		{
+			++move_count;
+
+			if (!compact)
+			{
+				node_moves[i].emplace_back(move);
+				return;
+			}
+
+			ASSERT_LV3(size_t(i) + 1 == node_refs.size());
+			u64& ref = node_refs[i];
+			u64 offset = ref >> 16;
+			u64 count  = ref & 0xffff;
+			if (count == 0xffff)
+			{
+				std::cout << "Error! : BookMovesStore exceeds maximum moves per node" << std::endl;
+				Tools::exit();
+			}
+
+			// chunkが一杯なら新しいchunkを確保して、この局面のここまでの指し手をそちらに移動させる。
+			// (1局面の指し手は、必ず1つのchunkのなかに連続して格納されている)
+			if (chunks.empty() || chunks.back().size() == CHUNK_SIZE)
+			{
+				vector<BookMove> chunk;
+				chunk.reserve(CHUNK_SIZE);
+				if (count)
+				{
+					auto& prev = chunks.back();
+					chunk.insert(chunk.end(), prev.end() - count, prev.end());
+					prev.erase(prev.end() - count, prev.end());
+				}
+				chunks.emplace_back(std::move(chunk));
+				offset = u64(chunks.size() - 1) << CHUNK_BITS;
+			}
+			chunks.back().push_back(move);
+			ref = (offset << 16) | (count + 1);
+		}
+
+		// 局面iの指し手。
+		BookMoveSpan operator[](BookNodeIndex i)
+		{
+			if (!compact)
+				return BookMoveSpan{ node_moves[i].begin(), node_moves[i].end() };
+
+			return make_span(chunks, node_refs[i]);
+		}
+
+		// 局面iの指し手を取り出して、局面iの指し手を空にする。
+		// convergence_check()で指し手を並べ直すのに用いる。
+		// ⚠ compactの時は、begin_rebuild()～end_rebuild()の間に局面順に呼び出すこと。
+		//    この時、局面iが新たに追加されたことになり、局面iに対してpush_back()できるようになる。
+		SmallVector<BookMove> take(BookNodeIndex i)
+		{
+			SmallVector<BookMove> moves;
+			if (!compact)
+			{
+				std::swap(node_moves[i], moves);
+				move_count -= moves.size();
+				return moves;
+			}
+
+			auto old = make_span(old_chunks, old_refs[i]);
+			for (auto& move : old)
+				moves.emplace_back(move);
+			move_count -= old.size();
+
+			// 局面順に指し手の位置も昇順になっているので、読み終わったchunkは解放していく。
+			const size_t chunk_index = std::min(size_t((old_refs[i] >> 16) >> CHUNK_BITS), old_chunks.size());
+			for (; released_old_chunks < chunk_index; ++released_old_chunks)
+				vector<BookMove>().swap(old_chunks[released_old_chunks]);
+
+			add_node();
+			return moves;
+		}
+
+		// take()で全局面の指し手を並べ直す前後に呼び出す。
+		void begin_rebuild()
+		{
+			if (!compact)
+				return;
+
+			old_chunks.swap(chunks);
+			old_refs.swap(node_refs);
+			released_old_chunks = 0;
+			chunks.clear();
+			node_refs.clear();
+			node_refs.reserve(old_refs.size());
+		}
+
+		void end_rebuild()
+		{
+			vector<vector<BookMove>>().swap(old_chunks);
+			vector<u64>().swap(old_refs);
+		}
+
+		// 格納している指し手の総数
+		u64 size_of_moves() const { return move_count; }
+
+		// 指し手の格納に用いているメモリ量の概算[byte]
+		u64 memory_usage() const
+		{
+			if (compact)
+				return u64(node_refs.capacity()) * sizeof(u64) + u64(chunks.size()) * CHUNK_SIZE * sizeof(BookMove);
+
+			// SmallVectorの確保するメモリ + malloc管理領域(16 bytesと仮定)
+			u64 bytes = u64(node_moves.capacity()) * sizeof(SmallVector<BookMove>);
+			for (auto& moves : node_moves)
+				bytes += std::max(size_t(4), moves.size()) * sizeof(BookMove) + 16;
+			return bytes;
+		}
+
+	private:
+		// 1つのchunkに格納する指し手の数
+		static constexpr u64 CHUNK_BITS = 20;
+		static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+
+		static BookMoveSpan make_span(vector<vector<BookMove>>& chunks, u64 ref)
+		{
+			const u64 offset = ref >> 16;
+			const u64 count  = ref & 0xffff;
+			if (count == 0)
+				return BookMoveSpan{ nullptr, nullptr };
+
+			BookMove* p = chunks[size_t(offset >> CHUNK_BITS)].data() + (offset & (CHUNK_SIZE - 1));
+			return BookMoveSpan{ p, p + count };
+		}
+
+		// 次に追加される指し手の位置
+		u64 next_offset() const
+		{
+			if (chunks.empty())
+				return 0;
+			return (u64(chunks.size() - 1) << CHUNK_BITS) + chunks.back().size();
+		}
+
+		bool compact = false;
+
+		// standardの時の局面ごとの指し手
+		vector<SmallVector<BookMove>> node_moves;
+
+		// compactの時の指し手本体
+		vector<vector<BookMove>> chunks;
+
+		// compactの時の局面ごとの指し手の位置。上位48bitが先頭位置、下位16bitが指し手の数。
+		vector<u64> node_refs;
+
+		// begin_rebuild()～end_rebuild()の間の、並べ直す前のchunks,node_refs
+		vector<vector<BookMove>> old_chunks;
+		vector<u64> old_refs;
+
+		// old_chunksのうち、解放済みのchunkの数
+		size_t released_old_chunks = 0;
+
+		// 格納している指し手の総数
+		u64 move_count = 0;
 	};
 
 	// ペタショック化
@@ -531,8 +737,10 @@ namespace MakeBook2025
 	{
 	public:
 		// 定跡をペタショック化する。
-		void make_book(istringstream& is, string book_dir)
+		void make_book(istringstream& is, string book_dir, ThreadPool& threads)
 		{
+			this->threads = &threads;
+
 			// 初期化等
 			if (initialize(is, book_dir).is_not_ok())
 				return;
@@ -594,7 +802,8 @@ namespace MakeBook2025
 
 			// コマンドラインオプションの読み込み
 			string token;
-			shrink = fast = false;
+			shrink = fast = compact = false;
+			thread_count = threads->num_threads();
 			while (is >> token)
 			{
 				if (token == "shrink")
@@ -602,7 +811,15 @@ namespace MakeBook2025
 
 				else if (token == "fast")
 					fast = true;
+
+				else if (token == "compact")
+					compact = true;
+
+				else if (token == "threads")
+					is >> thread_count;
 			}
+			// スレッドがまだ生成されていなければ、呼び出したスレッドだけで処理する。
+			thread_count = threads->num_threads() == 0 ? 1 : std::max(size_t(1), std::min(thread_count, threads->num_threads()));
 
 			string BOOK_DIR = book_dir;
 
@@ -636,6 +853,8 @@ namespace MakeBook2025
 
 			cout << "shrink             : " << shrink << endl;
 			cout << "fast               : " << fast << endl;
+			cout << "compact            : " << compact << endl;
+			cout << "threads            : " << thread_count << endl;
 
 			/*
 				note: DrawValueの変更について。
@@ -658,6 +877,7 @@ namespace MakeBook2025
 
 			original_sfens.clear();
 			check_loop_nodes.clear();
+			book_node_moves.init(compact);
 
 			return Tools::Result::Ok();
 		}
@@ -704,6 +924,7 @@ namespace MakeBook2025
 
 				cout << "Number Of Elements : " << noe << endl;
 				book_nodes.reserve(size_t(noe));
+				book_node_moves.reserve(size_t(noe));
 				hashkey_to_index.reserve(size_t(noe));
 				if (fast)
 					original_sfens.reserve(size_t(noe));
@@ -755,6 +976,7 @@ namespace MakeBook2025
 
 					bool checked = pos.checkers();
 					book_nodes.emplace_back(BookNode());
+					book_node_moves.add_node();
 					auto& book_node = book_nodes.back();
 
 					book_node.color       = stm;
@@ -802,7 +1024,7 @@ namespace MakeBook2025
 							move16 = flip_move(move16);
 
 						// 入力側の指し手はleaf候補なので、入力depthを引き継がず0として後退解析する。
-						book_node.moves.emplace_back(BookMove(move16, value, 0));
+						book_node_moves.push_back(BookNodeIndex(book_nodes.size() - 1), BookMove(move16, value, 0));
 					}
 				}
 
@@ -860,6 +1082,7 @@ namespace MakeBook2025
 
 									// エントリー数が事前にわかったので、その分だけそれぞれの構造体配列を確保する。
 									book_nodes.reserve(noe);
+									book_node_moves.reserve(noe);
 									hashkey_to_index.reserve(noe);
 									if (fast)
 										original_sfens.reserve(noe);
@@ -938,6 +1161,7 @@ namespace MakeBook2025
 					bool checked = pos.checkers();
 
 					book_nodes.emplace_back(BookNode());
+					book_node_moves.add_node();
 					auto& book_node = book_nodes.back();
 
 					book_node.color        = stm; // 元の手番。これを維持してファイルに書き出さないと、sfen文字列でsortされていたのが狂う。
@@ -968,7 +1192,7 @@ namespace MakeBook2025
 					move16 = flip_move(move16);
 
 				// 入力側の指し手はleaf候補なので、入力depthを引き継がず0として後退解析する。
-				book_node.moves.emplace_back(BookMove(move16, value, 0));
+				book_node_moves.push_back(BookNodeIndex(book_nodes.size() - 1), BookMove(move16, value, 0));
 				// あとで合流のチェックをしてleaf nodeであるかを確認する。
 			}
 			if (!fast)
@@ -1003,6 +1227,8 @@ namespace MakeBook2025
 			//  テンポラリファイルにsfen文字列を書き出してしまっているのでそれができない。
 			//  ⇨  fastオプションが指定されている時はその限りではないか..
 
+			book_node_moves.begin_rebuild();
+
 			for (BookNodeIndex i = 0; i < BookNodeIndex(book_nodes.size()); ++i)
 			{
 				auto& book_node = book_nodes[i];
@@ -1029,8 +1255,8 @@ namespace MakeBook2025
 				ASSERT_LV3(pos.side_to_move() == BLACK);
 
 				// 元ファイルの定跡DBに登録されていた指し手
-				SmallVector<BookMove> book_moves;
-				std::swap(book_node.moves, book_moves); // swapしていったんbook_node.movesはクリアしてしまう。
+				// ここでいったんこの局面の指し手はクリアされる。
+				SmallVector<BookMove> book_moves = book_node_moves.take(i);
 
 				// ここから全合法手で一手進めて既知の(定跡ツリー上の他の)局面に行くかを調べる。
 				for (auto move : MoveList<LEGAL_ALL>(pos))
@@ -1053,12 +1279,12 @@ namespace MakeBook2025
 						if (std::find_if(book_moves.begin(), book_moves.end(), [&](const auto& bm) { return bm.move == move16; }) == book_moves.end())
 							converged_moves++;
 
-						book_node.moves.emplace_back(book_move);
+						book_node_moves.push_back(i, book_move);
 					}
 				}
 
 				// どこにも合流していなければ、これは定跡ツリー上で、leaf nodeしか存在しないnodeである。
-				book_node.const_node = book_node.moves.size() == 0;
+				book_node.const_node = book_node_moves[i].size() == 0;
 
 				// 元ファイルの定跡DB上のこの局面の指し手も登録しておく。
 				for (auto& book_move : book_moves)
@@ -1070,9 +1296,10 @@ namespace MakeBook2025
 					// これがbook_nodeにすでに登録されているか？
 					// 登録されているということは合流する( = 子局面がある)ということだから、評価値は子局面のものを使うので
 					// ここで評価値を反映させる必要はない。
-					if (std::find_if(book_node.moves.begin(), book_node.moves.end(), [&](auto& book_move) { return book_move.move == move; }) == book_node.moves.end())
+					auto moves = book_node_moves[i];
+					if (std::find_if(moves.begin(), moves.end(), [&](auto& book_move) { return book_move.move == move; }) == moves.end())
 						// 登録されてなかったので登録する。(登録されていればどうせmin-max探索によって値が上書きされるので元の定跡ファイルの評価値は反映させなくて良い。)
-						book_node.moves.emplace_back(book_move);
+						book_node_moves.push_back(i, book_move);
 				}
 
 				progress.check(i);
@@ -1080,10 +1307,151 @@ namespace MakeBook2025
 			if (!fast)
 				sfen_reader.Close();
 
+			book_node_moves.end_rebuild();
+
+			// 後退解析に用いるメモリ量の概算
+			cout << "Book Nodes Memory  : "
+				 << (u64(book_nodes.capacity()) * sizeof(BookNode) + book_node_moves.memory_usage()) / (1024 * 1024) << " [MB] , "
+				 << book_node_moves.size_of_moves() << " moves" << endl;
+
 			//cout << "converged_moves : " << converged_moves << endl;
 			return Tools::Result::Ok();
 		}
 
+		// 📒 後退解析の並列化
+		//
+		//   後退解析の各stepは、book_nodesをindex順に走査して、その場でnodeを書き換えていく。
+		//   (前回の走査結果と今回の走査結果を2面持つと、千日手サイクルで値が振動することがあるので、この方式でなければならない)
+		//   あるnode iの更新でnode jを読むとき、
+		//     j < i なら、今回の走査で更新された値を読む　⇨ jの更新はiの更新より先に終わっていなければならない。
+		//     j > i なら、前回の走査での値を読む　　　　　⇨ iの更新はjの更新より先に終わっていなければならない。
+		//   いずれにせよ、indexが小さいほうを先に処理すれば良いので、
+		//     level(i) = max{ level(j) + 1 | jはiと読み書きの関係があってindexがiより小さいnode }
+		//   として、levelの小さい順に処理する。levelが同じnode同士は互いに読み書きしないので並列に処理できて、
+		//   結果は、index順に1スレッドで走査した時とbit単位で同じになる。
+
+		// levelごとに処理対象のnodeを並べたもの。
+		struct WavefrontSchedule
+		{
+			// levelの昇順に並べた処理対象のnode。同じlevelのなかではindex順。
+			vector<BookNodeIndex> nodes;
+
+			// level lのnodeは、nodes[level_begin[l]]からnodes[level_begin[l + 1] - 1]まで。
+			vector<size_t> level_begin;
+		};
+
+		// WavefrontScheduleを作る。
+		//   is_target(i)              : node iが処理対象であるか。
+		//   for_each_dependency(i, f) : node iの更新時に読むnode jそれぞれについてf(j)を呼び出す。
+		// 処理対象ではないnodeは、この間に書き換わらないものとする。
+		template <typename IsTarget, typename ForEachDependency>
+		WavefrontSchedule make_wavefront_schedule(IsTarget is_target, ForEachDependency for_each_dependency)
+		{
+			const BookNodeIndex n = BookNodeIndex(book_nodes.size());
+
+			// index順に見ていくので、node iに来た時にはi未満のnodeからの制約はすべてlevel[i]に反映されている。
+			vector<u32> level(n, 0);
+			u32 max_level = 0;
+			size_t target_count = 0;
+
+			for (BookNodeIndex i = 0; i < n; ++i)
+			{
+				if (!is_target(i))
+					continue;
+
+				// iが読むi未満のnodeより後。
+				u32 l = level[i];
+				for_each_dependency(i, [&](BookNodeIndex j) {
+					if (j < i && is_target(j))
+						l = std::max(l, level[j] + 1);
+				});
+				level[i] = l;
+
+				// iが読むiより大きいnodeより先。
+				for_each_dependency(i, [&](BookNodeIndex j) {
+					if (j > i && is_target(j))
+						level[j] = std::max(level[j], l + 1);
+				});
+
+				max_level = std::max(max_level, l);
+				++target_count;
+			}
+
+			// levelごとに数えてから並べる。(counting sort)
+			WavefrontSchedule schedule;
+			schedule.level_begin.assign(size_t(max_level) + 2, 0);
+			for (BookNodeIndex i = 0; i < n; ++i)
+				if (is_target(i))
+					schedule.level_begin[size_t(level[i]) + 1]++;
+			for (size_t l = 1; l < schedule.level_begin.size(); ++l)
+				schedule.level_begin[l] += schedule.level_begin[l - 1];
+
+			schedule.nodes.resize(target_count);
+			vector<size_t> cursor(schedule.level_begin.begin(), schedule.level_begin.end() - 1);
+			for (BookNodeIndex i = 0; i < n; ++i)
+				if (is_target(i))
+					schedule.nodes[cursor[level[i]]++] = i;
+
+			return schedule;
+		}
+
+		// 子nodeだけを読む更新用のWavefrontScheduleを作る。
+		//   is_target(node) : nodeが処理対象であるか。
+		template <typename IsTarget>
+		WavefrontSchedule make_children_schedule(IsTarget is_target)
+		{
+			return make_wavefront_schedule(
+				[&](BookNodeIndex i) { return is_target(book_nodes[i]); },
+				[&](BookNodeIndex i, auto f) {
+					for (auto& move : book_node_moves[i])
+						if (!move.leaf)
+							f(move.next);
+				});
+		}
+
+		// scheduleのlevel順に、各nodeに対してupdate(i)を呼び出す。同じlevelのnodeは並列に処理する。
+		// 返し値 : update()の返し値の合計。
+		template <typename Update>
+		u64 run_wavefront(const WavefrontSchedule& schedule, Update update)
+		{
+			// これより少ないnode数のlevelは、スレッドに割り振るほうが遅いので呼び出したスレッドで処理する。
+			constexpr size_t PARALLEL_MIN_NODES = 4096;
+
+			u64 total = 0;
+			vector<u64> counts(thread_count);
+
+			for (size_t l = 0; l + 1 < schedule.level_begin.size(); ++l)
+			{
+				const size_t begin = schedule.level_begin[l];
+				const size_t end   = schedule.level_begin[l + 1];
+
+				if (thread_count <= 1 || end - begin < PARALLEL_MIN_NODES)
+				{
+					for (size_t k = begin; k < end; ++k)
+						total += update(schedule.nodes[k]);
+					continue;
+				}
+
+				// このlevelのnodeをスレッドで分担する。
+				// 📝 nodeごとに指し手の数が違って処理時間に偏りがあるので、
+				//     PARALLEL_GRAIN個ずつのchunkにして、早く終わったスレッドに残りを手伝わせる。
+				constexpr size_t PARALLEL_GRAIN = 1024;
+
+				std::fill(counts.begin(), counts.end(), 0);
+				threads->parallel_for(begin, end, PARALLEL_GRAIN, [&](size_t thread_id, size_t b, size_t e) {
+					u64 count = 0;
+					for (size_t k = b; k < e; ++k)
+						count += update(schedule.nodes[k]);
+					counts[thread_id] += count;
+				}, thread_count);
+
+				for (auto count : counts)
+					total += count;
+			}
+
+			return total;
+		}
+
 		// 親に伝播するためのVDを作る。(評価値を反転させて、depthを1加算)
 		ValueDepth make_vd_for_parent(ValueDepth vd)
 		{
@@ -1092,11 +1460,11 @@ namespace MakeBook2025
 		}
 
 		// あるnodeについて、leaf nodeと子nodeを調べ、そのnodeの親に伝播すべきValueDepthを得るヘルパー関数。
-		ValueDepth bestvd_for_parent(const BookNode& node)
+		ValueDepth bestvd_for_parent(BookNodeIndex node_index)
 		{
 			ValueDepth best(-BOOK_VALUE_INF, BOOK_DEPTH_MAX);
 
-			for (const auto& book_move : node.moves)
+			for (const auto& book_move : book_node_moves[node_index])
 			{
 				// leaf nodeであるなら、このbook_moveのvdが有効。
 				// leaf nodeでないなら、子のvdを見る。
@@ -1111,8 +1479,9 @@ namespace MakeBook2025
 
 		// 評価値の親ノードへの伝播を1回だけ行う。
 		// const nodeの一つ上のnodeだけが処理対象。
+		// schedule : make_children_schedule()で作ったもの。
 		// 返し値 : 今回const nodeにしたnodeの数
-		u64 remove_const_nodes_once()
+		u64 remove_const_nodes_once(const WavefrontSchedule& schedule)
 		{
 			/*
 			  sfen_to_hashkeyとhashkey_to_book_nodeを頼りに、
@@ -1140,32 +1509,28 @@ namespace MakeBook2025
 
 			// 子がすべてleafもしくはconst nodeであるなら、それはconst nodeにできる。
 
-			// TODO : ここの処理は並列化できる。ここの速度はさほど問題ではないので、まあいいか…。
-			u64 node_count = 0;
-			for (BookNodeIndex book_node_index = 0; book_node_index < BookNodeIndex(book_nodes.size()); ++book_node_index)
+			// 📝 index順に走査した時と同じ結果になるように、scheduleに従って並列に処理する。
+			return run_wavefront(schedule, [&](BookNodeIndex book_node_index) -> u64
 			{
 				auto& node = book_nodes[book_node_index];
 
 				// const node以外を処理対象とする。
 				if (node.const_node)
-					continue;
+					return 0;
 
 				// このnodeのすべての指し手がleafもしくはconst nodeか？
 				// ⇨ 子nodeがあって、そこがconst nodeでなければ、このnodeは処理対象ではない。
-				for (auto& move : node.moves)
+				for (auto& move : book_node_moves[book_node_index])
 					if (!move.leaf && !book_nodes[move.next].const_node)
-						goto Next;
+						return 0;
 
 				// すべてがconst nodeだったので、このnodeをconst node化できる。
 
 				// 子のbestをnode.vdに反映。これは次回以降にこのnodeの親が用いる。
-				node.vd = bestvd_for_parent(node);
+				node.vd = bestvd_for_parent(book_node_index);
 				node.const_node = true;
-				node_count ++;
-
-			Next: ;
-			}
-			return node_count;
+				return 1;
+			});
 		}
 
 		// 評価値の親ノードへの伝播して出次数0のnodeを定跡ツリーから削除していく。(最終的に定跡ファイルには書き出す)
@@ -1176,12 +1541,15 @@ namespace MakeBook2025
 
 			cout << "Retrograde Analysis : Step I   -> delete nodes with zero out-degree." << endl;
 
+			// この時点ではすべてのnodeが処理対象。
+			const auto schedule = make_children_schedule([](const BookNode&) { return true; });
+
 			Tools::ProgressBar progress;
 			progress.reset(BOOK_MAX_PLY);
 
 			for(int i = 0; i < BOOK_MAX_PLY; ++i)
 			{
-				u64 count = remove_const_nodes_once();
+				u64 count = remove_const_nodes_once(schedule);
 				const_nodes += count;
 
 				if (count == 0)
@@ -1253,6 +1621,17 @@ namespace MakeBook2025
 			// 
 			//   ここで得られたcheck loop集合を数珠つなぎにしたものが、check loop集合。
 
+			// 2手先の局面に依存するので、2手先のcheck_loopのnodeとの前後関係からscheduleを作る。
+			const auto schedule = make_wavefront_schedule(
+				[&](BookNodeIndex i) { return book_nodes[i].check_loop; },
+				[&](BookNodeIndex i, auto f) {
+					for (auto& move : book_node_moves[i])
+						if (!move.leaf)
+							for (auto& move2 : book_node_moves[move.next])
+								if (!move2.leaf)
+									f(move2.next);
+				});
+
 			Tools::ProgressBar progress;
 			progress.reset(BOOK_MAX_PLY - 1);
 
@@ -1261,37 +1640,33 @@ namespace MakeBook2025
 			for(int i = 0; i < BOOK_MAX_PLY ; ++i)
 			{
 				// 今回更新されたnodeの個数
-				u64 updated = 0;
-				for (auto& node : book_nodes)
+				u64 updated = run_wavefront(schedule, [&](BookNodeIndex node_index) -> u64
 				{
+					auto& node = book_nodes[node_index];
 					if (!node.check_loop)
-						continue;
+						return 0;
 
 					// 2手先がcheck_loopか調べる
-					for (auto& move : node.moves)
+					for (auto& move : book_node_moves[node_index])
 					{
 						if (move.leaf)
 							continue;
 
-						auto& next_node = book_nodes[move.next];
-						for (auto& move2 : next_node.moves)
+						for (auto& move2 : book_node_moves[move.next])
 						{
 							if (move2.leaf)
 								continue;
 
 							auto& next_next_node = book_nodes[move2.next];
 							if (next_next_node.check_loop)
-								goto Next;
+								return 0;
 						}
 					}
 					// 2手先にcheck loop上の局面が見つからなかった。
 					// ゆえに、元のnodeはcheck loop上の局面ではない。
 					node.check_loop = false;
-					updated++;
-					continue;
-
-				Next:;
-				}
+					return 1;
+				});
 				progress.check(i);
 				if (updated == 0)
 					break;
@@ -1316,17 +1691,15 @@ namespace MakeBook2025
 			std::vector<BookNodeIndex> nodes(check_loop_nodes_set.begin(), check_loop_nodes_set.end());
 			for (auto index: nodes)
 			{
-				auto& node = book_nodes[index];
-
 				// 2手先がcheck_loopか調べる
-				for (auto& move : node.moves)
+				for (auto& move : book_node_moves[index])
 				{
 					if (move.leaf)
 						continue;
 
 					auto next_node_index = move.next;
 					auto& next_node = book_nodes[next_node_index];
-					for (auto& move2 : next_node.moves)
+					for (auto& move2 : book_node_moves[next_node_index])
 					{
 						if (move2.leaf)
 							continue;
@@ -1384,7 +1757,7 @@ namespace MakeBook2025
 			cout << "const_node = " << node.const_node << ", check_loop = " << node.check_loop << endl;
 			cout << "vd = " << node.vd << endl;
 
-			for (auto& move : node.moves)
+			for (auto& move : book_node_moves[index])
 			{
 				cout << "is leaf = " << move.leaf << ", move = " << to_usi_string(move.move) << " : ";
 				if (move.leaf)
@@ -1400,22 +1773,21 @@ namespace MakeBook2025
 
 		// 各ノードのbestvalueを親ノードに伝播させる。
 		// 
+		// schedule : const nodeでもcheck loopでもないnodeに対してmake_children_schedule()で作ったもの。
 		// 返し値
 		//   今回更新されたノード数。
-		u64 propagate_all_nodes_once()
+		u64 propagate_all_nodes_once(const WavefrontSchedule& schedule)
 		{
 			// 今回更新されたnode数
-			u64 nodes_count = 0;
-			for (BookNodeIndex i = 0 ; i < BookNodeIndex(book_nodes.size()) ; ++i)
+			// 📝 index順に走査した時と同じ結果になるように、scheduleに従って並列に処理する。
+			return run_wavefront(schedule, [&](BookNodeIndex i) -> u64
 			{
+				// 📝 const node　⇨　vdの値が変わらないので更新は無駄
+				//    check loop  ⇨  このあとdfsで更新するのでここで更新するとおかしくなる
+				//    なので、これらのnodeはscheduleに含まれていない。
 				auto& node = book_nodes[i];
 
-				// const node　⇨　vdの値が変わらないので更新は無駄
-				// check loop  ⇨  このあとdfsで更新するのでここで更新するとおかしくなる
-				if (node.const_node || node.check_loop)
-					continue;
-
-				auto best = bestvd_for_parent(node);
+				auto best = bestvd_for_parent(i);
 
 				// これは循環ではないものが絡んだためにBOOK_DEPTH_MAXになっていないだけで、
 				// 実際は循環であると思う。
@@ -1423,15 +1795,13 @@ namespace MakeBook2025
 					best.depth = BOOK_DEPTH_MAX;
 
 				// 前回からvdが変化した箇所のカウント。
-				nodes_count += node.vd != best;
+				u64 changed = node.vd != best;
 
 				// vdを更新する。
 				node.vd = best;
-			}
 
-			//cout << nodes_count << endl;
-
-			return nodes_count;
+				return changed;
+			});
 		}
 
 		// check loopのあるnodeからdfsして親node用のValueDepthを返す。
@@ -1460,7 +1830,7 @@ namespace MakeBook2025
 
 			ValueDepth best(-BOOK_VALUE_INF, 0);
 
-			for (const auto& move : node.moves)
+			for (const auto& move : book_node_moves[node_index])
 			{
 				// leaf nodeであるなら、このbook_moveのvdが有効。
 				// leaf nodeでないなら、次のnodeを再帰的に辿ってvdを得る。
@@ -1496,6 +1866,9 @@ namespace MakeBook2025
 		{
 			cout << "Retrograde Analysis : Step IV  -> Propagate the eval to the parents of all nodes." << endl;
 
+			// const nodeとcheck loopのnodeは、この間、vdが変化しないのでscheduleに含めなくて良い。
+			const auto schedule = make_children_schedule([](const BookNode& node) { return !node.const_node && !node.check_loop; });
+
 			Tools::ProgressBar progress;
 			progress.reset(BOOK_MAX_PLY + 100);
 
@@ -1503,7 +1876,7 @@ namespace MakeBook2025
 			for (int ply = 0; ply < BOOK_MAX_PLY + 100; ++ply)
 			{
 				// 親nodeにValueDepthを伝播させる。
-				u64 updating_nodes = propagate_all_nodes_once();
+				u64 updating_nodes = propagate_all_nodes_once(schedule);
 
 				// check loop上の局面だけdfsする。
 				dfs_for_check_loop_nodes();
@@ -1517,11 +1890,11 @@ namespace MakeBook2025
 			progress.check(BOOK_MAX_PLY + 100);
 		}
 
-		SmallVector<BookMove> make_output_moves(BookNode& book_node)
+		SmallVector<BookMove> make_output_moves(BookNodeIndex node_index)
 		{
 			// いったんコピー。
 			SmallVector<BookMove> moves;
-			for (auto& move : book_node.moves)
+			for (auto& move : book_node_moves[node_index])
 				if (move.leaf)
 					moves.emplace_back(move);
 				else
@@ -1643,7 +2016,7 @@ namespace MakeBook2025
 					return Tools::ResultCode::FileWriteError;
 				writer.Flush(); // ⇦ これ呼び出さないとメモリ食ったままになる。
 
-				const auto moves = make_output_moves(book_node);
+				const auto moves = make_output_moves(i);
 				for(const auto& move : moves)
 				{
 					// 元のDB上で後手の局面なら後手の局面として書き出したいので、
@@ -1719,7 +2092,7 @@ namespace MakeBook2025
 				}
 
 				auto& book_node = book_nodes[i];
-				const auto moves = make_output_moves(book_node);
+				const auto moves = make_output_moves(i);
 				if (moves.size() > numeric_limits<u16>::max())
 				{
 					sync_cout << "info string Error! : too many moves in ybb record : " << writebook_path << sync_endl;
@@ -1789,6 +2162,9 @@ namespace MakeBook2025
 		// 定跡本体
 		vector<BookNode> book_nodes;
 
+		// 定跡の各局面の指し手。book_nodesと同じindexでアクセスする。
+		BookMovesStore book_node_moves;
+
 		// 局面のHASH_KEYからBookMoveIndexへのmapper
 		// ただし、flipして後手番にしたhashkeyを登録してある。
 		// ⇨　後手の局面はflipして先手の局面として格納している。ゆえに、格納されているのはすべて先手の局面であり、
@@ -1836,6 +2212,15 @@ namespace MakeBook2025
 		// テンポラリファイルを書き出さない。
 		bool fast;
 
+		// 指し手をBookMovesStoreのcompact形式で保持する。(メモリ使用量が減る)
+		bool compact;
+
+		// 後退解析に用いるスレッド
+		ThreadPool* threads = nullptr;
+
+		// 後退解析に用いるスレッド数。threadsのうち先頭からこの数だけ用いる。
+		size_t thread_count = 1;
+
 	};
 
 } // namespace MakeBook2025
@@ -1844,7 +2229,7 @@ namespace Book
 {
 	// 2025年以降に作ったmakebook拡張コマンド。
 	// この拡張コマンドを処理したら、この関数は非0を返す。
-	int makebook2025(std::istringstream& is, const std::string& token, const OptionsMap& options)
+	int makebook2025(std::istringstream& is, const std::string& token, const OptionsMap& options, ThreadPool& threads)
     {
 		if (token == "peta_shock") {
 
@@ -1854,13 +2239,15 @@ namespace Book
 			//   makebook peta_shock book.db user_book1.db
 			// 　⇨　先手か後手か、片側の局面しか書き出さない。エンジンオプションの FlippedBook を必ずオンにして用いること。
 			//   オプション指定
-			//		shrink : 最善手しか書き出さない
-			//      fast   : テンポラリファイルを書き出さない。(メモリ上に格納するのでその分だけメモリを消費する。)
-			//     ⇨  fastの時は、思考エンジンオプションのThreadsで指定したスレッド数で並列化して合流チェックなどを行う。
+			//		shrink    : 最善手しか書き出さない
+			//      fast      : テンポラリファイルを書き出さない。(メモリ上に格納するのでその分だけメモリを消費する。)
+			//      compact   : 各局面の指し手を局面ごとに確保せず、1つの連続領域に詰めて保持する。(メモリ使用量が減る。結果は変わらない)
+			//      threads N : 後退解析に用いるスレッド数。省略時は思考エンジンオプションのThreadsの値。
+			//     ⇨  後退解析は、思考エンジンオプションのThreadsで指定したスレッド数で並列化して行う。(結果はスレッド数によらない)
 			//		事前に "Threads 32"などとしてスレッド数を指定しておいてください。
 			MakeBook2025::PetaShock ps;
 			auto book_dir = options["BookDir"];
-			ps.make_book(is, book_dir);
+			ps.make_book(is, book_dir, threads);
 			return 1;
 		}
 
@@ -189,6 +189,28 @@
 // 速度低下はほぼないはず。
 //#define TT_CLUSTER_SIZE 3
 
+// 数百GB～TB級の置換表を使うときの設定。(Makefileの"hugett"ターゲットでビルドするとdefineされる)
+// HASH_KEY_BITSを128、TT_CLUSTER_SIZEを4にする。
+// 置換表のindexはhash keyの下位64bitから、TTEntryに格納するkeyは上位64bitから求めるので、
+// 置換表を大きくしても、hash衝突(別の局面のEntryにhitすること)の確率が上がらない。
+// TTEntryは16 bytes、Clusterは64 bytes(= cache line size)になる。
+// hash keyが128bitになる分だけ、探索は少し遅くなる。
+// 📝 置換表のサイズと、hash衝突の確率との関係は、"test ttcollision"コマンドで確認できる。
+//#define TT_HUGE_TABLE
+
+// 置換表の統計(hit率、hash衝突、Entryの置き換えなど)を集計する。
+// USI拡張コマンドの"tt_stats"とbenchコマンドで出力される。
+// 探索が少し遅くなり、hash衝突の検出用に置換表とは別にTTEntryあたり8 bytesのメモリを確保するので、
+// 置換表の調整をするときだけ有効にすること。
+// (makeするときに EXTRA_CPPFLAGS=-DENABLE_TT_STATS としても良い)
+//#define ENABLE_TT_STATS
+
+// 探索のテレメトリ(iterationの開始・終了、fail high/low、置換表によるcutoff、時間チェックなど)を
+// スレッドごとのリングバッファに記録する。USI拡張コマンドの"search_telemetry"で出力される。
+// 思考時間がどこで使われたかを調べるためのもの。無効なときは、探索部には何もコードが生成されない。
+// (makeするときに EXTRA_CPPFLAGS=-DENABLE_SEARCH_TELEMETRY としても良い)
+//#define ENABLE_SEARCH_TELEMETRY
+
 // ---------------------
 //  詰将棋ルーチン関係の設定
 // ---------------------
@@ -243,6 +265,10 @@
 // ※　Mac専用。
 //#define COREML
 
+// ふかうら王で、外部ライブラリを用いずにCPUだけで推論するときはこちら。
+// ※　ONNX形式のモデルファイル(dlshogiのResNet)を自前で読み込む。eval/deep/nn_cpu.hを参照のこと。
+//#define CPU_NN
+
 // ---------------------
 // 探索パラメーターの自動調整用
 // ---------------------
@@ -459,6 +485,10 @@ constexpr int MAX_PLY_NUM = 246;
 	// 勝率の集計を行う型としてdouble型を用いる。
 	#define WIN_TYPE_DOUBLE
 
+	// Node,ChildNodeの配列をスレッドごとのslab(NodePool)から確保する。
+	// これをコメントアウトすると、std::make_unique()で確保する。(dlshogiと同じ。比較計測用)
+	#define USE_NODE_POOL
+
 	 //#define ASSERT_LV 3
 #endif
 
@@ -595,6 +625,16 @@ constexpr bool pretty_jp = false;
 
 // --- hash key bits and TT_CLUSTER_SIZE
 
+// 巨大な置換表用の設定
+#if defined(TT_HUGE_TABLE)
+	#if !defined(HASH_KEY_BITS) || HASH_KEY_BITS < 128
+		#undef  HASH_KEY_BITS
+		#define HASH_KEY_BITS 128
+	#endif
+	#undef  TT_CLUSTER_SIZE
+	#define TT_CLUSTER_SIZE 4
+#endif
+
 #if !defined(HASH_KEY_BITS)
 #define HASH_KEY_BITS 64
 #endif
@@ -735,6 +775,8 @@ constexpr bool pretty_jp = false;
 		#define EVAL_TYPE_NAME "TRT-" EVAL_DEEP
 	#elif defined(COREML)
 		#define EVAL_TYPE_NAME "CoreML-" EVAL_DEEP
+	#elif defined(CPU_NN)
+		#define EVAL_TYPE_NAME "CPU-" EVAL_DEEP
 	#endif
 
 #else
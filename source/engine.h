@@ -264,10 +264,31 @@ public:
     virtual bool qsearch_psv(const std::string& inputPath,
                              const std::string& outputPath,
                              size_t             workerCount,
+                             bool               useMmap,
                              std::string&       message) {
         message = "qsearch_psv is not supported by this engine.";
         return false;
     }
+
+    // USI拡張コマンド "psv_transform" 用のhook。
+    // .psvの各レコードに対してopで指定した処理を行い、残ったレコードを書き出す。
+    // 対応していないEngine派生classではfalseを返す。
+    virtual bool psv_transform(const std::string& op, std::istringstream& is, std::string& message) {
+        message = "psv_transform is not supported by this engine.";
+        return false;
+    }
+
+    // USI拡張コマンド "tt_save" / "tt_load" 用のhook。
+    // 置換表の内容をファイルに保存する/ファイルから復元する。
+    // 対応していないEngine派生classではfalseを返す。
+    virtual bool save_tt(const std::string& filename, std::string& message) {
+        message = "tt_save is not supported by this engine.";
+        return false;
+    }
+    virtual bool load_tt(const std::string& filename, bool useMmap, std::string& message) {
+        message = "tt_load is not supported by this engine.";
+        return false;
+    }
 #endif
 
 #if STOCKFISH
@@ -396,16 +417,37 @@ class Engine: public IEngine {
     virtual std::string thread_allocation_information_as_string() const override;
     virtual std::string thread_binding_information_as_string() const override;
 
+    // 現在のNUMAの設定。
+    // 💡 評価関数パラメーターをNUMA nodeごとに複製するときに用いる。
+    const NumaConfig& get_numa_config() const { return numaContext.get_numa_config(); }
+
 #if !STOCKFISH
     // USI拡張コマンド "qsearch_psv" 用のhook。
     // 標準Engine基底classは未対応扱いとし、標準探索部(YaneuraOuEngine)でoverrideする。
     virtual bool qsearch_psv(const std::string& inputPath,
                              const std::string& outputPath,
                              size_t             workerCount,
+                             bool               useMmap,
                              std::string&       message) override {
         message = "qsearch_psv is not supported by this engine.";
         return false;
     }
+
+    // USI拡張コマンド "psv_transform" 用のhook。
+    virtual bool psv_transform(const std::string& op, std::istringstream& is, std::string& message) override {
+        message = "psv_transform is not supported by this engine.";
+        return false;
+    }
+
+    // USI拡張コマンド "tt_save" / "tt_load" 用のhook。
+    virtual bool save_tt(const std::string& filename, std::string& message) override {
+        message = "tt_save is not supported by this engine.";
+        return false;
+    }
+    virtual bool load_tt(const std::string& filename, bool useMmap, std::string& message) override {
+        message = "tt_load is not supported by this engine.";
+        return false;
+    }
 #endif
 
     virtual void              add_options() override;
@@ -588,8 +630,21 @@ class EngineWrapper: public IEngine {
     virtual bool qsearch_psv(const std::string& inputPath,
                              const std::string& outputPath,
                              size_t             workerCount,
+                             bool               useMmap,
                              std::string&       message) override {
-        return engine->qsearch_psv(inputPath, outputPath, workerCount, message);
+        return engine->qsearch_psv(inputPath, outputPath, workerCount, useMmap, message);
+    }
+
+    virtual bool psv_transform(const std::string& op, std::istringstream& is, std::string& message) override {
+        return engine->psv_transform(op, is, message);
+    }
+
+    virtual bool save_tt(const std::string& filename, std::string& message) override {
+        return engine->save_tt(filename, message);
+    }
+
+    virtual bool load_tt(const std::string& filename, bool useMmap, std::string& message) override {
+        return engine->load_tt(filename, useMmap, message);
     }
 #endif
 
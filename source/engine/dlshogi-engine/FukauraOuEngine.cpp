@@ -9,11 +9,17 @@
 #include "../../thread.h"
 #include "../../misc.h"
 
+#include <iomanip>
+#include <sstream>
+#include <tuple>
+
 #include "dlshogi_searcher.h"
 #include "UctSearch.h"
+#include "NodePool.h"
 
 #include "../../eval/deep/nn.h"
 #include "../../eval/deep/nn_types.h"
+#include "../../eval/deep/nn_synthetic.h"
 
 using namespace YaneuraOu;
 
@@ -61,6 +67,9 @@ void FukauraOuEngine::add_nn_options()
 #elif defined(COREML)
     // M1チップで8程度でスループットが飽和する。
     options.add("DNN_Batch_Size", Option(8, 1, 1024));
+#elif defined(CPU_NN)
+    // CPUではbatchを大きくしても速くならないので小さめにしておく。(UCT_Threadsをcore数にすること)
+    options.add("DNN_Batch_Size", Option(16, 1, 1024));
 #endif
 }
 
@@ -151,7 +160,8 @@ void FukauraOuEngine::init_gpu() {
               << sync_endl;
 
     // modelファイルが存在することは事前に確認しておく。
-    if (!Path::Exists(model_path))
+    // 💡 "synthetic"で始まるモデル名はファイルではなく、探索部の計測用のNNの設定。
+    if (!Eval::dlshogi::NNSynthetic::is_synthetic_model(model_path) && !Path::Exists(model_path))
     {
         sync_cout << "Error! : " << model_path << " file not found" << sync_endl;
         Tools::exit();
@@ -209,6 +219,333 @@ void FukauraOuEngine::set_ponderhit(bool b) {
 	searcher.search_limits.ponder           = b;
 }
 
+// 🌈 USI拡張コマンド"user"に対する処理。
+void FukauraOuEngine::user(std::istringstream& is) {
+    std::string token;
+    is >> token;
+
+    if (token == "mctsbench")
+        mcts_benchmark(is);
+    else if (token == "nodealloc")
+        node_alloc_benchmark(is);
+    else
+        sync_cout << "info string Error! : unknown user command = " << token << sync_endl;
+}
+
+// "user mctsbench"のhandler。
+// DNN_Modelに合成NN(NNSynthetic)を設定して探索し、探索部(UctSearcher/DlshogiSearcher)だけの速度を計測する。
+// GPUもモデルファイルも不要なので、探索部の速度低下をCPUだけのCI環境でも検出できる。
+//
+//   user mctsbench [threads 1,2,4] [nodes 20000] [moves 8] [batch 32] [model synthetic:latency=1000] [transposition 0,1] [nncache 0,256]
+//
+//   threads : 計測するUCT_Threadsの値(カンマ区切り)。        default : UCT_Threadsの値
+//   nodes   : 1手あたりの探索ノード数。                      default : 20000
+//   moves   : 平手から何手指し進めるか。                      default : 8
+//             前の手の探索木を再利用するので、その時に開放されたNodeのGCの時間も計測される。
+//   batch   : DNN_Batch_Size。                                default : DNN_Batch_Sizeの値
+//   model   : DNN_Model。"synthetic"で始まること。            default : synthetic
+//             書式はeval/deep/nn_synthetic.hを参照のこと。
+//   transposition : 計測するUCT_Transpositionの値(カンマ区切り)。 default : UCT_Transpositionの値
+//                   "0,1"とすると、同じ条件でNNの評価結果の共有のあり/なしを比較できる。
+//   nncache : 計測するUCT_NNCacheSize[MB]の値(カンマ区切り)。   default : UCT_NNCacheSizeの値
+//
+// 出力する項目(UCT_Transpositionの値×UCT_NNCacheSizeの値×スレッド数ごとに1行)
+//   playouts/s : 1秒あたりのplayout数
+//   nn_pos/s   : 1秒あたりにNNで評価した局面数
+//   batch_fill : forward()に渡したbatchの充填率 = 評価した局面数 / (forward()の回数 × DNN_Batch_Size)
+//   discarded  : 評価中のNodeに到達して破棄したplayoutの割合
+//   node_lock  : Nodeのmutexで待たされた割合と、待ち時間の合計(全スレッド)
+//   gpu_lock   : mutex_gpuで待たされた割合と、待ち時間の合計(全スレッド)
+//                💡 slotごとに並列に推論できるTensorRT/CPU版ではlockしないので常に0。
+//   forward_ms : nn_forward()にかかった時間の合計(全スレッド)
+//   gc_ms      : GCスレッドがNodeの開放にかかった時間
+//   rss_mb     : 最後の手の探索が終わった時点でのプロセスのRSS
+//   pool_mb    : その時点でNodePoolがOSから確保しているメモリ
+//   transposition : UCT_Transpositionの値
+//   nn_evals   : NNで評価した局面数(合計)
+//   tt_hits    : NNを呼び出さずに、評価済みのNodeから評価結果をコピーした回数(合計)
+//   nncache_mb : UCT_NNCacheSizeの値
+//   cache_hits : NNCacheにあってNNを呼び出さずに済んだ回数(合計)
+//   cache_hit_rate : NNCacheを引いた回数に対するcache_hitsの割合
+//
+// ⚠ 計測のためにエンジンオプションを変更して"isready"相当の初期化を行う。
+//    オプションは最後に元に戻すが、NNは合成NNのままなので、対局に用いる前には"isready"を送ること。
+void FukauraOuEngine::mcts_benchmark(std::istringstream& is) {
+
+    std::vector<int> thread_list;
+    std::vector<int> transposition_list;
+    std::vector<int> nncache_list;
+    NodeCountType    nodes = 20000;
+    int              moves = 8;
+    int              batch = int(options["DNN_Batch_Size"]);
+    std::string      model = "synthetic";
+
+    std::string token;
+    while (is >> token)
+    {
+        if (token == "threads")
+        {
+            is >> token;
+            for (auto& t : split(token, ","))
+                thread_list.push_back(std::max(StringExtension::to_int(std::string(t), 1), 1));
+        }
+        else if (token == "nodes")
+            is >> nodes;
+        else if (token == "moves")
+            is >> moves;
+        else if (token == "batch")
+            is >> batch;
+        else if (token == "model")
+            is >> model;
+        else if (token == "transposition")
+        {
+            is >> token;
+            for (auto& t : split(token, ","))
+                transposition_list.push_back(StringExtension::to_int(std::string(t), 0) != 0);
+        }
+        else if (token == "nncache")
+        {
+            is >> token;
+            for (auto& t : split(token, ","))
+                nncache_list.push_back(std::max(StringExtension::to_int(std::string(t), 0), 0));
+        }
+    }
+    if (thread_list.empty())
+        thread_list.push_back(int(options["UCT_Threads"]));
+    if (transposition_list.empty())
+        transposition_list.push_back(bool(options["UCT_Transposition"]));
+    if (nncache_list.empty())
+        nncache_list.push_back(int(options["UCT_NNCacheSize"]));
+    nodes = std::max(nodes, NodeCountType(1));
+    moves = std::max(moves, 1);
+    batch = std::max(batch, 1);
+
+    if (!Eval::dlshogi::NNSynthetic::is_synthetic_model(model))
+    {
+        sync_cout << "info string Error! : mctsbench needs a synthetic model, model = " << model << sync_endl;
+        return;
+    }
+
+    auto setoption = [&](const std::string& name, const std::string& value) {
+        std::istringstream iss("name " + name + " value " + value);
+        options.setoption(iss);
+    };
+
+    // 計測後に元に戻すオプション
+    const std::vector<std::string> saved_names = {"UCT_Threads", "DNN_Batch_Size", "DNN_Model",
+                                                  "UCT_Transposition", "UCT_NNCacheSize"};
+    std::vector<std::string>       saved_values;
+    for (auto& name : saved_names)
+        saved_values.push_back(std::string(options[name]));
+
+    // bestmoveを受け取って、次の局面に進めるのに使う。
+    auto        on_bestmove = get_on_bestmove();
+    std::string bestmove;
+    set_on_bestmove([&](std::string_view bm, std::string_view) { bestmove = bm; });
+
+    setoption("DNN_Batch_Size", std::to_string(batch));
+    setoption("DNN_Model", model);
+
+    std::ostringstream out;
+    out << std::fixed << "threads,batch,moves,playouts,time_ms,playouts/s,nn_pos/s,batch_fill,discarded,"
+        << "node_lock_contended,node_lock_wait_ms,gpu_lock_contended,gpu_lock_wait_ms,forward_ms,gc_ms,rss_mb,pool_mb,"
+        << "transposition,nn_evals,tt_hits,nncache_mb,cache_hits,cache_hit_rate" << std::endl;
+
+    // 計測する(UCT_Transposition, UCT_NNCacheSize, UCT_Threads)の組み合わせ
+    std::vector<std::tuple<int, int, int>> runs;
+    for (int transposition : transposition_list)
+        for (int nncache : nncache_list)
+            for (int threads_num : thread_list)
+                runs.emplace_back(transposition, nncache, threads_num);
+
+    for (auto [transposition, nncache, threads_num] : runs)
+    {
+        setoption("UCT_Threads", std::to_string(threads_num));
+        setoption("UCT_Transposition", transposition ? "true" : "false");
+        setoption("UCT_NNCacheSize", std::to_string(nncache));
+        isready();
+
+        // 前回の計測の探索木は再利用しない。
+        searcher.ClearTree();
+
+        UctSearchStats stats;
+        u64            playouts = 0;
+        TimePoint      elapsed  = 0;
+        int            played   = 0;
+
+        std::vector<std::string> moves_list;
+        for (; played < moves; ++played)
+        {
+            if (set_position(StartSFEN, moves_list).has_value())
+                break;
+
+            Search::LimitsType limits;
+            limits.nodes     = nodes;
+            limits.startTime = now();
+
+            bestmove.clear();
+            go(limits);
+            wait_for_search_finished();
+            elapsed += now() - limits.startTime;
+
+            // 定跡にhitするなどして探索しなかった時は、statsは前回のままなので集計しない。
+            const NodeCountType searched = searcher.search_limits.nodes_searched;
+            if (searched)
+            {
+                playouts += u64(searched);
+                stats += searcher.GetSearchStats();
+            }
+
+            if (bestmove.empty() || bestmove == "resign" || bestmove == "win")
+            {
+                ++played;
+                break;
+            }
+            moves_list.push_back(bestmove);
+        }
+
+        elapsed = std::max(elapsed, TimePoint(1));
+        auto ratio = [](u64 a, u64 b) { return b ? double(a) / double(b) : 0.0; };
+
+        out << threads_num << ',' << batch << ',' << played << ',' << playouts << ',' << elapsed << ','
+            << std::setprecision(0) << 1000.0 * double(playouts) / double(elapsed) << ','
+            << 1000.0 * double(stats.forward_positions) / double(elapsed) << ',' << std::setprecision(3)
+            << ratio(stats.forward_positions, stats.batch_capacity) << ','
+            << ratio(stats.discarded, playouts + stats.discarded) << ','
+            << ratio(stats.node_lock_contended, stats.node_lock) << ',' << std::setprecision(1)
+            << double(stats.node_lock_wait_ns) / 1e6 << ',' << std::setprecision(3)
+            << ratio(stats.gpu_lock_contended, stats.gpu_lock) << ',' << std::setprecision(1)
+            << double(stats.gpu_lock_wait_ns) / 1e6 << ',' << double(stats.forward_ns) / 1e6 << ','
+            << double(stats.gc_ns) / 1e6 << ',' << double(Tools::resident_memory()) / (1024 * 1024) << ','
+            << double(NodePool::reserved_bytes()) / (1024 * 1024) << ',' << transposition << ','
+            << stats.forward_positions << ',' << stats.transposition_hits << ',' << nncache << ','
+            << stats.nn_cache_hits << ',' << std::setprecision(3) << ratio(stats.nn_cache_hits, stats.nn_cache_probes)
+            << std::endl;
+    }
+
+    set_on_bestmove(std::move(on_bestmove));
+    for (size_t i = 0; i < saved_names.size(); ++i)
+        setoption(saved_names[i], saved_values[i]);
+
+    sync_cout << out.str() << "info string mctsbench : finished. Send \"isready\" before using the engine."
+              << sync_endl;
+}
+
+// "user nodealloc"のhandler。
+// 探索木(Node, ChildNodeの配列, 子ノードへのポインタ配列)の確保と開放にかかる時間と、その時のメモリ使用量を計測する。
+// NNも探索も用いずに、MCTSと同じ形の木をランダムに成長させるので、確保/開放の時間だけが計測できる。
+//
+//   user nodealloc [nodes 1000000] [threads 4] [children 80] [rounds 2]
+//
+//   nodes    : 作成するNodeの数(全スレッドの合計)。   default : UCT_NodeLimitの値
+//   threads  : 木を作成するスレッド数。              default : UCT_Threadsの値
+//              スレッドごとに別の木を作成する。開放はGCスレッドと同じく1スレッドで行う。
+//              木の作成には探索スレッド(ThreadPool::parallel_for())を用いるので、探索スレッドの数が上限。
+//              (探索スレッドはisreadyで生成される)
+//   children : 展開したNodeの子の数の平均。          default : 80
+//              children/2 ～ children*3/2 の範囲でばらつかせる。
+//   rounds   : 作成→開放を繰り返す回数。             default : 2
+//              2回目以降は、1回目に開放したメモリを再利用する時の速度になる。
+//
+// 出力する項目(roundごとに1行)
+//   build_ms  : 木の作成にかかった時間(wall time)
+//   ns/node   : Node 1つあたりの作成時間(スレッド数×build_ms / nodes)
+//   release_ms: 木の開放にかかった時間
+//   rss_mb    : 木を作成した直後のプロセスのRSS
+//   pool_mb   : その時点でNodePoolがOSから確保しているメモリ。USE_NODE_POOLがdefineされていなければ0。
+//
+// 💡 config.hのUSE_NODE_POOLをdefineしたものとしないものでビルドして比較すると、NodePoolの効果がわかる。
+void FukauraOuEngine::node_alloc_benchmark(std::istringstream& is) {
+
+    u64 nodes      = u64(options["UCT_NodeLimit"]);
+    int thread_num = int(options["UCT_Threads"]);
+    int children   = 80;
+    int rounds     = 2;
+
+    std::string token;
+    while (is >> token)
+    {
+        if (token == "nodes")
+            is >> nodes;
+        else if (token == "threads")
+            is >> thread_num;
+        else if (token == "children")
+            is >> children;
+        else if (token == "rounds")
+            is >> rounds;
+    }
+    // 💡 スレッドが生成されていなければ、parallel_for()は呼び出したスレッドで処理する。
+    //     探索スレッドはisreadyで生成されるので、isreadyの前だと1スレッドになる。
+    if (thread_num > std::max(int(threads.size()), 1))
+        sync_cout << "info string Warning! : nodealloc : threads is capped to the number of search threads = "
+                  << std::max(int(threads.size()), 1) << " (the search threads are created by isready)" << sync_endl;
+    thread_num = std::clamp(thread_num, 1, std::max(int(threads.size()), 1));
+    nodes      = std::max(nodes, u64(thread_num));
+    children   = std::clamp(children, 2, int(MAX_MOVES) * 2 / 3);
+    rounds     = std::max(rounds, 1);
+
+    // 1スレッド分の木を作成する。
+    // 展開済みのNodeからランダムに1つ選び、その子のうちまだ作成されていないものを作成して展開する。
+    // (UctSearcher::UctSearch()のCreateChildNode()とExpandNode()に相当する)
+    auto build_tree = [children](Node* root, u64 num, u64 seed) {
+        PRNG rng(seed);
+        auto expand = [&](Node* node) {
+            const ChildNumType n = ChildNumType(children / 2 + rng.rand(children));
+            node->child          = make_unique_node_pool<ChildNode[]>(n);
+            node->child_num      = n;
+        };
+
+        std::vector<Node*> expanded;
+        expand(root);
+        expanded.push_back(root);
+
+        for (u64 created = 1; created < num;)
+        {
+            Node*     node = expanded[rng.rand(expanded.size())];
+            const int i    = int(rng.rand(node->child_num));
+            if (!node->child_nodes)
+                node->InitChildNodes();
+            if (node->child_nodes[i])
+                continue;
+
+            Node* child = node->CreateChildNode(i);
+            expand(child);
+            expanded.push_back(child);
+            ++created;
+        }
+    };
+
+    std::ostringstream out;
+    out << std::fixed << "round,threads,nodes,build_ms,ns/node,release_ms,rss_mb,pool_mb" << std::endl;
+
+    for (int round = 1; round <= rounds; ++round)
+    {
+        std::vector<NodePoolPtr<Node>> roots(thread_num);
+        for (auto& root : roots)
+            root = make_unique_node_pool<Node>();
+
+        // 1スレッドにつき1つの木を作成する。
+        const TimePoint build_start = now();
+        threads.parallel_for(0, size_t(thread_num), 1, [&](size_t, size_t t, size_t) {
+            build_tree(roots[t].get(), nodes / thread_num, u64(round) * 1000 + t + 1);
+        }, size_t(thread_num));
+        const TimePoint build_ms = std::max(now() - build_start, TimePoint(1));
+
+        const size_t rss  = Tools::resident_memory();
+        const size_t pool = NodePool::reserved_bytes();
+
+        const TimePoint release_start = now();
+        roots.clear();
+        const TimePoint release_ms = now() - release_start;
+
+        out << round << ',' << thread_num << ',' << nodes << ',' << build_ms << ',' << std::setprecision(1)
+            << double(build_ms) * 1e6 * thread_num / double(nodes) << ',' << release_ms << ','
+            << double(rss) / (1024 * 1024) << ',' << double(pool) / (1024 * 1024) << std::endl;
+    }
+
+    sync_cout << out.str() << "info string nodealloc : finished." << sync_endl;
+}
+
 // エンジン名の変更。
 std::string FukauraOuEngine::get_engine_name() const { return "FukauraOu"; }
 
@@ -64,6 +64,11 @@ class FukauraOuEngine: public YaneuraOu::Engine {
 	// 🌈 "ponderhit"に対する処理。
     virtual void set_ponderhit(bool b) override;
 
+	// 🌈 USI拡張コマンド"user"に対する処理。
+	//     "user mctsbench ..."で探索部の速度を計測する。
+	//     "user nodealloc ..."で探索木の確保/開放の速度を計測する。
+    virtual void user(std::istringstream& is) override;
+
 	// エンジン名の変更。
     virtual std::string get_engine_name() const override;
 
@@ -83,6 +88,12 @@ class FukauraOuEngine: public YaneuraOu::Engine {
 	// "Max_GPU","Disabled_GPU"と"UCT_Threads"の設定値から、各GPUのスレッド数の設定を返す。
     std::vector<int> get_thread_settings();
 
+	// "user mctsbench"のhandler。合成NNを用いて、探索部だけの速度を計測する。
+	void mcts_benchmark(std::istringstream& is);
+
+	// "user nodealloc"のhandler。探索木の確保/開放にかかる時間とメモリ使用量を計測する。
+	void node_alloc_benchmark(std::istringstream& is);
+
 };  // class FukauraOuEngine
 
 } // namespace dlshogi
@@ -0,0 +1,110 @@
+﻿#include "NNCache.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include "../../memory.h"
+#include "../../misc.h"
+#include "../../thread.h"
+
+namespace dlshogi {
+
+// tableのサイズを[MB]単位で設定して、クリアする。
+void NNCache::resize(size_t mb_size, ThreadPool& threads) {
+
+	// entry数は2の累乗にする。
+	size_t new_entry_num = 0;
+	if (mb_size)
+	{
+		new_entry_num = 1;
+		while (new_entry_num * 2 * sizeof(Entry) <= mb_size * 1024 * 1024)
+			new_entry_num *= 2;
+	}
+
+	if (new_entry_num != entry_num)
+	{
+		free_table();
+		if (new_entry_num == 0)
+			return;
+
+		table = static_cast<Entry*>(aligned_large_pages_alloc(new_entry_num * sizeof(Entry)));
+		if (!table)
+		{
+			sync_cout << "info string Error! : failed to allocate " << mb_size << "MB for UCT_NNCacheSize." << sync_endl;
+			Tools::exit();
+		}
+		entry_num = new_entry_num;
+	}
+
+	if (entry_num)
+		Tools::memclear(threads, nullptr, table, entry_num * sizeof(Entry));
+}
+
+void NNCache::free_table() {
+	aligned_large_pages_free(table);
+	table     = nullptr;
+	entry_num = 0;
+}
+
+// nodeの局面のNNの評価結果を登録する。
+void NNCache::store(Key key, const Node* node, float value) {
+	const ChildNumType child_num = node->child_num;
+	if (child_num > MAX_CHILDREN)
+		return;
+
+	Entry& e = entry_of(key);
+
+	// 他のスレッドが書き込み中なら諦める。
+	u32 seq = e.seq.load(std::memory_order_relaxed);
+	if ((seq & 1) || !e.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+		return;
+
+	e.key       = key;
+	e.child_num = child_num;
+	e.value     = value;
+#if defined(USE_POLICY_BOOK)
+	e.policy_book_value = node->policy_book_value;
+#endif
+	const ChildNode* uct_child = node->child.get();
+	for (ChildNumType i = 0; i < child_num; ++i)
+		e.nnrate[i] = uct_child[i].nnrate;
+
+	e.seq.store(seq + 2, std::memory_order_release);
+}
+
+// nodeの局面の評価結果がcacheにあれば、nodeに書き込んでtrueを返す。
+bool NNCache::probe(Key key, Node* node, float& value) const {
+	const Entry& e = entry_of(key);
+
+	const u32 seq = e.seq.load(std::memory_order_acquire);
+	if (seq & 1)
+		return false;
+
+	// 同じ局面なら、同じ順番で同じ指し手が生成されているはずなので、
+	// 合法手の数が一致すれば、nnrateはそのままの順番でコピーして良い。
+	const ChildNumType child_num = node->child_num;
+	if (e.key != key || e.child_num != child_num)
+		return false;
+
+	ChildNode* uct_child = node->child.get();
+	for (ChildNumType i = 0; i < child_num; ++i)
+		uct_child[i].nnrate = e.nnrate[i];
+	const float v = e.value;
+#if defined(USE_POLICY_BOOK)
+	const float policy_book_value = e.policy_book_value;
+#endif
+
+	// 読み込んでいる間に書き換えられていたら失敗。
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (e.seq.load(std::memory_order_relaxed) != seq)
+		return false;
+
+	value = v;
+#if defined(USE_POLICY_BOOK)
+	node->policy_book_value = policy_book_value;
+#endif
+	return true;
+}
+
+} // namespace dlshogi
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
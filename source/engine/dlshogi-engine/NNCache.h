@@ -0,0 +1,88 @@
+﻿#ifndef __NN_CACHE_H_INCLUDED__
+#define __NN_CACHE_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <atomic>
+
+#include "../../position.h"
+#include "Node.h"
+
+// NNの評価結果(各合法手のpolicyとvalue)のcache。
+//
+// ReuseSubtreeで捨てられた部分木の局面や、ponderで探索した局面など、同じ対局中に一度NNで評価した局面に
+// 再び到達することは多い。UctSearcher::QueuingNode()でこのcacheを引いて、あればNNのbatchに積まずにその結果を用いる。
+//
+// ・固定サイズ(エンジンオプションの"UCT_NNCacheSize"[MB])のtableで、1 entryに1局面。衝突したら常に上書きする。
+// ・lockはしない。entryごとにsequence番号を持たせて(seqlock)、書き込み中のentryや
+//   読み込み中に書き換えられたentryは、読み込みに失敗したとみなす。
+//   書き込みも、他のスレッドが書き込み中のentryなら諦める。cacheなので、それで問題ない。
+// ・"isready"でクリアされる以外は、"go"をまたいで保持する。
+//
+// 💡 UCT_Transposition(NodeHashTable)は今回の"go"の探索木にあるNodeしか引けないが、
+//     こちらは探索木から開放された局面も引ける。その代わり、1 entryが大きい(512 bytes)。
+
+namespace YaneuraOu {
+class ThreadPool;
+}
+
+namespace dlshogi {
+
+using namespace YaneuraOu;
+
+class NNCache
+{
+public:
+	// 1 entryに格納できる合法手の数。これより合法手の多い局面はcacheしない。
+	// 💡 1 entryが512 bytesになるように決めてある。
+	static constexpr ChildNumType MAX_CHILDREN = 120;
+
+	~NNCache() { free_table(); }
+
+	// tableのサイズを[MB]単位で設定して、クリアする。mb_size == 0ならtableを開放する。
+	// threads : クリアに用いるスレッド
+	void resize(size_t mb_size, ThreadPool& threads);
+
+	// nodeの局面のNNの評価結果を登録する。nodeは評価済みであること。
+	//   key   : nodeの局面のhash key(Position::key())
+	//   value : NNのvalue(nodeの局面の手番側から見た勝率)
+	void store(Key key, const Node* node, float value);
+
+	// nodeの局面の評価結果がcacheにあれば、nodeの各ChildNodeのnnrateに書き込んでtrueを返す。
+	// (Policy Bookを使っている時は、policy_book_valueも書き込む)
+	//   key   : nodeの局面のhash key(Position::key())
+	//   value : [Out] NNのvalue
+	// ⚠ nodeは展開済み(ExpandNode()済み)であること。
+	//    falseが返った時も、nodeのnnrateは書き換えられていることがある。(NNで評価し直すので問題ない)
+	bool probe(Key key, Node* node, float& value) const;
+
+	// 現在のentry数。(resize()されていなければ0)
+	size_t size() const { return entry_num; }
+
+private:
+	struct alignas(64) Entry {
+		// 書き込み中は奇数。書き込みが終わるごとに2ずつ増える。
+		std::atomic<u32> seq;
+		// 0なら空きentry。(評価するNodeのchild_numは1以上)
+		ChildNumType child_num;
+		float        value;
+#if defined(USE_POLICY_BOOK)
+		float policy_book_value;
+#endif
+		Key   key;
+		float nnrate[MAX_CHILDREN];
+	};
+
+	Entry& entry_of(Key key) const { return table[Key64(key) & (entry_num - 1)]; }
+
+	void free_table();
+
+	Entry* table     = nullptr;
+	size_t entry_num = 0;
+};
+
+} // namespace dlshogi
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NN_CACHE_H_INCLUDED__
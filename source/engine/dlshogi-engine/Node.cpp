@@ -15,6 +15,9 @@ namespace dlshogi {
 		if (child_num > 0 && child_nodes) {
 			bool found = false;
 
+			// 開放する子ノード。最後にまとめてGCに積む。
+			std::vector<NodePoolPtr<Node>> nodes_to_gc;
+
 			for (int i = 0; i < child_num; ++i)
 			{
 				auto& uct_child  = child[i];
@@ -26,7 +29,7 @@ namespace dlshogi {
 					// 子ノードへのedgeは見つかっているけど実体がまだ。
 					if (!child_node)
 	                    // 新しいノードを作成する
-	                    child_node = std::make_unique<Node>();
+	                    child_node = make_unique_node_pool<Node>();
 
 					// 0番目の要素に移動させる。
 					if (i != 0) {
@@ -37,9 +40,10 @@ namespace dlshogi {
 				else {
 					// 子ノードを削除（ガベージコレクタに追加）
 					if (child_node)
-						gc->AddToGcQueue(std::move(child_node));
+						nodes_to_gc.emplace_back(std::move(child_node));
 				}
 			}
+			gc->AddToGcQueue(std::move(nodes_to_gc));
 
 			if (found) {
 				// 子ノードを1つにする。
@@ -50,7 +54,7 @@ namespace dlshogi {
 				// 子ノードが見つからなかった場合、新しいノードを作成する
 				CreateSingleChildNode(move);
 				InitChildNodes();
-				return (child_nodes[0] = std::make_unique<Node>()).get();
+				return (child_nodes[0] = make_unique_node_pool<Node>()).get();
 			}
 		}
 		else {
@@ -58,7 +62,7 @@ namespace dlshogi {
 			CreateSingleChildNode(move);
 			// 子ノードへのポインタ配列を初期化する
 			InitChildNodes();
-			return (child_nodes[0] = std::make_unique<Node>()).get();
+			return (child_nodes[0] = make_unique_node_pool<Node>()).get();
 		}
 	}
 
@@ -83,7 +87,7 @@ namespace dlshogi {
 		}
 
 		if (!game_root_node) {
-			game_root_node = std::make_unique<Node>();
+			game_root_node = make_unique_node_pool<Node>();
 			current_head   = game_root_node.get();
 		}
 
@@ -123,7 +127,7 @@ namespace dlshogi {
 				ASSERT_LV3(prev_head->child_num == 1);
 				auto& prev_uct_child_node = prev_head->child_nodes[0];
 				gc->AddToGcQueue(std::move(prev_uct_child_node));
-				prev_uct_child_node = std::make_unique<Node>();
+				prev_uct_child_node = make_unique_node_pool<Node>();
 				current_head = prev_uct_child_node.get();
 			}
 			else {
@@ -142,7 +146,7 @@ namespace dlshogi {
 		// ※　AddToGcQueue()はnullptrを渡しても良いことになっている。
 		gc->AddToGcQueue(std::move(game_root_node));
 
-		game_root_node = std::make_unique<Node>();
+		game_root_node = make_unique_node_pool<Node>();
 		current_head = game_root_node.get();
 	}
 
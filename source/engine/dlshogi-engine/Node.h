@@ -8,6 +8,7 @@
 #include "../../position.h"
 #include "../../movegen.h"
 #include "dlshogi_types.h"
+#include "NodePool.h"
 
 namespace dlshogi {
 
@@ -110,12 +111,12 @@ struct Node {
         dfpn_proven_unsolvable(0) /*, dfpn_mate_ply(0)*/ {}
 
     // 子ノード作成
-    Node* CreateChildNode(int i) { return (child_nodes[i] = std::make_unique<Node>()).get(); }
+    Node* CreateChildNode(int i) { return (child_nodes[i] = make_unique_node_pool<Node>()).get(); }
 
     // 子ノード1つのみで初期化する。
     void CreateSingleChildNode(const Move move) {
         child_num = 1;
-        child     = std::make_unique<ChildNode[]>(1);
+        child     = make_unique_node_pool<ChildNode[]>(1);
         child[0]  = move;
     }
 
@@ -134,7 +135,7 @@ struct Node {
     }
 
     // 子ノードへのポインタ配列の初期化
-    void InitChildNodes() { child_nodes = std::make_unique<std::unique_ptr<Node>[]>(child_num); }
+    void InitChildNodes() { child_nodes = make_unique_node_pool<NodePoolPtr<Node>[]>(child_num); }
 
     // 引数のmoveで指定した子ノード以外の子ノードをすべて開放する。
     // 前回探索した局面からmoveの指し手を選んだ局面の以外の情報を開放するのに用いる。
@@ -181,13 +182,13 @@ struct Node {
     ChildNumType child_num;
 
     // 子ノード(に至るedge)
-    // child_numの数だけ、ChildNodeをnewして保持している。
-    std::unique_ptr<ChildNode[]> child;
+    // child_numの数だけ、ChildNodeをNodePoolから確保して保持している。
+    NodePoolPtr<ChildNode[]> child;
 
     // 子ノードへのポインタ配列
     // もったいないので必要になってからnewする。
     // 展開した子ノード以外はnullptrのまま。
-    std::unique_ptr<std::unique_ptr<Node>[]> child_nodes;
+    NodePoolPtr<NodePoolPtr<Node>[]> child_nodes;
 
 #if defined(USE_POLICY_BOOK)
     // PolicyBookから与えられたvalue
@@ -209,7 +210,7 @@ struct Node {
     void expand_node(const Position* pos) {
         MoveList<T> ml(*pos);
 
-        child            = std::make_unique<ChildNode[]>(ml.size());
+        child            = make_unique_node_pool<ChildNode[]>(ml.size());
         auto* child_node = child.get();
         for (auto m : ml)
             (child_node++)->move = m;
@@ -249,7 +250,7 @@ class NodeTree {
 
     // ゲーム木のroot node = ゲームの開始局面
     // ※　dlshogiでは、gamebegin_node_という変数名
-    std::unique_ptr<Node> game_root_node;
+    NodePoolPtr<Node> game_root_node;
 
     // ゲーム開始局面
     // ※　dlshogiではhistory_starting_pos_key_というKey型の変数
@@ -278,7 +279,8 @@ class NodeGarbageCollector {
     // GC対象に追加する。ここから辿れるNode,ChildNodeはすべて開放する。
     // また、Nodeは循環していないものとする。
     // また、node == nullptrなら何もせずにreturnする。
-    void AddToGcQueue(std::unique_ptr<Node> node) {
+    // 💡 開放されたNode,ChildNodeはGCスレッドのNodePoolのfree listに積まれて、batch単位で探索スレッドに戻っていく。
+    void AddToGcQueue(NodePoolPtr<Node> node) {
         if (!node)
             return;
 
@@ -286,6 +288,16 @@ class NodeGarbageCollector {
         subtrees_to_gc.emplace_back(std::move(node));
     }
 
+    // GC対象をまとめて追加する。(gc_mutexのlockが1回で済む)
+    void AddToGcQueue(std::vector<NodePoolPtr<Node>>&& nodes) {
+        if (nodes.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(gc_mutex);
+        for (auto& node : nodes)
+            subtrees_to_gc.emplace_back(std::move(node));
+    }
+
     ~NodeGarbageCollector() {
         // stopフラグを変更して、GCスレッドが停止するのを待つ
         stop.store(true);
@@ -300,6 +312,22 @@ class NodeGarbageCollector {
     // コンストラクタで起動させ、デストラクタで終了する感じ。
     void set_thread_id(size_t thread_id) { next_thread_id = (int) thread_id; }
 
+    // GCでNodeの開放にかかった時間の累計[ns]。(探索部の計測用)
+    u64 gc_time_ns() const { return gc_time.load(); }
+
+    // GC待ちのNodeがなくなるまで待機する。
+    void wait_for_empty() const {
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(gc_mutex);
+                if (subtrees_to_gc.empty() && !collecting)
+                    return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
    private:
     // ガーベジ用のスレッドがkGCIntervalMs[ms]ごとに実行するガーベジ本体。
     void GarbageCollect() {
@@ -307,7 +335,7 @@ class NodeGarbageCollector {
         {
 
             // Node will be released in destructor when mutex is not locked.
-            std::unique_ptr<Node> node_to_gc;
+            NodePoolPtr<Node> node_to_gc;
             {
                 // Lock the mutex and move last subtree from subtrees_to_gc_ into
                 // node_to_gc.
@@ -320,7 +348,18 @@ class NodeGarbageCollector {
                 // unique_ptrなどで保持しているノードが数珠つなぎに開放される。LC0の手法。
 
                 subtrees_to_gc.pop_back();
+                collecting = true;
             }
+
+            // --- やねうら王独自拡張
+
+            // 開放にかかった時間を計測しておく。
+            const auto start = std::chrono::steady_clock::now();
+            node_to_gc.reset();
+            gc_time += u64(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+            std::lock_guard<std::mutex> lock(gc_mutex);
+            collecting = false;
         }
     }
 
@@ -350,7 +389,7 @@ class NodeGarbageCollector {
 
     // GC対象のTree。ここから数珠つなぎに開放していく。
     // 一度にそんなにたくさん積まれないので、そこまで大きなコンテナにはならない。
-    std::vector<std::unique_ptr<Node>> subtrees_to_gc;
+    std::vector<NodePoolPtr<Node>> subtrees_to_gc;
 
     // gc_threadの停止フラグ。trueになったら、gc_threadはWorker()から抜けて終了する。
     std::atomic<bool> stop{false};
@@ -364,6 +403,12 @@ class NodeGarbageCollector {
 
     std::atomic<int> current_thread_id;
     std::atomic<int> next_thread_id;
+
+    // GCでNodeの開放にかかった時間の累計[ns]
+    std::atomic<u64> gc_time{0};
+
+    // GCスレッドがsubtrees_to_gcから取り出したNodeを開放している最中であるか。(gc_mutexで保護する)
+    bool collecting = false;
 };
 
 }  // namespace dlshogi
@@ -0,0 +1,245 @@
+﻿#include "NodePool.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../../misc.h"
+
+namespace dlshogi {
+namespace NodePool {
+
+namespace {
+
+// OSから一度に確保するchunkのsize。(large pageの単位に合わせておく)
+constexpr size_t kChunkSize = 2 * 1024 * 1024;
+
+// これを超えるsizeはNodePoolで管理せずに、直接std_aligned_alloc()する。
+// 💡 将棋の合法手は最大593手なので、ChildNode[593](+要素数)でもこれに収まる。
+constexpr size_t kMaxSmallSize = 16 * 1024;
+
+// size classの数。
+// 1024[byte]までは16byte刻み(64個)、そこから16KBまでは2の累乗の区間を8等分(4区間×8個)。
+// 💡 ChildNodeの配列は1～2KB程度のものが多いので、そこで切り上げによる無駄が大きくならないようにしておく。
+constexpr int kClassNum = 64 + 4 * 8;
+
+// size[byte]に対応するsize classのindex
+int size_to_class(size_t size) {
+    if (size <= 1024)
+        return int((std::max(size, size_t(1)) + 15) / 16) - 1;
+
+    int band = 10;
+    while ((size_t(2) << band) < size)
+        ++band;
+    const size_t step = size_t(1) << (band - 3);
+    return 64 + (band - 10) * 8 + int((size - (size_t(1) << band) + step - 1) / step) - 1;
+}
+
+// size classのindexに対応するblockのsize[byte]
+size_t class_to_size(int c) {
+    if (c < 64)
+        return size_t(c + 1) * 16;
+
+    const int band = 10 + (c - 64) / 8;
+    return (size_t(1) << band) + size_t((c - 64) % 8 + 1) * (size_t(1) << (band - 3));
+}
+
+// 空きblockの単方向リスト。空きblockの先頭に次の空きblockへのポインタを書く。
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct FreeList {
+    FreeBlock* head  = nullptr;
+    size_t     count = 0;
+
+    void push(void* p) {
+        auto* b = static_cast<FreeBlock*>(p);
+        b->next = head;
+        head    = b;
+        ++count;
+    }
+
+    void* pop() {
+        FreeBlock* b = head;
+        head         = b->next;
+        --count;
+        return b;
+    }
+};
+
+// 1 batchに含めるblockの数。スレッドのfree listと共有のfree listの間では、この単位で受け渡す。
+// 1 batchがおよそ64KBになるようにしておく。
+size_t batch_size(int c) { return std::max(size_t(8), size_t(64 * 1024) / class_to_size(c)); }
+
+struct ThreadCache;
+
+// 全スレッドで共有しているfree list
+struct CentralCache {
+    struct Class {
+        std::mutex            mutex;
+        std::vector<FreeList> batches;
+    };
+    Class classes[kClassNum];
+
+    // OSから確保したchunkの合計[byte]
+    std::atomic<size_t> reserved{0};
+
+    // 終了したスレッドのThreadCache::usedの合計[byte]
+    std::atomic<s64> retired_used{0};
+
+    // ThreadCache::usedの集計用。
+    std::mutex                caches_mutex;
+    std::vector<ThreadCache*> caches;
+};
+
+// ⚠ スレッドのデストラクタ(ThreadCacheの開放)から参照されるので、開放しない。
+CentralCache& central() {
+    static CentralCache* c = new CentralCache();
+    return *c;
+}
+
+// スレッドごとのfree listとchunk
+struct ThreadCache {
+    FreeList lists[kClassNum];
+
+    // chunkの未使用部分。ここから切り出す。
+    char* cur = nullptr;
+    char* end = nullptr;
+
+    // このスレッドでallocate()した合計 - deallocate()した合計[byte]
+    // 💡 このスレッドしか書き換えないが、used_bytes()で他のスレッドから読むのでatomicにしておく。
+    std::atomic<s64> used{0};
+
+    ThreadCache() {
+        auto&                       c = central();
+        std::lock_guard<std::mutex> lk(c.caches_mutex);
+        c.caches.push_back(this);
+    }
+
+    // スレッドの終了時に、保持しているblockを共有のfree listに返す。
+    // 💡 chunkの未使用部分は捨てることになるが、スレッドが終了するのは"isready"でスレッド数が変わった時ぐらいなので気にしない。
+    ~ThreadCache() {
+        auto& c = central();
+        for (int i = 0; i < kClassNum; ++i)
+            if (lists[i].count)
+            {
+                std::lock_guard<std::mutex> lk(c.classes[i].mutex);
+                c.classes[i].batches.push_back(lists[i]);
+            }
+
+        std::lock_guard<std::mutex> lk(c.caches_mutex);
+        c.retired_used += used.load(std::memory_order_relaxed);
+        c.caches.erase(std::find(c.caches.begin(), c.caches.end(), this));
+    }
+
+    void add_used(s64 size) { used.store(used.load(std::memory_order_relaxed) + size, std::memory_order_relaxed); }
+
+    // free listが空の時に呼び出される。共有のfree listから1 batch取ってくるか、chunkから切り出す。
+    void* refill(int cls) {
+        auto& c = central().classes[cls];
+        {
+            std::lock_guard<std::mutex> lk(c.mutex);
+            if (!c.batches.empty())
+            {
+                lists[cls] = c.batches.back();
+                c.batches.pop_back();
+            }
+        }
+        if (lists[cls].count)
+            return lists[cls].pop();
+
+        const size_t size = class_to_size(cls);
+        if (size_t(end - cur) < size)
+        {
+            // 現在のchunkの残りは捨てて、新しいchunkを確保する。
+            // (ChildNode[593]でも16KB程度なので、捨てる部分はchunkの1%に満たない)
+            cur = static_cast<char*>(aligned_large_pages_alloc(kChunkSize));
+            if (!cur)
+            {
+                sync_cout << "info string Error! : NodePool failed to allocate " << kChunkSize << " bytes." << sync_endl;
+                Tools::exit();
+            }
+            end = cur + kChunkSize;
+            central().reserved += kChunkSize;
+        }
+        void* p = cur;
+        cur += size;
+        return p;
+    }
+
+    // free listが長くなりすぎたら、1 batch分を共有のfree listに返す。
+    // (GCスレッドが大量に開放した分を、探索スレッドで再利用できるように)
+    void flush(int cls) {
+        auto&        list = lists[cls];
+        const size_t n    = batch_size(cls);
+
+        FreeList batch;
+        batch.head     = list.head;
+        FreeBlock* tail = list.head;
+        for (size_t i = 1; i < n; ++i)
+            tail = tail->next;
+        list.head   = tail->next;
+        tail->next  = nullptr;
+        batch.count = n;
+        list.count -= n;
+
+        auto&                       c = central().classes[cls];
+        std::lock_guard<std::mutex> lk(c.mutex);
+        c.batches.push_back(batch);
+    }
+};
+
+ThreadCache& thread_cache() {
+    thread_local ThreadCache cache;
+    return cache;
+}
+
+}  // namespace
+
+void* allocate(size_t size) {
+    if (size > kMaxSmallSize)
+        return std_aligned_alloc(16, size);
+
+    auto&     tc  = thread_cache();
+    const int cls = size_to_class(size);
+    tc.add_used(s64(size));
+
+    auto& list = tc.lists[cls];
+    return list.count ? list.pop() : tc.refill(cls);
+}
+
+void deallocate(void* ptr, size_t size) {
+    if (size > kMaxSmallSize)
+    {
+        std_aligned_free(ptr);
+        return;
+    }
+
+    auto&     tc  = thread_cache();
+    const int cls = size_to_class(size);
+    tc.add_used(-s64(size));
+
+    auto& list = tc.lists[cls];
+    list.push(ptr);
+    if (list.count >= 2 * batch_size(cls))
+        tc.flush(cls);
+}
+
+size_t reserved_bytes() { return central().reserved.load(); }
+
+size_t used_bytes() {
+    auto&                       c = central();
+    std::lock_guard<std::mutex> lk(c.caches_mutex);
+    s64                         sum = c.retired_used.load();
+    for (auto* tc : c.caches)
+        sum += tc->used.load(std::memory_order_relaxed);
+    return size_t(std::max(sum, s64(0)));
+}
+
+}  // namespace NodePool
+}  // namespace dlshogi
+
+#endif  // defined(YANEURAOU_ENGINE_DEEP)
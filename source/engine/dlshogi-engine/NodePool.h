@@ -0,0 +1,112 @@
+﻿#ifndef __NODE_POOL_H_INCLUDED__
+#define __NODE_POOL_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include "../../memory.h"
+
+// Node, ChildNodeの配列をmalloc()ではなく、スレッドごとのslabから切り出して確保するためのallocator。
+//
+// dlshogiではNode一つごとにnew、ChildNodeの配列ごとにnew[]していたが、
+// 10M node以上になるとmalloc()自体の時間とfragmentationが無視できなくなる。
+//
+// ・確保は、スレッドごとのfree list(size classごと)から取り出す。空なら全スレッドで共有している
+//   free list(batch単位で保持している)から1 batch分まとめて取ってくる。それもなければ、
+//   スレッドごとのchunk(kChunkSize)の先頭から切り出す。
+// ・開放は、開放したスレッドのfree listに積むだけ。一定数を超えたら1 batch分まとめて共有のfree listに返す。
+//   ReleaseChildrenExceptOne()などで不要になった部分木はGCスレッドがまとめて開放するが、
+//   それは探索スレッドのmalloc()/free()と競合せずに、batch単位で探索スレッドに戻っていく。
+// ・chunkはOSに返さない。置換表と同じく、一度確保した分はプロセス終了まで再利用する。
+//
+// 💡 config.hのUSE_NODE_POOLをundefすると、std::make_unique()による確保に戻る。(比較計測用)
+
+namespace dlshogi {
+
+using namespace YaneuraOu;
+
+namespace NodePool {
+
+// size[byte]のメモリを確保する。16の倍数でalignされている。
+void* allocate(size_t size);
+
+// allocate()で確保したメモリを開放する。sizeはallocate()の時と同じ値を渡すこと。
+void deallocate(void* ptr, size_t size);
+
+// いままでにchunkとしてOSから確保したメモリの合計[byte]。
+size_t reserved_bytes();
+
+// 現在使用中(allocate()されて、deallocate()されていない)のメモリの合計[byte]。
+// 💡 size classに切り上げる前のsizeで集計している。
+size_t used_bytes();
+
+}  // namespace NodePool
+
+#if defined(USE_NODE_POOL)
+
+template<typename T>
+struct NodePoolDeleter {
+    void operator()(T* ptr) const {
+        memory_deleter<T>(ptr, [](void* p) { NodePool::deallocate(p, sizeof(T)); });
+    }
+};
+
+template<typename T>
+struct NodePoolArrayDeleter {
+    void operator()(T* ptr) const {
+        if (!ptr)
+            return;
+
+        // memory_allocator<T[]>()は配列の手前に要素数を格納しているので、それを見て確保した時のsizeを求める。
+        const size_t array_offset = std::max(sizeof(size_t), alignof(T));
+        const size_t num          = *reinterpret_cast<size_t*>(reinterpret_cast<char*>(ptr) - array_offset);
+        memory_deleter_array<T>(ptr, [num](void* p) {
+            NodePool::deallocate(p, std::max(sizeof(size_t), alignof(T)) + num * sizeof(T));
+        });
+    }
+};
+
+// NodePoolから確保したunique_ptr<T>
+template<typename T>
+using NodePoolPtr = std::conditional_t<std::is_array_v<T>,
+                                       std::unique_ptr<T, NodePoolArrayDeleter<std::remove_extent_t<T>>>,
+                                       std::unique_ptr<T, NodePoolDeleter<T>>>;
+
+// make_unique_node_pool for single objects
+template<typename T, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, NodePoolPtr<T>> make_unique_node_pool(Args&&... args) {
+    static_assert(alignof(T) <= 16, "NodePool::allocate() is aligned to 16 bytes");
+
+    return NodePoolPtr<T>(memory_allocator<T>(NodePool::allocate, std::forward<Args>(args)...));
+}
+
+// make_unique_node_pool for arrays of unknown bound
+template<typename T>
+std::enable_if_t<std::is_array_v<T>, NodePoolPtr<T>> make_unique_node_pool(size_t num) {
+    static_assert(alignof(std::remove_extent_t<T>) <= 16, "NodePool::allocate() is aligned to 16 bytes");
+
+    return NodePoolPtr<T>(memory_allocator<T>(NodePool::allocate, num));
+}
+
+#else
+
+template<typename T>
+using NodePoolPtr = std::unique_ptr<T>;
+
+template<typename T, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, NodePoolPtr<T>> make_unique_node_pool(Args&&... args) {
+    return std::make_unique<T>(std::forward<Args>(args)...);
+}
+
+template<typename T>
+std::enable_if_t<std::is_array_v<T>, NodePoolPtr<T>> make_unique_node_pool(size_t num) {
+    return std::make_unique<T>(num);
+}
+
+#endif
+
+}  // namespace dlshogi
+
+#endif  // defined(YANEURAOU_ENGINE_DEEP)
+
+#endif  // ndef __NODE_POOL_H_INCLUDED__
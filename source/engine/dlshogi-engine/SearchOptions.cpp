@@ -85,6 +85,24 @@ void SearchOptions::add_options(OptionsMap& options) {
           return std::nullopt;
       }));
 
+    // 異なる手順で到達した同じ局面(transposition)を、探索木に登録されている評価済みのNodeから引いて、
+    // NNの評価結果(policyとvalue)を共有する。同じ局面をNNで評価し直さなくて済む。
+    // 💡 UCT_NodeLimit以下の最大の2の累乗個のentry(1 entry = 24 bytes)のtableを確保する。
+    options.add(  //
+      "UCT_Transposition", Option(false, [&](const Option& o) {
+          use_transposition = o;
+          return std::nullopt;
+      }));
+
+    // NNの評価結果(policyとvalue)のcacheのサイズ[MB]。0ならcacheしない。
+    // 探索木から開放された局面でも、同じ対局中にNNで評価済みの局面ならNNで評価し直さなくて済む。
+    // 💡 1 entry(1局面)あたり512 bytes。"isready"のタイミングで確保とクリアが行われる。
+    options.add(  //
+      "UCT_NNCacheSize", Option(0, 0, MaxHashMB, [&](const Option& o) {
+          nn_cache_size = size_t(o);
+          return std::nullopt;
+      }));
+
     // 引き分けの時の値 : 1000分率で
     // 引き分けの局面では、この値とみなす。
     // root color(探索開始局面の手番)に応じて、2通り。
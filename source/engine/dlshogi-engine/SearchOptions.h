@@ -91,6 +91,14 @@ struct SearchOptions {
 	// 入玉ルール
 	EnteringKingRule enteringKingRule = EKR_27_POINT;
 
+    // 異なる手順で到達した同じ局面について、NNの評価結果を共有するのか。
+    // エンジンオプションの"UCT_Transposition"の値。(NodeHashTableを参照のこと)
+    bool use_transposition = false;
+
+    // NNの評価結果のcacheのサイズ[MB]。0ならcacheしない。
+    // エンジンオプションの"UCT_NNCacheSize"の値。(NNCacheを参照のこと)
+    size_t nn_cache_size = 0;
+
     // leaf node(探索の末端の局面)でのdf-pn詰みルーチンを呼び出す時のノード数上限
     // 0 = 呼び出さない。
     // エンジンオプションの"LeafDfpnNodesLimit"の値。
@@ -247,12 +247,25 @@ UCTSearcherGroup::Term()
 NodeTree* UctSearcher::get_node_tree() const { return grp->get_dlsearcher()->get_node_tree(); }
 
 // Evaluateを呼び出すリスト(queue)に追加する。
-void UctSearcher::QueuingNode(const Position *pos, Node* node, float* value_win)
+// NNCacheにあれば、queueに追加せずにfalseを返す。
+bool UctSearcher::QueuingNode(const Position *pos, Node* node, float* value_win)
 {
 #if defined(LOG_PRINT)
 	logger.print("sfen "+pos->sfen(0));
 #endif
 
+	// 同じ対局中にNNで評価済みの局面なら、その評価結果を用いる。
+	auto& nn_cache = grp->get_dlsearcher()->get_nn_cache();
+	if (nn_cache.size())
+	{
+		++stats.nn_cache_probes;
+		if (nn_cache.probe(pos->key(), node, *value_win))
+		{
+			++stats.nn_cache_hits;
+			return false;
+		}
+	}
+
 	//cout << "QueuingNode:" << index << ":" << current_policy_value_queue_index << ":" << current_policy_value_batch_index << endl;
 	//cout << pos->toSFEN() << endl;
 
@@ -266,7 +279,7 @@ void UctSearcher::QueuingNode(const Position *pos, Node* node, float* value_win)
 	make_input_features(*pos, current_policy_value_batch_index, packed_features1, packed_features2);
 
 	// 現在のNodeと手番を保存しておく。
-	policy_value_batch[current_policy_value_batch_index] = { node, pos->side_to_move() ,
+	policy_value_batch[current_policy_value_batch_index] = { node, pos->side_to_move() , pos->key() ,
 #if defined(USE_POLICY_BOOK)
 		pos->hash_key() ,
 #endif
@@ -278,6 +291,41 @@ void UctSearcher::QueuingNode(const Position *pos, Node* node, float* value_win)
 
 	current_policy_value_batch_index++;
 	// これが、policy_value_batch_maxsize分だけ溜まったら、nn->forward()を呼び出す。
+
+	return true;
+}
+
+// 展開したばかりのnodeの局面が、今回の探索で評価済みのNodeとしてNodeHashTableに登録されていれば、
+// そのNodeのpolicyとNNのvalueをコピーする。
+bool UctSearcher::CopyFromTransposition(const Position* pos, Node* node, float& value)
+{
+	auto& node_hash = grp->get_dlsearcher()->get_node_hash();
+
+	float      v;
+	const Node* src = node_hash.probe(pos->key(), v);
+
+	// 同じ局面なら、同じ順番で同じ指し手が生成されているはず。
+	// hash keyの衝突に備えて、指し手が一致するかは確認しておく。
+	// ⚠ srcのmoveは上位bitにSetWin()等のフラグが立っている可能性がある。
+	if (src == nullptr || src == node || src->child_num != node->child_num)
+		return false;
+
+	const ChildNode* src_child = src->child.get();
+	ChildNode*       uct_child = node->child.get();
+	for (ChildNumType i = 0; i < node->child_num; ++i)
+		if (src_child[i].getMove() != uct_child[i].move)
+			return false;
+
+	for (ChildNumType i = 0; i < node->child_num; ++i)
+		uct_child[i].nnrate = src_child[i].nnrate;
+
+#if defined(USE_POLICY_BOOK)
+	node->policy_book_value = src->policy_book_value;
+#endif
+
+	value = v;
+	++stats.transposition_hits;
+	return true;
 }
 
 // leaf node用の詰め将棋ルーチンの初期化(alloc)を行う。
@@ -393,8 +441,8 @@ void UctSearcher::DummyForward()
 	// このスレッドとGPUとを紐付ける。
 	grp->set_device();
 	// 最大バッチサイズ(policy_value_batch_maxsize) と 最小バッチサイズ(1) でそれぞれ推論を実行しておく
-	grp->nn_forward(thread_id, policy_value_batch_maxsize, packed_features1, packed_features2, features1, features2, y1, y2);
-	grp->nn_forward(thread_id, 1, packed_features1, packed_features2, features1, features2, y1, y2);
+	grp->nn_forward(thread_id, policy_value_batch_maxsize, packed_features1, packed_features2, features1, features2, y1, y2, stats);
+	grp->nn_forward(thread_id, 1, packed_features1, packed_features2, features1, features2, y1, y2, stats);
 	// ダミー局面推論終了時間
 	TimePoint tpforwardend = now();
 
@@ -408,6 +456,9 @@ void UctSearcher::ParallelUctSearchStart(const Position& rootPos)
 	// このスレッドとGPUとを紐付ける。
 	grp->set_device();
 
+	// 探索部の計測用の統計は"go"ごとにクリアする。
+	stats.clear();
+
 	// 詰み探索部の"go"コマンド時の初期化
 	auto& options = grp->get_dlsearcher()->search_options;
 	SetMateSearcher(options);
@@ -434,8 +485,10 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
     {
         current_policy_value_batch_index = 0;
         float value_win;  // EvalNode()した時に、ここにvalueが書き戻される。ダミーの変数。
-        QueuingNode(&rootPos, current_root, &value_win);
-        EvalNode();
+        if (QueuingNode(&rootPos, current_root, &value_win))
+            EvalNode();
+        else
+            current_root->SetEvaled(); // NNCacheにあった。
     }
     UNLOCK_EXPAND;
 
@@ -452,6 +505,9 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
         trajectories_batch_discarded.clear();
         current_policy_value_batch_index = 0;
 
+        // NNを呼び出さずに、評価済みのNodeやNNCacheから評価結果を得たplayoutの数。(このbatchでの)
+        int evaluated_playouts = 0;
+
         // バッチサイズ分探索を繰り返す
         // stop()になったらなるべく早く終わりたいので終了判定のところに "&& !stop"を書いておく。
         // ※　VirtualLossを無くすなどして、stop()になったら直ちにリターンすべきだが、
@@ -467,9 +523,16 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
             std::memcpy(&pos, &rootPos, sizeof(Position));
 
             // 1回プレイアウトする
+            const u64 evaluated_hits = stats.transposition_hits + stats.nn_cache_hits;
             visitor_batch.emplace_back();
             const float result = UctSearch(&pos, nullptr, current_root, visitor_batch.back());
 
+            // 評価済みのNodeやNNCacheから評価結果を得たplayoutはbatchを消費していないので、batchのサイズに数えない。
+            // ただし、1つのbatchにつき、policy_value_batch_maxsize回までとする。(NNの評価が遅れすぎないように)
+            if (stats.transposition_hits + stats.nn_cache_hits != evaluated_hits
+                && evaluated_playouts++ < policy_value_batch_maxsize)
+                --i;
+
             if (result != DISCARDED)
             {
                 atomic_fetch_add(&search_limits.nodes_searched, (NodeCountType) 1);
@@ -478,6 +541,8 @@ void UctSearcher::ParallelUctSearch(const Position& rootPos) {
             }
             else
             {
+                ++stats.discarded;
+
                 // 破棄した探索経路を保存
                 trajectories_batch_discarded.emplace_back(
                   std::move(visitor_batch.back().trajectories));
@@ -571,7 +636,8 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 	// 現在見ているノードをロック
 	// これは、このNode(current)の展開(child[i].node = new Node(); ... )を行う時にLockすることになっている。
 	auto& mutex = ds->get_node_mutex(pos);
-	mutex.lock();
+	lock_with_stats(mutex, stats.node_lock_contended, stats.node_lock_wait_ns);
+	++stats.node_lock;
 
 	// 子ノードへのポインタ配列が初期化されていない場合、初期化する
 	if (!current->child_nodes) current->InitChildNodes();
@@ -708,8 +774,24 @@ float UctSearcher::UctSearch(Position* pos, ChildNode* parent , Node* current, N
 					}
 					else
 					{
+						// 異なる手順で評価済みの局面なら、その評価結果を用いる。
+						// ここで評価済みにするので、このあとのSetEvaled()で他のスレッドも辿れるようになる。
+						float value;
+						if (options.use_transposition && CopyFromTransposition(pos, child_node, value))
+						{
+							// valueはchild_nodeの手番側から見た勝率なので、反転させる。
+							result = 1.0f - value;
+							break;
+						}
+
 						// ノードをキューに追加
-						QueuingNode(pos, child_node , &visitor.value_win);
+						// NNCacheにあった時は、キューに追加せずに、その評価結果を用いる。
+						if (!QueuingNode(pos, child_node, &visitor.value_win))
+						{
+							// value_winはchild_nodeの手番側から見た勝率なので、反転させる。
+							result = 1.0f - visitor.value_win;
+							break;
+						}
 
 						// このとき、まだEvalNodeが完了していないのでchild_node->evaledはまだfalseのまま
 						// にしておく必要がある。
@@ -945,8 +1027,15 @@ void UctSearcher::EvalNode() {
 
     // predict
     // policy_value_batch_sizeの数だけまとめて局面を評価する
+    const auto forward_start = std::chrono::steady_clock::now();
     grp->nn_forward(thread_id, policy_value_batch_size, packed_features1, packed_features2, features1,
-                    features2, y1, y2);
+                    features2, y1, y2, stats);
+
+    ++stats.forward_count;
+    stats.forward_positions += policy_value_batch_size;
+    stats.batch_capacity += policy_value_batch_maxsize;
+    stats.forward_ns += u64(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - forward_start).count());
 
     //cout << *y2 << endl;
 
@@ -1112,6 +1201,15 @@ void UctSearcher::EvalNode() {
         }
 #endif
         node->SetEvaled();
+
+        // 異なる手順でこの局面に到達した時に、この評価結果を使えるように登録しておく。
+        if (ds->search_options.use_transposition)
+            ds->get_node_hash().store(policy_value_batch[i].pos_key, node, *policy_value_batch[i].value_win);
+
+        // 探索木から開放されたあとで、またこの局面に到達した時のために、cacheしておく。
+        auto& nn_cache = ds->get_nn_cache();
+        if (nn_cache.size())
+            nn_cache.store(policy_value_batch[i].pos_key, node, *policy_value_batch[i].value_win);
     }
 }
 
@@ -9,6 +9,9 @@
 #include "Node.h"
 #include "PvMateSearch.h"
 
+#include <chrono>
+#include <mutex>
+
 // この探索部は、NN専用なので直接読み込む。
 
 #include "../../eval/deep/nn_types.h"
@@ -22,6 +25,63 @@ class UctSearcher;
 class DlshogiSearcher;
 struct SearchOptions;
 
+// 探索部の計測用の統計。
+// UctSearcher(探索スレッド)ごとに持ち、"go"ごとにクリアされる。
+// 💡 そのスレッドしか書き換えないのでatomicにはしていない。集計は探索の終了後に行うこと。
+struct UctSearchStats
+{
+	u64 forward_count       = 0; // nn_forward()の呼び出し回数
+	u64 forward_positions   = 0; // nn_forward()で評価した局面数
+	u64 batch_capacity      = 0; // nn_forward()の呼び出しごとのpolicy_value_batch_maxsizeの合計。batchの充填率の計算用。
+	u64 forward_ns          = 0; // nn_forward()にかかった時間の合計(mutex_gpuの待ち時間を含む)
+	u64 discarded           = 0; // 他のスレッドが評価中のNodeに到達して破棄したplayoutの数
+	u64 node_lock           = 0; // Nodeのmutexをlockした回数
+	u64 node_lock_contended = 0; // そのうち、他のスレッドがlockしていて待たされた回数
+	u64 node_lock_wait_ns   = 0; // Nodeのmutexで待たされた時間の合計
+	u64 gpu_lock            = 0; // mutex_gpuをlockした回数
+	u64 gpu_lock_contended  = 0; // そのうち、他のスレッドがlockしていて待たされた回数
+	u64 gpu_lock_wait_ns    = 0; // mutex_gpuで待たされた時間の合計
+	u64 gc_ns               = 0; // GCスレッドがNodeの開放にかかった時間。(DlshogiSearcher::GetSearchStats()で設定される)
+	u64 transposition_hits  = 0; // NNを呼び出さずに、評価済みのNode(NodeHashTable)からpolicyとvalueをコピーした回数
+	u64 nn_cache_probes     = 0; // NNCacheを引いた回数
+	u64 nn_cache_hits       = 0; // そのうち、NNCacheにあってNNを呼び出さずに済んだ回数
+
+	void clear() { *this = UctSearchStats(); }
+
+	UctSearchStats& operator+=(const UctSearchStats& o)
+	{
+		forward_count += o.forward_count;
+		forward_positions += o.forward_positions;
+		batch_capacity += o.batch_capacity;
+		forward_ns += o.forward_ns;
+		discarded += o.discarded;
+		node_lock += o.node_lock;
+		node_lock_contended += o.node_lock_contended;
+		node_lock_wait_ns += o.node_lock_wait_ns;
+		gpu_lock += o.gpu_lock;
+		gpu_lock_contended += o.gpu_lock_contended;
+		gpu_lock_wait_ns += o.gpu_lock_wait_ns;
+		gc_ns += o.gc_ns;
+		transposition_hits += o.transposition_hits;
+		nn_cache_probes += o.nn_cache_probes;
+		nn_cache_hits += o.nn_cache_hits;
+		return *this;
+	}
+};
+
+// mutexをlockする。
+// 他のスレッドがlockしていて待たされたなら、contendedに1を、wait_nsに待った時間を加算する。
+inline void lock_with_stats(std::mutex& mutex, u64& contended, u64& wait_ns)
+{
+	if (mutex.try_lock())
+		return;
+
+	const auto start = std::chrono::steady_clock::now();
+	mutex.lock();
+	++contended;
+	wait_ns += u64(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
 // UctSearcher(探索用スレッド)をGPU一つ利用する分ずつひとまとめにしたもの。
 // 一つのGPUにつき、UctSearchThreadGroupひとつが対応する。
 class UctSearcherGroup
@@ -41,16 +101,21 @@ public:
 	                const int new_thread, const int gpu_id, const int policy_value_batch_maxsize);
 
 	// ニューラルネットのforward() (順方向の伝播 = 推論)を呼び出す。
-	void nn_forward(const int slot_id, const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
+	// stats : mutex_gpuで待たされた回数と時間を加算する。
+	void nn_forward(const int slot_id, const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2,
+	                UctSearchStats& stats)
 	{
 #if !defined(UNPACK_CUDA)
 		// 入力特徴量を展開する。GPU側で展開する場合は不要。
 		extract_input_features(batch_size, p1, p2, x1, x2);
 #endif
-#if defined(TENSOR_RT)
+#if defined(TENSOR_RT) || defined(CPU_NN)
+		// slotごとに作業領域を持っているので、lockせずに並列に推論できる。
+		(void)stats;
 		nn->forward(slot_id, batch_size, p1, p2, x1, x2, y1, y2);
 #else
-		mutex_gpu.lock();
+		lock_with_stats(mutex_gpu, stats.gpu_lock_contended, stats.gpu_lock_wait_ns);
+		++stats.gpu_lock;
 		nn->forward(batch_size, p1, p2, x1, x2, y1, y2);
 		mutex_gpu.unlock();
 #endif
@@ -161,6 +226,7 @@ struct NodeVisitor {
 struct BatchElement {
 	Node*	node;       // どのNodeに対するEvalNode()なのか。
 	Color	color;      // その時の手番
+	Key		pos_key;    // その局面のPosition::key()。NodeHashTable, NNCacheへの登録に用いる。
 
 #if defined(USE_POLICY_BOOK)
 	HASH_KEY key;       // この局面のhash key
@@ -259,6 +325,9 @@ public:
 	// policy_value_batch_maxsize と同数のダミーデータを作成し、推論を行う。
 	void DummyForward();
 
+	// 探索部の計測用の統計。(前回の"go"からのもの)
+	const UctSearchStats& get_stats() const { return stats; }
+
 private:
 	//  並列処理で呼び出す関数
 	//  UCTアルゴリズムを反復する
@@ -284,7 +353,15 @@ private:
 	ChildNumType SelectMaxUcbChild(ChildNode* parent, Node* current);
 
 	// Evaluateを呼び出すリスト(queue)に追加する。
-	void QueuingNode(const Position* pos, Node* node, float* value_win);
+	// ただし、NNの評価結果のcache(NNCache)にあれば、queueに追加せずにnodeにpolicyを書き込み、
+	// *value_winにvalueを代入してfalseを返す。(この時、nodeはNNで評価したのと同じ状態になる)
+	// queueに追加したならtrueを返す。
+	bool QueuingNode(const Position* pos, Node* node, float* value_win);
+
+	// 展開したばかりのnodeの局面が、今回の探索で評価済みのNodeとしてNodeHashTableに登録されていれば、
+	// そのNodeのpolicy(nnrate)をnodeにコピーして、valueにNNのvalueを代入してtrueを返す。
+	// (この時、nodeはNNで評価したのと同じ状態になるので、QueuingNode()しなくて良い)
+	bool CopyFromTransposition(const Position* pos, Node* node, float& value);
 
 	// ノードを評価
 	void EvalNode();
@@ -341,6 +418,9 @@ private:
 
 	// leaf node用のdf-pn solver
 	Mate::Dfpn::MateDfpnSolver mate_solver;
+
+	// 探索部の計測用の統計
+	UctSearchStats stats;
 };
 
 // 訪問回数が最大の子ノードを選択
@@ -5,6 +5,7 @@
 #include <sstream> // stringstream
 #include <cstring> // memcpy
 #include <numeric> // accumulate
+#include <iomanip> // setprecision
 
 #include "dlshogi_types.h"
 #include "UctSearch.h"
@@ -228,6 +229,12 @@ void DlshogiSearcher::InitializeUctSearch() {
     // UctSearcherGroupは、DlshogiSearcher*を持たなければならない。
     for (size_t i = 0; i < search_groups_size; ++i)
         search_groups[i].set_dlsearcher(this);
+
+    // 評価済みNodeのtableは、使う時だけ確保する。
+    node_hash.resize(search_options.use_transposition ? search_options.uct_node_limit : 0);
+
+    // NNの評価結果のcacheは、"isready"ごとにクリアする。("go"をまたいでは保持する)
+    nn_cache.resize(search_options.nn_cache_size, engine.threads);
 }
 
 //  UCT探索の終了処理
@@ -305,6 +312,64 @@ void DlshogiSearcher::SetLimits(const Position& pos, const Search::LimitsType& l
 //	const_playout = playout;
 //}
 
+// --------------------------------------------------------------------
+//  NodeHashTable : 評価済みのNodeを局面のhash keyから引くためのtable
+// --------------------------------------------------------------------
+
+// entry数を設定する。nodes以下で最大の2の累乗(MutexPool::MUTEX_NUM以上)にする。
+void NodeHashTable::resize(u64 nodes) {
+    size_t new_num = 0;
+    if (nodes)
+    {
+        new_num = size_t(MutexPool::MUTEX_NUM);
+        while (new_num * 2 <= nodes)
+            new_num *= 2;
+    }
+    if (new_num == entry_num)
+        return;
+
+    // make_unique_large_page()で確保した配列は、要素がvalue-initializeされる。(generation == 0なので無効なentry)
+    entries.reset();
+    entry_num = new_num;
+    if (entry_num)
+        entries = make_unique_large_page<Entry[]>(entry_num);
+}
+
+// NNで評価したNodeを登録する。
+void NodeHashTable::store(Key key, Node* node, float value) {
+    Entry&                      e = entries[key & (entry_num - 1)];
+    std::lock_guard<std::mutex> lock(mutexes.get_mutex(key));
+    e = {key, node, value, generation};
+}
+
+// 今回の"go"で登録されたNodeを探す。
+Node* NodeHashTable::probe(Key key, float& value) {
+    const Entry&                e = entries[key & (entry_num - 1)];
+    std::lock_guard<std::mutex> lock(mutexes.get_mutex(key));
+    if (e.generation != generation || e.key != key)
+        return nullptr;
+
+    value = e.value;
+    return e.node;
+}
+
+// 探索部の計測用の統計を全探索スレッド分集計して返す。
+UctSearchStats DlshogiSearcher::GetSearchStats() const {
+    UctSearchStats stats;
+    for (auto* uct_searcher : thread_id_to_uct_searcher)
+        stats += uct_searcher->get_stats();
+
+    stats.gc_ns = gc->gc_time_ns() - gc_time_at_search_start;
+    return stats;
+}
+
+// 探索木を開放する。
+void DlshogiSearcher::ClearTree() {
+    // 古いtreeはデストラクタでGCに積まれる。
+    tree = std::make_unique<NodeTree>(gc.get());
+    gc->wait_for_empty();
+}
+
 // 終了させるために、search_groupsを開放する。
 void DlshogiSearcher::FinalizeUctSearch() {
     TerminateUctSearch();
@@ -347,6 +412,9 @@ Move DlshogiSearcher::UctSearchGenmove(Position&                pos,
     // 中断フラグのリセット
     search_limits.interruption = false;
 
+    // 探索部の計測用に、ここからのGCの時間を求められるようにしておく。
+    gc_time_at_search_start = gc->gc_time_ns();
+
     // ゲーム木を現在の局面にリセット
     tree->ResetToPosition(game_root_sfen, moves);
 
@@ -366,6 +434,15 @@ Move DlshogiSearcher::UctSearchGenmove(Position&                pos,
     // 対局開始からの手数を設定しておく。(持ち時間制御などで使いたいため)
     search_limits.game_ply = pos.game_ply();
 
+    // 評価済みNodeのtableは、前回の"go"で登録されたものを無効にする。
+    // ("isready"のあとで"UCT_Transposition"がtrueにされたなら、ここで確保する)
+    if (search_options.use_transposition)
+    {
+        if (node_hash.size() == 0)
+            node_hash.resize(search_options.uct_node_limit);
+        node_hash.new_search();
+    }
+
     // UCTの初期化。
     // 探索開始局面の初期化
     ExpandRoot(&pos, search_options.generate_all_legal_moves);
@@ -475,6 +552,16 @@ Move DlshogiSearcher::UctSearchGenmove(Position&                pos,
     for (auto& searcher : pv_mate_searchers)
         searcher.Join();
 
+    // NNの評価結果のcacheのhit率を出力
+    if (nn_cache.size())
+    {
+        const UctSearchStats stats = GetSearchStats();
+        sync_cout << "info string NNCache : hits = " << stats.nn_cache_hits << " / " << stats.nn_cache_probes
+                  << " (" << std::fixed << std::setprecision(1)
+                  << (stats.nn_cache_probes ? 100.0 * stats.nn_cache_hits / stats.nn_cache_probes : 0.0)
+                  << "%) , entries = " << nn_cache.size() << sync_endl;
+    }
+
 SEARCH_SKIP:
     // ---------------------
     //     PVの出力
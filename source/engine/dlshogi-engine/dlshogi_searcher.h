@@ -9,15 +9,18 @@
 #include "../../book/policybook.h"
 #include "../../mate/mate.h"
 #include "../../timeman.h"
+#include "../../memory.h"
 #include "dlshogi_types.h"
 #include "SearchOptions.h"
 #include "PvMateSearch.h"
+#include "NNCache.h"
 
 // dlshogiの探索部で構造体化・クラス化されていないものを集めたもの。
 
 namespace dlshogi {
 
 	struct Node;
+	struct UctSearchStats;
 	class NodeTree;
 	class NodeGarbageCollector;
 	class UctSearcher;
@@ -117,9 +120,8 @@ namespace dlshogi {
 			return get_mutex(pos->key());
 		}
 
-	private:
 		// ある局面のHASH_KEY(Position::key()にて取得できる)に対応するmutexを返す。
-		// →　これ外から呼び出して使わなくていいっぽいのでとりまprivateにしておく。
+		// 💡 NodeHashTableから、BatchElementに保存しておいたkeyで呼び出す。
 		std::mutex& get_mutex(const Key key)
 		{
 			return mutexes[key & (MUTEX_NUM - 1)];
@@ -129,6 +131,58 @@ namespace dlshogi {
 		std::mutex mutexes[MUTEX_NUM];
 	};
 
+	// 評価済みのNodeを局面のhash keyから引くためのtable。(エンジンオプションの"UCT_Transposition")
+	//
+	// dlshogiの探索木は合流を扱わないので、異なる手順で同じ局面に到達すると、その局面をもう一度NNで評価してしまう。
+	// そこで、NNで評価したNodeをここに登録しておき、新しく展開したNodeの局面がここにあれば、
+	// NNを呼び出さずに、登録されているNodeのpolicy(ChildNode::nnrate)とNNのvalueをコピーして評価済みにする。
+	// ⚠ 木を合流させる(DAGにする)わけではなく、訪問回数や勝率は手順ごとのNodeで別々に集計する。
+	//    (千日手の判定が手順に依存するのと、Nodeの開放をGCが部分木単位で行っているため)
+	//
+	// 登録されているNode*が開放されていないことは、探索中はNodeが開放されないことで保証する。
+	// すなわち、"go"ごとにnew_search()で世代を進めて、前回の"go"以前に登録されたentryは無効とみなす。
+	//
+	// 各entryはMutexPoolのmutexで保護する。entry数をMutexPool::MUTEX_NUMの倍数にしておけば、
+	// 同じentryに格納される局面は、同じmutexに対応する。
+	class NodeHashTable
+	{
+	public:
+		NodeHashTable(MutexPool& mutexes) : mutexes(mutexes) {}
+
+		// entry数を設定する。nodes以下で最大の2の累乗(MutexPool::MUTEX_NUM以上)にする。
+		// 前回と同じentry数なら何もしない。nodes == 0ならtableを開放する。
+		void resize(u64 nodes);
+
+		// "go"ごとに呼び出す。それより前に登録されたentryは無効になる。
+		void new_search() { ++generation; }
+
+		// NNで評価したNodeを登録する。
+		//   key   : nodeの局面のhash key(Position::key())
+		//   value : NNのvalue(nodeの局面の手番側から見た勝率)
+		void store(Key key, Node* node, float value);
+
+		// 今回の"go"で登録されたNodeを探す。見つからなければnullptrが返る。
+		//   value : [Out] 登録時のNNのvalue
+		Node* probe(Key key, float& value);
+
+		// 現在のentry数。(resize()されていなければ0)
+		size_t size() const { return entry_num; }
+
+	private:
+		struct Entry {
+			Key   key;
+			Node* node;
+			float value;
+			u32   generation;
+		};
+
+		LargePagePtr<Entry[]> entries;
+		size_t                entry_num  = 0;
+		u32                   generation = 1;
+
+		MutexPool& mutexes;
+	};
+
 	// UCT探索部
 	// ※　dlshogiでは、この部分、class化されていない。
 	class DlshogiSearcher
@@ -231,6 +285,20 @@ namespace dlshogi {
 		// NodeTreeを取得。
 		NodeTree* get_node_tree() const { return tree.get(); }
 
+		// 評価済みのNodeのtable。search_options.use_transpositionがtrueの時だけ用いる。
+		NodeHashTable& get_node_hash() { return node_hash; }
+
+		// NNの評価結果のcache。search_options.nn_cache_sizeが0の時はsize() == 0。
+		NNCache& get_nn_cache() { return nn_cache; }
+
+		// 探索部の計測用の統計を全探索スレッド分集計して返す。(前回の"go"からのもの)
+		// 💡 探索の終了後に呼び出すこと。
+		UctSearchStats GetSearchStats() const;
+
+		// 探索木を開放する。(探索部の計測用)
+		// 💡 GCスレッドが開放し終わるまで待機するので、次の探索の計測にGCの時間が混ざらない。
+		void ClearTree();
+
 		// 並列探索を行う。
 		//   rootPos   : 探索開始局面
 		//   thread_id : スレッドID
@@ -306,6 +374,9 @@ namespace dlshogi {
 		// ガーベジコレクタ
 		std::unique_ptr<NodeGarbageCollector> gc;
 
+		// 探索開始時のgc->gc_time_ns()。GetSearchStats()で、探索開始からのGCの時間を求めるのに用いる。
+		u64 gc_time_at_search_start = 0;
+
 		// 探索停止チェック用
 		std::unique_ptr<SearchInterruptionChecker> interruption_checker;
 
@@ -327,6 +398,12 @@ namespace dlshogi {
 		// ノードのlockに使うmutex
 		MutexPool node_mutexes;
 
+		// 評価済みのNodeのtable。(node_mutexesで保護する)
+		NodeHashTable node_hash{node_mutexes};
+
+		// NNの評価結果のcache。"go"をまたいで保持する。
+		NNCache nn_cache;
+
 		// PV lineの詰探索用
 		std::vector<PvMateSearcher> pv_mate_searchers;
 	};
@@ -19,6 +19,10 @@
 #include <iomanip>
 #include <cmath>	// std::log(),std::pow(),std::round()
 #include <cstring>	// memset()
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
 
 #include "yaneuraou-search.h"
 #include "../../position.h"
@@ -31,6 +35,10 @@
 #include "../../mate/mate.h"
 #include "../../tune.h"
 
+#if defined(EVAL_NNUE)
+#include "../../eval/nnue/evaluate_nnue.h"
+#endif
+
 namespace YaneuraOu {
 
 using namespace Search;
@@ -144,6 +152,34 @@ void YaneuraOuEngine::add_options() {
         }));
 #endif
 
+    // 🌈 置換表のメモリのNUMA nodeへの配置方針
+    //   default    : OSの既定の配置
+    //   interleave : 全NUMA nodeにpage単位で交互に配置する。(Linuxのみ)
+    //   firsttouch : clear()のたびに、各スレッドの担当範囲をそのスレッドのNUMA nodeに配置しなおす。(Linuxのみ)
+    // 📝 複数socketの環境で巨大な置換表を用いる時に、方針ごとのNPSとhashfullを比較するためのもの。
+    options.add(  //
+        "TTMemoryPolicy", Option(std::vector<std::string>{"default", "interleave", "firsttouch"}, "default", [this](const Option& o) {
+            const std::string policy = o;
+            wait_for_search_finished();
+            tt.set_memory_policy(policy == "interleave" ? TTMemoryPolicy::Interleave
+                                 : policy == "firsttouch" ? TTMemoryPolicy::FirstTouch
+                                                          : TTMemoryPolicy::Default);
+            set_tt_size(options["USI_Hash"]);
+            return std::nullopt;
+        }));
+
+    // 🌈 複数のエンジンのプロセスで置換表を共有する。
+    //   ここに指定した名前の共有メモリに置換表を配置する。同じ名前を指定したプロセス同士で共有される。
+    //   空(<empty>)なら共有しない。
+    // 📝 共有するプロセス同士で、USI_Hashを揃えること。(Linuxのみ)
+    options.add(  //
+        "TTSharedMemoryName", Option("", [this](const Option& o) {
+            wait_for_search_finished();
+            tt.set_shared_memory_name(std::string(o));
+            set_tt_size(options["USI_Hash"]);
+            return std::nullopt;
+        }));
+
 	// その局面での上位N個の候補手を調べる機能
     // ⇨　これMAX_MOVESで十分。
     options.add("MultiPV", Option(1, 1, MAX_MOVES));
@@ -357,7 +393,846 @@ int YaneuraOuEngine::get_hashfull(int maxAge) const
 
 namespace {
 
-constexpr size_t QSEARCH_PSV_CHUNK_RECORDS = 65536;
+// 置換表のsnapshotに記録する、評価関数の識別用のhash値を返す。
+// 📝 評価関数の種類と、いくつかの局面での評価値から求める。
+//     評価関数のファイルの中身を調べなくとも、パラメーターが異なればまず一致しない。
+u64 tt_snapshot_eval_hash() {
+    static const char* sfens[] = {
+      "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1",
+      "ln1g3nl/1r3kg2/p1sppsbpp/2p2pp2/1p5P1/2PPP4/PPBS1PP1P/2GK3R1/LN3GSNL b - 27",
+      "l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w GR5pnsg 1",
+      "4k4/9/4P4/9/9/9/9/9/4K4 b 2r2b4g4s4n4l17p 1",
+    };
+
+    u64 h = hash_string(std::string(EVAL_TYPE_NAME));
+
+    Position  pos;
+    StateInfo si;
+    for (auto sfen : sfens)
+    {
+        pos.set(sfen, &si);
+        h = h * 0x9E3779B97F4A7C15ULL ^ u64(Eval::evaluate(pos));
+    }
+    return h;
+}
+
+} // namespace
+
+// USI拡張コマンド "tt_save" の実体。
+bool YaneuraOuEngine::save_tt(const std::string& filename, std::string& message) {
+    wait_for_search_finished();
+
+    const auto start  = now();
+    const auto result = tt.save(filename, threads, tt_snapshot_eval_hash());
+    if (result.is_not_ok())
+    {
+        message = "tt_save : " + result.to_string() + " , file = " + filename;
+        return false;
+    }
+
+    message = "tt_save : saved " + std::to_string(tt.size_in_bytes() / (1024 * 1024)) + "[MB] to " + filename
+            + " , " + std::to_string(now() - start) + "[ms]";
+    return true;
+}
+
+// USI拡張コマンド "tt_load" の実体。
+bool YaneuraOuEngine::load_tt(const std::string& filename, bool useMmap, std::string& message) {
+    wait_for_search_finished();
+
+    const auto start  = now();
+    const auto result = tt.load(filename, threads, tt_snapshot_eval_hash(), useMmap, message);
+    if (result.is_not_ok())
+    {
+        message = "tt_load : " + result.to_string() + " , file = " + filename
+                + (message.empty() ? "" : " , " + message);
+        return false;
+    }
+
+    message = "tt_load : loaded " + std::to_string(tt.size_in_bytes() / (1024 * 1024)) + "[MB] from " + filename
+            + " , hashfull = " + std::to_string(tt.hashfull(31 /* すべての世代 */)) + " , "
+            + std::to_string(now() - start) + "[ms]";
+    return true;
+}
+
+namespace {
+
+// -----------------------
+//   PSV transform
+// -----------------------
+
+// 📝 .psv(PsvRecord列)の各レコードに何らかの処理をして書き出す汎用の仕組み。
+//     qsearch_psvとpsv_transformはこれを用いて実装してある。
+//
+//     reader → worker → writer のpipelineで処理する。
+//
+//     reader/writer : コマンドを実行しているthread。
+//                     空いたchunkに読み込んではpendingに積み、処理の終わったchunkを書き出す。
+//     worker        : 探索threadで、最後まで起動しっぱなし。pendingの先頭のchunkからレコードを確保して処理する。
+//
+//     chunkを複数個使い回すので、読み込みと書き出しの間もworkerは次のchunkを処理し続けられる。
+
+constexpr size_t PSV_TRANSFORM_CHUNK_RECORDS = 65536;
+
+// reader → worker → writer の間で使い回すchunkの数。
+// 読み込み中、処理中、書き出し待ちのchunkが同時に存在できるように3以上にしておく。
+constexpr size_t PSV_TRANSFORM_PIPELINE_CHUNKS = 4;
+
+// workerが1回に確保するレコード数。
+// 1局面の処理は軽いので、1件ずつ確保するとmutexの競合が目立つ。
+constexpr size_t PSV_TRANSFORM_BATCH_RECORDS = 64;
+
+// dedupeで、書き出した局面1つを保持するのに必要なbyte数の見積り。(PackedSfen + unordered_setのnodeとbucket)
+constexpr u64 PSV_TRANSFORM_DEDUPE_BYTES_PER_RECORD = sizeof(PackedSfen) + 32;
+
+// workerごとの作業領域。
+// PsvRecordの局面を復元するためのPosition/StateInfoは、ここのものを使い回す。
+struct PsvTransformContext {
+    YaneuraOuWorker* worker   = nullptr;
+    size_t           threadId = 0;
+    Position         pos;
+    StateInfo        si;
+};
+
+// 1レコードに対する処理。recordを書き換えて良い。falseを返したレコードは出力しない。
+// 💡 複数のworkerから同時に呼び出される。
+using PsvRecordTransform = std::function<bool(PsvTransformContext& ctx, PsvRecord& record)>;
+
+// run_psv_transform()の入出力の設定。
+struct PsvTransformSettings {
+    std::string inputPath;
+    std::string outputPath;
+    size_t      workerCount = 1;
+
+    // inputPathをstreamで読む代わりにメモリにmapして読む。
+    bool useMmap = false;
+
+    // 入力と同じ順番で書き出す。falseなら処理の終わったchunkから書き出す。
+    bool ordered = true;
+
+    // 同一局面(PackedSfenが一致するもの)は、最初に書き出したものだけを残す。
+    // 書き出した局面をすべてメモリに保持するので、dedupeMemoryLimitを超えたらエラーにする。
+    bool dedupe            = false;
+    u64  dedupeMemoryLimit = 1024ULL * 1024 * 1024;
+
+    // 書き出すレコードをすべてメモリに溜め、shuffleしてから書き出す。
+    // seedが0なら時刻などから決める。
+    bool shuffle = false;
+    u64  seed    = 0;
+};
+
+// run_psv_transform()の処理結果。
+struct PsvTransformResult {
+    u64       read       = 0;  // 読み込んだレコード数
+    u64       written    = 0;  // 書き出したレコード数
+    u64       dropped    = 0;  // transformがfalseを返したレコード数
+    u64       duplicates = 0;  // dedupeで除外したレコード数
+    TimePoint elapsed    = 1;  // 処理にかかった時間[ms]
+};
+
+// pipelineで受け渡しする、PsvRecord列のchunk。
+// countとnextRecordはPsvTransformPipeline::mutexで保護する。
+// doneRecordsは処理済みのレコード数で、これがcountに達したらwriterが書き出せる。
+struct PsvChunk {
+    std::vector<PsvRecord> records;
+    std::vector<u8>        keep;
+    size_t                 count      = 0;
+    size_t                 nextRecord = 0;
+    std::atomic<size_t>    doneRecords{0};
+
+    bool done() const { return doneRecords.load() == count; }
+};
+
+// reader/writerとworkerの間で共有する状態。
+struct PsvTransformPipeline {
+    std::mutex mutex;
+
+    // workerがまだ確保していないレコードの残っているchunk。読み込んだ順に並んでいる。
+    std::deque<PsvChunk*> pending;
+
+    // 入力を読み終わった or 中断した。
+    bool inputDone = false;
+    bool aborted   = false;
+
+    // workerの待機用と、reader/writerの待機用。
+    std::condition_variable workCv;
+    std::condition_variable ioCv;
+};
+
+// PsvRecord列の読み込み元。streamで読むか、メモリにmapしたファイルから読む。
+class PsvReader {
+   public:
+    // path : 絶対pathに解決済みのpath。(MemoryMappedFile::Open()もそのまま開く)
+    bool open(const std::string& path, bool useMmap) {
+        // 💡 空のファイルはmapできないので、streamで読む。(0件として処理される)
+        if (useMmap && std::ifstream(path, std::ios::binary | std::ios::ate).tellg() != 0)
+            return mapped.Open(path).is_ok();
+
+        stream.open(path, std::ios::binary);
+        return bool(stream);
+    }
+
+    // 最大でrecords.size()件を読み込んで、読み込めた件数を返す。
+    // 末尾に端数のbyteがあったときはtruncatedがtrueになる。
+    size_t read(std::vector<PsvRecord>& records, bool& truncated) {
+        const size_t recordBytes = sizeof(PsvRecord);
+
+        if (mapped.is_open())
+        {
+            const size_t rest  = mapped.size() - offset;
+            const size_t count = std::min(records.size(), rest / recordBytes);
+            std::memcpy(records.data(), mapped.data() + offset, count * recordBytes);
+            offset += count * recordBytes;
+            truncated = count < records.size() && count * recordBytes != rest;
+            return count;
+        }
+
+        stream.read(reinterpret_cast<char*>(records.data()),
+                    std::streamsize(records.size() * recordBytes));
+        const size_t bytesRead = size_t(stream.gcount());
+        truncated              = (bytesRead % recordBytes) != 0;
+        return bytesRead / recordBytes;
+    }
+
+    bool bad() const { return !mapped.is_open() && stream.bad(); }
+
+   private:
+    std::ifstream              stream;
+    SystemIO::MemoryMappedFile mapped;
+    size_t                     offset = 0;
+};
+
+// settings.inputPathの各PsvRecordに対してtransformを呼び出し、
+// trueを返したレコードをsettings.outputPathへ書き出す。
+// workerには、threadsのthreadId = 0 ～ settings.workerCount - 1 を用いる。
+// 失敗したときはmessageにその理由を格納してfalseを返す。
+bool run_psv_transform(ThreadPool&                 threads,
+                       const PsvTransformSettings& settings,
+                       const PsvRecordTransform&   transform,
+                       PsvTransformResult&         result,
+                       std::string&                message) {
+
+    if (settings.inputPath.empty() || settings.outputPath.empty())
+    {
+        message = "input and output path must be specified.";
+        return false;
+    }
+
+    // 入出力のpathはworking directory相対とする。
+    // MemoryMappedFile::Open()は相対pathを起動フォルダ相対で開くので、streamで読む時もmmapで読む時も
+    // 同じファイルを開くように、ここで一度だけ絶対pathに解決しておく。
+    const std::string inputPath  = Path::Combine(CommandLine::get_working_directory(), settings.inputPath);
+    const std::string outputPath = Path::Combine(CommandLine::get_working_directory(), settings.outputPath);
+
+    if (inputPath == outputPath)
+    {
+        message = "input and output path must be different.";
+        return false;
+    }
+
+    PsvReader input;
+    if (!input.open(inputPath, settings.useMmap))
+    {
+        message = "failed to open input file: " + settings.inputPath;
+        return false;
+    }
+
+    std::ofstream output(outputPath, std::ios::binary);
+    if (!output)
+    {
+        message = "failed to open output file: " + settings.outputPath;
+        return false;
+    }
+
+    PsvTransformPipeline                   pipeline;
+    std::vector<std::unique_ptr<PsvChunk>> chunks;
+    std::vector<PsvChunk*>                 freeChunks;
+    for (size_t i = 0; i < PSV_TRANSFORM_PIPELINE_CHUNKS; ++i)
+    {
+        chunks.emplace_back(std::make_unique<PsvChunk>());
+        chunks.back()->records.resize(PSV_TRANSFORM_CHUNK_RECORDS);
+        chunks.back()->keep.resize(PSV_TRANSFORM_CHUNK_RECORDS);
+        freeChunks.push_back(chunks.back().get());
+    }
+
+    // 読み込んだ順に並んでいる、処理中 or 書き出し待ちのchunk。
+    std::deque<PsvChunk*> inFlight;
+
+    // 💡 Positionは大きいので、workerごとにheapに確保する。
+    std::vector<std::unique_ptr<PsvTransformContext>> contexts;
+    for (size_t threadId = 0; threadId < settings.workerCount; ++threadId)
+    {
+        contexts.emplace_back(std::make_unique<PsvTransformContext>());
+        contexts.back()->worker =
+          static_cast<YaneuraOuWorker*>(threads.threads[threadId]->worker.get());
+        contexts.back()->threadId = threadId;
+    }
+
+    for (size_t threadId = 0; threadId < settings.workerCount; ++threadId)
+    {
+        threads.run_on_thread(threadId, [&, threadId]() {
+            auto& ctx = *contexts[threadId];
+            ctx.worker->bind_network_to_current_thread();
+
+            while (true)
+            {
+                PsvChunk* chunk;
+                size_t    begin, end;
+                {
+                    std::unique_lock<std::mutex> lk(pipeline.mutex);
+                    pipeline.workCv.wait(lk, [&] {
+                        return pipeline.aborted || pipeline.inputDone || !pipeline.pending.empty();
+                    });
+
+                    if (pipeline.aborted || pipeline.pending.empty())
+                        break;
+
+                    chunk             = pipeline.pending.front();
+                    begin             = chunk->nextRecord;
+                    end               = std::min(chunk->count, begin + PSV_TRANSFORM_BATCH_RECORDS);
+                    chunk->nextRecord = end;
+
+                    // このchunkのレコードはすべて確保されたので、次のchunkへ。
+                    if (end == chunk->count)
+                        pipeline.pending.pop_front();
+                }
+
+                for (size_t i = begin; i < end; ++i)
+                    chunk->keep[i] = transform(ctx, chunk->records[i]);
+
+                if (chunk->doneRecords.fetch_add(end - begin) + (end - begin) == chunk->count)
+                {
+                    std::lock_guard<std::mutex> lk(pipeline.mutex);
+                    pipeline.ioCv.notify_one();
+                }
+            }
+        });
+    }
+
+    // dedupe用。hashではなくPackedSfenそのもので比較するので、異なる局面を取り除くことはない。
+    std::unordered_set<PackedSfen, PackedSfenHash> seen;
+    std::vector<PsvRecord>                         shuffled;
+    const u64 maxSeen = settings.dedupeMemoryLimit / PSV_TRANSFORM_DEDUPE_BYTES_PER_RECORD;
+
+    // 処理の終わったchunkのうち、残すレコードを書き出す。(shuffleするときは溜めておく)
+    auto write_chunk = [&](PsvChunk& chunk) {
+        size_t kept = 0;
+        for (size_t i = 0; i < chunk.count; ++i)
+        {
+            if (!chunk.keep[i])
+            {
+                ++result.dropped;
+                continue;
+            }
+
+            if (settings.dedupe)
+            {
+                if (!seen.insert(chunk.records[i].sfen).second)
+                {
+                    ++result.duplicates;
+                    continue;
+                }
+
+                if (seen.size() > maxSeen)
+                {
+                    message = "dedupe exceeded the memory limit (" + std::to_string(maxSeen)
+                            + " positions). use \"psv_transform shuffle\" with dedupe, or raise memory.";
+                    return false;
+                }
+            }
+
+            chunk.records[kept++] = chunk.records[i];
+        }
+
+        if (settings.shuffle)
+            shuffled.insert(shuffled.end(), chunk.records.begin(), chunk.records.begin() + kept);
+        else
+            output.write(reinterpret_cast<const char*>(chunk.records.data()),
+                         std::streamsize(kept * sizeof(PsvRecord)));
+
+        result.read += chunk.count;
+        result.written += kept;
+        return bool(output);
+    };
+
+    const TimePoint startTime    = now();
+    u64             nextProgress = 1000000;
+    bool            eof          = false;
+
+    while (message.empty())
+    {
+        // 処理の終わったchunkを書き出す。orderedなら読み込んだ順に書き出す。
+        for (auto it = inFlight.begin(); it != inFlight.end();)
+        {
+            if (!(*it)->done())
+            {
+                if (settings.ordered)
+                    break;
+                ++it;
+                continue;
+            }
+
+            if (!write_chunk(**it))
+            {
+                if (message.empty())
+                    message = "failed to write output file: " + settings.outputPath;
+                break;
+            }
+
+            freeChunks.push_back(*it);
+            it = inFlight.erase(it);
+
+            if (result.read >= nextProgress)
+            {
+                const TimePoint elapsed = std::max(TimePoint(1), now() - startTime);
+                sync_cout << "info string processed " << result.read << " records , "
+                          << result.read * 1000 / elapsed << " records/sec" << sync_endl;
+                nextProgress += 1000000;
+            }
+        }
+        if (!message.empty())
+            break;
+
+        // 空いているchunkがあれば読み込んでworkerに渡す。
+        if (!eof && !freeChunks.empty())
+        {
+            auto&        chunk     = *freeChunks.back();
+            bool         truncated = false;
+            const size_t count     = input.read(chunk.records, truncated);
+
+            if (truncated)
+            {
+                message = "truncated psv record at end of input.";
+                continue;
+            }
+
+            if (count == 0)
+            {
+                if (input.bad())
+                    message = "failed to read input file: " + settings.inputPath;
+                eof = true;
+                continue;
+            }
+
+            freeChunks.pop_back();
+            inFlight.push_back(&chunk);
+
+            std::lock_guard<std::mutex> lk(pipeline.mutex);
+            chunk.count      = count;
+            chunk.nextRecord = 0;
+            chunk.doneRecords.store(0);
+            pipeline.pending.push_back(&chunk);
+            pipeline.workCv.notify_all();
+            continue;
+        }
+
+        // すべて書き出した。
+        if (inFlight.empty())
+            break;
+
+        // 書き出せるchunkができるのを待つ。
+        std::unique_lock<std::mutex> lk(pipeline.mutex);
+        pipeline.ioCv.wait(lk, [&] {
+            return settings.ordered
+                   ? inFlight.front()->done()
+                   : std::any_of(inFlight.begin(), inFlight.end(), [](PsvChunk* c) { return c->done(); });
+        });
+    }
+
+    // workerを終了させる。
+    {
+        std::lock_guard<std::mutex> lk(pipeline.mutex);
+        pipeline.inputDone = true;
+        pipeline.aborted   = !message.empty();
+        pipeline.workCv.notify_all();
+    }
+    for (size_t threadId = 0; threadId < settings.workerCount; ++threadId)
+        threads.wait_on_thread(threadId);
+
+    if (!message.empty())
+        return false;
+
+    if (settings.shuffle)
+    {
+        // Fisher-Yates shuffle
+        PRNG prng = settings.seed ? PRNG(settings.seed) : PRNG();
+        for (size_t i = shuffled.size(); i > 1; --i)
+            std::swap(shuffled[i - 1], shuffled[prng.rand(i)]);
+
+        output.write(reinterpret_cast<const char*>(shuffled.data()),
+                     std::streamsize(shuffled.size() * sizeof(PsvRecord)));
+        if (!output)
+        {
+            message = "failed to write output file: " + settings.outputPath;
+            return false;
+        }
+    }
+
+    result.elapsed = std::max(TimePoint(1), now() - startTime);
+    return true;
+}
+
+// -----------------------
+//   psv_transform shuffle
+// -----------------------
+
+// 📝 メモリに載らない大きさの.psvをdedupeしてshuffleする。
+//
+//     1. 入力を先頭から順に読みながら、各レコードをbucket(テンポラリファイル)に振り分ける。
+//        dedupeするときは同一局面が同じbucketに入るようにPackedSfenのhashで、そうでなければ乱数で振り分ける。
+//        振り分けたbucketがまだメモリに載らない大きさなら、そのbucketをさらに振り分ける。(multi-pass)
+//     2. bucketをworkerの数ずつ並列に読み込み、メモリ上でdedupeとshuffleをして、bucketの順番に書き出す。
+//
+//     どのレコードがどのbucketに入るかはランダムなので、各bucketの中をshuffleして順番に連結すると
+//     全体をshuffleしたことになる。ファイルの読み書きはすべてsequential。
+
+// メモリ上で1レコードあたりに必要なbyte数の見積り。(PsvRecord + dedupe用のindexとflag、余裕を持たせておく)
+constexpr u64 PSV_SHUFFLE_BYTES_PER_RECORD = sizeof(PsvRecord) + 16;
+
+// 1回の振り分けで作るbucketの最大数。(同時に開いておくファイルの数)
+constexpr size_t PSV_SHUFFLE_MAX_BUCKETS = 256;
+
+// bucketをさらに振り分ける深さの上限。
+// 💡 同一局面ばかりのbucketは何度振り分けても小さくならないので、ここで打ち切ってそのまま処理する。
+constexpr int PSV_SHUFFLE_MAX_PASSES = 4;
+
+// run_psv_shuffle()の設定。
+struct PsvShuffleSettings {
+    std::string inputPath;
+    std::string outputPath;
+    size_t      workerCount = 1;
+
+    // 使用するメモリの上限[byte]。workerの数で等分して、各workerが1つのbucketを処理する。
+    u64 memoryLimit = 1024ULL * 1024 * 1024;
+
+    // 同一局面(PackedSfenが一致するもの)は、入力で最初に現れたものだけを残す。
+    bool dedupe = false;
+
+    // 乱数seed。0なら時刻などから決める。
+    u64 seed = 0;
+};
+
+// run_psv_shuffle()の処理結果。
+struct PsvShuffleResult {
+    u64       read       = 0;  // 読み込んだレコード数
+    u64       written    = 0;  // 書き出したレコード数
+    u64       duplicates = 0;  // dedupeで除外したレコード数
+    u64       buckets    = 0;  // 最終的なbucketの数
+    int       passes     = 0;  // 振り分けの深さ
+    TimePoint elapsed    = 1;  // 処理にかかった時間[ms]
+};
+
+// 64bitの値をかき混ぜる。(splitmix64のfinalizer)
+u64 mix64(u64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+u64 packed_sfen_hash(const PackedSfen& sfen) {
+    return hash_bytes(reinterpret_cast<const char*>(sfen.data), sizeof(PackedSfen));
+}
+
+// ファイルサイズを返す。開けなければ-1。
+s64 psv_file_size(const std::string& path) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    return f ? s64(f.tellg()) : -1;
+}
+
+// pathのレコードをbucketPaths.size()個のファイルに振り分ける。
+// 振り分け先は、dedupeならPackedSfenのhashとsaltから、そうでなければprngで決める。
+// bufferBytesは、書き出し用のbufferとして全bucketで使って良いメモリ量。
+bool partition_psv(const std::string&              path,
+                   const std::vector<std::string>& bucketPaths,
+                   bool                            dedupe,
+                   u64                             salt,
+                   PRNG&                           prng,
+                   u64                             bufferBytes,
+                   std::string&                    message) {
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        message = "failed to open input file: " + path;
+        return false;
+    }
+
+    const size_t                        bucketCount = bucketPaths.size();
+    std::vector<std::ofstream>          outputs(bucketCount);
+    std::vector<std::vector<PsvRecord>> buffers(bucketCount);
+    const size_t bufferRecords = std::max(size_t(1), size_t(bufferBytes / sizeof(PsvRecord) / bucketCount));
+
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+        outputs[i].open(bucketPaths[i], std::ios::binary | std::ios::trunc);
+        if (!outputs[i])
+        {
+            message = "failed to open temporary file: " + bucketPaths[i];
+            return false;
+        }
+        buffers[i].reserve(bufferRecords);
+    }
+
+    auto flush = [&](size_t i) {
+        outputs[i].write(reinterpret_cast<const char*>(buffers[i].data()),
+                         std::streamsize(buffers[i].size() * sizeof(PsvRecord)));
+        buffers[i].clear();
+        return bool(outputs[i]);
+    };
+
+    std::vector<PsvRecord> records(PSV_TRANSFORM_CHUNK_RECORDS);
+    while (true)
+    {
+        input.read(reinterpret_cast<char*>(records.data()),
+                   std::streamsize(records.size() * sizeof(PsvRecord)));
+        const size_t bytesRead = size_t(input.gcount());
+        if (bytesRead == 0)
+            break;
+
+        if (bytesRead % sizeof(PsvRecord))
+        {
+            message = "truncated psv record at end of input.";
+            return false;
+        }
+
+        for (size_t i = 0; i < bytesRead / sizeof(PsvRecord); ++i)
+        {
+            const size_t b = dedupe ? size_t(mul_hi64(mix64(packed_sfen_hash(records[i].sfen) ^ salt), bucketCount))
+                                    : size_t(prng.rand(bucketCount));
+            buffers[b].push_back(records[i]);
+            if (buffers[b].size() == bufferRecords && !flush(b))
+            {
+                message = "failed to write temporary file: " + bucketPaths[b];
+                return false;
+            }
+        }
+    }
+
+    if (input.bad())
+    {
+        message = "failed to read input file: " + path;
+        return false;
+    }
+
+    for (size_t i = 0; i < bucketCount; ++i)
+        if (!flush(i))
+        {
+            message = "failed to write temporary file: " + bucketPaths[i];
+            return false;
+        }
+
+    return true;
+}
+
+// 1つのbucketを読み込み、dedupeとshuffleをしてrecordsに返す。
+bool shuffle_psv_bucket(const std::string&      path,
+                        bool                    dedupe,
+                        u64                     seed,
+                        std::vector<PsvRecord>& records,
+                        u64&                    duplicates) {
+
+    const s64 size = psv_file_size(path);
+    if (size < 0)
+        return false;
+
+    records.resize(size_t(size) / sizeof(PsvRecord));
+    std::ifstream input(path, std::ios::binary);
+    input.read(reinterpret_cast<char*>(records.data()), std::streamsize(records.size() * sizeof(PsvRecord)));
+    if (size_t(input.gcount()) != records.size() * sizeof(PsvRecord))
+        return false;
+
+    if (dedupe)
+    {
+        // (PackedSfen, 入力での順番)で並べて、同じ局面のうち一番先に現れたものだけを残す。
+        // 💡 hashではなくPackedSfenそのもので比較するので、hashの衝突で異なる局面を取り除くことはない。
+        std::vector<u32> order(records.size());
+        for (size_t i = 0; i < records.size(); ++i)
+            order[i] = u32(i);
+        std::sort(order.begin(), order.end(), [&](u32 lhs, u32 rhs) {
+            const int c = std::memcmp(records[lhs].sfen.data, records[rhs].sfen.data, sizeof(PackedSfen));
+            return c != 0 ? c < 0 : lhs < rhs;
+        });
+
+        std::vector<u8> keep(records.size(), 0);
+        for (size_t i = 0; i < order.size(); ++i)
+            if (i == 0 || records[order[i]].sfen != records[order[i - 1]].sfen)
+                keep[order[i]] = 1;
+
+        size_t kept = 0;
+        for (size_t i = 0; i < records.size(); ++i)
+            if (keep[i])
+                records[kept++] = records[i];
+
+        duplicates = records.size() - kept;
+        records.resize(kept);
+    }
+
+    // Fisher-Yates shuffle
+    PRNG prng(seed | 1);
+    for (size_t i = records.size(); i > 1; --i)
+        std::swap(records[i - 1], records[prng.rand(i)]);
+
+    return true;
+}
+
+// settings.inputPathをdedupe & shuffleして、settings.outputPathへ書き出す。
+// 使用するメモリはおおよそsettings.memoryLimitに収まる。
+// テンポラリファイルはoutputPathと同じフォルダに作る。
+bool run_psv_shuffle(ThreadPool&               threads,
+                     const PsvShuffleSettings& settings,
+                     PsvShuffleResult&         result,
+                     std::string&              message) {
+
+    if (settings.inputPath.empty() || settings.outputPath.empty())
+    {
+        message = "input and output path must be specified.";
+        return false;
+    }
+
+    // 入出力のpathは、run_psv_transform()と同じくworking directory相対とする。
+    const std::string inputPath  = Path::Combine(CommandLine::get_working_directory(), settings.inputPath);
+    const std::string outputPath = Path::Combine(CommandLine::get_working_directory(), settings.outputPath);
+
+    if (inputPath == outputPath)
+    {
+        message = "input and output path must be different.";
+        return false;
+    }
+
+    const s64 inputSize = psv_file_size(inputPath);
+    if (inputSize < 0)
+    {
+        message = "failed to open input file: " + settings.inputPath;
+        return false;
+    }
+    if (inputSize % sizeof(PsvRecord))
+    {
+        message = "truncated psv record at end of input.";
+        return false;
+    }
+
+    const TimePoint startTime = now();
+    result.read               = u64(inputSize) / sizeof(PsvRecord);
+
+    const u64 seed = settings.seed ? settings.seed : PRNG().rand<u64>();
+    PRNG      prng(seed | 1);
+
+    // 1つのbucketとしてメモリに読み込めるファイルサイズ
+    const u64 workerBytes = std::max(u64(1024 * 1024), settings.memoryLimit / settings.workerCount);
+    const u64 bucketBytes = workerBytes / PSV_SHUFFLE_BYTES_PER_RECORD * sizeof(PsvRecord);
+
+    // 最終的に、メモリ上でshuffleするbucket。出力の順番に並んでいる。
+    struct Bucket {
+        std::string path;
+        bool        temporary;
+    };
+    std::vector<Bucket> buckets;
+
+    // 作ったテンポラリファイル。最後にまとめて削除する。
+    std::vector<std::string> temporaries;
+
+    // pathがbucketBytesに収まらなければ振り分けて、bucketsに積む。
+    std::function<bool(const Bucket&, int, const std::string&)> split =
+      [&](const Bucket& bucket, int pass, const std::string& name) {
+          const s64 size = psv_file_size(bucket.path);
+          if (size < 0)
+          {
+              message = "failed to open file: " + bucket.path;
+              return false;
+          }
+
+          if (u64(size) <= bucketBytes || pass >= PSV_SHUFFLE_MAX_PASSES)
+          {
+              buckets.push_back(bucket);
+              return true;
+          }
+
+          // 乱数の偏りで溢れないように、少し多めのbucketに分ける。
+          const size_t count = size_t(
+            std::clamp<u64>((u64(size) / bucketBytes + 1) * 5 / 4 + 1, 2, PSV_SHUFFLE_MAX_BUCKETS));
+
+          std::vector<std::string> paths;
+          for (size_t i = 0; i < count; ++i)
+              paths.push_back(outputPath + ".bucket" + name + "_" + std::to_string(i) + ".tmp");
+          temporaries.insert(temporaries.end(), paths.begin(), paths.end());
+
+          if (!partition_psv(bucket.path, paths, settings.dedupe, mix64(seed + u64(pass)), prng,
+                             settings.memoryLimit, message))
+              return false;
+
+          result.passes = std::max(result.passes, pass + 1);
+          if (bucket.temporary)
+              std::remove(bucket.path.c_str());
+
+          for (size_t i = 0; i < count; ++i)
+              if (!split({paths[i], true}, pass + 1, name + "_" + std::to_string(i)))
+                  return false;
+          return true;
+      };
+
+    bool ok = split({inputPath, false}, 0, "");
+
+    std::ofstream output;
+    if (ok)
+    {
+        output.open(outputPath, std::ios::binary | std::ios::trunc);
+        if (!output)
+        {
+            message = "failed to open output file: " + settings.outputPath;
+            ok      = false;
+        }
+    }
+
+    // workerの数ずつ並列にbucketを処理して、bucketの順に書き出す。
+    for (size_t begin = 0; ok && begin < buckets.size(); begin += settings.workerCount)
+    {
+        const size_t                        n = std::min(settings.workerCount, buckets.size() - begin);
+        std::vector<std::vector<PsvRecord>> records(n);
+        std::vector<u64>                    duplicates(n);
+        std::vector<u8>                     succeeded(n);
+
+        threads.parallel_for(0, n, 1, [&](size_t, size_t kBegin, size_t kEnd) {
+            for (size_t k = kBegin; k < kEnd; ++k)
+                succeeded[k] = shuffle_psv_bucket(buckets[begin + k].path, settings.dedupe,
+                                                  mix64(seed ^ (begin + k)), records[k], duplicates[k]);
+        });
+
+        for (size_t k = 0; ok && k < n; ++k)
+        {
+            if (!succeeded[k])
+            {
+                message = "failed to read file: " + buckets[begin + k].path;
+                ok      = false;
+                break;
+            }
+
+            output.write(reinterpret_cast<const char*>(records[k].data()),
+                         std::streamsize(records[k].size() * sizeof(PsvRecord)));
+            if (!output)
+            {
+                message = "failed to write output file: " + settings.outputPath;
+                ok      = false;
+                break;
+            }
+
+            result.written += records[k].size();
+            result.duplicates += duplicates[k];
+        }
+    }
+
+    result.buckets = buckets.size();
+    for (auto& path : temporaries)
+        std::remove(path.c_str());
+
+    result.elapsed = std::max(TimePoint(1), now() - startTime);
+    return ok;
+}
+
+// -----------------------
+//   qsearch_psv
+// -----------------------
 
 struct QSearchPsvStats {
     u64 records       = 0;
@@ -378,20 +1253,19 @@ struct QSearchPsvStats {
 // PsvRecord 1件に対して qsearch<PV>() を実行し、
 // 得られたPVを実際に進めたleaf nodeの局面でrecord.sfenを置換する。
 // score/game_resultはPSVの規約に合わせて、leaf側の手番視点になるよう必要なら符号反転する。
-bool qsearch_psv_record(YaneuraOuWorker& worker, PsvRecord& record, QSearchPsvStats& stats) {
+bool qsearch_psv_record(PsvTransformContext& ctx, PsvRecord& record, QSearchPsvStats& stats) {
     ++stats.records;
 
-    Position  pos;
-    StateInfo si;
+    Position& pos = ctx.pos;
 
-    if (pos.set_from_packed_sfen(record.sfen, &si, false, record.gamePly).is_not_ok())
+    if (pos.set_from_packed_sfen(record.sfen, &ctx.si, false, record.gamePly).is_not_ok())
     {
         ++stats.decodeErrors;
         return false;
     }
 
     PVMoves pv;
-    worker.qsearch_pv(pos, pv);
+    ctx.worker->qsearch_pv(pos, pv);
 
     if (pv.empty())
         return true;
@@ -437,26 +1311,9 @@ bool qsearch_psv_record(YaneuraOuWorker& worker, PsvRecord& record, QSearchPsvSt
 
 } // namespace
 
-// USI拡張コマンド "qsearch_psv input.psv output.psv [workers]" の実体。
-// .psv(PsvRecord列)をchunk単位で読み込み、各レコードの局面を
-// qsearchのPV leaf nodeに置換して、同じPSV形式でoutputPathへ書き出す。
-// qsearch自体を並列化するのではなく、独立したPSVレコードを既存の探索workerへ分配する。
-bool YaneuraOuEngine::qsearch_psv(const std::string& inputPath,
-                                  const std::string& outputPath,
-                                  size_t             workerCount,
-                                  std::string&       message) {
-
-    if (inputPath.empty() || outputPath.empty())
-    {
-        message = "usage: qsearch_psv input.psv output.psv [workers]";
-        return false;
-    }
-
-    if (inputPath == outputPath)
-    {
-        message = "input and output path must be different.";
-        return false;
-    }
+// qsearch_psv/psv_transformで用いるworker数を決めて、探索threadを準備する。
+// workerCountが0ならThreadsの数だけ用いる。
+bool YaneuraOuEngine::prepare_psv_workers(size_t& workerCount, std::string& message) {
 
     wait_for_search_finished();
 
@@ -476,100 +1333,256 @@ bool YaneuraOuEngine::qsearch_psv(const std::string& inputPath,
         message = "requested workers exceed current Threads option.";
         return false;
     }
+    return true;
+}
 
-    std::ifstream input(inputPath, std::ios::binary);
-    if (!input)
+// USI拡張コマンド "qsearch_psv input.psv output.psv [workers] [mmap]" の実体。
+// .psv(PsvRecord列)をchunk単位で読み込み、各レコードの局面を
+// qsearchのPV leaf nodeに置換して、同じPSV形式でoutputPathへ書き出す。
+// qsearch自体を並列化するのではなく、独立したPSVレコードを既存の探索workerへ分配する。
+// 読み込み・探索・書き出しはpipelineで重ねて行うので、I/O待ちの間もworkerは止まらない。
+bool YaneuraOuEngine::qsearch_psv(const std::string& inputPath,
+                                  const std::string& outputPath,
+                                  size_t             workerCount,
+                                  bool               useMmap,
+                                  std::string&       message) {
+
+    if (inputPath.empty() || outputPath.empty())
     {
-        message = "failed to open input file: " + inputPath;
+        message = "usage: qsearch_psv input.psv output.psv [workers] [mmap]";
         return false;
     }
 
-    std::ofstream output(outputPath, std::ios::binary);
-    if (!output)
-    {
-        message = "failed to open output file: " + outputPath;
+    if (!prepare_psv_workers(workerCount, message))
         return false;
-    }
 
-    std::vector<PsvRecord> records(QSEARCH_PSV_CHUNK_RECORDS);
-    QSearchPsvStats                 total;
-    u64                             nextProgress = 1000000;
+    PsvTransformSettings settings;
+    settings.inputPath   = inputPath;
+    settings.outputPath  = outputPath;
+    settings.workerCount = workerCount;
+    settings.useMmap     = useMmap;
+
+    // 💡 decodeに失敗したレコードなども、元のまま出力に残す。
+    std::vector<QSearchPsvStats> localStats(workerCount);
+    PsvTransformResult           result;
+
+    if (!run_psv_transform(
+          threads, settings,
+          [&](PsvTransformContext& ctx, PsvRecord& record) {
+              qsearch_psv_record(ctx, record, localStats[ctx.threadId]);
+              return true;
+          },
+          result, message))
+        return false;
 
-    const auto recordBytes = std::streamsize(sizeof(PsvRecord));
-    const auto chunkBytes  = std::streamsize(records.size() * sizeof(PsvRecord));
+    QSearchPsvStats total;
+    for (const auto& stats : localStats)
+        total.merge(stats);
 
-    while (true)
+    std::ostringstream ss;
+    ss << "qsearch_psv done: records=" << total.records
+       << " replaced=" << total.replaced
+       << " decode_errors=" << total.decodeErrors
+       << " illegal_pv=" << total.illegalPv
+       << " max_leaf_ply=" << total.maxLeafPly
+       << " workers=" << workerCount
+       << " elapsed_ms=" << result.elapsed
+       << " records_per_sec=" << result.read * 1000 / result.elapsed
+       << " input=" << (useMmap ? "mmap" : "stream");
+    message = ss.str();
+    return total.decodeErrors == 0 && total.illegalPv == 0;
+}
+
+// USI拡張コマンド "psv_transform op input.psv output.psv [options...]" の実体。
+// input.psv, output.psvはworking directory相対。
+//
+// op :
+//   copy    : レコードをそのまま書き出す。dedupe/shuffleと組み合わせて使う。
+//   qsearch : qsearch_psvと同じ。局面をqsearch PVのleaf nodeで置換する。
+//   rescore_qsearch
+//           : scoreをqsearchの評価値で置き換える。PVがあればmoveもその初手にする。
+//             ⚠ 深さを指定した通常探索ではなく、静止探索だけの評価値である。(通常探索はiterative_deepening()の
+//                rootMovesやmain threadの時間制御が前提なので、このレコードごとの処理からは呼び出せない)
+//   shuffle : メモリに載らない大きさのファイルでもshuffleできる。テンポラリファイルを出力先に作る。
+//               memory N              : 使用するメモリの上限[MB]。省略時は1024。
+//               dedupe                : 同一局面は入力で最初に現れたものだけを残す。PackedSfenそのもので比較する。
+//               seed N                : 乱数seed。
+//             ⚠ 以下の共通のoptionのうち、workers以外は用いない。
+//   filter  : 条件を満たさないレコードを取り除く。局面を復元できないレコードは常に取り除く。
+//               min_ply N / max_ply N : gamePlyがこの範囲外のものを取り除く。
+//               max_score N           : |score|がNを超えるものを取り除く。
+//               drop_draw             : game_resultが引き分けのものを取り除く。(eval_accuracyで除外する局面)
+//               drop_in_check         : 王手のかかっている局面を取り除く。
+//
+// 共通のoption :
+//   workers N : 用いるworker数。省略時はThreadsの数。
+//   mmap      : 入力ファイルをメモリにmapして読む。
+//   unordered : 処理の終わったchunkから書き出す。(出力の順番は入力と一致しなくなる)
+//   dedupe    : 同一局面は最初のものだけを書き出す。PackedSfenそのもので比較するので、hashの衝突で
+//               異なる局面が取り除かれることはない。書き出した局面をすべてメモリに保持するので、
+//               memoryを超えたらエラーで中断する。(その時はop = shuffleのdedupeを用いる)
+//   memory N  : dedupeで用いるメモリの上限[MB]。省略時は1024。
+//   shuffle   : 出力をshuffleする。全レコードがメモリに載ることが前提。(載らないならop = shuffleを用いる)
+//   seed N    : shuffleの乱数seed。
+bool YaneuraOuEngine::psv_transform(const std::string& op, std::istringstream& is, std::string& message) {
+
+    PsvTransformSettings settings;
+    is >> settings.inputPath >> settings.outputPath;
+
+    if (op.empty() || settings.inputPath.empty() || settings.outputPath.empty())
     {
-        input.read(reinterpret_cast<char*>(records.data()), chunkBytes);
-        const std::streamsize bytesRead = input.gcount();
+        message = "usage: psv_transform [copy|qsearch|rescore_qsearch|shuffle|filter] input.psv output.psv [options...]";
+        return false;
+    }
 
-        if (bytesRead == 0)
-            break;
+    size_t workerCount = 0;
+    u64    memoryMb    = 1024;
+    int    minPly = 0, maxPly = INT_MAX, maxScore = INT_MAX;
+    bool   dropDraw = false, dropInCheck = false;
 
-        if ((bytesRead % recordBytes) != 0)
+    std::string token;
+    while (is >> token)
+    {
+        if (token == "workers")
+            is >> workerCount;
+        else if (token == "mmap")
+            settings.useMmap = true;
+        else if (token == "unordered")
+            settings.ordered = false;
+        else if (token == "dedupe")
+            settings.dedupe = true;
+        else if (token == "shuffle")
+            settings.shuffle = true;
+        else if (token == "seed")
+            is >> settings.seed;
+        else if (token == "memory")
+            is >> memoryMb;
+        else if (token == "min_ply")
+            is >> minPly;
+        else if (token == "max_ply")
+            is >> maxPly;
+        else if (token == "max_score")
+            is >> maxScore;
+        else if (token == "drop_draw")
+            dropDraw = true;
+        else if (token == "drop_in_check")
+            dropInCheck = true;
+        else
         {
-            message = "truncated psv record at end of input.";
+            message = "unknown option: " + token;
             return false;
         }
+    }
 
-        const size_t count = size_t(bytesRead / recordBytes);
+    // shuffleだけはレコードごとの処理ではないので別扱い。
+    if (op == "shuffle")
+    {
+        if (!prepare_psv_workers(workerCount, message))
+            return false;
 
-        std::atomic<size_t>         nextRecord(0);
-        std::vector<QSearchPsvStats> localStats(workerCount);
+        PsvShuffleSettings shuffleSettings;
+        shuffleSettings.inputPath   = settings.inputPath;
+        shuffleSettings.outputPath  = settings.outputPath;
+        shuffleSettings.workerCount = workerCount;
+        shuffleSettings.memoryLimit = memoryMb * 1024 * 1024;
+        shuffleSettings.dedupe      = settings.dedupe;
+        shuffleSettings.seed        = settings.seed;
 
-        for (size_t threadId = 0; threadId < workerCount; ++threadId)
-        {
-            threads.run_on_thread(threadId, [&, threadId]() {
-                auto* worker =
-                  static_cast<YaneuraOuWorker*>(threads.threads[threadId]->worker.get());
+        PsvShuffleResult result;
+        if (!run_psv_shuffle(threads, shuffleSettings, result, message))
+            return false;
 
-                while (true)
-                {
-                    const size_t index = nextRecord.fetch_add(1, std::memory_order_relaxed);
-                    if (index >= count)
-                        break;
+        std::ostringstream ss;
+        ss << "psv_transform done: op=shuffle"
+           << " read=" << result.read
+           << " written=" << result.written
+           << " duplicates=" << result.duplicates
+           << " buckets=" << result.buckets
+           << " passes=" << result.passes
+           << " workers=" << workerCount
+           << " elapsed_ms=" << result.elapsed
+           << " records_per_sec=" << result.read * 1000 / result.elapsed;
+        message = ss.str();
+        return true;
+    }
 
-                    qsearch_psv_record(*worker, records[index], localStats[threadId]);
-                }
-            });
-        }
+    settings.dedupeMemoryLimit = memoryMb * 1024 * 1024;
 
-        for (size_t threadId = 0; threadId < workerCount; ++threadId)
-            threads.wait_on_thread(threadId);
+    PsvRecordTransform transform;
+    std::vector<QSearchPsvStats> localStats;
 
-        for (const auto& stats : localStats)
-            total.merge(stats);
+    if (op == "copy")
+        transform = [](PsvTransformContext&, PsvRecord&) { return true; };
 
-        output.write(reinterpret_cast<const char*>(records.data()), bytesRead);
-        if (!output)
-        {
-            message = "failed to write output file: " + outputPath;
-            return false;
-        }
+    else if (op == "qsearch")
+        transform = [&](PsvTransformContext& ctx, PsvRecord& record) {
+            qsearch_psv_record(ctx, record, localStats[ctx.threadId]);
+            return true;
+        };
 
-        if (total.records >= nextProgress)
-        {
-            sync_cout << "info string qsearch_psv processed " << total.records << " records"
-                      << sync_endl;
-            nextProgress += 1000000;
-        }
+    else if (op == "rescore_qsearch")
+        transform = [](PsvTransformContext& ctx, PsvRecord& record) {
+            if (ctx.pos.set_from_packed_sfen(record.sfen, &ctx.si, false, record.gamePly).is_not_ok())
+                return false;
+
+            PVMoves     pv;
+            const Value value = ctx.worker->qsearch_pv(ctx.pos, pv);
+
+            record.score = s16(std::clamp(int(value), int((std::numeric_limits<s16>::min)()),
+                                          int((std::numeric_limits<s16>::max)())));
+            if (!pv.empty())
+                record.move = pv[0].to_move16().to_u16();
+            return true;
+        };
+
+    else if (op == "filter")
+        transform = [=](PsvTransformContext& ctx, PsvRecord& record) {
+            if (record.gamePly < minPly || record.gamePly > maxPly)
+                return false;
+            if (std::abs(int(record.score)) > maxScore)
+                return false;
+            if (dropDraw && record.game_result == 0)
+                return false;
+            if (ctx.pos.set_from_packed_sfen(record.sfen, &ctx.si, false, record.gamePly).is_not_ok())
+                return false;
+            if (dropInCheck && ctx.pos.in_check())
+                return false;
+            return true;
+        };
+
+    else if (op == "rescore")
+    {
+        message = "psv_transform rescore with a fixed-depth search is not supported. use rescore_qsearch.";
+        return false;
     }
 
-    if (input.bad())
+    else
     {
-        message = "failed to read input file: " + inputPath;
+        message = "unknown psv_transform op: " + op;
         return false;
     }
 
+    if (!prepare_psv_workers(workerCount, message))
+        return false;
+
+    settings.workerCount = workerCount;
+    localStats.resize(workerCount);
+
+    PsvTransformResult result;
+    if (!run_psv_transform(threads, settings, transform, result, message))
+        return false;
+
     std::ostringstream ss;
-    ss << "qsearch_psv done: records=" << total.records
-       << " replaced=" << total.replaced
-       << " decode_errors=" << total.decodeErrors
-       << " illegal_pv=" << total.illegalPv
-       << " max_leaf_ply=" << total.maxLeafPly
-       << " workers=" << workerCount;
+    ss << "psv_transform done: op=" << op
+       << " read=" << result.read
+       << " written=" << result.written
+       << " dropped=" << result.dropped
+       << " duplicates=" << result.duplicates
+       << " workers=" << workerCount
+       << " elapsed_ms=" << result.elapsed
+       << " records_per_sec=" << result.read * 1000 / result.elapsed;
     message = ss.str();
-    return total.decodeErrors == 0 && total.illegalPv == 0;
+    return true;
 }
 
 // utility functions
@@ -692,6 +1705,15 @@ using namespace Search;
 // 💡 冒頭で書いたのでコメントアウト。
 #endif
 
+// 🌈 探索のテレメトリにイベントを記録する。(config.hのENABLE_SEARCH_TELEMETRY)
+//     無効なときは、引数も含めて何もコードが生成されない。
+#if defined(ENABLE_SEARCH_TELEMETRY)
+#define SEARCH_TELEMETRY(event, depth, value, nodes) \
+    Telemetry::record(Telemetry::event, int(depth), int(value), u64(nodes))
+#else
+#define SEARCH_TELEMETRY(event, depth, value, nodes)
+#endif
+
 namespace {
 
 // -----------------------
@@ -884,12 +1906,21 @@ Search::YaneuraOuWorker::YaneuraOuWorker(SharedState& sharedState,
 }
 
 void Search::YaneuraOuWorker::ensure_network_replicated() {
-	// TODO : あとで評価関数を実装する。
-	#if 0
+#if defined(EVAL_NNUE)
     // Access once to force lazy initialization.
     // We do this because we want to avoid initialization during search.
-    (void) (networks[numaAccessToken]);
-	#endif
+
+    // 📝 このWorkerの属するNUMA nodeの評価関数パラメーターの複製を、探索開始前に作っておく。
+    Eval::NNUE::ensure_networks_replicated(engine.get_numa_config(), numaAccessToken.get_numa_index());
+#endif
+}
+
+void Search::YaneuraOuWorker::bind_network_to_current_thread() {
+#if defined(EVAL_NNUE)
+    // 📝 evaluate()はWorkerを受け取らないので、呼び出したスレッドに、
+    //     このWorkerの属するNUMA nodeの評価関数パラメーターを紐付けておく。
+    Eval::NNUE::bind_networks_to_thread(numaAccessToken.get_numa_index());
+#endif
 }
 
 void Search::YaneuraOuWorker::pre_start_searching() {
@@ -942,12 +1973,22 @@ void Search::YaneuraOuWorker::start_searching() {
     // 前回のgoで得たPVは今回の探索では使えないので、各Workerの探索開始時に破棄する。
     lastIterationPV.clear();
 
+    // このスレッドのevaluate()が、このWorkerの属するNUMA nodeの評価関数パラメーターを用いるようにする。
+    bind_network_to_current_thread();
+
+    // 🌈 探索のテレメトリ。時刻はmain threadの探索開始時刻からの経過時間で出力される。
+    Telemetry::set_thread(threadIdx);
+    if (is_mainthread())
+        Telemetry::search_started();
+    SEARCH_TELEMETRY(SearchStart, 0, 0, nodes);
+
     // Non-main threads go directly to iterative_deepening()
     // メインスレッド以外は直接 iterative_deepening() へ進む
 
     if (!is_mainthread())
     {
         iterative_deepening();
+        SEARCH_TELEMETRY(SearchEnd, completedDepth, 0, nodes);
         return;
     }
 
@@ -1129,6 +2170,8 @@ void Search::YaneuraOuWorker::start_searching() {
     uciPvSent = iterative_deepening();  // main thread start searching
     // 💡 main threadも並列探索に加わる。
 
+    SEARCH_TELEMETRY(SearchEnd, completedDepth, 0, nodes);
+
     // When we reach the maximum depth, we can arrive here without a raise of
     // threads.stop. However, if we are pondering or in an infinite search,
     // the UCI protocol states that we shouldn't print the best move before the
@@ -1580,6 +2623,8 @@ bool Search::YaneuraOuWorker::iterative_deepening() {
             uciPvSent = false;
         }
 
+        SEARCH_TELEMETRY(IterationStart, rootDepth, 0, nodes);
+
         // Save the last iteration's scores before the first PV line is searched and
         // all the move scores except the (new) PV are set to -VALUE_INFINITE.
 
@@ -1776,6 +2821,8 @@ bool Search::YaneuraOuWorker::iterative_deepening() {
                 // otherwise exit the loop.
                 if (bestValue <= alpha)
                 {
+                    SEARCH_TELEMETRY(FailLow, rootDepth, bestValue, nodes);
+
                     beta  = alpha;
                     alpha = std::max(bestValue - delta, -VALUE_INFINITE);
 
@@ -1785,6 +2832,8 @@ bool Search::YaneuraOuWorker::iterative_deepening() {
                 }
                 else if (bestValue >= beta)
                 {
+                    SEARCH_TELEMETRY(FailHigh, rootDepth, bestValue, nodes);
+
                     alpha = std::max(beta - delta, alpha);
                     beta  = std::min(bestValue + delta, VALUE_INFINITE);
                     ++failedHighCnt;
@@ -1792,6 +2841,8 @@ bool Search::YaneuraOuWorker::iterative_deepening() {
                 else
                     break;
 
+                SEARCH_TELEMETRY(AspirationResearch, rootDepth, beta - alpha, nodes);
+
                 delta += delta / 3;
 
                 assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
@@ -1845,6 +2896,8 @@ bool Search::YaneuraOuWorker::iterative_deepening() {
 
         if (!threads.stop)
         {
+            SEARCH_TELEMETRY(IterationEnd, rootDepth, rootMoves[0].score, nodes);
+
             completedDepth  = rootDepth;
 
             if (lastIterationPV.empty() || rootMoves[0].pv[0] != lastIterationPV[0])
@@ -2793,6 +3846,13 @@ Value YaneuraOuWorker::search(Position& pos, Stack* ss, Value alpha, Value beta,
                 return ttData.value;
         }
 #else
+
+#if defined(ENABLE_SEARCH_TELEMETRY)
+        // 💡 浅いnodeのcutoffは数が多すぎるので記録しない。
+        if (depth >= Telemetry::TT_CUTOFF_MIN_DEPTH)
+            SEARCH_TELEMETRY(TTCutoff, depth, ttData.value, nodes);
+#endif
+
         return ttData.value;
 #endif        
     }
@@ -3494,7 +4554,12 @@ moves_loop:  // When in check, search starts here
 		*/
 
         if (!pos.legal(move))
+        {
+            // 置換表の指し手がlegalではなかった回数を数える。(TTStats)
+            if (move == ttData.move)
+                TTStats::add(TTStats::TTMoveNotLegal);
             continue;
+        }
 
         // At root obey the "searchmoves" option and skip moves not listed in Root
         // Move List. In MultiPV mode we also skip PV moves that have been already
@@ -4887,7 +5952,12 @@ Value Search::YaneuraOuWorker::qsearch(Position& pos, Stack* ss, Value alpha, Va
 		*/
 
         if (!pos.legal(move))
+        {
+            // 置換表の指し手がlegalではなかった回数を数える。(TTStats)
+            if (move == ttData.move)
+                TTStats::add(TTStats::TTMoveNotLegal);
             continue;
+        }
 
 		//  局面を進める前の枝刈り
 
@@ -5497,6 +6567,16 @@ void SearchManager::check_time(Search::YaneuraOuWorker& worker) {
         dbg_print();
     }
 
+#if defined(ENABLE_SEARCH_TELEMETRY)
+    // 💡 check_time()は頻繁に呼び出されるので、10msに1回だけ記録する。
+    static TimePoint lastTelemetryTime = 0;
+    if (elapsed < lastTelemetryTime || elapsed - lastTelemetryTime >= 10)
+    {
+        lastTelemetryTime = elapsed;
+        SEARCH_TELEMETRY(CheckTime, worker.completedDepth, elapsed, worker.nodes);
+    }
+#endif
+
     // We should not stop pondering until told so by the GUI
     // GUIから指示があるまで、ポンダリングを停止すべきではない
     // 💡 ponderフラグが立っていたら、"go ponder"の最中なので
@@ -5547,15 +6627,20 @@ void SearchManager::check_time(Search::YaneuraOuWorker& worker) {
           || (worker.limits.nodes && worker.threads.nodes_searched() >= worker.limits.nodes)
           // 5.
           || (tm.search_end && tm.search_end <= elapsed))
-
+        {
+            SEARCH_TELEMETRY(TimeStop, worker.completedDepth, elapsed, worker.nodes);
             worker.threads.stop = worker.threads.abortedSearch = true;
+        }
 
         else if (!tm.search_end && worker.limits.use_time_management() &&
 				 // 1.
 				 (elapsed > tm.maximum()
 				 // 2
 				  || stopOnPonderhit))
+        {
+            SEARCH_TELEMETRY(TimeSearchEnd, worker.completedDepth, elapsed, worker.nodes);
             tm.set_search_end(elapsed);
+        }
     }
 
 
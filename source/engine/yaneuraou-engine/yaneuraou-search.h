@@ -387,8 +387,18 @@ class YaneuraOuEngine: public Engine {
     virtual bool qsearch_psv(const std::string& inputPath,
                              const std::string& outputPath,
                              size_t             workerCount,
+                             bool               useMmap,
                              std::string&       message) override;
 
+    // USI拡張コマンド "psv_transform" の実体。
+    // .psvの各レコードに対してopで指定した処理を行い、残ったレコードを書き出す。
+    virtual bool psv_transform(const std::string& op, std::istringstream& is, std::string& message) override;
+
+    // USI拡張コマンド "tt_save" / "tt_load" の実体。
+    // 置換表の内容をファイルに保存する/ファイルから復元する。
+    virtual bool save_tt(const std::string& filename, std::string& message) override;
+    virtual bool load_tt(const std::string& filename, bool useMmap, std::string& message) override;
+
 	// 現在の局面の評価値の詳細を出力する。
     virtual void trace_eval() const override;
 
@@ -407,6 +417,10 @@ class YaneuraOuEngine: public Engine {
 
     // Stockfishとの互換性のために用意。
     Search::SearchManager* main_manager() { return &manager; }
+
+   private:
+    // qsearch_psv/psv_transformで用いるworker数を決めて、探索threadを準備する。
+    bool prepare_psv_workers(size_t& workerCount, std::string& message);
 };
 
 // やねうら王の探索Worker
@@ -434,6 +448,10 @@ class YaneuraOuWorker: public Worker {
     // 評価関数のパラメーターが各NUMAにコピーされているようにする。
     virtual void ensure_network_replicated() override;
 
+    // 呼び出したスレッドのevaluate()が、このWorkerの属するNUMA nodeの評価関数のパラメーターを用いるようにする。
+    // 💡 探索以外で、このWorkerのスレッドで評価関数を呼び出すとき(qsearch_psvなど)にも呼び出すこと。
+    void bind_network_to_current_thread();
+
     // qsearch<PV>()をTT hitなし扱いで行い、この呼び出し中に得られたPVを返す。
     // 返されたPVを進めた局面が、qsearchで到達したleaf nodeになる。
     Value qsearch_pv(Position& pos, PVMoves& pv);
@@ -9,7 +9,10 @@
 	#include "nn_tensorrt.h"
 #elif defined (COREML)
     #include "nn_coreml.h"
+#elif defined (CPU_NN)
+	#include "nn_cpu.h"
 #endif
+#include "nn_synthetic.h"
 
 #include "../../misc.h"
 
@@ -30,6 +33,8 @@ namespace Eval::dlshogi {
 		checkCudaErrors(cudaHostAlloc(&ptr, size, cudaHostAllocPortable));
 #elif defined (COREML)
 		ptr = (void*)new u8[size];
+#elif defined (CPU_NN)
+		ptr = (void*)new u8[size];
 #endif
 		return ptr;
 	}
@@ -44,6 +49,8 @@ namespace Eval::dlshogi {
 		checkCudaErrors(cudaFreeHost(ptr));
 #elif defined (COREML)
 		delete[] (u8*)ptr;
+#elif defined (CPU_NN)
+		delete[] (u8*)ptr;
 #endif
 	}
 	
@@ -55,6 +62,8 @@ namespace Eval::dlshogi {
 		return NNTensorRT::get_device_count();
 #elif defined (COREML)
 		return NNCoreML::get_device_count();
+#elif defined (CPU_NN)
+		return NNCpu::get_device_count();
 #endif
 	}
 
@@ -63,13 +72,19 @@ namespace Eval::dlshogi {
 	{
 		std::shared_ptr<NN> nn;
 
+		// 探索部の計測用のNN。どのeditionでも使える。
+		if (NNSynthetic::is_synthetic_model(model_path))
+			nn = std::make_unique<NNSynthetic>();
+
 #if defined (ONNXRUNTIME)
 
-		nn = std::make_unique<NNOnnxRuntime>();
+		else
+			nn = std::make_unique<NNOnnxRuntime>();
 
 #elif defined (TENSOR_RT)
 
-		nn = std::make_unique<NNTensorRT>();
+		else
+			nn = std::make_unique<NNTensorRT>();
 
 		// ファイル名に応じて、他のフォーマットに対応させるはずだったが、
 		// TensorRTの場合、モデルファイル側にその情報があるので
@@ -77,7 +92,13 @@ namespace Eval::dlshogi {
 
 #elif defined (COREML)
 
-		nn = std::make_unique<NNCoreML>();
+		else
+			nn = std::make_unique<NNCoreML>();
+
+#elif defined (CPU_NN)
+
+		else
+			nn = std::make_unique<NNCpu>();
 
 #endif
 
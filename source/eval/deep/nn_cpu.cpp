@@ -0,0 +1,1281 @@
+﻿#include "nn_cpu.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP) && defined(CPU_NN)
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+#endif
+
+#include "../../usi.h"
+#include "../../misc.h"
+
+using namespace std;
+
+namespace YaneuraOu {
+using namespace Tools;
+
+namespace Eval::dlshogi {
+
+namespace {
+
+	// ----------------------------------
+	//   ONNX(protobuf)の読み込み
+	// ----------------------------------
+
+	// 📝 ONNXのファイルはprotobufで書かれている。ここでは推論に必要なfieldだけを読む。
+	//     field番号は以下を参照のこと。
+	//     cf. https://github.com/onnx/onnx/blob/main/onnx/onnx.proto
+
+	// protobufのwire formatの読み込み
+	class ProtoReader
+	{
+	public:
+		ProtoReader(const u8* data, size_t size) : p(data), end(data + size) {}
+
+		bool eof() const { return p >= end; }
+
+		// 読み込みに失敗したか。
+		bool fail() const { return failed; }
+
+		// 子のmessageの読み込みに失敗していれば、こちらも失敗扱いにする。
+		void merge(const ProtoReader& child) { failed |= child.failed; }
+
+		// 次のfieldのkeyを読み込む。
+		bool next(int& field, int& wire_type)
+		{
+			if (eof() || failed)
+				return false;
+
+			const u64 key = read_varint();
+			field     = int(key >> 3);
+			wire_type = int(key & 7);
+			return !failed;
+		}
+
+		u64 read_varint()
+		{
+			u64 v = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				if (p >= end)
+					break;
+
+				const u8 b = *p++;
+				v |= u64(b & 0x7f) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			failed = true;
+			return 0;
+		}
+
+		u32 read_fixed32()
+		{
+			u32 v = 0;
+			if (advance(4))
+				std::memcpy(&v, p - 4, 4);
+			return v;
+		}
+
+		// length-delimitedなfieldの中身を読み込む。
+		ProtoReader read_message()
+		{
+			const size_t len = size_t(read_varint());
+			if (failed || len > size_t(end - p))
+			{
+				failed = true;
+				return ProtoReader(end, 0);
+			}
+			ProtoReader r(p, len);
+			p += len;
+			return r;
+		}
+
+		std::string read_string()
+		{
+			auto r = read_message();
+			return std::string((const char*)r.p, size_t(r.end - r.p));
+		}
+
+		// 不要なfieldを読み飛ばす。
+		void skip(int wire_type)
+		{
+			switch (wire_type)
+			{
+			case 0: read_varint();  break;
+			case 1: advance(8);     break;
+			case 2: read_message(); break;
+			case 5: advance(4);     break;
+			default: failed = true; break;
+			}
+		}
+
+		const u8* data() const { return p; }
+		size_t    size() const { return size_t(end - p); }
+
+	private:
+		bool advance(size_t n)
+		{
+			if (n > size())
+			{
+				failed = true;
+				return false;
+			}
+			p += n;
+			return true;
+		}
+
+		const u8* p;
+		const u8* end;
+		bool      failed = false;
+	};
+
+	// repeated int64(packedかどうかは問わない)を読み込む。
+	void read_int64s(ProtoReader& r, int wire_type, std::vector<int64_t>& out)
+	{
+		if (wire_type == 2)
+		{
+			auto m = r.read_message();
+			while (!m.eof() && !m.fail())
+				out.push_back(int64_t(m.read_varint()));
+			r.merge(m);
+		}
+		else
+			out.push_back(int64_t(r.read_varint()));
+	}
+
+	// repeated float(packedかどうかは問わない)を読み込む。
+	void read_floats(ProtoReader& r, int wire_type, std::vector<float>& out)
+	{
+		auto to_float = [](u32 u) { float f; std::memcpy(&f, &u, 4); return f; };
+
+		if (wire_type == 2)
+		{
+			auto m = r.read_message();
+			while (!m.eof() && !m.fail())
+				out.push_back(to_float(m.read_fixed32()));
+			r.merge(m);
+		}
+		else
+			out.push_back(to_float(r.read_fixed32()));
+	}
+
+	// IEEE754 half → float
+	float half_to_float(u16 h)
+	{
+		const u32 sign = u32(h & 0x8000) << 16;
+		u32       exp  = (h >> 10) & 0x1f;
+		u32       mant = h & 0x3ff;
+		u32       bits;
+
+		if (exp == 0x1f)
+			bits = sign | 0x7f800000 | (mant << 13);
+		else if (exp != 0)
+			bits = sign | ((exp + 112) << 23) | (mant << 13);
+		else if (mant == 0)
+			bits = sign;
+		else
+		{
+			// 非正規化数
+			exp = 113;
+			while (!(mant & 0x400))
+			{
+				mant <<= 1;
+				--exp;
+			}
+			bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+		}
+
+		float f;
+		std::memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	// ONNXのTensorProto
+	struct OnnxTensor
+	{
+		// TensorProto.DataType
+		enum { FLOAT = 1, INT32 = 6, INT64 = 7, FLOAT16 = 10, DOUBLE = 11 };
+
+		std::string          name;
+		std::vector<int64_t> dims;
+		int                  data_type = 0;
+
+		// 浮動小数点型のときの中身
+		std::vector<float>   data;
+
+		// モデルファイルの外部に中身がある。(対応していない)
+		bool external = false;
+
+		bool is_float() const { return data_type == FLOAT || data_type == FLOAT16 || data_type == DOUBLE; }
+
+		// 要素数をnに返す。
+		// dimsに0以下の値があるか、要素数×sizeof(double)がsize_tに収まらないなら不正なtensorなのでfalseを返す。
+		bool numel(size_t& n) const
+		{
+			n = 1;
+			for (auto d : dims)
+			{
+				if (d <= 0 || u64(d) > std::numeric_limits<size_t>::max() / sizeof(double) / n)
+					return false;
+				n *= size_t(d);
+			}
+			return true;
+		}
+	};
+
+	bool parse_tensor(ProtoReader r, OnnxTensor& t)
+	{
+		const u8*            raw      = nullptr;
+		size_t               raw_size = 0;
+		std::vector<int64_t> int32_data;
+
+		int field, wire_type;
+		while (r.next(field, wire_type))
+		{
+			switch (field)
+			{
+			case 1: read_int64s(r, wire_type, t.dims); break;
+			case 2: t.data_type = int(r.read_varint()); break;
+			case 4: read_floats(r, wire_type, t.data); break;
+			case 5: read_int64s(r, wire_type, int32_data); break;
+			case 8: t.name = r.read_string(); break;
+			case 9: { auto m = r.read_message(); raw = m.data(); raw_size = m.size(); break; }
+			case 14: t.external = r.read_varint() == 1; break;
+			default: r.skip(wire_type); break;
+			}
+		}
+		if (r.fail())
+			return false;
+
+		if (!t.is_float())
+			return true;
+
+		// 読み込む側(Conv, Gemmなど)はdimsに従ってdataを参照するので、
+		// dimsから求めた要素数とdataの長さが一致しないものはここで弾いておく。
+		size_t n;
+		if (!t.numel(n))
+			return false;
+
+		// float_dataに格納されていた。
+		if (!t.data.empty())
+			return t.data.size() == n;
+
+		// 中身がモデルファイルの外部にある。(対応していないので、呼び出し元でエラーにする)
+		if (t.external)
+			return true;
+
+		// raw_data(little endian)から展開する。
+		// 中身の長さが要素数と一致することを確かめてから確保する。
+		if (t.data_type == OnnxTensor::FLOAT && raw_size == n * 4)
+		{
+			t.data.resize(n);
+			std::memcpy(t.data.data(), raw, n * 4);
+		}
+		else if (t.data_type == OnnxTensor::FLOAT16 && raw_size == n * 2)
+		{
+			t.data.resize(n);
+			for (size_t i = 0; i < n; ++i)
+				t.data[i] = half_to_float(u16(raw[i * 2] | (raw[i * 2 + 1] << 8)));
+		}
+		else if (t.data_type == OnnxTensor::FLOAT16 && int32_data.size() == n)
+		{
+			t.data.resize(n);
+			for (size_t i = 0; i < n; ++i)
+				t.data[i] = half_to_float(u16(int32_data[i]));
+		}
+		else if (t.data_type == OnnxTensor::DOUBLE && raw_size == n * 8)
+		{
+			t.data.resize(n);
+			for (size_t i = 0; i < n; ++i)
+			{
+				double d;
+				std::memcpy(&d, raw + i * 8, 8);
+				t.data[i] = float(d);
+			}
+		}
+		else
+			return false;
+
+		return true;
+	}
+
+	// ONNXのAttributeProto
+	struct OnnxAttribute
+	{
+		std::string          name;
+		float                f = 0;
+		int64_t              i = 0;
+		std::vector<int64_t> ints;
+		std::vector<float>   floats;
+		OnnxTensor           t;
+	};
+
+	// ONNXのNodeProto
+	struct OnnxNode
+	{
+		std::string                op_type;
+		std::vector<std::string>   inputs, outputs;
+		std::vector<OnnxAttribute> attrs;
+
+		const OnnxAttribute* attr(const std::string& name) const
+		{
+			for (auto& a : attrs)
+				if (a.name == name)
+					return &a;
+			return nullptr;
+		}
+
+		int64_t attr_i(const std::string& name, int64_t default_value) const
+		{
+			auto a = attr(name);
+			return a ? a->i : default_value;
+		}
+
+		float attr_f(const std::string& name, float default_value) const
+		{
+			auto a = attr(name);
+			return a ? a->f : default_value;
+		}
+
+		std::vector<int64_t> attr_ints(const std::string& name) const
+		{
+			auto a = attr(name);
+			return a ? a->ints : std::vector<int64_t>();
+		}
+
+		// i番目の入力。(省略されていれば空文字列)
+		const std::string& input(size_t i) const
+		{
+			static const std::string empty;
+			return i < inputs.size() ? inputs[i] : empty;
+		}
+	};
+
+	// ONNXのGraphProto
+	struct OnnxGraph
+	{
+		std::vector<OnnxNode>                       nodes;
+		std::unordered_map<std::string, OnnxTensor> initializers;
+		std::vector<std::string>                    inputs, outputs;
+	};
+
+	bool parse_attribute(ProtoReader r, OnnxAttribute& a)
+	{
+		int field, wire_type;
+		while (r.next(field, wire_type))
+		{
+			switch (field)
+			{
+			case 1: a.name = r.read_string(); break;
+			case 2: { u32 u = r.read_fixed32(); std::memcpy(&a.f, &u, 4); break; }
+			case 3: a.i = int64_t(r.read_varint()); break;
+			case 5: if (!parse_tensor(r.read_message(), a.t)) return false; break;
+			case 7: read_floats(r, wire_type, a.floats); break;
+			case 8: read_int64s(r, wire_type, a.ints); break;
+			default: r.skip(wire_type); break;
+			}
+		}
+		return !r.fail();
+	}
+
+	bool parse_node(ProtoReader r, OnnxNode& node)
+	{
+		int field, wire_type;
+		while (r.next(field, wire_type))
+		{
+			switch (field)
+			{
+			case 1: node.inputs.push_back(r.read_string()); break;
+			case 2: node.outputs.push_back(r.read_string()); break;
+			case 4: node.op_type = r.read_string(); break;
+			case 5:
+				node.attrs.emplace_back();
+				if (!parse_attribute(r.read_message(), node.attrs.back()))
+					return false;
+				break;
+			default: r.skip(wire_type); break;
+			}
+		}
+		return !r.fail();
+	}
+
+	// ValueInfoProtoからは名前だけを取り出す。
+	std::string parse_value_info_name(ProtoReader r)
+	{
+		std::string name;
+		int field, wire_type;
+		while (r.next(field, wire_type))
+			if (field == 1)
+				name = r.read_string();
+			else
+				r.skip(wire_type);
+		return name;
+	}
+
+	bool parse_graph(ProtoReader r, OnnxGraph& graph)
+	{
+		int field, wire_type;
+		while (r.next(field, wire_type))
+		{
+			switch (field)
+			{
+			case 1:
+				graph.nodes.emplace_back();
+				if (!parse_node(r.read_message(), graph.nodes.back()))
+					return false;
+				break;
+			case 5: {
+				OnnxTensor t;
+				if (!parse_tensor(r.read_message(), t))
+					return false;
+				auto name = t.name;
+				graph.initializers[name] = std::move(t);
+				break;
+			}
+			case 11: graph.inputs.push_back(parse_value_info_name(r.read_message())); break;
+			case 12: graph.outputs.push_back(parse_value_info_name(r.read_message())); break;
+			default: r.skip(wire_type); break;
+			}
+		}
+		return !r.fail();
+	}
+
+	bool parse_model(const u8* data, size_t size, OnnxGraph& graph)
+	{
+		ProtoReader r(data, size);
+		bool        has_graph = false;
+
+		int field, wire_type;
+		while (r.next(field, wire_type))
+		{
+			// ModelProto.graph
+			if (field == 7)
+			{
+				if (!parse_graph(r.read_message(), graph))
+					return false;
+				has_graph = true;
+			}
+			else
+				r.skip(wire_type);
+		}
+		return !r.fail() && has_graph;
+	}
+
+	// ----------------------------------
+	//   演算
+	// ----------------------------------
+
+	// 出力channelをこの単位で計算する。Value::strideはこの倍数にしておく。
+	constexpr int OC_BLOCK = 32;
+
+	// 同時に計算する升の数。(81の約数)
+	constexpr int SQ_BLOCK = 3;
+
+	// 3×3の畳み込みで、升sqのtap t(= kh * 3 + kw)が参照する升。盤外なら-1。
+	struct NeighborTable
+	{
+		int sq[SQ_NB][9];
+
+		NeighborTable()
+		{
+			for (int h = 0; h < 9; ++h)
+				for (int w = 0; w < 9; ++w)
+					for (int kh = 0; kh < 3; ++kh)
+						for (int kw = 0; kw < 3; ++kw)
+						{
+							const int h2 = h + kh - 1, w2 = w + kw - 1;
+							sq[h * 9 + w][kh * 3 + kw] = (0 <= h2 && h2 < 9 && 0 <= w2 && w2 < 9) ? h2 * 9 + w2 : -1;
+						}
+		}
+	};
+
+	const NeighborTable neighbor_table;
+
+	// SQ_BLOCK升 × OC_BLOCK channel分の畳み込み。
+	//   src[r][t]    : r番目の升のtap tが参照する入力の行
+	//   weights      : [tap][入力channel][出力channel(w_stride)]のうち、このblockの先頭
+	//   out          : r番目の升の出力は out + r * out_stride
+	FORCE_INLINE void conv_block(const float* const src[SQ_BLOCK][9], int taps, int in_channels,
+		const float* weights, int w_stride, const float* bias, bool relu, float* out, int out_stride)
+	{
+#if defined(USE_AVX512)
+
+		// 1升あたりzmm 2本。
+		__m512 acc[SQ_BLOCK][2];
+		for (int r = 0; r < SQ_BLOCK; ++r)
+			for (int k = 0; k < 2; ++k)
+				acc[r][k] = _mm512_loadu_ps(bias + k * 16);
+
+		for (int t = 0; t < taps; ++t)
+		{
+			const float* w = weights + size_t(t) * in_channels * w_stride;
+			for (int ic = 0; ic < in_channels; ++ic, w += w_stride)
+			{
+				const __m512 w0 = _mm512_loadu_ps(w), w1 = _mm512_loadu_ps(w + 16);
+				for (int r = 0; r < SQ_BLOCK; ++r)
+				{
+					const __m512 a = _mm512_set1_ps(src[r][t][ic]);
+					acc[r][0] = _mm512_fmadd_ps(a, w0, acc[r][0]);
+					acc[r][1] = _mm512_fmadd_ps(a, w1, acc[r][1]);
+				}
+			}
+		}
+
+		const __m512 zero = _mm512_setzero_ps();
+		for (int r = 0; r < SQ_BLOCK; ++r)
+			for (int k = 0; k < 2; ++k)
+				_mm512_storeu_ps(out + r * out_stride + k * 16, relu ? _mm512_max_ps(acc[r][k], zero) : acc[r][k]);
+
+#elif defined(USE_AVX2)
+
+		// 1升あたりymm 4本。
+		__m256 acc[SQ_BLOCK][4];
+		for (int r = 0; r < SQ_BLOCK; ++r)
+			for (int k = 0; k < 4; ++k)
+				acc[r][k] = _mm256_loadu_ps(bias + k * 8);
+
+		for (int t = 0; t < taps; ++t)
+		{
+			const float* w = weights + size_t(t) * in_channels * w_stride;
+			for (int ic = 0; ic < in_channels; ++ic, w += w_stride)
+			{
+				__m256 wv[4];
+				for (int k = 0; k < 4; ++k)
+					wv[k] = _mm256_loadu_ps(w + k * 8);
+
+				for (int r = 0; r < SQ_BLOCK; ++r)
+				{
+					const __m256 a = _mm256_broadcast_ss(&src[r][t][ic]);
+					for (int k = 0; k < 4; ++k)
+#if defined(__FMA__)
+						acc[r][k] = _mm256_fmadd_ps(a, wv[k], acc[r][k]);
+#else
+						acc[r][k] = _mm256_add_ps(acc[r][k], _mm256_mul_ps(a, wv[k]));
+#endif
+				}
+			}
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+		for (int r = 0; r < SQ_BLOCK; ++r)
+			for (int k = 0; k < 4; ++k)
+				_mm256_storeu_ps(out + r * out_stride + k * 8, relu ? _mm256_max_ps(acc[r][k], zero) : acc[r][k]);
+
+#else
+
+		float acc[SQ_BLOCK][OC_BLOCK];
+		for (int r = 0; r < SQ_BLOCK; ++r)
+			for (int k = 0; k < OC_BLOCK; ++k)
+				acc[r][k] = bias[k];
+
+		for (int t = 0; t < taps; ++t)
+		{
+			const float* w = weights + size_t(t) * in_channels * w_stride;
+			for (int ic = 0; ic < in_channels; ++ic, w += w_stride)
+				for (int r = 0; r < SQ_BLOCK; ++r)
+				{
+					const float a = src[r][t][ic];
+					for (int k = 0; k < OC_BLOCK; ++k)
+						acc[r][k] += a * w[k];
+				}
+		}
+
+		for (int r = 0; r < SQ_BLOCK; ++r)
+			for (int k = 0; k < OC_BLOCK; ++k)
+				out[r * out_stride + k] = relu ? std::max(acc[r][k], 0.0f) : acc[r][k];
+#endif
+	}
+
+	float sigmoid(float x) { return 1.0f / (1.0f + std::exp(-x)); }
+
+} // namespace
+
+// ----------------------------------
+//   NNCpu
+// ----------------------------------
+
+int NNCpu::new_value(bool spatial, int channels)
+{
+	Value v;
+	v.spatial  = spatial;
+	v.channels = channels;
+	v.stride   = (channels + OC_BLOCK - 1) / OC_BLOCK * OC_BLOCK;
+	values.push_back(v);
+	return int(values.size()) - 1;
+}
+
+// モデルファイルの読み込み。
+Result NNCpu::load(const std::string& model_path, int gpu_id, int batch_size)
+{
+	(void)gpu_id;
+
+	std::vector<u8> file;
+	auto result = SystemIO::ReadFileToMemory(model_path, [&](size_t size) { file.resize(size); return (void*)file.data(); });
+	if (result.is_not_ok())
+		return result;
+
+	OnnxGraph graph;
+	if (!parse_model(file.data(), file.size(), graph))
+	{
+		sync_cout << "info string Error! : failed to parse the ONNX model, path = " << model_path << sync_endl;
+		return ResultCode::FileMismatch;
+	}
+	file = std::vector<u8>();
+
+	layers.clear();
+	values.clear();
+	workspaces.clear();
+	max_batch_size = batch_size;
+
+	// エラーを出力して、読み込み失敗を返す。
+	auto error = [&](const std::string& message) {
+		sync_cout << "info string Error! : " << message << sync_endl;
+		layers.clear();
+		values.clear();
+		return Result(ResultCode::FileMismatch);
+	};
+
+	for (auto& it : graph.initializers)
+		if (it.second.external)
+			return error("external tensor data is not supported, name = " + it.first);
+
+	// ONNXの値の名前 → values[]のindex
+	std::unordered_map<std::string, int> value_of;
+
+	// 定数(initializerとConstant nodeのうち浮動小数点型のもの)
+	std::unordered_map<std::string, const OnnxTensor*> const_of;
+	for (auto& it : graph.initializers)
+		if (it.second.is_float())
+			const_of[it.first] = &it.second;
+
+	// 形状の計算にだけ用いる値(Shape nodeやint64の定数など)
+	// 📝 dlshogiのモデルのReshapeは、すべて[batch, channels * 81]へのflattenなので、これらの値は見る必要がない。
+	std::unordered_set<std::string> shape_names;
+	for (auto& it : graph.initializers)
+		if (!it.second.is_float())
+			shape_names.insert(it.first);
+
+	// 各値を入力として参照している回数。graphの出力は融合の対象にしないように1加算しておく。
+	std::unordered_map<std::string, int> use_count;
+	for (auto& node : graph.nodes)
+		for (auto& name : node.inputs)
+			use_count[name]++;
+	for (auto& name : graph.outputs)
+		use_count[name]++;
+
+	// 値を出力したlayer。(values[]と同じindex。入力なら-1)
+	std::vector<int> producer;
+
+	auto add_value = [&](const std::string& name, bool spatial, int channels) {
+		int v = new_value(spatial, channels);
+		producer.push_back(int(layers.size()));
+		value_of[name] = v;
+		return v;
+	};
+
+	// 入力
+	{
+		std::vector<std::string> inputs;
+		for (auto& name : graph.inputs)
+			if (!graph.initializers.count(name))
+				inputs.push_back(name);
+
+		auto find_input = [&](const std::string& name, size_t index) {
+			return std::find(inputs.begin(), inputs.end(), name) != inputs.end() ? name
+			     : index < inputs.size() ? inputs[index] : std::string();
+		};
+		const auto& spec   = input_feature_spec();
+		auto        name1 = find_input("input1", 0);
+		auto        name2 = find_input("input2", 1);
+		if (name1.empty() || name2.empty())
+			return error("the ONNX model must have two inputs (input1, input2).");
+
+		input1 = add_value(name1, true, int(spec.features1_channels));
+		input2 = add_value(name2, true, int(spec.features2_channels));
+		producer[input1] = producer[input2] = -1;
+	}
+
+	// 後段の処理を融合できるlayer(入力を出力しているlayerで、その値をほかで参照していないもの)を返す。
+	auto fusable = [&](const std::string& name, bool gemm_or_conv_only) -> Layer* {
+		const int v = value_of[name];
+		if (producer[v] < 0 || use_count[name] != 1)
+			return nullptr;
+
+		Layer& l = layers[producer[v]];
+		if (gemm_or_conv_only && l.type != LayerType::Conv && l.type != LayerType::Gemm)
+			return nullptr;
+		return &l;
+	};
+
+	// 定数tを、値xの1行(channelごと)に展開する。展開できない形状ならfalseを返す。
+	auto broadcast = [&](const OnnxTensor& t, const Value& x, std::vector<float>& row) {
+		row.assign(x.stride, 0.0f);
+		const size_t n = t.data.size();
+		if (n == 1)
+			std::fill_n(row.begin(), x.channels, t.data[0]);
+		else if (n == size_t(x.channels))
+		{
+			// [batch, C, 9, 9]に対してなら[C, 1, 1]、[batch, C]に対してなら[C]の形でなければならない。
+			const auto& d = t.dims;
+			if (x.spatial && !(d.size() >= 3 && d[d.size() - 1] == 1 && d[d.size() - 2] == 1))
+				return false;
+			std::copy(t.data.begin(), t.data.end(), row.begin());
+		}
+		else
+			return false;
+		return true;
+	};
+
+	// channelごとのAffine変換を追加する。可能なら前段のConv/Gemmに融合する。
+	auto add_affine = [&](const OnnxNode& node, const std::string& x_name, std::vector<float> scale, std::vector<float> bias) {
+		const int x = value_of[x_name];
+		Layer*    l = fusable(x_name, true);
+		if (l && !l->relu)
+		{
+			const int out_stride = values[x].stride;
+			if (!scale.empty())
+			{
+				if (l->type == LayerType::Conv)
+				{
+					const size_t rows = l->weights.size() / out_stride;
+					for (size_t i = 0; i < rows; ++i)
+						for (int oc = 0; oc < out_stride; ++oc)
+							l->weights[i * out_stride + oc] *= scale[oc];
+				}
+				else
+				{
+					const size_t k = l->weights.size() / values[x].channels;
+					for (int m = 0; m < values[x].channels; ++m)
+						for (size_t i = 0; i < k; ++i)
+							l->weights[m * k + i] *= scale[m];
+				}
+				for (int oc = 0; oc < out_stride; ++oc)
+					l->bias[oc] *= scale[oc];
+			}
+			if (!bias.empty())
+				for (int oc = 0; oc < out_stride; ++oc)
+					l->bias[oc] += bias[oc];
+
+			value_of[node.outputs[0]] = x;
+			return;
+		}
+
+		Layer layer;
+		layer.type   = LayerType::Affine;
+		layer.input  = x;
+		layer.scale  = std::move(scale);
+		layer.bias   = std::move(bias);
+		layer.output = add_value(node.outputs[0], values[x].spatial, values[x].channels);
+		layers.emplace_back(std::move(layer));
+	};
+
+	for (auto& node : graph.nodes)
+	{
+		const auto& op = node.op_type;
+		if (node.outputs.empty())
+			continue;
+		const auto& out_name = node.outputs[0];
+
+		// 入力がすべて形状計算用の値か。
+		auto is_shape_input = [&]() {
+			for (auto& name : node.inputs)
+				if (!name.empty() && !shape_names.count(name))
+					return false;
+			return !node.inputs.empty();
+		};
+
+		if (op == "Constant")
+		{
+			auto a = node.attr("value");
+			if (!a)
+				return error("unsupported Constant node, output = " + out_name);
+			if (a->t.is_float())
+			{
+				graph.initializers[out_name] = a->t;
+				const_of[out_name] = &graph.initializers[out_name];
+			}
+			else
+				shape_names.insert(out_name);
+		}
+		else if (op == "Shape")
+			shape_names.insert(out_name);
+
+		else if ((op == "Gather" || op == "Unsqueeze" || op == "Squeeze" || op == "Concat" || op == "Cast" || op == "Slice") && is_shape_input())
+			shape_names.insert(out_name);
+
+		else if (op == "Identity" || op == "Dropout")
+		{
+			const auto& in = node.input(0);
+			if (value_of.count(in))
+				value_of[out_name] = value_of[in];
+			else if (const_of.count(in))
+				const_of[out_name] = const_of[in];
+			else
+				shape_names.insert(out_name);
+		}
+		else if (op == "Conv")
+		{
+			if (!value_of.count(node.input(0)) || !const_of.count(node.input(1)))
+				return error("unsupported Conv node, output = " + out_name);
+
+			const int   x = value_of[node.input(0)];
+			const auto& w = *const_of[node.input(1)];
+			if (w.dims.size() != 4 || !values[x].spatial)
+				return error("unsupported Conv shape, output = " + out_name);
+
+			const int oc_num = int(w.dims[0]), ic_num = int(w.dims[1]), kh = int(w.dims[2]), kw = int(w.dims[3]);
+			if (ic_num != values[x].channels)
+				return error("Conv input channels mismatch, output = " + out_name + ", expected = " + std::to_string(ic_num)
+					+ ", actual = " + std::to_string(values[x].channels) + ". Check ModelArchitecture.");
+
+			auto pads = node.attr_ints("pads");
+			auto all_of_value = [](const std::vector<int64_t>& v, int64_t n) {
+				return std::all_of(v.begin(), v.end(), [&](int64_t e) { return e == n; });
+			};
+			const bool is3x3 = kh == 3 && kw == 3 && pads.size() == 4 && all_of_value(pads, 1);
+			const bool is1x1 = kh == 1 && kw == 1 && all_of_value(pads, 0);
+			if (!(is3x3 || is1x1) || node.attr_i("group", 1) != 1
+				|| !all_of_value(node.attr_ints("strides"), 1) || !all_of_value(node.attr_ints("dilations"), 1))
+				return error("only 3x3(pad 1) or 1x1 convolutions with stride 1 are supported, output = " + out_name);
+
+			Layer layer;
+			layer.type   = LayerType::Conv;
+			layer.input  = x;
+			layer.taps   = kh * kw;
+			layer.output = add_value(out_name, true, oc_num);
+
+			const int stride = values[layer.output].stride;
+			layer.weights.assign(size_t(layer.taps) * ic_num * stride, 0.0f);
+			for (int oc = 0; oc < oc_num; ++oc)
+				for (int ic = 0; ic < ic_num; ++ic)
+					for (int t = 0; t < layer.taps; ++t)
+						layer.weights[(size_t(t) * ic_num + ic) * stride + oc] = w.data[(size_t(oc) * ic_num + ic) * layer.taps + t];
+
+			layer.bias.assign(stride, 0.0f);
+			if (!node.input(2).empty())
+			{
+				if (!const_of.count(node.input(2)) || const_of[node.input(2)]->data.size() != size_t(oc_num))
+					return error("unsupported Conv bias, output = " + out_name);
+				std::copy_n(const_of[node.input(2)]->data.begin(), oc_num, layer.bias.begin());
+			}
+			layers.emplace_back(std::move(layer));
+		}
+		else if (op == "Gemm" || op == "MatMul")
+		{
+			if (!value_of.count(node.input(0)) || !const_of.count(node.input(1)))
+				return error("unsupported " + op + " node, output = " + out_name);
+
+			const int   x       = value_of[node.input(0)];
+			const auto& w       = *const_of[node.input(1)];
+			const bool  trans_b = op == "Gemm" && node.attr_i("transB", 0) != 0;
+			const float alpha   = op == "Gemm" ? node.attr_f("alpha", 1.0f) : 1.0f;
+			const float beta    = op == "Gemm" ? node.attr_f("beta", 1.0f) : 1.0f;
+			if (values[x].spatial || w.dims.size() != 2 || (op == "Gemm" && node.attr_i("transA", 0) != 0))
+				return error("unsupported " + op + " shape, output = " + out_name);
+
+			const int k = int(trans_b ? w.dims[1] : w.dims[0]);
+			const int m = int(trans_b ? w.dims[0] : w.dims[1]);
+			if (k != values[x].channels)
+				return error(op + " input size mismatch, output = " + out_name);
+
+			Layer layer;
+			layer.type   = LayerType::Gemm;
+			layer.input  = x;
+			layer.output = add_value(out_name, false, m);
+
+			// [出力][入力]の順にする。
+			layer.weights.resize(size_t(m) * k);
+			for (int i = 0; i < m; ++i)
+				for (int j = 0; j < k; ++j)
+					layer.weights[size_t(i) * k + j] = alpha * (trans_b ? w.data[size_t(i) * k + j] : w.data[size_t(j) * m + i]);
+
+			layer.bias.assign(values[layer.output].stride, 0.0f);
+			if (!node.input(2).empty())
+			{
+				if (!const_of.count(node.input(2)) || !broadcast(*const_of[node.input(2)], values[layer.output], layer.bias))
+					return error("unsupported Gemm bias, output = " + out_name);
+				for (auto& b : layer.bias)
+					b *= beta;
+			}
+			layers.emplace_back(std::move(layer));
+		}
+		else if (op == "BatchNormalization")
+		{
+			if (!value_of.count(node.input(0)))
+				return error("unsupported BatchNormalization node, output = " + out_name);
+			for (size_t i = 1; i <= 4; ++i)
+				if (!const_of.count(node.input(i)))
+					return error("unsupported BatchNormalization node, output = " + out_name);
+
+			const int   x     = value_of[node.input(0)];
+			const int   c     = values[x].channels;
+			const auto& gamma = const_of[node.input(1)]->data;
+			const auto& beta  = const_of[node.input(2)]->data;
+			const auto& mean  = const_of[node.input(3)]->data;
+			const auto& var   = const_of[node.input(4)]->data;
+			if (gamma.size() != size_t(c) || beta.size() != size_t(c) || mean.size() != size_t(c) || var.size() != size_t(c))
+				return error("BatchNormalization channels mismatch, output = " + out_name);
+
+			// y = (x - mean) / sqrt(var + eps) * gamma + beta = x * scale + bias
+			const float        eps = node.attr_f("epsilon", 1e-5f);
+			std::vector<float> scale(values[x].stride, 0.0f), bias(values[x].stride, 0.0f);
+			for (int i = 0; i < c; ++i)
+			{
+				scale[i] = gamma[i] / std::sqrt(var[i] + eps);
+				bias[i]  = beta[i] - mean[i] * scale[i];
+			}
+			add_affine(node, node.input(0), std::move(scale), std::move(bias));
+		}
+		else if (op == "Add" || op == "Mul")
+		{
+			const auto& a = node.input(0);
+			const auto& b = node.input(1);
+
+			if (value_of.count(a) && value_of.count(b))
+			{
+				const auto& va = values[value_of[a]];
+				const auto& vb = values[value_of[b]];
+				if (va.spatial != vb.spatial || va.channels != vb.channels)
+					return error("unsupported " + op + " broadcast, output = " + out_name);
+
+				Layer layer;
+				layer.type   = op == "Add" ? LayerType::Add : LayerType::Mul;
+				layer.input  = value_of[a];
+				layer.input2 = value_of[b];
+				layer.output = add_value(out_name, va.spatial, va.channels);
+				layers.emplace_back(std::move(layer));
+			}
+			else if (value_of.count(a) != value_of.count(b) && (const_of.count(a) || const_of.count(b)))
+			{
+				// 一方が定数ならAffine変換。
+				const auto& x_name = value_of.count(a) ? a : b;
+				const auto& k      = *const_of[value_of.count(a) ? b : a];
+
+				std::vector<float> row;
+				if (!broadcast(k, values[value_of[x_name]], row))
+					return error("unsupported " + op + " broadcast, output = " + out_name);
+
+				if (op == "Add")
+					add_affine(node, x_name, std::vector<float>(), std::move(row));
+				else
+					add_affine(node, x_name, std::move(row), std::vector<float>());
+			}
+			else
+				return error("unsupported " + op + " node, output = " + out_name);
+		}
+		else if (op == "Relu" || op == "Sigmoid")
+		{
+			if (!value_of.count(node.input(0)))
+				return error("unsupported " + op + " node, output = " + out_name);
+
+			const int x = value_of[node.input(0)];
+
+			// Reluは前段のConv/Gemmに融合する。
+			Layer* l = op == "Relu" ? fusable(node.input(0), true) : nullptr;
+			if (l && !l->relu)
+			{
+				l->relu             = true;
+				value_of[out_name] = x;
+				continue;
+			}
+
+			Layer layer;
+			layer.type   = op == "Relu" ? LayerType::Relu : LayerType::Sigmoid;
+			layer.input  = x;
+			layer.output = add_value(out_name, values[x].spatial, values[x].channels);
+			layers.emplace_back(std::move(layer));
+		}
+		else if (op == "Flatten" || op == "Reshape")
+		{
+			if (!value_of.count(node.input(0)) || (op == "Flatten" && node.attr_i("axis", 1) != 1))
+				return error("unsupported " + op + " node, output = " + out_name);
+
+			const int x = value_of[node.input(0)];
+			if (!values[x].spatial)
+			{
+				value_of[out_name] = x;
+				continue;
+			}
+
+			Layer layer;
+			layer.type   = LayerType::Flatten;
+			layer.input  = x;
+			layer.output = add_value(out_name, false, values[x].channels * int(SQ_NB));
+			layers.emplace_back(std::move(layer));
+		}
+		else
+			return error("unsupported ONNX operator = " + op + ", output = " + out_name);
+	}
+
+	// 出力
+	{
+		auto find_output = [&](const std::string& name, size_t index) {
+			return std::find(graph.outputs.begin(), graph.outputs.end(), name) != graph.outputs.end() ? name
+			     : index < graph.outputs.size() ? graph.outputs[index] : std::string();
+		};
+		auto name1 = find_output("output_policy", 0);
+		auto name2 = find_output("output_value", 1);
+		if (!value_of.count(name1) || !value_of.count(name2))
+			return error("the ONNX model must have two outputs (output_policy, output_value).");
+
+		output_policy = value_of[name1];
+		output_value  = value_of[name2];
+
+		const auto& p = values[output_policy];
+		const auto& v = values[output_value];
+		if (p.channels != MAX_MOVE_LABEL_NUM * (p.spatial ? 1 : int(SQ_NB)) || v.spatial || v.channels != 1)
+			return error("unexpected output shape.");
+	}
+
+	assign_buffers();
+
+	zero_row.assign(std::max(values[input1].stride, values[input2].stride), 0.0f);
+	for (auto& v : values)
+		zero_row.resize(std::max(zero_row.size(), size_t(v.stride)), 0.0f);
+
+	prepare_slots(1);
+
+	sync_cout << "info string CPU NN : layers = " << layers.size() << ", buffers = " << buffer_count
+#if defined(USE_AVX512)
+		<< ", simd = AVX-512"
+#elif defined(USE_AVX2)
+		<< ", simd = AVX2"
+#else
+		<< ", simd = none"
+#endif
+		<< sync_endl;
+
+	return ResultCode::Ok;
+}
+
+// 各値に作業バッファを割り当てる。
+// 📝 値が最後に参照されたらそのバッファを解放して、後続の値に使い回す。
+void NNCpu::assign_buffers()
+{
+	const int n = int(layers.size());
+
+	// 値が最後に参照されるlayer
+	std::vector<int> last_use(values.size(), -1);
+	for (int i = 0; i < n; ++i)
+		for (int v : { layers[i].input, layers[i].input2 })
+			if (v >= 0)
+				last_use[v] = i;
+	last_use[output_policy] = last_use[output_value] = n;
+
+	for (auto& v : values)
+		v.buffer = -1;
+
+	std::vector<int> free_buffers;
+	buffer_count = 0;
+	auto allocate = [&](int v) {
+		if (values[v].buffer >= 0)
+			return;
+		if (free_buffers.empty())
+			values[v].buffer = buffer_count++;
+		else
+		{
+			values[v].buffer = free_buffers.back();
+			free_buffers.pop_back();
+		}
+	};
+	auto release = [&](int v, int i) {
+		if (v >= 0 && last_use[v] <= i && values[v].buffer >= 0
+			&& std::find(free_buffers.begin(), free_buffers.end(), values[v].buffer) == free_buffers.end())
+			free_buffers.push_back(values[v].buffer);
+	};
+
+	allocate(input1);
+	allocate(input2);
+	for (int i = 0; i < n; ++i)
+	{
+		// 出力は入力と別のバッファにする。
+		allocate(layers[i].output);
+		release(layers[i].input, i);
+		release(layers[i].input2, i);
+		release(layers[i].output, i);
+	}
+
+	buffer_size = 0;
+	for (auto& v : values)
+		buffer_size = std::max(buffer_size, rows(v, max_batch_size) * v.stride);
+}
+
+std::unique_ptr<NNCpu::Workspace> NNCpu::new_workspace() const
+{
+	auto ws = std::make_unique<Workspace>();
+	ws->buffers.resize(buffer_count);
+	for (auto& b : ws->buffers)
+		b.assign(buffer_size, 0.0f);
+	return ws;
+}
+
+// 指定数の推論slotを準備する。
+void NNCpu::prepare_slots(int slot_count)
+{
+	while (int(workspaces.size()) < slot_count)
+		workspaces.emplace_back(new_workspace());
+}
+
+// 推論の1ステップを実行する。
+void NNCpu::run_layer(const Layer& layer, Workspace& ws, int batch_size) const
+{
+	const Value& in   = values[layer.input];
+	const Value& out  = values[layer.output];
+	const float* x    = ws.buffers[in.buffer].data();
+	float*       y    = ws.buffers[out.buffer].data();
+	const size_t size = rows(out, batch_size) * out.stride;
+
+	switch (layer.type)
+	{
+	case LayerType::Conv:
+		for (int n = 0; n < batch_size; ++n)
+		{
+			const float* x_n = x + size_t(n) * size_t(SQ_NB) * in.stride;
+			float*       y_n = y + size_t(n) * size_t(SQ_NB) * out.stride;
+
+			for (int sq = 0; sq < SQ_NB; sq += SQ_BLOCK)
+			{
+				const float* src[SQ_BLOCK][9];
+				for (int r = 0; r < SQ_BLOCK; ++r)
+					for (int t = 0; t < layer.taps; ++t)
+					{
+						const int s = layer.taps == 1 ? sq + r : neighbor_table.sq[sq + r][t];
+						src[r][t]   = s < 0 ? zero_row.data() : x_n + size_t(s) * in.stride;
+					}
+
+				for (int oc = 0; oc < out.stride; oc += OC_BLOCK)
+					conv_block(src, layer.taps, in.channels, layer.weights.data() + oc, out.stride,
+						layer.bias.data() + oc, layer.relu, y_n + size_t(sq) * out.stride + oc, out.stride);
+			}
+		}
+		break;
+
+	case LayerType::Gemm:
+		for (int n = 0; n < batch_size; ++n)
+		{
+			const float* x_n = x + size_t(n) * in.stride;
+			for (int m = 0; m < out.channels; ++m)
+			{
+				const float* w   = layer.weights.data() + size_t(m) * in.channels;
+				float        sum = 0;
+				for (int k = 0; k < in.channels; ++k)
+					sum += x_n[k] * w[k];
+				sum += layer.bias[m];
+				y[size_t(n) * out.stride + m] = layer.relu ? std::max(sum, 0.0f) : sum;
+			}
+		}
+		break;
+
+	case LayerType::Affine:
+		for (size_t i = 0; i < size; i += out.stride)
+			for (int c = 0; c < out.stride; ++c)
+			{
+				float v = x[i + c];
+				if (!layer.scale.empty())
+					v *= layer.scale[c];
+				if (!layer.bias.empty())
+					v += layer.bias[c];
+				y[i + c] = v;
+			}
+		break;
+
+	case LayerType::Add:
+	case LayerType::Mul: {
+		const float* x2 = ws.buffers[values[layer.input2].buffer].data();
+		if (layer.type == LayerType::Add)
+			for (size_t i = 0; i < size; ++i)
+				y[i] = x[i] + x2[i];
+		else
+			for (size_t i = 0; i < size; ++i)
+				y[i] = x[i] * x2[i];
+		break;
+	}
+
+	case LayerType::Relu:
+		for (size_t i = 0; i < size; ++i)
+			y[i] = std::max(x[i], 0.0f);
+		break;
+
+	case LayerType::Sigmoid:
+		for (size_t i = 0; i < size; ++i)
+			y[i] = sigmoid(x[i]);
+		break;
+
+	case LayerType::Flatten:
+		// ONNXのNCHWの順(channel * 81 + 升)にする。
+		for (int n = 0; n < batch_size; ++n)
+			for (int sq = 0; sq < SQ_NB; ++sq)
+			{
+				const float* x_sq = x + (size_t(n) * size_t(SQ_NB) + sq) * in.stride;
+				float*       y_n  = y + size_t(n) * out.stride;
+				for (int c = 0; c < in.channels; ++c)
+					y_n[c * int(SQ_NB) + sq] = x_sq[c];
+			}
+		break;
+	}
+}
+
+// NNによる推論
+void NNCpu::forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
+{
+	forward(0, batch_size, p1, p2, x1, x2, y1, y2);
+}
+
+// NNによる推論
+void NNCpu::forward(const int slot_id, const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
+{
+	(void)p1; (void)p2;
+	ASSERT_LV3(0 <= slot_id && slot_id < int(workspaces.size()) && batch_size <= max_batch_size);
+
+	auto& ws = *workspaces[slot_id];
+
+	// 入力特徴量 [batch][channel][81] → [batch][81][stride]
+	auto to_rows = [&](const DType* x, const Value& v) {
+		float* dst = ws.buffers[v.buffer].data();
+		for (int n = 0; n < batch_size; ++n)
+			for (int c = 0; c < v.channels; ++c)
+			{
+				const DType* src = x + (size_t(n) * v.channels + c) * size_t(SQ_NB);
+				for (int sq = 0; sq < SQ_NB; ++sq)
+					dst[(size_t(n) * size_t(SQ_NB) + sq) * v.stride + c] = to_float(src[sq]);
+			}
+	};
+	to_rows(x1, values[input1]);
+	to_rows(x2, values[input2]);
+
+	for (auto& layer : layers)
+		run_layer(layer, ws, batch_size);
+
+	// 出力
+	const Value& p      = values[output_policy];
+	const float* policy = ws.buffers[p.buffer].data();
+	for (int n = 0; n < batch_size; ++n)
+	{
+		DType* dst = y1[n];
+		if (p.spatial)
+			for (int sq = 0; sq < SQ_NB; ++sq)
+				for (int c = 0; c < p.channels; ++c)
+					dst[c * int(SQ_NB) + sq] = to_dtype(policy[(size_t(n) * size_t(SQ_NB) + sq) * p.stride + c]);
+		else
+			for (int i = 0; i < p.channels; ++i)
+				dst[i] = to_dtype(policy[size_t(n) * p.stride + i]);
+	}
+
+	const Value& v     = values[output_value];
+	const float* value = ws.buffers[v.buffer].data();
+	for (int n = 0; n < batch_size; ++n)
+		y2[n] = to_dtype(value[size_t(n) * v.stride]);
+}
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(YANEURAOU_ENGINE_DEEP) && defined(CPU_NN)
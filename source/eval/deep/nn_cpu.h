@@ -0,0 +1,154 @@
+﻿#ifndef __NN_CPU_H_INCLUDED__
+#define __NN_CPU_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+#if defined(CPU_NN)
+
+// 外部ライブラリ(TensorRT/ONNX Runtimeなど)を用いずに、CPUだけで推論する場合。
+//
+// 📝 ONNXのモデルファイルを自前で読み込み、dlshogiのResNet(policy/value network)の推論に必要な
+//     operator(Conv, BatchNormalization, Gemm, Relu, Sigmoid, Add, Mulなど)だけを実装している。
+//     それ以外のoperatorを含むモデルは読み込み時にエラーになる。
+//
+//     盤面は9×9と小さいので、im2colは行わずに、channel方向を連続させたlayout([batch][81升][channel])で
+//     畳み込みを直接計算する。(AVX2/AVX-512があればそれを用いる)
+
+#include "nn.h"
+#include "nn_types.h"
+
+#include <memory>
+#include <vector>
+
+namespace YaneuraOu {
+namespace Eval::dlshogi {
+
+	// CPU推論用
+	class NNCpu : public NN
+	{
+	public:
+		// モデルファイルの読み込み。
+		virtual Tools::Result load(const std::string& model_path , int gpu_id , int batch_size) override;
+
+		// NNによる推論
+		// 💡 slot 0 を用いる。
+		virtual void forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2) override;
+
+		// NNによる推論。slotごとに作業領域を持っているので、slotが異なれば並列に呼び出して良い。
+		virtual void forward(const int slot_id, const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2) override;
+
+		// 確保済みの推論slot数。
+		virtual int slot_capacity() const override { return int(workspaces.size()); }
+
+		// 指定数の推論slotを準備する。
+		virtual void prepare_slots(int slot_count) override;
+
+		// 使用可能なデバイス数を取得する。
+		// 📝 CPUなので1とする。
+		static int get_device_count() { return 1; }
+
+		// 推論の1ステップ(ONNXのnode 1つ、もしくはそれを前後のnodeと融合したもの)の種類
+		enum class LayerType
+		{
+			Conv,      // 畳み込み(3×3 or 1×1)。bias、BatchNormalization、Reluを融合している。
+			Gemm,      // 全結合。bias、Reluを融合している。
+			Affine,    // channelごとの y = x * scale + bias。(BatchNormalization、定数とのAdd/Mul)
+			Add,       // 2つの値の要素ごとの和
+			Mul,       // 2つの値の要素ごとの積
+			Relu,
+			Sigmoid,
+			Flatten,   // [batch][81升][channel] → [batch][channel * 81] (ONNXのNCHWの順)
+		};
+
+		// 推論の1ステップ
+		struct Layer
+		{
+			LayerType type;
+
+			// 入出力の値のindex(values[])
+			int input  = -1;
+			int input2 = -1;
+			int output = -1;
+
+			// Conv : 畳み込みのtap数(9 or 1)
+			int taps = 0;
+
+			// 出力にReluを適用するか。
+			bool relu = false;
+
+			// Conv   : [tap][入力channel][出力channel(stride)]
+			// Gemm   : [出力channel][入力channel]
+			std::vector<float> weights;
+
+			// Conv,Gemm,Affine : [出力channel(stride)]
+			std::vector<float> bias;
+
+			// Affine : [channel(stride)]
+			std::vector<float> scale;
+		};
+
+		// 推論途中の値(tensor)
+		struct Value
+		{
+			// 盤面の形をしているか。
+			//   true  : [batch][81升][stride]  (ONNX上は[batch, channels, 9, 9])
+			//   false : [batch][stride]        (ONNX上は[batch, channels])
+			bool spatial;
+
+			// channel数(有効な要素数)
+			int channels;
+
+			// 1行あたりのfloatの数。channelsをSIMDの幅に切り上げたもの。
+			int stride;
+
+			// 割り当てた作業バッファの番号
+			int buffer = -1;
+		};
+
+	private:
+		// 値を生成して、そのindexを返す。
+		int new_value(bool spatial, int channels);
+
+		// 1行の数(spatialなら batch×81、そうでないならbatch)
+		size_t rows(const Value& v, int batch_size) const { return size_t(batch_size) * (v.spatial ? size_t(SQ_NB) : 1); }
+
+		// 各値に作業バッファを割り当てる。
+		void assign_buffers();
+
+		// 各slotの作業領域
+		struct Workspace
+		{
+			std::vector<std::vector<float>> buffers;
+		};
+
+		// slot用の作業領域を確保する。
+		std::unique_ptr<Workspace> new_workspace() const;
+
+		// 推論の1ステップを実行する。
+		void run_layer(const Layer& layer, Workspace& ws, int batch_size) const;
+
+		std::vector<Layer> layers;
+		std::vector<Value> values;
+
+		// 入出力に対応する値のindex
+		int input1 = -1, input2 = -1, output_policy = -1, output_value = -1;
+
+		// 作業バッファの数と、1つあたりのfloatの数。
+		int    buffer_count = 0;
+		size_t buffer_size  = 0;
+
+		// load()で指定されたbatch size。forward()はこれ以下のbatch sizeで呼び出すこと。
+		int max_batch_size = 0;
+
+		// 盤外を参照するときに用いる0で埋められた行
+		std::vector<float> zero_row;
+
+		std::vector<std::unique_ptr<Workspace>> workspaces;
+	};
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(CPU_NN)
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NN_CPU_H_INCLUDED__
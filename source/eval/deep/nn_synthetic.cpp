@@ -0,0 +1,166 @@
+﻿#include "nn_synthetic.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+#include <chrono>
+#include <thread>
+
+#include "../../usi.h"
+#include "../../misc.h"
+
+using namespace std;
+
+namespace YaneuraOu {
+using namespace Tools;
+
+namespace Eval::dlshogi {
+
+namespace {
+
+	// 64bitの値をかき混ぜる。(splitmix64の後半)
+	inline u64 mix64(u64 x)
+	{
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	// packed[]のbit [begin, begin + bits) のhash値を求める。
+	// 📝 1局面分の入力特徴量はbyte境界に揃っていないので、前後の局面のbitをmaskしてから混ぜる。
+	u64 hash_bits(const PType* packed, size_t begin, size_t bits, u64 h)
+	{
+		if (bits == 0)
+			return h;
+
+		const size_t end   = begin + bits;
+		const size_t first = begin >> 3;
+		const size_t last  = (end - 1) >> 3;
+
+		for (size_t i = first; i <= last; ++i)
+		{
+			u8 b = packed[i];
+			if (i == first)
+				b &= u8(0xff << (begin & 7));
+			if (i == last && (end & 7))
+				b &= u8(0xff >> (8 - (end & 7)));
+
+			h = mix64(h ^ b ^ (u64(i - first) << 8));
+		}
+		return h;
+	}
+
+} // namespace
+
+bool NNSynthetic::is_synthetic_model(const std::string& model_path)
+{
+	return StringExtension::StartsWith(Path::GetFileName(model_path), "synthetic");
+}
+
+Result NNSynthetic::load(const std::string& model_path, int gpu_id, int batch_size)
+{
+	(void)gpu_id;
+	(void)batch_size;
+
+	// "synthetic:"より後ろが設定。
+	const std::string name = Path::GetFileName(model_path);
+	const auto        pos  = name.find(':');
+	const std::string spec = pos == std::string::npos ? "" : name.substr(pos + 1);
+
+	auto error = [&](const std::string& message) {
+		sync_cout << "info string Error! : synthetic model, " << message << ", model = " << name << sync_endl;
+		return Result(ResultCode::FileMismatch);
+	};
+
+	// 💡 値は全体が数値として解釈できる時だけ受け付ける。(to_int()だと"abc"が0、"5x"が5になってしまう)
+	for (auto item : StringExtension::Split(spec, ","))
+	{
+		if (item.empty())
+			continue;
+
+		const auto        eq    = item.find('=');
+		const std::string key   = std::string(item.substr(0, eq));
+		const std::string value = eq == std::string_view::npos ? "" : std::string(item.substr(eq + 1));
+
+		if (key == "latency" || key == "per_position")
+		{
+			int us = -1;
+			if (!StringExtension::try_to_int(value, us) || us < 0)
+				return error("bad " + key + " = " + value);
+			(key == "latency" ? latency_us : per_position_us) = us;
+		}
+		else if (key == "value")
+		{
+			fixed_value = -1.0f;
+			if (value != "hash"
+				&& !(StringExtension::try_to_float(value, fixed_value) && 0.0f <= fixed_value && fixed_value <= 1.0f))
+				return error("bad value = " + value);
+		}
+		else if (key == "policy")
+		{
+			if (value != "hash" && value != "uniform")
+				return error("bad policy = " + value);
+			uniform_policy = value == "uniform";
+		}
+		else if (key == "seed")
+		{
+			int s = 0;
+			if (!StringExtension::try_to_int(value, s))
+				return error("bad seed = " + value);
+			seed = u64(s);
+		}
+		else
+			return error("unknown key = " + key);
+	}
+
+	sync_cout << "info string synthetic NN : latency = " << latency_us << "us, per_position = " << per_position_us
+	          << "us, value = " << (fixed_value < 0 ? std::string("hash") : std::to_string(fixed_value))
+	          << ", policy = " << (uniform_policy ? "uniform" : "hash") << ", seed = " << seed << sync_endl;
+
+	return ResultCode::Ok;
+}
+
+void NNSynthetic::forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2)
+{
+	(void)x1;
+	(void)x2;
+
+	// GPUの推論が終わるのを待つ時間。
+	// 💡 GPU待ちではCPUを使わないので、spinせずにsleepする。
+	const auto deadline = std::chrono::steady_clock::now()
+	                    + std::chrono::microseconds(latency_us + per_position_us * batch_size);
+
+	const auto&  spec  = input_feature_spec();
+	const size_t bits1 = size_t(spec.features1_channels) * size_t(SQ_NB);
+	const size_t bits2 = size_t(spec.features2_channels);
+
+	for (int i = 0; i < batch_size; ++i)
+	{
+		u64 h = mix64(seed + 0x9e3779b97f4a7c15ULL);
+		h = hash_bits(p1, bits1 * i, bits1, h);
+		h = hash_bits(p2, bits2 * i, bits2, h);
+
+		// value : [0.1, 0.9]
+		const float value = fixed_value >= 0 ? fixed_value : 0.1f + 0.8f * float(h >> 40) / float(1 << 24);
+		y2[i] = to_dtype(value);
+
+		// policy : logitなので[-2, 2]程度の値にしておく。
+		// 💡 hash 1つから16bitずつ取り出して4ラベル分に使う。(探索部の計測の邪魔にならないように軽くしておく)
+		auto&     policy = y1[i];
+		const int labels = MAX_MOVE_LABEL_NUM * int(SQ_NB);
+		u64       r      = 0;
+		for (int label = 0; label < labels; ++label)
+		{
+			if ((label & 3) == 0)
+				r = mix64(h + u64(label));
+			policy[label] = uniform_policy ? dtype_zero : to_dtype(4.0f * float(r & 0xffff) / 65536.0f - 2.0f);
+			r >>= 16;
+		}
+	}
+
+	std::this_thread::sleep_until(deadline);
+}
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
@@ -0,0 +1,68 @@
+﻿#ifndef __NN_SYNTHETIC_H_INCLUDED__
+#define __NN_SYNTHETIC_H_INCLUDED__
+#include "../../config.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+
+// 推論をせずに、局面から決定的に作ったpolicy/valueを返すだけのNN。
+//
+// 📝 探索部(UctSearcher/DlshogiSearcher)の速度を、GPUやモデルファイルなしで計測するためのもの。
+//     DNN_Modelに"synthetic"で始まる文字列を指定すると、どのDEEPのeditionでもこれが用いられる。
+//
+//       synthetic[:key=value,key=value,...]
+//
+//       latency      : forward()1回あたりにかかる時間[μs]。GPUの推論待ちを模倣する。(default : 0)
+//       per_position : forward()で1局面あたりに追加でかかる時間[μs]。(default : 0)
+//       value        : "hash"なら局面ごとに[0.1,0.9]の値。数値ならその値固定。(default : hash)
+//       policy       : "hash"なら局面と指し手ラベルごとに[-2,2]のlogit。"uniform"ならすべて0。(default : hash)
+//       seed         : hashに混ぜる値。(default : 0)
+//
+//     例) setoption name DNN_Model value synthetic:latency=2000,per_position=5
+//
+//     policy/valueは入力特徴量(packed)だけから決まるので、同じ局面に対しては常に同じ値を返す。
+
+#include "nn.h"
+#include "nn_types.h"
+
+#include <limits>
+
+namespace YaneuraOu {
+namespace Eval::dlshogi {
+
+	class NNSynthetic : public NN
+	{
+	public:
+		// model_pathのファイル名の部分に書かれている設定を読み込む。
+		virtual Tools::Result load(const std::string& model_path, int gpu_id, int batch_size) override;
+
+		// NNによる推論(のふり)
+		// 📝 状態を持たないので、並列に呼び出して良い。
+		virtual void forward(const int batch_size, PType* p1, PType* p2, NN_Input1* x1, NN_Input2* x2, NN_Output_Policy* y1, NN_Output_Value* y2) override;
+
+		// 作業領域を持たないので、slotはいくつでも良い。
+		virtual int slot_capacity() const override { return std::numeric_limits<int>::max(); }
+
+		// model_pathがNNSyntheticを指しているか。(ファイル名が"synthetic"で始まるか)
+		static bool is_synthetic_model(const std::string& model_path);
+
+	private:
+		// forward()1回あたりの待ち時間[μs]
+		int latency_us = 0;
+
+		// forward()で1局面あたりに追加される待ち時間[μs]
+		int per_position_us = 0;
+
+		// valueを固定値にするなら0以上。負ならhashから作る。
+		float fixed_value = -1.0f;
+
+		// policyのlogitをすべて0にするか。
+		bool uniform_policy = false;
+
+		u64 seed = 0;
+	};
+
+} // namespace Eval::dlshogi
+} // namespace YaneuraOu
+
+#endif // defined(YANEURAOU_ENGINE_DEEP)
+#endif // ndef __NN_SYNTHETIC_H_INCLUDED__
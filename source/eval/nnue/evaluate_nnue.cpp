@@ -9,6 +9,7 @@
 #include <cmath>
 #include <fstream>
 #include <limits>
+#include <mutex>
 #include <sstream>
 #include <vector>
 
@@ -246,6 +247,65 @@ int Parameters::BucketIndex(const Position& pos, int bucket_count) const {
     // NNUE評価関数パラメーター（共有メモリまたはローカルメモリ上に配置）
     SystemWideSharedConstant<NnueNetworks> shared_networks;
 
+    // NUMA nodeごとの複製
+    thread_local ThreadNetworks thread_networks;
+    std::atomic<u64>            networks_epoch{1};
+
+namespace {
+    // NUMA nodeごとの複製。[NumaIndex]
+    // 📝 NUMA nodeが1つしかないときは空。
+    std::vector<SystemWideSharedConstant<NnueNetworks>> numa_networks;
+
+    // numa_networksを作ったときのNUMAの設定。これが変わったら作り直す。
+    std::string numa_networks_config;
+
+    std::mutex numa_networks_mutex;
+
+    // 共有メモリの名前に含める、NUMA nodeの識別子。
+    // 💡 LazyNumaReplicatedSystemWide::get_discriminator()と同じく、そのnodeのCPUが属する
+    //     system(hardware)のNUMA nodeで区別する。
+    std::size_t numa_discriminator(const NumaConfig& cfg, NumaIndex n) {
+        const NumaConfig& cfg_sys = NumaConfig::from_system(SystemNumaPolicy{}, false);
+        CpuIndex          cpu     = *cfg.nodes[n].begin();
+        NumaIndex         sys_idx = cfg_sys.is_cpu_assigned(cpu) ? cfg_sys.nodeByCpu.at(cpu) : 0;
+        std::string       s       = cfg_sys.to_string() + "$" + std::to_string(sys_idx);
+        return static_cast<std::size_t>(hash_string(s));
+    }
+}
+
+    void ensure_networks_replicated(const NumaConfig& cfg, NumaIndex n) {
+        std::unique_lock<std::mutex> lk(numa_networks_mutex);
+
+        if (!cfg.requires_memory_replication() || n >= cfg.num_numa_nodes())
+            return;
+
+        // NUMAの設定が変わったなら、複製を作り直す。
+        const std::string config = cfg.to_string();
+        if (numa_networks_config != config || numa_networks.size() != cfg.num_numa_nodes())
+        {
+            networks_epoch.fetch_add(1, std::memory_order_release);
+            numa_networks.clear();
+            numa_networks.resize(cfg.num_numa_nodes());
+            numa_networks_config = config;
+        }
+
+        if (numa_networks[n] != nullptr)
+            return;
+
+        // そのnodeにbindしたスレッドでコピーすることで、そのnodeのメモリに配置されるようにする。
+        cfg.execute_on_numa_node(n, [&]() {
+            numa_networks[n] = SystemWideSharedConstant<NnueNetworks>(*shared_networks, numa_discriminator(cfg, n));
+        });
+    }
+
+    void bind_networks_to_thread(NumaIndex n) {
+        std::unique_lock<std::mutex> lk(numa_networks_mutex);
+
+        thread_networks.networks = (n < numa_networks.size() && numa_networks[n] != nullptr) ? &*numa_networks[n]
+                                                                                           : &*shared_networks;
+        thread_networks.epoch    = networks_epoch.load(std::memory_order_relaxed);
+    }
+
     // 評価関数ファイル名
     const char* const kFileName = EvalFileDefaultName;
 
@@ -326,6 +386,13 @@ namespace {
 		if (!stream || stream.peek() != std::ios::traits_type::eof())
 			return Tools::ResultCode::FileCloseError;
 
+		// NUMA nodeごとの複製と、各スレッドが保持しているそのポインターを無効化する。
+		{
+			std::unique_lock<std::mutex> lk(numa_networks_mutex);
+			networks_epoch.fetch_add(1, std::memory_order_release);
+			numa_networks.clear();
+		}
+
 		// 共有メモリに配置（同一ハッシュの共有メモリが既に存在すればそちらを参照）
 		shared_networks = SystemWideSharedConstant<NnueNetworks>(*tmp);
 
@@ -8,11 +8,14 @@
 
 #if defined(EVAL_NNUE)
 
+#include <atomic>
+
 #include "nnue_feature_transformer.h"
 #include "nnue_architecture.h"
 #include "../../misc.h"
 #include "../../memory.h"
 #include "../../shm.h"
+#include "../../numa.h"
 
 #if defined(SFNNwoPSQT)
 #define NNUE_SFNN_KING_BUCKET_TYPE_NONE 0
@@ -138,11 +141,43 @@ namespace Progress {
 		"NnueNetworks must be trivially copyable for shared memory support");
 
 	// NNUE評価関数パラメーター（共有メモリまたはローカルメモリ上に配置）
+	// 💡 読み込んだパラメーターはここに置かれる。下のNUMA nodeごとの複製は、これから作られる。
 	extern SystemWideSharedConstant<NnueNetworks> shared_networks;
 
-	// 共有メモリ上のNnueNetworksへのconst参照を返すヘルパー。
+	// 🌈 NUMA nodeごとの複製
+	//
+	// 複数socketの環境で、feature transformerなどの読み出しがnode間をまたがないように、
+	// NUMA nodeごとにパラメーターを複製して、各探索スレッドは自分の属するnodeの複製を用いる。
+	// 複製は、そのnodeにbindしたスレッドで作るので、そのnodeのメモリに配置される。
+	// また、同じパラメーター・同じnodeを用いる他のプロセスとはsystem wideで共有される。
+	// (StockfishのLazyNumaReplicatedSystemWideと同じ仕組み)
+	//
+	// ensure_networks_replicated() : NUMA node nの複製を(まだなければ)作る。探索開始前にUI threadから呼び出す。
+	// bind_networks_to_thread()    : 呼び出したスレッドが、以降、NUMA node nの複製を用いるようにする。
+	//                                探索スレッドが探索の開始時に呼び出す。
+	// 📝 NUMA nodeが1つしかないなら複製は作らず、shared_networksをそのまま用いる。
+	void ensure_networks_replicated(const NumaConfig& cfg, NumaIndex n);
+	void bind_networks_to_thread(NumaIndex n);
+
+	// bind_networks_to_thread()で設定された、このスレッドが用いるパラメーター。
+	// epochがnetworks_epochと異なる(パラメーターが読み込み直された、NUMAの設定が変わったなど)なら、
+	// このポインターは無効であり、shared_networksを用いる。
+	struct ThreadNetworks {
+		const NnueNetworks* networks = nullptr;
+		u64                 epoch    = 0;
+	};
+	extern thread_local ThreadNetworks thread_networks;
+
+	// numa_networks_mutexをlockして書き換えるが、networks()ではlockせずに読むのでatomicにしておく。
+	// 💡 x86では、acquireのloadは普通のloadと同じ命令になるので、評価関数の呼び出しが遅くなることはない。
+	extern std::atomic<u64>            networks_epoch;
+
+	// このスレッドが用いるNnueNetworksへのconst参照を返すヘルパー。
 	// 評価関数の呼び出しで毎回使われるので、インライン化する。
-	inline const NnueNetworks& networks() { return *shared_networks; }
+	inline const NnueNetworks& networks() {
+		return thread_networks.epoch == networks_epoch.load(std::memory_order_acquire) ? *thread_networks.networks
+		                                                                                : *shared_networks;
+	}
 
 	// 評価関数ファイル名
 	extern const char* const kFileName;
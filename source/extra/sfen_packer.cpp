@@ -178,6 +178,9 @@ HuffmanedPiece huffman_table_piecebox[] =
 //
 // 内部フォーマット = 手番1bit+王の位置7bit*2 + 盤上の駒(ハフマン符号化) + 手駒(ハフマン符号化)
 //
+// 💡 1bitずつ読み書きする素朴な実装。実際の変換には、下の表引きによる実装を用いる。
+//     こちらは、その検証とベンチマークのための参照実装として残してある。
+//
 struct SfenPacker
 {
 	// sfenをpackしてdata[32]に格納する。
@@ -520,6 +523,275 @@ struct SfenPacker
 	}
 };
 
+// -----------------------------------
+//   局面の圧縮・解凍(表引きによる実装)
+// -----------------------------------
+
+// 📝 上のSfenPackerは1bitずつ読み書きし、復号のときはハフマン符号表を線形に探すので遅い。
+//     学習データや定跡の局面を大量に展開するときにはここがボトルネックになるので、
+//     64bit単位で読み書きするビットストリームと、符号化・復号の表を用いて1駒を1回の表引きで処理する。
+//
+//     盤上の駒は、成りフラグと先後フラグを含めて最大8bit、手駒(駒箱の駒)は最大7bitなので、
+//     その分だけ先読みした値で表を引けば、駒とそのbit数が一度に得られる。
+//
+//     符号化された結果は、SfenPackerとbit単位で一致する。
+
+// 64bit単位で読み書きするビットストリーム
+// PackedSfen(256bit)専用。後ろに0を詰めた余白があるので、256bitを少し超えて読み書きしてもはみ出さない。
+struct BitStream64
+{
+	// 書き出し用に0クリアする。
+	void clear() { std::memset(words, 0, sizeof(words)); cursor = 0; }
+
+	// 読み込み用にPackedSfenの内容をセットする。
+	void set_data(const u8* data)
+	{
+		clear();
+		std::memcpy(words, data, 32);
+	}
+
+	// 書き出した内容(先頭の256bit)をdata[32]にコピーする。
+	void get_data(u8* data) const { std::memcpy(data, words, 32); }
+
+	// カーソルの取得。
+	int get_cursor() const { return cursor; }
+
+	// カーソル位置から64bitを先読みする。カーソルは進めない。
+	FORCE_INLINE u64 peek() const
+	{
+		const int w = cursor >> 6, b = cursor & 63;
+		return b ? (words[w] >> b) | (words[w + 1] << (64 - b)) : words[w];
+	}
+
+	// nビットのデータを読み込む。
+	FORCE_INLINE int read_n_bit(int n)
+	{
+		const int result = int(peek() & ((1ULL << n) - 1));
+		cursor += n;
+		return result;
+	}
+
+	FORCE_INLINE int  read_one_bit() { return read_n_bit(1); }
+	FORCE_INLINE void skip(int n) { cursor += n; }
+
+	// nビットのデータを書き出す。データはdの下位から順に書き出される。
+	FORCE_INLINE void write_n_bit(u64 d, int n)
+	{
+		// 駒の数がおかしい局面だと256bitを超えるので、余白を超える分は捨てる。
+		if (cursor + n > MAX_BITS)
+		{
+			cursor += n;
+			return;
+		}
+
+		const int w = cursor >> 6, b = cursor & 63;
+		words[w] |= d << b;
+		if (b + n > 64)
+			words[w + 1] |= d >> (64 - b);
+		cursor += n;
+	}
+
+private:
+	// 256bit + 余白
+	static constexpr int MAX_BITS = 64 * 7;
+	u64 words[8];
+
+	// 次に読み書きすべきbit位置。
+	int cursor;
+};
+
+// 符号化・復号に用いる表
+struct SfenPackTables
+{
+	// 盤上の駒の符号(成りフラグ、先後フラグ込み)。[Piece]
+	HuffmanedPiece board_code[PIECE_NB];
+
+	// 手駒の符号(成りフラグ = 0、先後フラグ込み)。[Piece]
+	HuffmanedPiece hand_code[PIECE_NB];
+
+	// 駒箱の駒の符号(先後フラグ込み)。[PieceType]
+	HuffmanedPiece piecebox_code[KING];
+
+	// 先読みした値から復号した駒とそのbit数
+	struct Decoded
+	{
+		u8 piece;
+		u8 bits;
+	};
+
+	// 盤上の駒の復号用。8bit先読みした値で引く。
+	Decoded board_decode[256];
+
+	// 手駒の復号用。7bit先読みした値で引く。駒箱の駒なら成り駒が得られる。
+	Decoded hand_decode[128];
+
+	SfenPackTables()
+	{
+		// codeの下位bitsビットがcodeと一致するすべての値に対して、表を埋める。
+		auto fill = [](Decoded* table, int table_bits, int code, int bits, Piece pc) {
+			for (int x = 0; x < (1 << table_bits); ++x)
+				if ((x & ((1 << bits) - 1)) == code)
+					table[x] = { u8(pc), u8(bits) };
+		};
+
+		// 盤上の駒 : ハフマン符号 + 成りフラグ(金以外) + 先後フラグ
+		board_code[NO_PIECE] = huffman_table[NO_PIECE_TYPE];
+		fill(board_decode, 8, huffman_table[NO_PIECE_TYPE].code, huffman_table[NO_PIECE_TYPE].bits, NO_PIECE);
+
+		// 手駒 : ハフマン符号のbit0を削ったもの + 成りフラグ(金以外) + 先後フラグ
+		for (auto c : COLOR)
+			for (PieceType pr = PAWN; pr < KING; ++pr)
+				for (int promote = 0; promote < (pr == GOLD ? 1 : 2); ++promote)
+				{
+					const Piece pc = make_piece(c, PieceType(pr + (promote ? PIECE_TYPE_PROMOTE : NO_PIECE_TYPE)));
+
+					int code = huffman_table[pr].code, bits = huffman_table[pr].bits;
+					if (pr != GOLD)
+						code |= promote << bits++;
+					code |= int(c) << bits++;
+					board_code[pc] = { code, bits };
+					fill(board_decode, 8, code, bits, pc);
+
+					code = huffman_table[pr].code >> 1, bits = huffman_table[pr].bits - 1;
+					if (pr != GOLD)
+						code |= promote << bits++;
+					code |= int(c) << bits++;
+					if (!promote)
+						hand_code[pc] = { code, bits };
+					fill(hand_decode, 7, code, bits, pc);
+				}
+
+		// 駒箱の駒 : 駒箱用の符号 + 先後フラグ(= 0)。金は先後フラグまで含めて駒箱用の符号になっている。
+		piecebox_code[NO_PIECE_TYPE] = { 0, 0 };
+		for (PieceType pr = PAWN; pr < KING; ++pr)
+			piecebox_code[pr] = { huffman_table_piecebox[pr].code, huffman_table_piecebox[pr].bits + (pr == GOLD ? 0 : 1) };
+	}
+};
+
+const SfenPackTables sfen_pack_tables;
+
+// 盤上の駒を1枚streamから読み込む
+FORCE_INLINE Piece read_board_piece(BitStream64& stream)
+{
+	const auto d = sfen_pack_tables.board_decode[stream.peek() & 0xff];
+	stream.skip(d.bits);
+	return Piece(d.piece);
+}
+
+// 手駒を1枚streamから読み込む
+// 駒箱の駒である場合、成り駒が返ってくる。
+FORCE_INLINE Piece read_hand_piece(BitStream64& stream)
+{
+	const auto d = sfen_pack_tables.hand_decode[stream.peek() & 0x7f];
+	stream.skip(d.bits);
+	return Piece(d.piece);
+}
+
+// 盤面(玉の位置と、piece_on(sq)で得られる盤上の駒)と手駒、手番をpackしてdata[32]に格納する。
+// 書き出し順は、SfenPacker::pack()と同じ。
+template <typename PieceOn>
+void pack_fast(const Square king_sq[COLOR_NB], PieceOn piece_on, const Hand hand[COLOR_NB], Color turn, u8* data)
+{
+	constexpr PieceType to_apery_pieces[] = { NO_PIECE_TYPE , PAWN, LANCE, KNIGHT, SILVER, GOLD, BISHOP , ROOK };
+
+	// 駒箱枚数
+	int32_t hp_count[8] =
+	{
+		0,
+		18/*PAWN*/, 4/*LANCE*/, 4/*KNIGHT*/, 4/*SILVER*/,
+		2/*BISHOP*/, 2/*ROOK*/, 4/*GOLD*/
+	};
+
+	BitStream64 stream;
+	stream.clear();
+
+	// 手番と、先手玉、後手玉の位置(それぞれ7bit)
+	stream.write_n_bit(u64(turn) | (u64(king_sq[BLACK]) << 1) | (u64(king_sq[WHITE]) << 8), 15);
+
+	// 盤上の玉以外の駒
+	for (auto sq : SQ)
+	{
+		const Piece pc = piece_on(sq);
+		if (type_of(pc) == KING)
+			continue;
+
+		const auto& c = sfen_pack_tables.board_code[pc];
+		stream.write_n_bit(c.code, c.bits);
+		hp_count[type_of(raw_of(pc))]--;
+	}
+
+	// 手駒
+	for (auto c : COLOR)
+		for (PieceType pr = PAWN; pr < KING; ++pr)
+		{
+			const PieceType pr2 = to_apery_pieces[pr];
+			const int       n   = hand_count(hand[c], pr2);
+			const auto&     code = sfen_pack_tables.hand_code[make_piece(c, pr2)];
+
+			for (int i = 0; i < n; ++i)
+				stream.write_n_bit(code.code, code.bits);
+			hp_count[pr2] -= n;
+		}
+
+	// 駒箱
+	for (PieceType pr = PAWN; pr < KING; ++pr)
+	{
+		const PieceType pr2  = to_apery_pieces[pr];
+		const auto&     code = sfen_pack_tables.piecebox_code[pr2];
+
+		for (int i = 0; i < hp_count[pr2]; ++i)
+			stream.write_n_bit(code.code, code.bits);
+	}
+
+	// 全部で256bitのはず。(普通の盤面であれば)
+	ASSERT_LV3(stream.get_cursor() == 256);
+
+	stream.get_data(data);
+}
+
+// data[32]を盤面と手駒、手番に展開する。
+void unpack_rawdata_fast(const u8* data, Piece board[81], Hand hand[2], Color& turn)
+{
+	BitStream64 stream;
+	stream.set_data(data);
+
+	memset(board, 0, sizeof(Piece) * 81);
+	hand[BLACK] = hand[WHITE] = HAND_ZERO;
+
+	// 手番
+	turn = (Color)stream.read_one_bit();
+
+	// まず玉の位置
+	for (auto c : COLOR)
+	{
+		Square king_sq = (Square)stream.read_n_bit(7);
+		if (king_sq < SQ_NB)
+			board[king_sq] = make_piece(c, KING);
+	}
+
+	// 盤上の駒
+	for (auto sq : SQ)
+	{
+		// すでに玉がいるようだ
+		if (type_of(board[sq]) == KING)
+			continue;
+
+		board[sq] = read_board_piece(stream);
+	}
+
+	// 手駒
+	while (stream.get_cursor() < 256)
+	{
+		auto pc = read_hand_piece(stream);
+
+		// 成り駒が返ってきたら、これは駒箱の駒。
+		if (is_promoted(pc))
+			continue;
+
+		add_hand(hand[(int)color_of(pc)], type_of(pc));
+	}
+}
+
 // -----------------------------------
 //        Positionクラスに追加
 // -----------------------------------
@@ -532,9 +804,7 @@ PackedSfen PackedSfen::flipped() const
 	Hand hand[2];
 	Color turn;
 
-	SfenPacker unpacker;
-	unpacker.data = const_cast<u8*>(data);
-	unpacker.unpack_rawdata(board, hand, turn);
+	unpack_rawdata_fast(data, board, hand, turn);
 
 	Piece flipped_board[81];
 	memset(flipped_board, 0, sizeof(flipped_board));
@@ -551,9 +821,7 @@ PackedSfen PackedSfen::flipped() const
 	flipped_hand[BLACK] = hand[WHITE];
 	flipped_hand[WHITE] = hand[BLACK];
 
-	SfenPacker packer;
-	packer.data = result.data;
-	packer.pack_rawdata(flipped_board, flipped_hand, ~turn);
+	SfenPacking::pack_rawdata(flipped_board, flipped_hand, ~turn, result);
 
 	return result;
 }
@@ -567,9 +835,8 @@ void PackedSfen::flip()
 // packer::unpack()とPosition::set()とを合体させて書く。
 Tools::Result Position::set_from_packed_sfen(const PackedSfen& sfen , StateInfo * si, bool mirror , int gamePly_ /* = 0 */)
 {
-	SfenPacker packer;
-	auto& stream = packer.stream;
-	stream.set_data((u8*)&sfen);
+	BitStream64 stream;
+	stream.set_data(sfen.data);
 
 	std::memset(static_cast<void*>(this), 0, sizeof(Position));
 	std::memset(static_cast<void*>(si), 0, sizeof(StateInfo));
@@ -614,7 +881,7 @@ Tools::Result Position::set_from_packed_sfen(const PackedSfen& sfen , StateInfo
 		if (type_of(board[sq]) != KING)
 		{
 			ASSERT_LV3(board[sq] == NO_PIECE);
-			pc = packer.read_board_piece_from_stream();
+			pc = read_board_piece(stream);
 		}
 		else
 		{
@@ -654,7 +921,7 @@ Tools::Result Position::set_from_packed_sfen(const PackedSfen& sfen , StateInfo
 	while (stream.get_cursor() < 256)
 	{
 		// 256になるまで手駒が格納されているはず
-		auto pc = packer.read_hand_piece_from_stream();
+		auto pc = read_hand_piece(stream);
 
 		// 成り駒は、無視する。(これは駒箱の駒)
 		if (is_promoted(pc))
@@ -742,20 +1009,99 @@ std::string Position::sfen_from_rawdata(Piece board[81], Hand hands[2], Color tu
 	// 棋譜を大量に読み込ませて学習させるときにここがボトルネックになるので直接unpackする関数を書く。
 }
 
+// 複数のPackedSfenをまとめて展開する。
+size_t Position::set_from_packed_sfens(Position* positions, StateInfo* states, const PackedSfen* sfens,
+	size_t count, const u16* gamePlys, bool* results)
+{
+	size_t errors = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		// 次の局面のPackedSfenを先読みしておく。
+		if (i + 1 < count)
+			prefetch(&sfens[i + 1]);
+
+		const bool ok = positions[i].set_from_packed_sfen(sfens[i], &states[i], false, gamePlys ? gamePlys[i] : 0).is_ok();
+		errors += !ok;
+		if (results)
+			results[i] = ok;
+	}
+	return errors;
+}
+
+size_t Position::set_from_packed_sfens(Position* positions, StateInfo* states, const PsvRecord* records,
+	size_t count, bool* results)
+{
+	size_t errors = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (i + 1 < count)
+			prefetch(&records[i + 1]);
+
+		const bool ok = positions[i].set_from_packed_sfen(records[i].sfen, &states[i], false, records[i].gamePly).is_ok();
+		errors += !ok;
+		if (results)
+			results[i] = ok;
+	}
+	return errors;
+}
+
 // packされたsfenを得る。引数に指定したバッファに返す。
 void Position::sfen_pack(PackedSfen& sfen)
 {
-	SfenPacker sp;
-	sp.data = (u8*)&sfen;
-	sp.pack(*this);
+	const Square king_sq[COLOR_NB] = { square<KING>(BLACK), square<KING>(WHITE) };
+	pack_fast(king_sq, [&](Square sq) { return piece_on(sq); }, hand, sideToMove, sfen.data);
 }
 
 // packされたsfenを解凍する。sfen文字列が返る。
 std::string Position::sfen_unpack(const PackedSfen& sfen)
 {
-	SfenPacker sp;
-	sp.data = (u8*)&sfen;
-	return sp.unpack();
+	Piece board[81];
+	Hand hand[2];
+	Color turn;
+	unpack_rawdata_fast(sfen.data, board, hand, turn);
+
+	return Position::sfen_from_rawdata(board, hand, turn, 0);
+}
+
+// -----------------------------------
+//        SfenPacking
+// -----------------------------------
+
+namespace SfenPacking
+{
+	void pack_rawdata(const Piece board[81], const Hand hand[2], Color turn, PackedSfen& sfen)
+	{
+		// 玉が見つからなければSQ_NB。(詰将棋の片玉など)
+		Square king_sq[COLOR_NB] = { SQ_NB, SQ_NB };
+		for (auto sq : SQ)
+			if (type_of(board[sq]) == KING)
+			{
+				const Color c = color_of(board[sq]);
+				if (king_sq[c] == SQ_NB)
+					king_sq[c] = sq;
+			}
+
+		pack_fast(king_sq, [&](Square sq) { return board[sq]; }, hand, turn, sfen.data);
+	}
+
+	void unpack_rawdata(const PackedSfen& sfen, Piece board[81], Hand hand[2], Color& turn)
+	{
+		unpack_rawdata_fast(sfen.data, board, hand, turn);
+	}
+
+	void pack_rawdata_reference(const Piece board[81], const Hand hand[2], Color turn, PackedSfen& sfen)
+	{
+		SfenPacker sp;
+		sp.data = sfen.data;
+		sp.pack_rawdata(board, hand, turn);
+	}
+
+	void unpack_rawdata_reference(const PackedSfen& sfen, Piece board[81], Hand hand[2], Color& turn)
+	{
+		SfenPacker sp;
+		sp.data = const_cast<u8*>(sfen.data);
+		sp.unpack_rawdata(board, hand, turn);
+	}
 }
 
 } // namespace YaneuraOu
@@ -9,6 +9,10 @@
 
 #if defined(__linux__) && !defined(__ANDROID__)
     #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <string>
+    #include <vector>
 #endif
 
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
@@ -207,4 +211,61 @@ void aligned_large_pages_free(void* mem) { std_aligned_free(mem); }
 
 #endif
 
+// 🌈 やねうら王独自
+// NUMA nodeへのメモリの配置
+
+#if defined(__linux__) && !defined(__ANDROID__) && defined(SYS_mbind)
+
+bool numa_interleave_memory(void* mem, size_t size) {
+
+    // 💡 libnumaに依存したくないので、mbind()をsystem callで直接呼び出す。
+    //     MPOL_INTERLEAVE, MPOL_MF_MOVEの値は<linux/mempolicy.h>による。
+    //     すでに触れたpageがあった場合(mallocが使い回したメモリなど)に備えて、MPOL_MF_MOVEも指定しておく。
+    constexpr int      MPOL_INTERLEAVE_ = 3;
+    constexpr unsigned MPOL_MF_MOVE_    = 1 << 1;
+
+    // /sys/devices/system/node/online には "0-1" や "0,2-3" のような形式で有効なnodeが書いてある。
+    auto online = read_file_to_string("/sys/devices/system/node/online");
+    if (!online.has_value())
+        return false;
+
+    std::vector<unsigned long> nodemask;
+    size_t                     node_count = 0;
+    const size_t               bits       = sizeof(unsigned long) * 8;
+
+    for (const auto& range : split(*online, ","))
+    {
+        const auto parts = split(range, "-");
+        if (parts.empty() || parts[0].empty())
+            continue;
+
+        const size_t first = std::stoull(std::string(parts[0]));
+        const size_t last  = parts.size() >= 2 ? std::stoull(std::string(parts[1])) : first;
+        for (size_t n = first; n <= last; ++n)
+        {
+            if (nodemask.size() <= n / bits)
+                nodemask.resize(n / bits + 1);
+            nodemask[n / bits] |= 1UL << (n % bits);
+            ++node_count;
+        }
+    }
+
+    // node が1つしかないなら、interleaveする意味がない。
+    if (node_count <= 1)
+        return false;
+
+    return syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE_, nodemask.data(), nodemask.size() * bits + 1, MPOL_MF_MOVE_) == 0;
+}
+
+bool numa_release_pages(void* mem, size_t size) {
+    return madvise(mem, size, MADV_DONTNEED) == 0;
+}
+
+#else
+
+bool numa_interleave_memory(void* mem, size_t size) { return false; }
+bool numa_release_pages(void* mem, size_t size) { return false; }
+
+#endif
+
 } // namespace YaneuraOu
@@ -65,6 +65,18 @@ void  aligned_large_pages_free(void* mem);
 // 現環境でlarge pagesが使えるか判定して返す。
 bool has_large_pages();
 
+// 🌈 やねうら王独自
+// aligned_large_pages_alloc()で確保したメモリのNUMA nodeへの配置。(置換表で用いる)
+//
+// numa_interleave_memory() : [mem, mem+size)のpageを、すべてのNUMA nodeに交互に割り当てるように設定する。
+//                            まだ一度も触れていないメモリに対して呼び出すこと。
+// numa_release_pages()     : [mem, mem+size)の物理pageを解放する。内容はゼロになり、次にそのpageに
+//                            触れたスレッドのNUMA nodeに割り当て直される。(first touch)
+//                            memとsizeはpage sizeの倍数でなければならない。
+// 💡 どちらもLinuxでのみ機能する。それ以外の環境では何もせずにfalseを返す。
+bool numa_interleave_memory(void* mem, size_t size);
+bool numa_release_pages(void* mem, size_t size);
+
 // Frees memory which was placed there with placement new.
 // Works for both single objects and arrays of unknown bound.
 
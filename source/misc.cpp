@@ -16,6 +16,7 @@
 #endif
 
 #include <windows.h>
+#include <psapi.h>  // GetProcessMemoryInfo()
 // The needed Windows API for processor groups could be missed from old Windows
 // versions, so instead of calling them directly (forcing the linker to resolve
 // the calls at compile time), try to load them at runtime. To do this we need
@@ -45,6 +46,13 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 #include <sys/mman.h> // madvise()
 #endif
 
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <fcntl.h>     // open()
+#include <sys/mman.h>  // mmap()
+#include <sys/stat.h>  // fstat()
+#include <unistd.h>    // close()
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) || defined(__e2k__)
 #define POSIXALIGNEDALLOC
 #include <stdlib.h>
@@ -672,26 +680,15 @@ namespace Tools {
 			sync_cout << "info string " + string(name_) + " : Start clearing with " << threadCount << " threads , size =  " << size / (1024 * 1024) << "[MB]" << sync_endl;
 
 		// マルチスレッドで並列化してクリアする。
+		// 📝 各スレッドがまず自分の担当範囲(sizeをthreadCount等分したもの)をゼロクリアし、
+		//     早く終わったスレッドは、遅いスレッドの担当範囲の残りを手伝う。
+		//     1chunkは、スレッドごとに16分割程度(ただし最低でも1MB)にしておく。
 
-		for (size_t i = 0; i < threadCount; ++i)
-		{
-			threads.run_on_thread(i, [table, size, threadCount, i]() {
-				// それぞれのスレッドがhash tableの各パートをゼロ初期化する。
-				// start  : このスレッドによるゼロクリア開始位置
-				// stride : 各スレッドのゼロクリアするサイズ
-				// len    : このスレッドによるゼロクリアするサイズ。
-				//          strideと等しいが、最後のスレッドだけは端数を考慮し、
-				//			size - start のサイズだけクリアする必要がある。
-				const size_t stride = size / threadCount,
-				start = stride * i,
-				len = (i != threadCount - 1) ? stride : size - start;
-
-				memset((uint8_t*)table + start, 0, len);
-			});
-		}
+		const size_t grain = std::max(size / (threadCount * 16 + 1), size_t(1024 * 1024));
 
-		for (size_t i = 0; i < threadCount; ++i)
-			threads.wait_on_thread(i);
+		threads.parallel_for(0, size, grain, [table](size_t /*threadId*/, size_t start, size_t end) {
+			memset((uint8_t*)table + start, 0, end - start);
+		});
 
 		if (name_ != nullptr)
 			sync_cout << "info string " + string(name_) + " : Finish clearing." << sync_endl;
@@ -719,6 +716,26 @@ namespace Tools {
 		this_thread::sleep_for(chrono::milliseconds(ms));
 	}
 
+	// このプロセスが現在使用している物理メモリ(RSS)[byte]を返す。
+	size_t resident_memory()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+			return size_t(pmc.WorkingSetSize);
+		return 0;
+#elif defined(__linux__)
+		// /proc/self/statm の2番目の値が、RSSのpage数。
+		std::ifstream fs("/proc/self/statm");
+		size_t total_pages = 0, resident_pages = 0;
+		if (fs >> total_pages >> resident_pages)
+			return resident_pages * size_t(sysconf(_SC_PAGESIZE));
+		return 0;
+#else
+		return 0;
+#endif
+	}
+
 	// 現在時刻を文字列化したもを返す。(評価関数の学習時などに用いる)
 	string now_string()
 	{
@@ -1439,6 +1456,101 @@ namespace SystemIO
 
 		return Tools::Result::Ok();
 	}
+
+	// === MemoryMappedFile ===
+
+	// ファイル全体を読み込み専用でmapする。
+	Tools::Result MemoryMappedFile::Open(const string& filename)
+	{
+		Close();
+
+		// 起動フォルダ相対でのpath
+		std::string path = Path::Combine(Directory::GetBinaryFolder(), filename);
+
+#if defined(_WIN32)
+
+		HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (hFile == INVALID_HANDLE_VALUE)
+			return Tools::Result(Tools::ResultCode::FileOpenError);
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(hFile, &file_size) || file_size.QuadPart == 0)
+		{
+			CloseHandle(hFile);
+			return Tools::Result(Tools::ResultCode::FileReadError);
+		}
+
+		HANDLE hMap = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (hMap == nullptr)
+		{
+			CloseHandle(hFile);
+			return Tools::Result(Tools::ResultCode::FileReadError);
+		}
+
+		void* ptr = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+		if (ptr == nullptr)
+		{
+			CloseHandle(hMap);
+			CloseHandle(hFile);
+			return Tools::Result(Tools::ResultCode::FileReadError);
+		}
+
+		file_handle    = hFile;
+		mapping_handle = hMap;
+		data_          = reinterpret_cast<const u8*>(ptr);
+		size_          = size_t(file_size.QuadPart);
+		return Tools::Result::Ok();
+
+#elif !defined(__EMSCRIPTEN__)
+
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd == -1)
+			return Tools::Result(Tools::ResultCode::FileOpenError);
+
+		struct stat st;
+		if (::fstat(fd, &st) == -1 || st.st_size <= 0)
+		{
+			::close(fd);
+			return Tools::Result(Tools::ResultCode::FileReadError);
+		}
+
+		void* ptr = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+		// mapしたあとはfile descriptorは不要。(mapはmunmap()するまで有効)
+		::close(fd);
+
+		if (ptr == MAP_FAILED)
+			return Tools::Result(Tools::ResultCode::FileReadError);
+
+		data_ = reinterpret_cast<const u8*>(ptr);
+		size_ = size_t(st.st_size);
+		return Tools::Result::Ok();
+
+#else
+		return Tools::Result(Tools::ResultCode::NotImplementedError);
+#endif
+	}
+
+	// mapを解除してファイルを閉じる。
+	void MemoryMappedFile::Close()
+	{
+#if defined(_WIN32)
+		if (data_ != nullptr)
+			UnmapViewOfFile(data_);
+		if (mapping_handle != nullptr)
+			CloseHandle(mapping_handle);
+		if (file_handle != nullptr)
+			CloseHandle(file_handle);
+		mapping_handle = nullptr;
+		file_handle    = nullptr;
+#elif !defined(__EMSCRIPTEN__)
+		if (data_ != nullptr)
+			::munmap(const_cast<u8*>(data_), size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
 }
 
 // Reads the file as bytes.
@@ -1830,6 +1942,23 @@ namespace StringExtension
 		return result;
 	}
 
+	// 文字列全体をint/floatとして解釈できた時だけresultに格納してtrueを返す。
+	// 💡 istringstreamで読んだあと、末尾まで読み切っているかを調べる。
+	template <typename T>
+	static bool try_to_number(const string& input, T& result)
+	{
+		istringstream ss(input);
+		T value;
+		ss >> value;
+		if (ss.fail() || !ss.eof())
+			return false;
+		result = value;
+		return true;
+	}
+
+	bool try_to_int(const string& input, int& result) { return try_to_number(input, result); }
+	bool try_to_float(const string& input, float& result) { return try_to_number(input, result); }
+
 	// スペース、タブなど空白に相当する文字で分割して返す。
 	vector<string> split(const string& input)
 	{
@@ -2128,10 +2257,72 @@ namespace Misc {
 				tester.test("to_string_with_zero", StringExtension::to_string_with_zero(1234, 6) == "001234");
 				tester.test("ToUpper"            , StringExtension::ToUpper("False&True") == "FALSE&TRUE");
 
+				int   i = -1;
+				float f = -1.0f;
+				tester.test("try_to_int"         , StringExtension::try_to_int("8", i) && i == 8
+				                                   && StringExtension::try_to_int("-12", i) && i == -12);
+				tester.test("try_to_int garbage" , !StringExtension::try_to_int("foo", i) && !StringExtension::try_to_int("8x", i)
+				                                   && !StringExtension::try_to_int("", i) && i == -12);
+				tester.test("try_to_float"       , StringExtension::try_to_float("0.5", f) && f == 0.5f
+				                                   && !StringExtension::try_to_float("abc", f) && !StringExtension::try_to_float("1.5ms", f) && f == 0.5f);
+
 				auto v = StringExtension::Split("ABC ; DEF ; GHI", " ; ");
 				tester.test("Split"              , v[0]=="ABC" && v[1]=="DEF" && v[2] =="GHI");
 			}
 		}
+		{
+			auto section2 = tester.section("ThreadPool");
+
+			auto& threads = engine.get_threads();
+
+			// すべての要素がちょうど1回ずつ処理されるか。処理時間に偏りをつけて、work stealingを起こさせる。
+			{
+				const size_t                   n = 10007;
+				std::vector<std::atomic<int>>  visited(n);
+				std::atomic<bool>              bad_thread_id(false);
+
+				threads.parallel_for(0, n, 7, [&](size_t thread_id, size_t begin, size_t end) {
+					if (thread_id >= std::max(threads.num_threads(), size_t(1)) || end - begin > 7)
+						bad_thread_id = true;
+					for (size_t i = begin; i < end; ++i)
+					{
+						// 先頭のほうの要素だけ重くしておく。
+						if (i < n / 8)
+							for (volatile int k = 0; k < 10000; ++k) {}
+						visited[i]++;
+					}
+				});
+
+				bool ok = !bad_thread_id;
+				for (auto& v : visited)
+					ok &= v == 1;
+				tester.test("parallel_for", ok);
+			}
+
+			// スレッド数を制限した時と、空の区間。
+			{
+				std::atomic<size_t> sum(0);
+				std::atomic<bool>   bad_thread_id(false);
+				threads.parallel_for(10, 110, 3, [&](size_t thread_id, size_t begin, size_t end) {
+					if (thread_id != 0)
+						bad_thread_id = true;
+					for (size_t i = begin; i < end; ++i)
+						sum += i;
+				}, 1);
+				tester.test("parallel_for threadCount", !bad_thread_id && sum == (10 + 109) * 100 / 2);
+
+				bool called = false;
+				threads.parallel_for(5, 5, 1, [&](size_t, size_t, size_t) { called = true; });
+				tester.test("parallel_for empty", !called);
+			}
+
+			// memclear
+			{
+				std::vector<u8> buf(3 * 1024 * 1024 + 123, 0xcc);
+				Tools::memclear(threads, nullptr, buf.data(), buf.size());
+				tester.test("memclear", std::all_of(buf.begin(), buf.end(), [](u8 b) { return b == 0; }));
+			}
+		}
 	}
 } // namespace Misc
 
@@ -643,6 +643,10 @@ namespace Tools
 	// 指定されたミリ秒だけsleepする。
 	void sleep(u64 ms);
 
+	// このプロセスが現在使用している物理メモリ(RSS, WindowsではWorking Set)[byte]を返す。
+	// 取得できない環境では0を返す。(メモリ使用量の計測用)
+	size_t resident_memory();
+
 	// 現在時刻を文字列化したもを返す。(評価関数の学習時などにログ出力のために用いる)
 	std::string now_string();
 
@@ -1002,6 +1006,48 @@ namespace SystemIO
 		// ※　sizeは2GB制限があるので気をつけて。
 		Tools::Result Write(void* ptr, size_t size);
 	};
+
+	// ファイルを読み込み専用でメモリにmapするclass
+	// 同じファイルをmapしている複数のプロセス間でOSのpage cacheが共有されるので、
+	// 巨大な定跡ファイルを複数のエンジンから参照するような用途で用いる。
+	// 💡 mmapが使えない環境(WASMなど)では、Open()はNotImplementedErrorを返す。
+	class MemoryMappedFile
+	{
+	public:
+		MemoryMappedFile() {}
+		~MemoryMappedFile() { Close(); }
+
+		// mapしたアドレスを保持しているのでコピーは不可。
+		MemoryMappedFile(const MemoryMappedFile&) = delete;
+		MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+		// ファイルをopenして、ファイル全体を読み込み専用でmapする。
+		// 空のファイルはmapできないのでFileReadErrorを返す。
+		// 💡 filenameは、起動フォルダ相対で指定する。
+		Tools::Result Open(const std::string& filename);
+
+		// mapを解除してファイルを閉じる。デストラクタからも呼び出される。
+		void Close();
+
+		// ファイルをmapしている状態であるか。
+		bool is_open() const { return data_ != nullptr; }
+
+		// mapされたファイルの先頭アドレス。
+		const u8* data() const { return data_; }
+
+		// mapされたファイルのサイズ[byte]
+		size_t size() const { return size_; }
+
+	private:
+		const u8* data_ = nullptr;
+		size_t    size_ = 0;
+
+#if defined(_WIN32)
+		// CreateFile()とCreateFileMapping()で得たHANDLE。
+		void* file_handle    = nullptr;
+		void* mapping_handle = nullptr;
+#endif
+	};
 };
 
 // Reads the file as bytes.
@@ -1270,6 +1316,11 @@ namespace StringExtension
 	// 文字列をfloat化する。float化に失敗した場合はdefault_の値を返す。
 	float to_float(const std::string input, float default_);
 
+	// 文字列全体をint/floatとして解釈できた時だけresultに格納してtrueを返す。
+	// to_int()/to_float()と違い、"abc"や"8x"のように数値として解釈できない文字が残っていたらfalse。
+	bool try_to_int(const std::string& input, int& result);
+	bool try_to_float(const std::string& input, float& result);
+
 	// スペース、タブなど空白に相当する文字で分割して返す。
 	std::vector<std::string> split(const std::string& input);
 
@@ -8,6 +8,7 @@
 
 #include "bitboard.h"
 #include "position.h"
+#include "tt.h"
 
 namespace YaneuraOu {
 using namespace Eval; // Eval::PieceValue
@@ -170,6 +171,12 @@ MovePicker::MovePicker(const Position&              p,
         // ⇨ 通常探索から呼び出されたのか、静止探索から呼び出されたのかについてはdepth > 0 によって判定できる。
         stage = (depth > 0 ? MAIN_TT : QSEARCH_TT)
               + !(ttm && pos.pseudo_legal(ttm, generate_all_legal_moves));
+
+#if defined(ENABLE_TT_STATS)
+    // 置換表の指し手がpseudo-legalではなかった回数を数える。
+    if (ttm && !pos.pseudo_legal(ttm, generate_all_legal_moves))
+        TTStats::add(TTStats::TTMoveNotPseudoLegal);
+#endif
 #endif
 
 	// ⇨ Stockfish 16のコード、ttm(置換表の指し手)は無条件でこのMovePickerが返す1番目の指し手としているが、これだと
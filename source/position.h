@@ -994,6 +994,16 @@ public:
 	// PackedSfenにgamePlyは含まないので復元できない。そこを設定したいのであれば引数で指定すること。
 	Tools::Result set_from_packed_sfen(const PackedSfen& sfen , StateInfo * si , bool mirror=false , int gamePly_ = 0);
 
+	// ↑を複数局面に対してまとめて行う。学習データや定跡ファイルの局面を大量に展開するとき用。
+	// positions[i]に、sfens[i](あるいはrecords[i].sfen)の局面をstates[i]を用いて設定する。
+	// gamePlyは、gamePlysがnullptrなら0、PsvRecordならrecords[i].gamePlyとなる。
+	// resultsがnullptrでなければ、results[i]に展開できたかどうかを格納する。
+	// 返し値 : 展開できなかった局面の数
+	static size_t set_from_packed_sfens(Position* positions, StateInfo* states, const PackedSfen* sfens,
+		size_t count, const u16* gamePlys = nullptr, bool* results = nullptr);
+	static size_t set_from_packed_sfens(Position* positions, StateInfo* states, const PsvRecord* records,
+		size_t count, bool* results = nullptr);
+
 	// 盤面と手駒、手番を与えて、そのsfenを返す。
 	static std::string sfen_from_rawdata(Piece board[81], Hand hands[2], Color turn, int gamePly);
 
@@ -1181,6 +1191,22 @@ private:
 // 盤面を出力する。(USI形式ではない) デバッグ用。
 std::ostream& operator<<(std::ostream& os, const Position& pos);
 
+// PackedSfenの符号化・復号を直接呼び出すための関数群
+// 💡 通常は、Position::sfen_pack()やPosition::set_from_packed_sfen()を用いれば良い。
+namespace SfenPacking
+{
+	// 盤面と手駒、手番をpackする。
+	void pack_rawdata(const Piece board[81], const Hand hand[2], Color turn, PackedSfen& sfen);
+
+	// packされたsfenを盤面と手駒、手番に展開する。
+	void unpack_rawdata(const PackedSfen& sfen, Piece board[81], Hand hand[2], Color& turn);
+
+	// 1bitずつ読み書きする素朴な実装。
+	// 上の表引きによる実装(Position::sfen_pack()なども用いている)の検証とベンチマーク用。
+	void pack_rawdata_reference(const Piece board[81], const Hand hand[2], Color turn, PackedSfen& sfen);
+	void unpack_rawdata_reference(const PackedSfen& sfen, Piece board[81], Hand hand[2], Color& turn);
+}
+
 inline Color Position::side_to_move() const { return sideToMove; }
 
 inline Piece Position::piece_on(Square s) const {
@@ -1,4 +1,10 @@
-﻿#include "search.h"
+﻿#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#include "search.h"
 #include "evaluate.h"
 
 namespace YaneuraOu {
@@ -59,6 +65,154 @@ void Search::Worker::ensure_network_replicated() {
 //void Search::Worker::clear()
 // 💡　エンジン実装部で定義する。
 
+// -----------------------
+//   探索のテレメトリ
+// -----------------------
+
+namespace Search::Telemetry {
+
+std::atomic<bool> dump_on_stop(false);
+
+namespace {
+
+#if defined(ENABLE_SEARCH_TELEMETRY)
+
+	const char* event_name(int e) {
+		static const char* names[EVENT_NB] = {
+		  "SearchStart", "SearchEnd", "IterationStart", "IterationEnd", "FailHigh", "FailLow",
+		  "AspirationResearch", "TTCutoff", "CheckTime", "TimeStop", "TimeSearchEnd"};
+		return 0 <= e && e < EVENT_NB ? names[e] : "?";
+	}
+
+	// 生存しているスレッドのリングバッファ
+	struct Registry {
+		std::mutex         mutex;
+		std::vector<Ring*> live;
+
+		// 出力時の時刻の基準。最後の探索の開始時刻[μs]。
+		std::atomic<u64>   epochUs{0};
+	};
+
+	Registry& registry() {
+		static Registry r;
+		return r;
+	}
+
+	// スレッドごとのリングバッファ。スレッドの終了時に、その記録は破棄される。
+	// 💡 リングバッファは大きいので、thread_localな領域ではなくheapに確保する。
+	struct LocalRing {
+		std::unique_ptr<Ring> ring;
+
+		LocalRing() : ring(std::make_unique<Ring>()) {
+			ring->count.store(0, std::memory_order_relaxed);
+			ring->threadIdx = size_t(-1);
+
+			auto& r = registry();
+			std::lock_guard<std::mutex> lk(r.mutex);
+			r.live.push_back(ring.get());
+		}
+
+		~LocalRing() {
+			auto& r = registry();
+			std::lock_guard<std::mutex> lk(r.mutex);
+			r.live.erase(std::find(r.live.begin(), r.live.end(), ring.get()));
+		}
+	};
+#endif
+}
+
+#if defined(ENABLE_SEARCH_TELEMETRY)
+
+Ring& local_ring() {
+	thread_local LocalRing local;
+	return *local.ring;
+}
+
+void search_started() { registry().epochUs = now_us(); }
+
+#endif
+
+void clear() {
+#if defined(ENABLE_SEARCH_TELEMETRY)
+	auto& r = registry();
+	std::lock_guard<std::mutex> lk(r.mutex);
+	for (auto* ring : r.live)
+		ring->count.store(0, std::memory_order_relaxed);
+#endif
+}
+
+std::vector<std::string> dump(size_t last, bool currentSearchOnly) {
+#if defined(ENABLE_SEARCH_TELEMETRY)
+	auto& r = registry();
+	std::lock_guard<std::mutex> lk(r.mutex);
+
+	std::vector<Ring*> rings;
+	for (auto* ring : r.live)
+		if (ring->count.load(std::memory_order_acquire) && ring->threadIdx != size_t(-1))
+			rings.push_back(ring);
+	std::sort(rings.begin(), rings.end(), [](Ring* a, Ring* b) { return a->threadIdx < b->threadIdx; });
+
+	const u64 epoch = r.epochUs;
+
+	// 探索開始からの時刻[ms]を小数点以下3桁で。探索開始より前なら負になる。
+	auto ms = [epoch](u64 t) {
+		std::ostringstream ss;
+		ss << std::fixed << std::setprecision(3) << std::setw(10) << (double(s64(t - epoch)) / 1000.0);
+		return ss.str();
+	};
+
+	std::vector<std::string> lines;
+	if (rings.empty())
+		lines.push_back("search telemetry : no events.");
+
+	for (auto* ring : rings)
+	{
+		const u64 count = ring->count.load(std::memory_order_acquire);
+		const u64 kept  = std::min<u64>(count, RING_SIZE);
+		u64       n     = last ? std::min<u64>(kept, last) : kept;
+
+		// 最後の探索より前のイベントを除く。
+		if (currentSearchOnly)
+			while (n > 0 && ring->records[(count - n) & (RING_SIZE - 1)].timeUs < epoch)
+				--n;
+
+		lines.push_back("search telemetry : thread " + std::to_string(ring->threadIdx) + " , events = " + std::to_string(count)
+		              + " , dropped = " + std::to_string(count - kept) + " , shown = " + std::to_string(n));
+
+		// iterationの開始時刻。IterationEndのときに、そのiterationにかかった時間を出力する。
+		u64 iterationStart[MAX_PLY + 1] = {};
+
+		for (u64 i = count - n; i < count; ++i)
+		{
+			const Record& rec = ring->records[i & (RING_SIZE - 1)];
+
+			std::string line = "  " + ms(rec.timeUs) + "ms " + event_name(rec.event)
+			                 + " depth = " + std::to_string(rec.depth)
+			                 + " value = " + std::to_string(rec.value)
+			                 + " nodes = " + std::to_string(rec.nodes);
+
+			if (rec.event == IterationStart && 0 <= rec.depth && rec.depth <= MAX_PLY)
+				iterationStart[rec.depth] = rec.timeUs;
+			else if (rec.event == IterationEnd && 0 <= rec.depth && rec.depth <= MAX_PLY && iterationStart[rec.depth])
+			{
+				std::ostringstream ss;
+				ss << std::fixed << std::setprecision(3) << double(rec.timeUs - iterationStart[rec.depth]) / 1000.0;
+				line += " (took " + ss.str() + "ms)";
+			}
+
+			lines.push_back(line);
+		}
+	}
+	return lines;
+#else
+	(void) last;
+	(void) currentSearchOnly;
+	return { "search telemetry : not available. Build with ENABLE_SEARCH_TELEMETRY defined." };
+#endif
+}
+
+} // namespace Search::Telemetry
+
 
 } // namespace YaneuraOu
 
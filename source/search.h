@@ -2,8 +2,11 @@
 #define SEARCH_H_INCLUDED
 
 //#include <cstdint>
+#include <atomic>
+#include <chrono>
 #include <cstring>
-//#include <vector>
+#include <string>
+#include <vector>
 
 #include "config.h"
 
@@ -590,6 +593,120 @@ protected:
 #endif
 };
 
+// -----------------------
+//   探索のテレメトリ
+// -----------------------
+
+/*
+	🌈 探索中のイベント(iterationの開始・終了、fail high/low、aspirationの再探索、置換表によるcutoff、
+	    check_time()での時間チェック)を、スレッドごとのリングバッファに記録する。
+
+	    持ち時間のある対局で、1手の思考時間がどこで使われたか(どのiterationで詰まったか等)を調べるためのもの。
+	    USI拡張コマンドの"search_telemetry"か、"stop"を受け取ったとき(dump_on_stopを有効にした場合)に出力される。
+
+	⚠ config.hのENABLE_SEARCH_TELEMETRYをdefineしてビルドしたときだけ有効。
+	   そうでないときは、record()などは空の関数になり、探索部には何もコードが生成されない。
+*/
+namespace Telemetry {
+
+// 記録するイベントの種類
+enum Event : u8 {
+	SearchStart,        // 探索の開始("go")
+	SearchEnd,          // 探索の終了                          depth = completedDepth
+	IterationStart,     // 反復深化の1 iterationの開始          depth = rootDepth
+	IterationEnd,       // 反復深化の1 iterationの終了          depth = rootDepth       , value = bestValue
+	FailHigh,           // aspiration searchでfail high       depth = rootDepth       , value = bestValue
+	FailLow,            // aspiration searchでfail low        depth = rootDepth       , value = bestValue
+	AspirationResearch, // 窓を広げての再探索                  depth = rootDepth       , value = 新しい窓の幅
+	TTCutoff,           // 置換表によるcutoff                 depth = 残り探索深さ     , value = ttValue
+	CheckTime,          // check_time()での時間チェック        depth = completedDepth  , value = 経過時間[ms]
+	TimeStop,           // check_time()で探索の停止を決めた     depth = completedDepth  , value = 経過時間[ms]
+	TimeSearchEnd,      // check_time()で思考終了時刻を決めた   depth = completedDepth  , value = 経過時間[ms]
+	EVENT_NB
+};
+
+// 1イベントの記録
+struct Record {
+	u64 timeUs; // 記録した時刻[μs]
+	u64 nodes;  // 記録したスレッドの探索node数
+	s32 value;
+	s16 depth;
+	u8  event;
+};
+
+#if defined(ENABLE_SEARCH_TELEMETRY)
+
+constexpr bool enabled = true;
+
+// 1スレッドあたりのリングバッファの大きさ。2の累乗であること。
+constexpr size_t RING_SIZE = size_t(1) << 16;
+
+// 置換表によるcutoffは、残り探索深さがこれ以上のときだけ記録する。
+// 💡 浅いnodeのcutoffは数が多すぎて、リングバッファがそれで埋まってしまうため。
+constexpr int TT_CUTOFF_MIN_DEPTH = 8;
+
+// スレッドごとのリングバッファ
+struct Ring {
+	Record records[RING_SIZE];
+
+	// これまでに記録した件数。records[count % RING_SIZE]が次に書き込む場所。
+	std::atomic<u64> count;
+
+	// 記録したスレッドのThreadPoolでのindex
+	size_t threadIdx;
+};
+
+// 呼び出したスレッドのリングバッファ。初回の呼び出しで確保される。
+Ring& local_ring();
+
+// 現在時刻[μs]
+inline u64 now_us() {
+	return u64(std::chrono::duration_cast<std::chrono::microseconds>(
+	             std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// 呼び出したスレッドのリングバッファにイベントを記録する。
+inline void record(Event e, int depth = 0, int value = 0, u64 nodes = 0) {
+	Ring&     ring = local_ring();
+	const u64 n    = ring.count.load(std::memory_order_relaxed);
+	Record&   r    = ring.records[n & (RING_SIZE - 1)];
+	r.timeUs = now_us();
+	r.nodes  = nodes;
+	r.value  = s32(value);
+	r.depth  = s16(depth);
+	r.event  = u8(e);
+	ring.count.store(n + 1, std::memory_order_release);
+}
+
+// 呼び出したスレッドのリングバッファに、ThreadPoolでのindexを設定する。
+inline void set_thread(size_t threadIdx) { local_ring().threadIdx = threadIdx; }
+
+// 探索の開始時刻として、出力時の時刻の基準にする。(main threadから"go"ごとに呼び出す)
+void search_started();
+
+#else
+
+constexpr bool enabled = false;
+
+inline void record(Event, int = 0, int = 0, u64 = 0) {}
+inline void set_thread(size_t) {}
+inline void search_started() {}
+
+#endif
+
+// すべてのスレッドの記録を消去する。
+void clear();
+
+// 記録を文字列化して返す。スレッドごとに、直近のlast件(0なら記録が残っているすべて)を出力する。
+//   currentSearchOnly : 最後の探索("go")の開始以降のイベントだけを出力する。
+// ⚠ 探索中に呼び出さないこと。
+std::vector<std::string> dump(size_t last = 0, bool currentSearchOnly = false);
+
+// "stop"を受け取ったときに記録を出力するか。(USI拡張コマンドの"search_telemetry dump_on_stop on"で設定する)
+extern std::atomic<bool> dump_on_stop;
+
+} // namespace Telemetry
+
 
 } // namespace Search
 } // namespace YaneuraOu
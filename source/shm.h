@@ -614,6 +614,35 @@ struct SystemWideSharedConstant {
     std::variant<std::monostate, SharedMemoryBackend<T>, SharedMemoryBackendFallback<T>> backend;
 };
 
+#if !STOCKFISH
+
+// 🌈 読み書きできる、サイズを実行時に決める共有メモリ(やねうら王独自拡張)
+//    複数のプロセスで置換表を共有するために用いる。
+//    POSIX shared memoryが使える環境(Linux)でのみ有効。それ以外では、open()が常に失敗する。
+
+#if defined(__linux__) && !defined(__ANDROID__)
+
+using SharedMemoryRegion = shm::SharedMemoryRegion;
+
+#else
+
+class SharedMemoryRegion {
+   public:
+    [[nodiscard]] bool open(const std::string&, size_t, std::string& error) noexcept {
+        error = "shared memory is not supported on this platform";
+        return false;
+    }
+    void                 close() noexcept {}
+    [[nodiscard]] bool   is_open() const noexcept { return false; }
+    [[nodiscard]] void*  data() const noexcept { return nullptr; }
+    [[nodiscard]] size_t size() const noexcept { return 0; }
+    [[nodiscard]] bool   created() const noexcept { return false; }
+};
+
+#endif
+
+#endif
+
 
 }  // namespace YaneuraOu
 
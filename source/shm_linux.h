@@ -688,6 +688,163 @@ template<typename T>
     return std::nullopt;
 }
 
+#if !STOCKFISH
+
+// 🌈 読み書きできる、サイズを実行時に決める共有メモリ(やねうら王独自拡張)
+//
+// SharedMemory<T>は、読み込み専用の定数(評価関数のパラメーター)を共有するためのものなので、
+// 複数のプロセスで置換表を共有するために、こちらを用意する。
+//
+// 📝 作成したプロセスが、ftruncate()でサイズを設定する。そのとき内容はゼロクリアされている。
+//     あとからopen()したプロセスは、サイズが設定されるのを待ってからmapする。
+//
+//     使用中のプロセスは、fdに対して共有ロック(flock(LOCK_SH))を保持しておく。
+//     close()のときに、排他ロックに変更できたら、他に使っているプロセスはいないので削除する。
+//     flock()はプロセスが異常終了してもkernelが解放するので、残骸は次に使うプロセスのclose()で削除される。
+//
+// ⚠ 最後のプロセスがclose()するのと同時に別のプロセスがopen()すると、その別のプロセスは
+//     削除された(名前のない)領域を1人で使うことになる。そのときは共有されないだけで、動作に問題はない。
+//
+// 💡 他のユーザーから置換表を読み書きされないように、領域のpermissionは0600(作成したユーザーのみ)にする。
+class SharedMemoryRegion {
+   public:
+    SharedMemoryRegion() = default;
+    ~SharedMemoryRegion() noexcept { close(); }
+
+    SharedMemoryRegion(const SharedMemoryRegion&)            = delete;
+    SharedMemoryRegion& operator=(const SharedMemoryRegion&) = delete;
+
+    // nameの共有メモリを、sizeバイトで作成するか、既存のものをmapする。
+    // name : "/"で始まる名前。
+    // 失敗したらfalseを返し、errorにその理由を格納する。
+    [[nodiscard]] bool open(const std::string& name, size_t size, std::string& error) noexcept {
+        close();
+
+        for (int retry = 0; retry < 2; ++retry)
+        {
+            created_ = true;
+            fd_      = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+            if (fd_ == -1)
+            {
+                created_ = false;
+                fd_      = shm_open(name.c_str(), O_RDWR, 0);
+            }
+            if (fd_ == -1)
+            {
+                error = std::string("shm_open failed : ") + std::strerror(errno);
+                return false;
+            }
+
+            // 使用中であることを示す共有ロック
+            while (flock(fd_, LOCK_SH) == -1)
+                if (errno != EINTR)
+                {
+                    error = std::string("flock failed : ") + std::strerror(errno);
+                    fail(name);
+                    return false;
+                }
+
+            if (created_)
+            {
+                if (ftruncate(fd_, static_cast<off_t>(size)) == -1)
+                {
+                    error = std::string("ftruncate failed : ") + std::strerror(errno);
+                    fail(name);
+                    return false;
+                }
+            }
+            else
+            {
+                // 作成したプロセスがサイズを設定するのを待つ。
+                off_t actual = 0;
+                for (int i = 0; i < 500 && (actual = current_size()) == 0; ++i)
+                    usleep(10 * 1000);
+
+                if (actual != static_cast<off_t>(size))
+                {
+                    // 誰も使っていない残骸なら、削除して作り直す。
+                    if (retry == 0 && flock(fd_, LOCK_EX | LOCK_NB) == 0)
+                    {
+                        shm_unlink(name.c_str());
+                        ::close(fd_);
+                        fd_ = -1;
+                        continue;
+                    }
+
+                    error = "size mismatch : the existing region is " + std::to_string(actual)
+                          + " bytes , requested " + std::to_string(size) + " bytes";
+                    fail(name);
+                    return false;
+                }
+            }
+
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if (p == MAP_FAILED)
+            {
+                error = std::string("mmap failed : ") + std::strerror(errno);
+                fail(name);
+                return false;
+            }
+
+            ptr_  = p;
+            size_ = size;
+            name_ = name;
+            return true;
+        }
+
+        error = "failed to recreate a stale region";
+        return false;
+    }
+
+    void close() noexcept {
+        if (ptr_)
+            munmap(ptr_, size_);
+
+        if (fd_ != -1)
+        {
+            // 排他ロックに変更できたら、他に使っているプロセスはいない。
+            if (flock(fd_, LOCK_EX | LOCK_NB) == 0)
+                shm_unlink(name_.c_str());
+            ::close(fd_);
+        }
+
+        fd_      = -1;
+        ptr_     = nullptr;
+        size_    = 0;
+        created_ = false;
+        name_.clear();
+    }
+
+    [[nodiscard]] bool   is_open() const noexcept { return ptr_ != nullptr; }
+    [[nodiscard]] void*  data() const noexcept { return ptr_; }
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+
+    // このプロセスが作成したか。(作成したなら中身はゼロクリアされている)
+    [[nodiscard]] bool created() const noexcept { return created_; }
+
+   private:
+    off_t current_size() const noexcept {
+        struct stat st;
+        return fstat(fd_, &st) == 0 ? st.st_size : -1;
+    }
+
+    void fail(const std::string& name) noexcept {
+        if (created_)
+            shm_unlink(name.c_str());
+        ::close(fd_);
+        fd_      = -1;
+        created_ = false;
+    }
+
+    int         fd_      = -1;
+    void*       ptr_     = nullptr;
+    size_t      size_    = 0;
+    bool        created_ = false;
+    std::string name_;
+};
+
+#endif
+
 }  // namespace YaneuraOu::shm
 
 #endif  // #ifndef SHM_LINUX_H_INCLUDED
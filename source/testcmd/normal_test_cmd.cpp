@@ -6,8 +6,10 @@
 //      通常のtestコマンド
 // ----------------------------------
 
+#include <cstring>
 #include <fstream>
 #include <iomanip>
+#include <memory>
 #include <sstream>
 #include "../position.h"
 #include "../usi.h"
@@ -15,6 +17,13 @@
 #include "../search.h"
 #include "../movegen.h"
 #include "../evaluate.h"
+#include "../tt.h"
+#include "../extra/key128.h"
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+#include "../eval/deep/nn.h"
+#include "../eval/deep/nn_types.h"
+#endif
 
 namespace YaneuraOu {
 namespace {
@@ -232,6 +241,240 @@ namespace {
 		}
 	}
 
+	// "test packedsfen [count N] [loop L]" : PackedSfenの圧縮・解凍のベンチマーク
+	//   平手からランダムに指し進めた局面をN個作り、表引きによる実装と参照実装(1bitずつ処理する実装)とで
+	//   結果がbit単位で一致することを確認したあと、それぞれの速度を計測する。
+	void packed_sfen_bench(IEngine& engine, std::istringstream& is)
+	{
+		size_t count = 100000;
+		int    loop  = 10;
+
+		std::string token;
+		while (is >> token)
+		{
+			if (token == "count")
+				is >> count;
+			else if (token == "loop")
+				is >> loop;
+		}
+		count = std::max(count, size_t(1));
+		loop  = std::max(loop, 1);
+
+		std::cout << "PackedSfen benchmark : " << std::endl
+				  << "  count = " << count << std::endl
+				  << "  loop  = " << loop << std::endl;
+
+		// 局面の生成
+
+		const int              MAX_PLY = 256;
+		PRNG                   prng(20251018);
+		std::vector<Piece>     boards(count * 81);
+		std::vector<Hand>      hands(count * 2);
+		std::vector<Color>     turns(count);
+		std::vector<u16>       plies(count);
+		std::vector<StateInfo> states(MAX_PLY + 1);
+		Position               pos;
+
+		for (size_t n = 0; n < count; )
+		{
+			pos.set_hirate(&states[0]);
+			for (int ply = 0; ply < MAX_PLY && n < count; ++ply, ++n)
+			{
+				MoveList<LEGAL> ml(pos);
+				if (ml.size() == 0)
+					break;
+
+				for (auto sq : SQ)
+					boards[n * 81 + sq] = pos.piece_on(sq);
+				for (auto c : COLOR)
+					hands[n * 2 + c] = pos.hand_of(c);
+				turns[n] = pos.side_to_move();
+				plies[n] = u16(pos.game_ply());
+
+				pos.do_move(ml.at(prng.rand(ml.size())), states[ply + 1]);
+			}
+		}
+
+		// 結果の一致確認
+
+		std::vector<PackedSfen> sfens(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			PackedSfen ref;
+			SfenPacking::pack_rawdata(&boards[i * 81], &hands[i * 2], turns[i], sfens[i]);
+			SfenPacking::pack_rawdata_reference(&boards[i * 81], &hands[i * 2], turns[i], ref);
+
+			Piece board1[81], board2[81];
+			Hand  hand1[2], hand2[2];
+			Color turn1, turn2;
+			SfenPacking::unpack_rawdata(sfens[i], board1, hand1, turn1);
+			SfenPacking::unpack_rawdata_reference(sfens[i], board2, hand2, turn2);
+
+			if (   sfens[i] != ref
+				|| std::memcmp(board1, board2, sizeof(board1)) != 0
+				|| std::memcmp(board1, &boards[i * 81], sizeof(board1)) != 0
+				|| hand1[BLACK] != hand2[BLACK] || hand1[WHITE] != hand2[WHITE] || turn1 != turn2)
+			{
+				std::cout << "Error! : mismatch , sfen = " << Position::sfen_from_rawdata(&boards[i * 81], &hands[i * 2], turns[i], plies[i]) << std::endl;
+				return;
+			}
+		}
+		std::cout << "  verified " << count << " positions." << std::endl;
+
+		// 計測
+
+		// 1局面あたりの時間と、1秒あたりの局面数を出力する。
+		// checksumは、計算が最適化で消されないようにするためのもの。
+		auto report = [&](const std::string& name, TimePoint elapsed, u64 checksum) {
+			const double n = double(count) * loop;
+			elapsed = std::max(elapsed, TimePoint(1));
+			std::cout << "  " << std::left << std::setw(24) << name << std::right
+					  << std::setw(8) << elapsed << " ms, "
+					  << std::fixed << std::setprecision(1) << std::setw(8) << (elapsed * 1e6 / n) << " ns/pos, "
+					  << std::setw(12) << u64(n * 1000 / elapsed) << " pos/sec"
+					  << " (checksum " << checksum << ")" << std::endl;
+		};
+
+		for (int fast = 0; fast < 2; ++fast)
+		{
+			u64  checksum = 0;
+			auto start = now();
+			for (int l = 0; l < loop; ++l)
+				for (size_t i = 0; i < count; ++i)
+				{
+					PackedSfen ps;
+					if (fast)
+						SfenPacking::pack_rawdata(&boards[i * 81], &hands[i * 2], turns[i], ps);
+					else
+						SfenPacking::pack_rawdata_reference(&boards[i * 81], &hands[i * 2], turns[i], ps);
+					checksum += ps.data[i & 31];
+				}
+			report(fast ? "pack   (table)" : "pack   (reference)", now() - start, checksum);
+		}
+
+		for (int fast = 0; fast < 2; ++fast)
+		{
+			u64  checksum = 0;
+			auto start = now();
+			for (int l = 0; l < loop; ++l)
+				for (size_t i = 0; i < count; ++i)
+				{
+					Piece board[81];
+					Hand  hand[2];
+					Color turn;
+					if (fast)
+						SfenPacking::unpack_rawdata(sfens[i], board, hand, turn);
+					else
+						SfenPacking::unpack_rawdata_reference(sfens[i], board, hand, turn);
+					checksum += board[i % 81] + u32(hand[turn]);
+				}
+			report(fast ? "unpack (table)" : "unpack (reference)", now() - start, checksum);
+		}
+
+		// Positionへの展開。まとめて展開するAPIを用いる。
+		{
+			const size_t           BATCH = 256;
+			std::vector<Position>  positions(BATCH);
+			std::vector<StateInfo> sis(BATCH);
+
+			u64  checksum = 0;
+			auto start = now();
+			for (int l = 0; l < loop; ++l)
+				for (size_t i = 0; i < count; i += BATCH)
+				{
+					const size_t n = std::min(BATCH, count - i);
+					checksum += Position::set_from_packed_sfens(positions.data(), sis.data(), &sfens[i], n, &plies[i]);
+					checksum += positions[n - 1].game_ply() + positions[n - 1].side_to_move();
+				}
+			report("set_from_packed_sfens", now() - start, checksum);
+		}
+	}
+
+	// "test ttcollision [hash MB1,MB2,...] [probes N]" : 置換表のhash衝突の確率の計測
+	//   指定されたサイズの置換表を、ランダムなhash keyの局面で埋めたあと、
+	//   書き込んでいないhash keyでprobe()して、hitしてしまった(= hash衝突した)割合を計測する。
+	//   また、計測できないような巨大な置換表について、TranspositionTable::false_hit_rate()による見積もりを出力する。
+	void tt_collision_bench(IEngine& engine, std::istringstream& is)
+	{
+		std::vector<size_t> sizes = { 64, 256, 1024 };
+		u64                 probes = 10000000;
+
+		std::string token;
+		while (is >> token)
+		{
+			if (token == "hash")
+			{
+				is >> token;
+				sizes.clear();
+				for (auto& s : StringExtension::Split(token, ","))
+					sizes.push_back(size_t(StringExtension::to_int(std::string(s), 0)));
+			}
+			else if (token == "probes")
+				is >> probes;
+		}
+
+		std::cout << "TT collision benchmark : HASH_KEY_BITS = " << HASH_KEY_BITS << " , TT_CLUSTER_SIZE = " << TT_CLUSTER_SIZE
+				  << " , probes = " << probes << std::endl;
+
+		auto& threads = engine.get_threads();
+
+		// 置換表のClusterのindexのbit0は手番なので、先手番と後手番の局面を用意して交互に用いる。
+		Position  pos[COLOR_NB];
+		StateInfo si[COLOR_NB];
+		pos[BLACK].set("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1", &si[BLACK]);
+		pos[WHITE].set("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL w - 1", &si[WHITE]);
+
+		PRNG prng(20251018);
+		auto random_key = [&]() {
+			Key key;
+			SET_HASH(key, prng.rand<Key64>(), prng.rand<Key64>(), prng.rand<Key64>(), prng.rand<Key64>());
+			return key;
+		};
+
+		for (auto mb : sizes)
+		{
+			if (mb == 0)
+				continue;
+
+			TranspositionTable tt;
+			tt.resize(mb, threads);
+			tt.clear(threads);
+
+			// 置換表を埋める。Entry数の2倍だけ書き込めば、ほぼすべてのEntryが埋まる。
+			// ⚠ TTEntryのサイズはTT_CLUSTER_SIZEによって異なるが、ここでは10 bytesとして多めに見積もる。
+			const u64 writes = u64(mb) * 1024 * 1024 / 10 * 2;
+			for (u64 i = 0; i < writes; ++i)
+			{
+				const Key key = random_key();
+				auto [ttHit, ttData, ttWriter] = tt.probe(key, pos[i & 1]);
+				ttWriter.write(key, Value(0), false, BOUND_EXACT, Depth(1 + prng.rand(30)), Move::none(), Value(0), tt.generation());
+			}
+
+			// 書き込んでいない局面でprobe()する。
+			// 💡 hash keyは128bit以上あれば事実上重複しないので、hitしたらそれはhash衝突である。
+			u64 falseHits = 0;
+			for (u64 i = 0; i < probes; ++i)
+			{
+				auto [ttHit, ttData, ttWriter] = tt.probe(random_key(), pos[i & 1]);
+				falseHits += ttHit;
+			}
+
+			std::cout << "  hash " << std::setw(8) << mb << " MB : hashfull = " << std::setw(4) << tt.hashfull()
+					  << " , false hits = " << std::setw(8) << falseHits
+					  << " , measured rate = " << std::scientific << std::setprecision(3) << double(falseHits) / std::max(probes, u64(1))
+					  << " , expected rate = " << TranspositionTable::false_hit_rate(mb) << std::defaultfloat << std::endl;
+		}
+
+		// 巨大な置換表での見積もり
+		std::cout << "Expected false hit rate for large tables :" << std::endl;
+		for (size_t gb : { 1, 16, 256, 1024, 2048, 4096 })
+		{
+			const double rate = TranspositionTable::false_hit_rate(gb * 1024);
+			std::cout << "  hash " << std::setw(8) << gb << " GB : rate = " << std::scientific << std::setprecision(3) << rate
+					  << " , false hits per 1e9 probes = " << rate * 1e9 << std::defaultfloat << std::endl;
+		}
+	}
+
 #if defined(YANEURAOU_ENGINE)
 	// "test eval_accuracy <psv_path>" : 検証用 PSV ファイルに対し evaluate() を
 	// 呼び、決着のついた局面 (= W/L) のみを対象に sign 一致率を計算する。
@@ -292,8 +535,24 @@ namespace {
 		// nn.bin の load を保証 (= "isready" 相当処理を先に走らせる)
 		engine.isready();
 
-		auto& pos = engine.get_position();
-		StateInfo si;
+		// 評価関数が読み込まれていることを確認しておく。
+		engine.verify_networks();
+
+		// 📝 PSVをPSV_BATCH_RECORDS件ずつ読み込んで、ThreadPoolのスレッドで並列にevaluate()する。
+		//     Positionとカウンターはスレッドごとに持つ。
+		constexpr size_t PSV_BATCH_RECORDS = 1024 * 1024;
+		constexpr size_t PSV_BATCH_GRAIN   = 4096;
+
+		auto& threads = engine.get_threads();
+		const size_t thread_count = std::max(threads.num_threads(), size_t(1));
+
+		struct alignas(64) Counter {
+			uint64_t compared = 0, sign_match = 0, drawn = 0, skipped = 0;
+		};
+		std::vector<Counter> counters(thread_count);
+		std::vector<std::unique_ptr<Position>> positions;
+		for (size_t i = 0; i < thread_count; ++i)
+			positions.emplace_back(std::make_unique<Position>());
 
 		uint64_t compared = 0;
 		uint64_t sign_match = 0;
@@ -303,32 +562,55 @@ namespace {
 		auto start_time = now();
 		auto last_report = start_time;
 
-		PsvRecord rec;
-		while (f.read(reinterpret_cast<char*>(&rec), sizeof(PsvRecord)))
+		std::vector<PsvRecord> records(PSV_BATCH_RECORDS);
+		while (f)
 		{
-			if (pos.set_from_packed_sfen(rec.sfen, &si, false, rec.gamePly).is_not_ok())
-			{
-				skipped++;
-				continue;
-			}
+			f.read(reinterpret_cast<char*>(records.data()), std::streamsize(records.size() * sizeof(PsvRecord)));
+			const size_t count = size_t(f.gcount()) / sizeof(PsvRecord);
+			if (count == 0)
+				break;
 
-			// 引き分けは accuracy 算出から除外。位置数のカウントだけ別途行う。
-			if (rec.game_result == 0)
-			{
-				drawn++;
-				continue;
-			}
+			threads.parallel_for(0, count, PSV_BATCH_GRAIN, [&](size_t thread_id, size_t begin, size_t end) {
+				auto& pos = *positions[thread_id];
+				auto& c   = counters[thread_id];
+				StateInfo si;
 
-			// IEngine::evaluate() は内部で verify_networks() + Eval::evaluate(pos) を
-			// 呼ぶ。NNUE accumulator は set_from_packed_sfen 後に invalid 状態に
-			// なっているはずなので、Eval::evaluate 側で full refresh される (= 通常の
-			// 探索開始時と同じ経路)。
-			Value v = engine.evaluate();
+				for (size_t i = begin; i < end; ++i)
+				{
+					const auto& rec = records[i];
+					if (pos.set_from_packed_sfen(rec.sfen, &si, false, rec.gamePly).is_not_ok())
+					{
+						c.skipped++;
+						continue;
+					}
+
+					// 引き分けは accuracy 算出から除外。位置数のカウントだけ別途行う。
+					if (rec.game_result == 0)
+					{
+						c.drawn++;
+						continue;
+					}
+
+					// NNUE accumulator は set_from_packed_sfen 後に invalid 状態に
+					// なっているので、Eval::evaluate 側で full refresh される (= 通常の
+					// 探索開始時と同じ経路)。
+					Value v = Eval::evaluate(pos);
+
+					bool pred  = v >= VALUE_ZERO;
+					bool truth = rec.game_result > 0;
+					if (pred == truth) c.sign_match++;
+					c.compared++;
+				}
+			});
 
-			bool pred  = v >= VALUE_ZERO;
-			bool truth = rec.game_result > 0;
-			if (pred == truth) sign_match++;
-			compared++;
+			compared = sign_match = drawn = skipped = 0;
+			for (const auto& c : counters)
+			{
+				compared   += c.compared;
+				sign_match += c.sign_match;
+				drawn      += c.drawn;
+				skipped    += c.skipped;
+			}
 
 			// 5 秒ごとに進捗
 			auto cur = now();
@@ -365,6 +647,151 @@ namespace {
 				  << " positions/sec)" << std::endl;
 	}
 #endif // defined(YANEURAOU_ENGINE)
+
+#if defined(YANEURAOU_ENGINE_DEEP)
+	// "test nnbench [batch N] [loop L] [threads T] [model path]" : NNの推論速度の計測
+	//   EvalDir,DNN_Model,ModelArchitecture,DNN_Batch_Sizeの設定に従ってNNを構築し、
+	//   平手からランダムに指し進めた局面をbatch個ずつ、T個のスレッドからそれぞれL回推論して、positions/secを出力する。
+	//   💡 T個のスレッドは、それぞれ別の推論slotを用いる。(探索時のUCT_Threadsに相当する)
+	//      推論は探索スレッドで行うので、Tは探索スレッドの数が上限。(探索スレッドはisreadyで生成される)
+	void nn_bench(IEngine& engine, std::istringstream& is)
+	{
+		using namespace Eval::dlshogi;
+
+		auto& options = engine.get_options();
+
+		int batch      = int(options["DNN_Batch_Size"]);
+		int loop       = 100;
+		int thread_num = 1;
+		std::string model_path = Path::Combine(Path::Combine(Directory::GetBinaryFolder(), std::string(options["EvalDir"])),
+		                                       std::string(options["DNN_Model"]));
+
+		std::string token;
+		while (is >> token)
+		{
+			if (token == "batch")
+				is >> batch;
+			else if (token == "loop")
+				is >> loop;
+			else if (token == "threads")
+				is >> thread_num;
+			else if (token == "model")
+				is >> model_path;
+		}
+		batch   = std::max(batch, 1);
+		loop    = std::max(loop, 1);
+		// 推論は探索スレッド(ThreadPool::parallel_for())から呼び出すので、探索スレッドの数が上限。
+		// 💡 探索スレッドがない時は、parallel_for()は呼び出し元のスレッドで実行される。
+		//     探索スレッドはisreadyで生成されるので、isreadyの前だと1スレッドになる。
+		auto& threads = engine.get_threads();
+		if (thread_num > std::max(int(threads.size()), 1))
+			std::cout << "Warning! : threads is capped to the number of search threads = "
+					  << std::max(int(threads.size()), 1) << " (the search threads are created by isready)" << std::endl;
+		thread_num = std::clamp(thread_num, 1, std::max(int(threads.size()), 1));
+
+		Eval::dlshogi::init();
+		if (!set_model_architecture(std::string(options["ModelArchitecture"])))
+		{
+			std::cout << "Error! : unknown ModelArchitecture = " << std::string(options["ModelArchitecture"]) << std::endl;
+			return;
+		}
+
+		auto nn = NN::build_nn(model_path, 0, batch, thread_num);
+		if (!nn)
+			return;
+		nn->prepare_slots(thread_num);
+
+		std::cout << "NN benchmark : " << std::endl
+				  << "  model   = " << model_path << std::endl
+				  << "  batch   = " << batch << std::endl
+				  << "  loop    = " << loop << std::endl
+				  << "  threads = " << thread_num << std::endl;
+
+		// 推論に用いるメモリ(スレッドごと)
+		struct Buffers
+		{
+			PType*            p1;
+			PType*            p2;
+			NN_Input1*        x1;
+			NN_Input2*        x2;
+			NN_Output_Policy* y1;
+			NN_Output_Value*  y2;
+		};
+		auto alloc = [&](size_t size) {
+			void* ptr = nn->alloc(size);
+			std::memset(ptr, 0, size);
+			return ptr;
+		};
+
+		// 平手からランダムに指し進めた局面で入力特徴量を作る。
+		const int              MAX_PLY = 256;
+		PRNG                   prng(20251018);
+		std::vector<StateInfo> states(MAX_PLY + 1);
+		Position               pos;
+		int                    ply = MAX_PLY;
+
+		std::vector<Buffers> buffers(thread_num);
+		for (auto& b : buffers)
+		{
+			b.p1 = (PType*)alloc(packed_input1_byte_count(batch));
+			b.p2 = (PType*)alloc(packed_input2_byte_count(batch));
+			b.x1 = (NN_Input1*)alloc(input1_element_count(batch) * sizeof(NN_Input1));
+			b.x2 = (NN_Input2*)alloc(input2_element_count(batch) * sizeof(NN_Input2));
+			b.y1 = (NN_Output_Policy*)alloc(batch * sizeof(NN_Output_Policy));
+			b.y2 = (NN_Output_Value*)alloc(batch * sizeof(NN_Output_Value));
+
+			for (int i = 0; i < batch; ++i)
+			{
+				if (ply >= MAX_PLY)
+				{
+					pos.set_hirate(&states[0]);
+					ply = 0;
+				}
+				make_input_features(pos, i, b.p1, b.p2);
+
+				// 詰んでいたら次は平手から。
+				MoveList<LEGAL> ml(pos);
+				if (ml.size() == 0)
+					ply = MAX_PLY;
+				else
+					pos.do_move(ml.at(prng.rand(ml.size())), states[++ply]);
+			}
+			extract_input_features(batch, b.p1, b.p2, b.x1, b.x2);
+		}
+
+		// 1回目は計測に含めない。(メモリの確保などが走るかも知れないので)
+		for (int t = 0; t < thread_num; ++t)
+		{
+			auto& b = buffers[t];
+			nn->forward(t, batch, b.p1, b.p2, b.x1, b.x2, b.y1, b.y2);
+		}
+
+		TimePoint start = now();
+
+		// 1スレッドにつき1つの推論slotを用いる。
+		threads.parallel_for(0, size_t(thread_num), 1, [&](size_t, size_t t, size_t) {
+			auto& b = buffers[t];
+			for (int i = 0; i < loop; ++i)
+				nn->forward(int(t), batch, b.p1, b.p2, b.x1, b.x2, b.y1, b.y2);
+		}, size_t(thread_num));
+
+		const TimePoint elapsed   = std::max(now() - start, TimePoint(1));
+		const u64       positions = u64(batch) * loop * thread_num;
+
+		// 推論結果の確認用に、最初の局面のvalueとpolicyの最大値を出力しておく。
+		const auto& y1     = buffers[0].y1[0];
+		const int   argmax = int(std::max_element(y1, y1 + MAX_MOVE_LABEL_NUM * int(SQ_NB)) - y1);
+
+		std::cout << "  value[0]          = " << to_float(buffers[0].y2[0]) << std::endl
+				  << "  policy[0] argmax  = " << argmax << " (" << to_float(y1[argmax]) << ")" << std::endl
+				  << "  elapsed           = " << elapsed << " ms" << std::endl
+				  << "  positions/sec     = " << positions * 1000 / elapsed << std::endl;
+
+		for (auto& b : buffers)
+			for (void* ptr : { (void*)b.p1, (void*)b.p2, (void*)b.x1, (void*)b.x2, (void*)b.y1, (void*)b.y2 })
+				nn->free(ptr);
+	}
+#endif // defined(YANEURAOU_ENGINE_DEEP)
 } // namespace
 
 // ----------------------------------
@@ -378,8 +805,13 @@ namespace Test
 	{
 		if (token == "genmoves")              gen_moves(engine, is);       // 現在の局面に対して指し手生成のテストを行う。
 		else if (token == "autoplay")         auto_play(engine, is);       // 連続自己対局を行う。
+		else if (token == "packedsfen")       packed_sfen_bench(engine, is); // PackedSfenの圧縮・解凍のベンチマーク。
+		else if (token == "ttcollision")      tt_collision_bench(engine, is); // 置換表のhash衝突の確率の計測。
 #if defined(YANEURAOU_ENGINE)
 		else if (token == "eval_accuracy")    eval_accuracy(engine, is);   // PSV に対し evaluate() の sign 一致率を測る。
+#endif
+#if defined(YANEURAOU_ENGINE_DEEP)
+		else if (token == "nnbench")          nn_bench(engine, is);        // NNの推論速度(positions/sec)の計測。
 #endif
 		else return false;									               // どのコマンドも処理することがなかった
 			
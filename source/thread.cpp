@@ -385,6 +385,79 @@ void ThreadPool::wait_on_thread(size_t threadId) {
 
 size_t ThreadPool::num_threads() const { return threads.size(); }
 
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              const std::function<void(size_t, size_t, size_t)>& f, size_t threadCount) {
+
+	if (begin >= end)
+		return;
+
+	grain = std::max(grain, size_t(1));
+	const size_t chunks = (end - begin + grain - 1) / grain;
+
+	auto run_chunk = [&](size_t threadId, size_t chunk) {
+		const size_t b = begin + chunk * grain;
+		f(threadId, b, std::min(b + grain, end));
+	};
+
+	// スレッドが生成されていないなら、呼び出したスレッドで処理する。
+	if (threads.empty())
+	{
+		for (size_t c = 0; c < chunks; ++c)
+			run_chunk(0, c);
+		return;
+	}
+
+	threadCount = std::min({threadCount ? threadCount : threads.size(), threads.size(), chunks});
+
+	// 各スレッドが受け持つchunkの区間。上位32bitが終端、下位32bitが次に処理するchunk。
+	// 📝 持ち主は先頭から、盗むスレッドは末尾から、CASで1chunkずつ取り出す。
+	ASSERT_LV3(chunks < (u64(1) << 32));
+	struct alignas(64) ChunkRange {
+		std::atomic<u64> range;
+	};
+	std::unique_ptr<ChunkRange[]> ranges(new ChunkRange[threadCount]);
+	for (size_t i = 0; i < threadCount; ++i)
+		ranges[i].range = (u64(chunks * (i + 1) / threadCount) << 32) | u64(chunks * i / threadCount);
+
+	// 区間rの先頭(fromBack == falseのとき) or 末尾からchunkを1つ取り出す。取り出せなければfalse。
+	auto pop = [](std::atomic<u64>& r, bool fromBack, size_t& chunk) {
+		u64 cur = r.load(std::memory_order_relaxed);
+		while (true)
+		{
+			const u64 next = cur & 0xffffffff, last = cur >> 32;
+			if (next >= last)
+				return false;
+
+			const u64 desired = fromBack ? (((last - 1) << 32) | next) : ((last << 32) | (next + 1));
+			if (r.compare_exchange_weak(cur, desired, std::memory_order_acq_rel, std::memory_order_relaxed))
+			{
+				chunk = size_t(fromBack ? last - 1 : next);
+				return true;
+			}
+		}
+	};
+
+	for (size_t i = 0; i < threadCount; ++i)
+		run_on_thread(i, [&, i]() {
+			size_t chunk;
+
+			// まず自分の区間を先頭から処理する。
+			while (pop(ranges[i].range, false, chunk))
+				run_chunk(i, chunk);
+
+			// 自分の区間を処理し終わったら、他のスレッドの区間の末尾から盗む。
+			for (size_t k = 1; k < threadCount; ++k)
+			{
+				auto& victim = ranges[(i + k) % threadCount].range;
+				while (pop(victim, true, chunk))
+					run_chunk(i, chunk);
+			}
+		});
+
+	for (size_t i = 0; i < threadCount; ++i)
+		wait_on_thread(i);
+}
+
 
 // Wakes up main thread waiting in idle_loop() and returns immediately.
 // Main thread will wake up other threads and start the search.
@@ -5,6 +5,7 @@
 #include <condition_variable>
 //#include <cstddef>
 //#include <cstdint>
+#include <functional>
 #include <mutex>
 #include <vector>
 
@@ -224,6 +225,21 @@ public:
 	// このThreadPoolが保持しているthread数
 	size_t num_threads() const;
 
+	// 🌈 探索以外の並列処理(memclearやバッチ系のコマンドなど)のためのjob API
+
+	// [begin, end)をgrain個ずつのchunkに分けて、このThreadPoolのスレッドで並列に処理する。
+	//   f(threadId, chunkBegin, chunkEnd) が各chunkに対して1回ずつ呼び出される。
+	//   threadCount : 用いるスレッド数。0ならすべてのスレッドを用いる。
+	// 📝 はじめに各スレッドに連続したchunkの区間を割り当てる。自分の区間を処理し終わったスレッドは、
+	//     他のスレッドの区間の末尾からchunkを盗む(work stealing)。
+	//     各スレッドは自分のNUMA nodeにbindされているので、処理の偏りがなければ自分の区間はNUMAローカルに処理される。
+	//     スレッドは使い回されるので、chunkごとにスレッドを生成するコストはかからない。
+	// ⚠ すべてのchunkの処理が終わるまでblockする。探索中に呼び出してはならない。
+	//    スレッドが生成されていなければ、呼び出したスレッドで(threadId = 0として)処理する。
+	void parallel_for(size_t begin, size_t end, size_t grain,
+	                  const std::function<void(size_t threadId, size_t chunkBegin, size_t chunkEnd)>& f,
+	                  size_t threadCount = 0);
+
 	// set()で生成したスレッドの初期化
     // 💡 各ThreadのWorkerに対してclear()が呼び出される。
     void clear();
@@ -1,10 +1,20 @@
 ﻿#include "tt.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
 //#include <thread>
 //#include <vector>
 
@@ -12,6 +22,7 @@
 #include "misc.h"
 #include "thread.h"
 #include "engine.h"
+#include "shm.h"
 
 // やねうら王独自拡張
 #include "extra/key128.h"
@@ -118,6 +129,9 @@ struct TTEntry {
 
    private:
     friend class TranspositionTable;
+#if defined(ENABLE_TT_STATS)
+    friend struct TTWriter;
+#endif
 
     TTE_KEY_TYPE key;
     uint8_t      depth8;
@@ -128,6 +142,123 @@ struct TTEntry {
 };
 
 
+// ============================================================
+//                   置換表の統計
+// ============================================================
+
+namespace TTStats {
+
+#if defined(ENABLE_TT_STATS)
+
+// hash keyの全bitから64bitの値を得る。collisionの検出用。
+// 💡 0は「不明」の意味で用いるので、0にはしない。
+u64 full_key(const Key& key) {
+#if HASH_KEY_BITS <= 64
+	const u64 k = u64(key);
+#else
+	const u64 k = key.extract64<0>() ^ (key.extract64<1>() * 0x9E3779B97F4A7C15ULL);
+#endif
+	return k ? k : 1;
+}
+
+namespace {
+
+	// 生存しているスレッドのカウンターと、終了したスレッドのカウンターの合計。
+	struct Registry {
+		std::mutex             mutex;
+		std::vector<Counters*> live;
+		u64                    retired[COUNTER_NB] = {};
+	};
+
+	Registry& registry() {
+		static Registry r;
+		return r;
+	}
+
+	// スレッドごとのカウンター。スレッドの終了時に、その値をretiredに足し込む。
+	struct LocalCounters {
+		Counters counters;
+
+		LocalCounters() {
+			for (auto& n : counters.count)
+				n.store(0, std::memory_order_relaxed);
+
+			auto& r = registry();
+			std::lock_guard<std::mutex> lk(r.mutex);
+			r.live.push_back(&counters);
+		}
+
+		~LocalCounters() {
+			auto& r = registry();
+			std::lock_guard<std::mutex> lk(r.mutex);
+			for (int i = 0; i < COUNTER_NB; ++i)
+				r.retired[i] += counters.count[i].load(std::memory_order_relaxed);
+			r.live.erase(std::find(r.live.begin(), r.live.end(), &counters));
+		}
+	};
+}
+
+Counters& local_counters() {
+	thread_local LocalCounters local;
+	return local.counters;
+}
+
+#endif
+
+void reset() {
+#if defined(ENABLE_TT_STATS)
+	auto& r = registry();
+	std::lock_guard<std::mutex> lk(r.mutex);
+	for (auto* c : r.live)
+		for (auto& n : c->count)
+			n.store(0, std::memory_order_relaxed);
+	std::fill(std::begin(r.retired), std::end(r.retired), 0);
+#endif
+}
+
+std::vector<std::string> report() {
+#if defined(ENABLE_TT_STATS)
+	u64 n[COUNTER_NB];
+	{
+		auto& r = registry();
+		std::lock_guard<std::mutex> lk(r.mutex);
+		for (int i = 0; i < COUNTER_NB; ++i)
+		{
+			n[i] = r.retired[i];
+			for (auto* c : r.live)
+				n[i] += c->count[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	// a / b を、scale倍して小数点以下2桁で。
+	auto ratio = [](u64 a, u64 b, double scale) {
+		std::ostringstream ss;
+		ss << std::fixed << std::setprecision(2) << (b ? double(a) * scale / double(b) : 0.0);
+		return ss.str();
+	};
+
+	std::vector<std::string> lines;
+	lines.push_back("TT stats : probes = " + std::to_string(n[Probe])
+	              + " , hits = " + std::to_string(n[Hit]) + " (" + ratio(n[Hit], n[Probe], 100) + "%)"
+	              + " , misses = " + std::to_string(n[Miss])
+	              + " , collisions = " + std::to_string(n[Collision]) + " (" + ratio(n[Collision], n[Hit], 1000000) + " ppm of hits)"
+	              + " , move rejects = " + std::to_string(n[MoveReject]));
+	lines.push_back("TT stats : writes = " + std::to_string(n[Write])
+	              + " , empty = " + std::to_string(n[WriteEmpty])
+	              + " , same key = " + std::to_string(n[WriteSameKey])
+	              + " , replaced by age = " + std::to_string(n[ReplaceByAge])
+	              + " , replaced by depth = " + std::to_string(n[ReplaceByDepth])
+	              + " , kept = " + std::to_string(n[WriteKept]));
+	lines.push_back("TT stats : ttMove rejects , not pseudo-legal = " + std::to_string(n[TTMoveNotPseudoLegal])
+	              + " , not legal = " + std::to_string(n[TTMoveNotLegal]));
+	return lines;
+#else
+	return { "TT stats : not available. Build with ENABLE_TT_STATS defined." };
+#endif
+}
+
+} // namespace TTStats
+
 // Populates the TTEntry with a new node's data, possibly
 // overwriting an old position. The update is non-atomic and can be racy.
 
@@ -156,6 +287,12 @@ void TTEntry::save(TTE_KEY_TYPE k, Value v, bool pv, Bound b, Depth d, Move m, V
 	if (b == BOUND_EXACT || k != key || d - DEPTH_NONE + 2 * pv > depth8 - 4
 		|| relative_age(curr_generation))
 	{
+		// 📝 上書きする理由を数える。(TTStats)
+		TTStats::add(!is_occupied()                ? TTStats::WriteEmpty
+		             : k == key                    ? TTStats::WriteSameKey
+		             : relative_age(curr_generation) ? TTStats::ReplaceByAge
+		                                           : TTStats::ReplaceByDepth);
+
 		assert(d > DEPTH_NONE);
 		assert(d - DEPTH_NONE < 256);
 		assert(curr_generation <= GENERATION_MASK); // TT::new_search() plays nice
@@ -171,6 +308,8 @@ void TTEntry::save(TTE_KEY_TYPE k, Value v, bool pv, Bound b, Depth d, Move m, V
 		ASSERT_LV3(-VALUE_MAX_EVAL <= ev && ev <= VALUE_MAX_EVAL || ev == VALUE_NONE);
 		
 	}
+	else
+		TTStats::add(TTStats::WriteKept);
 }
 
 
@@ -209,7 +348,14 @@ void TTWriter::write(
     const TTE_KEY_TYPE k = TTE_KEY_TYPE(k_.extract64<1>());
 #endif
 
+    TTStats::add(TTStats::Write);
     entry->save(k, v, pv, b, d, m, ev, generation8);
+
+#if defined(ENABLE_TT_STATS)
+    // このEntryがこの局面のものになったなら、hash keyの全bitを記録しておく。
+    if (fullKey && entry->key == k)
+        *fullKey = TTStats::full_key(k_);
+#endif
 }
 #endif
 
@@ -249,6 +395,105 @@ struct Cluster {
 // static_assert(sizeof(Cluster) == 32, "Suboptimal Cluster size");
 static_assert((sizeof(Cluster) % 32) == 0, "Unexpected Cluster size");
 
+// ----------------------------------
+//	   共有メモリ上の置換表
+// ----------------------------------
+
+// 共有メモリの先頭に置くheader。このあとにCluster配列が続く。
+// 💡 64 bytesにしてあるので、Cluster配列がcache lineにalignされる。
+struct alignas(64) TTSharedHeader {
+	char                  magic[8];      // "YOTTSHM1"
+	uint32_t              hashKeyBits;   // HASH_KEY_BITS
+	uint32_t              clusterSize;   // TT_CLUSTER_SIZE
+	uint32_t              clusterBytes;  // sizeof(Cluster)
+	uint64_t              clusterCount;  // Cluster数
+	std::atomic<uint32_t> ready;         // 作成したプロセスがheaderを書き終えたら1になる。
+	std::atomic<uint8_t>  generation8;   // 共有している全プロセスの世代
+};
+static_assert(sizeof(TTSharedHeader) == 64, "Unexpected TTSharedHeader size");
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint8_t>::is_always_lock_free,
+              "atomics in shared memory must be lock free");
+
+struct TTSharedMemory {
+	SharedMemoryRegion region;
+	TTSharedHeader*    header = nullptr;
+
+	Cluster* table() const { return reinterpret_cast<Cluster*>(static_cast<char*>(region.data()) + sizeof(TTSharedHeader)); }
+};
+
+namespace {
+
+	constexpr char TT_SHARED_MAGIC[8] = { 'Y', 'O', 'T', 'T', 'S', 'H', 'M', '1' };
+
+	// nameの共有メモリに、clusterCount個のClusterの置換表を作成するか、既存のものに接続する。
+	// 失敗したらnullptrを返し、messageにその理由を格納する。
+	std::unique_ptr<TTSharedMemory> open_shared_tt(const std::string& name, size_t clusterCount, std::string& message) {
+
+		// POSIX shared memoryの名前は"/"で始まり、ほかに"/"を含まないようにする。
+		std::string shmName = "/yaneuraou_tt_";
+		for (char c : name)
+			shmName += (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-') ? c : '_';
+
+		auto shm = std::make_unique<TTSharedMemory>();
+		if (!shm->region.open(shmName, sizeof(TTSharedHeader) + clusterCount * sizeof(Cluster), message))
+			return nullptr;
+
+		char* const base = static_cast<char*>(shm->region.data());
+		if (shm->region.created())
+		{
+			// 作成したときはゼロクリアされているので、headerだけ書き込む。
+			shm->header = new (base) TTSharedHeader();
+			std::memcpy(shm->header->magic, TT_SHARED_MAGIC, sizeof(TT_SHARED_MAGIC));
+			shm->header->hashKeyBits  = HASH_KEY_BITS;
+			shm->header->clusterSize  = TT_CLUSTER_SIZE;
+			shm->header->clusterBytes = uint32_t(sizeof(Cluster));
+			shm->header->clusterCount = clusterCount;
+			shm->header->ready.store(1, std::memory_order_release);
+			return shm;
+		}
+
+		// 作成したプロセスがheaderを書き終えるのを待つ。
+		shm->header = std::launder(reinterpret_cast<TTSharedHeader*>(base));
+		for (int i = 0; i < 500 && !shm->header->ready.load(std::memory_order_acquire); ++i)
+			Tools::sleep(10);
+
+		if (!shm->header->ready.load(std::memory_order_acquire)
+			|| std::memcmp(shm->header->magic, TT_SHARED_MAGIC, sizeof(TT_SHARED_MAGIC)) != 0)
+		{
+			message = "the existing region is not a transposition table";
+			return nullptr;
+		}
+		if (   shm->header->hashKeyBits  != HASH_KEY_BITS
+			|| shm->header->clusterSize  != TT_CLUSTER_SIZE
+			|| shm->header->clusterBytes != sizeof(Cluster)
+			|| shm->header->clusterCount != clusterCount)
+		{
+			message = "layout mismatch : HASH_KEY_BITS = " + std::to_string(shm->header->hashKeyBits)
+			        + " , TT_CLUSTER_SIZE = " + std::to_string(shm->header->clusterSize)
+			        + " , clusters = " + std::to_string(shm->header->clusterCount);
+			return nullptr;
+		}
+		return shm;
+	}
+}
+
+TranspositionTable::TranspositionTable() = default;
+
+TranspositionTable::~TranspositionTable() {
+	free_table();
+#if defined(ENABLE_TT_STATS)
+	aligned_large_pages_free(fullKeys);
+#endif
+}
+
+void TranspositionTable::free_table() {
+	if (shared)
+		shared.reset();
+	else
+		aligned_large_pages_free(table);
+	table = nullptr;
+}
+
 // Sets the size of the transposition table,
 // measured in megabytes. Transposition table consists
 // of clusters and each cluster consists of ClusterSize number of TTEntry.
@@ -259,7 +504,7 @@ static_assert((sizeof(Cluster) % 32) == 0, "Unexpected Cluster size");
 
 void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
 #if STOCKFISH
-    aligned_large_pages_free(table);
+    free_table();
 
     clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
@@ -283,9 +528,26 @@ void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
 	if (newClusterCount == clusterCount)
 		return;
 
-	aligned_large_pages_free(table);
+	free_table();
 
 	clusterCount = newClusterCount;
+
+	// 🌈 共有メモリへの配置
+	if (!sharedMemoryName.empty())
+	{
+		std::string message;
+		shared = open_shared_tt(sharedMemoryName, clusterCount, message);
+		if (shared)
+		{
+			table       = shared->table();
+			generation8 = shared->header->generation8.load(std::memory_order_relaxed);
+			sync_cout << "info string USI_Hash : " << (shared->region.created() ? "created" : "attached to")
+			          << " the shared transposition table \"" << sharedMemoryName << "\"." << sync_endl;
+		}
+		else
+			sync_cout << "info string USI_Hash : failed to share the transposition table \"" << sharedMemoryName
+			          << "\" , " << message << " , fall back to private memory." << sync_endl;
+	}
 #endif
 
 	// tableはCacheLineSizeでalignされたメモリに配置したいので、CacheLineSize-1だけ余分に確保する。
@@ -295,7 +557,8 @@ void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
 
 	// Large Pageを確保する。ランダムメモリアクセスが5%程度速くなる。
 
-	table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+	if (!table)
+		table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
 
 	if (!table)
 	{
@@ -303,6 +566,21 @@ void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
 		exit(EXIT_FAILURE);
 	}
 
+#if defined(ENABLE_TT_STATS)
+	resize_full_keys();
+#endif
+
+#if !STOCKFISH
+	// 🌈 NUMA nodeへの配置方針の反映
+	if (memoryPolicy == TTMemoryPolicy::Interleave && !shared)
+	{
+		if (numa_interleave_memory(table, clusterCount * sizeof(Cluster)))
+			sync_cout << "info string USI_Hash : interleaved across NUMA nodes." << sync_endl;
+		else
+			sync_cout << "info string USI_Hash : NUMA interleave is not available, fall back to default." << sync_endl;
+	}
+#endif
+
 #if STOCKFISH
 	clear(threads);
 
@@ -323,8 +601,24 @@ void TranspositionTable::clear(ThreadPool& threads) {
 	return;
 #endif
 
+#if !STOCKFISH
+	// 🌈 共有メモリ上の置換表は、他のプロセスが使っているかも知れないのでクリアしない。世代だけ合わせる。
+	if (shared)
+	{
+		generation8 = shared->header->generation8.load(std::memory_order_relaxed);
+#if defined(ENABLE_TT_STATS)
+		clear_full_keys(threads);
+#endif
+		return;
+	}
+#endif
+
 	generation8 = 0;
 
+#if defined(ENABLE_TT_STATS)
+	clear_full_keys(threads);
+#endif
+
 	// Stockfishのコード
 #if 0
 	const size_t threadCount = threads.num_threads();
@@ -347,11 +641,97 @@ void TranspositionTable::clear(ThreadPool& threads) {
 
 	auto size = clusterCount * sizeof(Cluster);
 
+	// 🌈 first touchで配置する場合は、各スレッドが担当範囲の物理pageを解放してからゼロクリアする。
+	//     こうすると、ゼロクリアで触れた時点で、そのスレッドのNUMA nodeにpageが割り当てられる。
+	// 📝 上のStockfishのコードと同じくスレッドごとに分割するが、page境界で分割する。
+	//     aligned_large_pages_alloc()は、Linuxでは2MB単位で確保しているので、末尾のpageもこの確保範囲に収まる。
+	const size_t threadCount = threads.num_threads();
+	if (memoryPolicy == TTMemoryPolicy::FirstTouch && threadCount > 0)
+	{
+		constexpr size_t PageSize = 2 * 1024 * 1024;
+		const size_t     pages    = (size + PageSize - 1) / PageSize;
+
+		sync_cout << "info string USI_Hash : Start clearing with " << threadCount << " threads (first touch) , size =  "
+		          << size / (1024 * 1024) << "[MB]" << sync_endl;
+
+		for (size_t i = 0; i < threadCount; ++i)
+		{
+			threads.run_on_thread(i, [this, size, pages, threadCount, i]() {
+				const size_t stride = pages / threadCount,
+				firstPage = stride * i,
+				pageCount = (i != threadCount - 1) ? stride : pages - firstPage;
+
+				const size_t start = firstPage * PageSize;
+				if (pageCount == 0 || start >= size)
+					return;
+
+				uint8_t* const p = reinterpret_cast<uint8_t*>(table) + start;
+				numa_release_pages(p, pageCount * PageSize);
+				std::memset(p, 0, std::min(pageCount * PageSize, size - start));
+			});
+		}
+
+		for (size_t i = 0; i < threadCount; ++i)
+			threads.wait_on_thread(i);
+
+		sync_cout << "info string USI_Hash : Finish clearing." << sync_endl;
+		return;
+	}
+
 	// 進捗を表示しながら並列化してゼロクリア
 	// Stockfishのここにあったコードは、独自の置換表を実装した時にも使いたいため、tt.cppに移動させた。
 	Tools::memclear(threads, "USI_Hash", table, size);
 }
 
+void TranspositionTable::set_shared_memory_name(const std::string& name) {
+	if (sharedMemoryName == name)
+		return;
+
+	sharedMemoryName = name;
+
+	// 次のresize()で確保しなおさせる。
+	free_table();
+	clusterCount = 0;
+}
+
+void TranspositionTable::set_memory_policy(TTMemoryPolicy policy) {
+	if (memoryPolicy == policy)
+		return;
+
+	memoryPolicy = policy;
+
+	// 次のresize()で確保しなおさせる。
+	free_table();
+	clusterCount = 0;
+
+#if defined(ENABLE_TT_STATS)
+	aligned_large_pages_free(fullKeys);
+	fullKeys = nullptr;
+#endif
+}
+
+#if defined(ENABLE_TT_STATS)
+void TranspositionTable::resize_full_keys() {
+	aligned_large_pages_free(fullKeys);
+	fullKeys = static_cast<u64*>(aligned_large_pages_alloc(clusterCount * ClusterSize * sizeof(u64)));
+
+	if (!fullKeys)
+	{
+		std::cerr << "Failed to allocate the keys for TT stats." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+void TranspositionTable::clear_full_keys(ThreadPool& threads) {
+	Tools::memclear(threads, nullptr, fullKeys, clusterCount * ClusterSize * sizeof(u64));
+}
+
+u64* TranspositionTable::full_key_slot(const TTEntry* tte) const {
+	const size_t offset = size_t(reinterpret_cast<const char*>(tte) - reinterpret_cast<const char*>(table));
+	return &fullKeys[offset / sizeof(Cluster) * ClusterSize + offset % sizeof(Cluster) / sizeof(TTEntry)];
+}
+#endif
+
 // Returns an approximation of the hashtable
 // occupation during a search. The hash is x permill full, as per UCI protocol.
 // Only counts entries which are younger than maxAge.
@@ -372,6 +752,22 @@ int TranspositionTable::hashfull(int maxAge) const {
 
 void TranspositionTable::new_search() {
 
+#if !STOCKFISH
+	// 🌈 共有メモリ上の置換表では、世代は共有している全プロセスで1つ。
+	//     自分が前回見た世代から、まだ誰も進めていなければ1つ進める。
+	//     他のプロセスがすでに進めていたら、それに合わせるだけにする。
+	//     こうすることで、複数のプロセスが同時に探索を開始しても、世代は1つしか進まない。
+	if (shared)
+	{
+		uint8_t       expected = generation8;
+		const uint8_t next     = uint8_t((generation8 + 1) & GENERATION_MASK);
+		generation8 = shared->header->generation8.compare_exchange_strong(expected, next, std::memory_order_relaxed)
+		              ? next
+		              : expected;
+		return;
+	}
+#endif
+
 	++generation8;
 
 	// Don't overflow into the other bits of TTEntry::genBound8
@@ -400,6 +796,8 @@ std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key, cons
 
     TTEntry* const tte = first_entry(key, pos.side_to_move());
 
+    TTStats::add(TTStats::Probe);
+
 #if HASH_KEY_BITS <= 64
     const TTE_KEY_TYPE key_for_ttentry = TTE_KEY_TYPE(key);
 #else
@@ -426,10 +824,32 @@ std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key, cons
 				// 置換表にhitしなかったという扱いにする。
 				Move move = pos.to_move(ttData.move.to_move16());
 				if (!move)
+				{
+					TTStats::add(TTStats::MoveReject);
 					continue;
+				}
 				ttData.move = move;
 			}
+
+#if defined(ENABLE_TT_STATS)
+			TTWriter writer(&tte[i]);
+			writer.fullKey = full_key_slot(&tte[i]);
+
+			if (tte[i].is_occupied())
+			{
+				TTStats::add(TTStats::Hit);
+
+				// 格納されているbitは一致したが、別の局面であった。
+				if (*writer.fullKey && *writer.fullKey != TTStats::full_key(key))
+					TTStats::add(TTStats::Collision);
+			}
+			else
+				TTStats::add(TTStats::Miss);
+
+			return { tte[i].is_occupied(), ttData, writer };
+#else
 			return { tte[i].is_occupied(), ttData, TTWriter(&tte[i]) };
+#endif
 		}
 
 	// Find an entry to be replaced according to the replacement strategy
@@ -441,9 +861,20 @@ std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key, cons
 			> tte[i].depth8 - 8 * tte[i].relative_age(generation8))
 			replace = &tte[i];
 
+#if defined(ENABLE_TT_STATS)
+	TTStats::add(TTStats::Miss);
+
+	TTWriter writer(replace);
+	writer.fullKey = full_key_slot(replace);
+
+	return { false,
+			TTData{Move::none(), VALUE_NONE, VALUE_NONE, DEPTH_NONE, BOUND_NONE, false},
+			writer };
+#else
 	return { false,
 			TTData{Move::none(), VALUE_NONE, VALUE_NONE, DEPTH_NONE, BOUND_NONE, false},
 			TTWriter(replace) };
+#endif
 }
 
 // keyを元にClusterのindexを求めて、その最初のTTEntry*を返す。内部実装用。
@@ -483,7 +914,267 @@ TTEntry* TranspositionTable::first_entry(const Key& key_, Color side_to_move) co
 	// ⚠ Colorの実体はuint8で、0,1の値しか取らないものとする。
 	return &table[(index & ~1) | side_to_move].entry[0];
 
+	/*
+		📓 巨大な置換表について
+
+		mul_hi64()で求めるので、indexは、hash keyの下位64bitのうちの上位側のbitから決まる。
+		Cluster数が2^32を超えても、keyの上位32bitだけでindexが決まるようなことはない。
+
+		HASH_KEY_BITS == 64で、TTEntryにhash keyをそのまま格納している(TT_CLUSTER_SIZE != 3)ときは、
+		indexを決めたbitは、同じClusterのEntryのkeyと比較しても判別の役に立たない。
+		そのため、Cluster数を2倍にするごとに、hash衝突の確率が2倍になる。(false_hit_rate()を参照)
+		HASH_KEY_BITS >= 128では、TTEntryに格納するkeyは上位64bitから取るので、indexとは独立である。
+		(TT_HUGE_TABLEはこの構成)
+	*/
+
+#endif
+}
+
+double TranspositionTable::false_hit_rate(size_t mbSize) {
+	const double clusters = double(mbSize) * 1024 * 1024 / sizeof(Cluster);
+
+	// TTEntryに格納されているkeyのbitのうち、Clusterのindexと独立なbitの数
+#if HASH_KEY_BITS <= 64 && TT_CLUSTER_SIZE != 3
+	// indexのbit0は手番なので、hash keyのbitで決まるのは残りのbit。
+	const double bits = 64 - std::max(0.0, std::log2(clusters) - 1);
+#else
+	const double bits = sizeof(TTE_KEY_TYPE) * 8;
+#endif
+
+	// 同じClusterのClusterSize個のEntryのどれかと、keyが一致する確率
+	return ClusterSize * std::pow(2.0, -bits);
+}
+
+// ----------------------------------
+//	   置換表のsnapshot
+// ----------------------------------
+
+namespace {
+
+	// snapshotファイルのheader。このあとにCluster配列が続く。
+	// 💡 64 bytesにしてあるので、mapしたときにcopy元のCluster配列がcache lineにalignされる。
+	struct TTSnapshotHeader {
+		char     magic[8];      // "YOTTSNAP"
+		uint32_t version;       // TT_SNAPSHOT_VERSION
+		uint32_t hashKeyBits;   // HASH_KEY_BITS
+		uint32_t clusterSize;   // TT_CLUSTER_SIZE
+		uint32_t clusterBytes;  // sizeof(Cluster)
+		uint64_t clusterCount;  // Cluster数
+		uint64_t evalHash;      // 評価関数の識別用のhash値
+		uint8_t  generation8;   // 保存時のgeneration
+		uint8_t  padding[23];
+	};
+	static_assert(sizeof(TTSnapshotHeader) == 64, "Unexpected TTSnapshotHeader size");
+
+	constexpr char     TT_SNAPSHOT_MAGIC[8]  = { 'Y', 'O', 'T', 'T', 'S', 'N', 'A', 'P' };
+	constexpr uint32_t TT_SNAPSHOT_VERSION   = 1;
+
+	// 1回のwrite/readで扱う最大サイズ。
+	constexpr size_t   TT_SNAPSHOT_IO_CHUNK  = 64 * 1024 * 1024;
+
+	// sizeバイトをスレッド数で等分し、i番目のスレッドでi番目の区間に対してjob(start, len)を実行する。
+	// (端数は最後のスレッドが受け持つ)
+	// 💡 各スレッドが1つのfile streamで連続した範囲を読み書きするように、Tools::memclear()のような
+	//     ThreadPool::parallel_for()による細かい分割ではなく、スレッドごとに固定の区間にしている。
+	// すべてのjobが成功したらtrueを返す。
+	template<typename Job>
+	bool run_on_stripes(ThreadPool& threads, size_t size, Job job) {
+
+		const size_t threadCount = threads.num_threads();
+		if (threadCount == 0)
+			return job(size_t(0), size);
+
+		std::atomic<bool> ok(true);
+		for (size_t i = 0; i < threadCount; ++i)
+		{
+			threads.run_on_thread(i, [&ok, &job, size, threadCount, i]() {
+				const size_t stride = size / threadCount,
+				start = stride * i,
+				len = (i != threadCount - 1) ? stride : size - start;
+
+				if (!job(start, len))
+					ok = false;
+			});
+		}
+
+		for (size_t i = 0; i < threadCount; ++i)
+			threads.wait_on_thread(i);
+
+		return ok;
+	}
+}
+
+size_t TranspositionTable::size_in_bytes() const { return clusterCount * sizeof(Cluster); }
+
+Tools::Result TranspositionTable::save(const std::string& filename, ThreadPool& threads, u64 evalHash) const {
+
+	if (!table)
+		return Tools::ResultCode::SomeError;
+
+	// 起動フォルダ相対でのpath。(load()のMemoryMappedFile::Open()と同じ)
+	const std::string path = Path::Combine(Directory::GetBinaryFolder(), filename);
+
+	TTSnapshotHeader header = {};
+	std::memcpy(header.magic, TT_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version      = TT_SNAPSHOT_VERSION;
+	header.hashKeyBits  = HASH_KEY_BITS;
+	header.clusterSize  = TT_CLUSTER_SIZE;
+	header.clusterBytes = sizeof(Cluster);
+	header.clusterCount = clusterCount;
+	header.evalHash     = evalHash;
+	header.generation8  = generation8;
+
+	const size_t size = size_in_bytes();
+
+	// headerを書き出して、ファイルを最終的なサイズにしておく。
+	// そのあと、各スレッドが自分の担当範囲を書き込む。
+	{
+		std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+		if (!fs)
+			return Tools::ResultCode::FileOpenError;
+
+		fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (size > 0)
+		{
+			fs.seekp(std::streamoff(sizeof(header) + size - 1));
+			fs.put('\0');
+		}
+		if (!fs)
+			return Tools::ResultCode::FileWriteError;
+	}
+
+	const char* const data = reinterpret_cast<const char*>(table);
+	const bool ok = run_on_stripes(threads, size, [&](size_t start, size_t len) {
+		std::fstream fs(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!fs)
+			return false;
+
+		fs.seekp(std::streamoff(sizeof(header) + start));
+		for (size_t done = 0; done < len && fs; done += TT_SNAPSHOT_IO_CHUNK)
+			fs.write(data + start + done, std::streamsize(std::min(TT_SNAPSHOT_IO_CHUNK, len - done)));
+
+		return bool(fs.flush());
+	});
+
+	return ok ? Tools::Result::Ok() : Tools::Result(Tools::ResultCode::FileWriteError);
+}
+
+Tools::Result TranspositionTable::load(const std::string& filename, ThreadPool& threads, u64 evalHash, bool useMmap, std::string& message) {
+
+	if (!table)
+		return Tools::ResultCode::SomeError;
+
+	// 起動フォルダ相対でのpath。(save()と同じ)
+	const std::string path = Path::Combine(Directory::GetBinaryFolder(), filename);
+
+	SystemIO::MemoryMappedFile mmap;
+	TTSnapshotHeader           header;
+	size_t                     fileSize;
+
+	if (useMmap)
+	{
+		auto result = mmap.Open(path);
+		if (result.is_not_ok())
+			return result;
+
+		fileSize = mmap.size();
+		if (fileSize < sizeof(header))
+			return Tools::ResultCode::FileReadError;
+		std::memcpy(&header, mmap.data(), sizeof(header));
+	}
+	else
+	{
+		std::ifstream fs(path, std::ios::binary | std::ios::ate);
+		if (!fs)
+			return Tools::ResultCode::FileOpenError;
+
+		fileSize = size_t(fs.tellg());
+		fs.seekg(0);
+		if (!fs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			return Tools::ResultCode::FileReadError;
+	}
+
+	// headerの検証
+
+	auto mismatch = [&](const std::string& what, u64 file_value, u64 engine_value) {
+		message = "TT snapshot mismatch : " + what + " , file = " + std::to_string(file_value)
+		        + " , engine = " + std::to_string(engine_value);
+		return Tools::Result(Tools::ResultCode::FileMismatch);
+	};
+
+	if (std::memcmp(header.magic, TT_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+	{
+		message = "not a TT snapshot file.";
+		return Tools::ResultCode::FileMismatch;
+	}
+	if (header.version != TT_SNAPSHOT_VERSION)
+		return mismatch("version", header.version, TT_SNAPSHOT_VERSION);
+	if (header.hashKeyBits != HASH_KEY_BITS)
+		return mismatch("HASH_KEY_BITS", header.hashKeyBits, HASH_KEY_BITS);
+	if (header.clusterSize != TT_CLUSTER_SIZE || header.clusterBytes != sizeof(Cluster))
+		return mismatch("TT_CLUSTER_SIZE", header.clusterSize, TT_CLUSTER_SIZE);
+	if (header.clusterCount != clusterCount)
+	{
+		// USI_Hashを合わせて貰えば読み込めるので、その値も出しておく。
+		message = "TT snapshot mismatch : cluster count , file = " + std::to_string(header.clusterCount)
+		        + " (USI_Hash " + std::to_string(header.clusterCount * sizeof(Cluster) / (1024 * 1024)) + "[MB])"
+		        + " , engine = " + std::to_string(clusterCount)
+		        + " (USI_Hash " + std::to_string(size_in_bytes() / (1024 * 1024)) + "[MB])";
+		return Tools::ResultCode::FileMismatch;
+	}
+	if (header.evalHash != evalHash)
+	{
+		message = "TT snapshot mismatch : evaluation function differs.";
+		return Tools::ResultCode::FileMismatch;
+	}
+
+	const size_t size = size_in_bytes();
+	if (fileSize != sizeof(header) + size)
+	{
+		message = "TT snapshot file is truncated.";
+		return Tools::ResultCode::FileReadError;
+	}
+
+	// Cluster配列の読み込み
+
+	char* const data = reinterpret_cast<char*>(table);
+	const bool ok = run_on_stripes(threads, size, [&](size_t start, size_t len) {
+		// mmapのときは、mapしたファイルから置換表にcopyする。
+		if (useMmap)
+		{
+			std::memcpy(data + start, mmap.data() + sizeof(header) + start, len);
+			return true;
+		}
+
+		std::ifstream fs(path, std::ios::binary);
+		if (!fs)
+			return false;
+
+		fs.seekg(std::streamoff(sizeof(header) + start));
+		for (size_t done = 0; done < len && fs; done += TT_SNAPSHOT_IO_CHUNK)
+			fs.read(data + start + done, std::streamsize(std::min(TT_SNAPSHOT_IO_CHUNK, len - done)));
+
+		return bool(fs);
+	});
+
+	if (!ok)
+	{
+		// 途中まで読み込んだ置換表は信用できないので捨てる。
+		Tools::memclear(threads, nullptr, table, size);
+		generation8 = 0;
+		return Tools::ResultCode::FileReadError;
+	}
+
+	generation8 = header.generation8;
+	if (shared)
+		shared->header->generation8.store(generation8, std::memory_order_relaxed);
+
+#if defined(ENABLE_TT_STATS)
+	// 読み込んだEntryの局面のhash keyは分からない。
+	clear_full_keys(threads);
 #endif
+
+	return Tools::Result::Ok();
 }
 
 // ----------------------------------
@@ -533,6 +1224,167 @@ void TranspositionTable::UnitTest(Test::UnitTester& unittest, IEngine& engine)
 			unittest.test("write & probe", ok);
 		}
 	}
+#if defined(__linux__) && !defined(__ANDROID__)
+	{
+		auto section2 = unittest.section("shared memory");
+
+		auto&             threads = engine.get_threads();
+		const std::string name    = "unittest_" + std::to_string(getpid());
+
+		Position  pos;
+		StateInfo si;
+		pos.set_hirate(&si);
+		const Key  posKey = pos.key();
+		const Move m = make_move(SQ_77, SQ_76, BLACK, PAWN);
+
+		{
+			// 同じ名前の置換表を2つ作ると、2つ目は1つ目の共有メモリに接続する。
+			TranspositionTable tt1, tt2;
+			tt1.set_shared_memory_name(name);
+			tt2.set_shared_memory_name(name);
+			tt1.resize(16, threads);
+			tt2.resize(16, threads);
+			tt1.clear(threads);
+			unittest.test("attach", tt1.is_shared() && tt2.is_shared());
+
+			tt1.new_search();
+			{
+				auto [ttHit, ttData, ttWriter] = tt1.probe(posKey, pos);
+				ttWriter.write(posKey, Value(123), false, BOUND_EXACT, 10, m, Value(45), tt1.generation());
+			}
+
+			// 片方のclear()で、もう片方が書き込んだ内容が消えてはならない。
+			tt2.clear(threads);
+			{
+				auto [ttHit, ttData, ttWriter] = tt2.probe(posKey, pos);
+				unittest.test("shared probe", ttHit && ttData.value == Value(123) && ttData.move == m);
+			}
+
+			// 両方が探索を開始しても、世代は1つしか進まない。
+			tt1.new_search();
+			tt2.new_search();
+			unittest.test("generation", tt1.generation() == 2 && tt2.generation() == 2);
+		}
+
+		// 使っているプロセスがいなくなったら削除されている。
+		const std::string path = "/dev/shm/yaneuraou_tt_" + name;
+		unittest.test("unlink", !std::ifstream(path).is_open());
+
+		// サイズが異なると共有しない。
+		{
+			TranspositionTable tt1, tt2;
+			tt1.set_shared_memory_name(name);
+			tt2.set_shared_memory_name(name);
+			tt1.resize(16, threads);
+			tt2.resize(32, threads);
+			unittest.test("size mismatch", tt1.is_shared() && !tt2.is_shared());
+		}
+	}
+#endif
+
+#if defined(ENABLE_TT_STATS)
+	{
+		auto section2 = unittest.section("stats");
+
+		auto& threads = engine.get_threads();
+
+		Position  pos;
+		StateInfo si;
+		pos.set_hirate(&si);
+		const Key  posKey = pos.key();
+		const Move m = make_move(SQ_77, SQ_76, BLACK, PAWN);
+
+		TranspositionTable tt;
+		tt.resize(16, threads);
+		tt.clear(threads);
+
+		// 💡 このスレッドのカウンターだけを見る。
+		TTStats::reset();
+		auto count = [](TTStats::Counter c) { return TTStats::local_counters().count[c].load(std::memory_order_relaxed); };
+
+		{
+			auto [ttHit, ttData, ttWriter] = tt.probe(posKey, pos);
+			ttWriter.write(posKey, Value(100), false, BOUND_EXACT, 10, m, Value(50), tt.generation());
+		}
+		unittest.test("miss & write empty", count(TTStats::Probe) == 1 && count(TTStats::Miss) == 1 && count(TTStats::WriteEmpty) == 1);
+
+		{
+			auto [ttHit, ttData, ttWriter] = tt.probe(posKey, pos);
+			ttWriter.write(posKey, Value(100), false, BOUND_LOWER, 5, m, Value(50), tt.generation());
+			unittest.test("hit", ttHit && count(TTStats::Hit) == 1 && count(TTStats::Collision) == 0);
+		}
+		unittest.test("write kept", count(TTStats::Write) == 2 && count(TTStats::WriteKept) == 1);
+
+		// 格納されているbitは一致するが、別の局面が書き込まれたことにする。
+		{
+			auto [ttHit, ttData, ttWriter] = tt.probe(posKey, pos);
+			*ttWriter.fullKey ^= 0x100;
+			auto [ttHit2, ttData2, ttWriter2] = tt.probe(posKey, pos);
+			unittest.test("collision", ttHit2 && count(TTStats::Collision) == 1);
+		}
+
+		TTStats::reset();
+		unittest.test("reset", count(TTStats::Probe) == 0);
+	}
+#endif
+	{
+		auto section2 = unittest.section("snapshot");
+
+		auto&       threads = engine.get_threads();
+		const u64   evalHash = 0x1234567890abcdefULL;
+		// 相対pathで保存したものを、stream/mmapのどちらでも同じファイルとして読み込めること。
+		const std::string filename = "tt_unittest.bin";
+		const auto  path = Path::Combine(Directory::GetBinaryFolder(), filename);
+
+		Position  pos;
+		StateInfo si;
+		pos.set_hirate(&si);
+		const Key  posKey = pos.key();
+		const Move m = make_move(SQ_77, SQ_76, BLACK, PAWN);
+
+		TranspositionTable tt;
+		tt.resize(16, threads);
+		tt.clear(threads);
+		tt.new_search();
+		tt.new_search();
+		{
+			auto [ttHit, ttData, ttWriter] = tt.probe(posKey, pos);
+			ttWriter.write(posKey, Value(123), true, BOUND_EXACT, 20, m, Value(45), tt.generation());
+		}
+		unittest.test("save", tt.save(filename, threads, evalHash).is_ok() && std::ifstream(path, std::ios::binary).good());
+
+		for (bool useMmap : { false, true })
+		{
+			TranspositionTable tt2;
+			tt2.resize(16, threads);
+			tt2.clear(threads);
+
+			std::string message;
+			bool ok = tt2.load(filename, threads, evalHash, useMmap, message).is_ok();
+			ok &= tt2.generation() == tt.generation();
+
+			auto [ttHit, ttData, ttWriter] = tt2.probe(posKey, pos);
+			ok &= ttHit && ttData.value == Value(123) && ttData.eval == Value(45) && ttData.depth == 20
+			   && ttData.bound == BOUND_EXACT && ttData.is_pv && ttData.move == m;
+			unittest.test(useMmap ? "load (mmap)" : "load", ok);
+		}
+
+		{
+			TranspositionTable tt2;
+			tt2.resize(16, threads);
+
+			std::string message;
+			unittest.test("eval hash mismatch",
+				tt2.load(path, threads, evalHash + 1, false, message).code == Tools::ResultCode::FileMismatch);
+
+			TranspositionTable tt3;
+			tt3.resize(32, threads);
+			unittest.test("size mismatch",
+				tt3.load(path, threads, evalHash, false, message).code == Tools::ResultCode::FileMismatch);
+		}
+
+		std::remove(path.c_str());
+	}
 }
 
 } // namespace YaneuraOu
@@ -8,6 +8,10 @@
 #include "memory.h"
 #include "thread.h"
 
+#if defined(ENABLE_TT_STATS)
+#include <atomic>
+#endif
+
 namespace YaneuraOu {
 
 struct Key128;
@@ -18,6 +22,7 @@ struct Key256;
 //class ThreadPool;
 struct TTEntry;
 struct Cluster;
+struct TTSharedMemory;
 
 // There is only one global hash table for the engine and all its threads. For chess in particular, we even allow racy
 // updates between threads to and from the TT, as taking the time to synchronize access would cost thinking time and
@@ -83,6 +88,11 @@ private:
 	friend class TranspositionTable;
 	TTEntry* entry;
 	TTWriter(TTEntry* tte);
+
+#if defined(ENABLE_TT_STATS)
+	// entryに対応するhash keyの記録場所。(TTStatsのcollisionの検出用)
+	u64* fullKey = nullptr;
+#endif
 };
 
 // ============================================================
@@ -96,6 +106,79 @@ typedef uint16_t TTE_KEY_TYPE;
 typedef uint64_t TTE_KEY_TYPE;
 #endif
 
+// 置換表のメモリのNUMA nodeへの配置方針。(やねうら王独自拡張)
+// Default    : 特に何もしない。(OSの既定の配置。Linuxならclear()で最初に触れたスレッドのnode)
+// Interleave : 全NUMA nodeにpage単位で交互に割り当てる。どのスレッドから見ても平均的なアクセス速度になる。
+// FirstTouch : clear()のたびに物理pageを解放してから、各スレッドが担当範囲をゼロクリアする。
+//              各スレッドの担当範囲が、そのスレッドのNUMA nodeに配置される。
+enum class TTMemoryPolicy { Default, Interleave, FirstTouch };
+
+// 🌈 置換表の統計(やねうら王独自拡張)
+//
+// USI_HashやTT_CLUSTER_SIZEを調整するときの手がかりとして、probe()とwrite()の結果を数える。
+// ENABLE_TT_STATSをdefineしたときだけ有効。そうでなければadd()は何もしないので、探索速度に影響はない。
+//
+// 📝 カウンターはスレッドごとに持ち、report()のときに合計する。
+//     key collisionは、TTEntryに格納されていないbitまで含めたhash keyを別の配列に記録しておき、
+//     probe()でhitしたときにそれと比較して検出する。(そのため、置換表とは別にEntryあたり8 bytes確保する)
+namespace TTStats {
+
+enum Counter : int {
+	Probe,              // probe()の呼び出し回数
+	Hit,                // probe()でhitした回数
+	Miss,               // probe()でhitしなかった回数
+	Collision,          // hitしたが、hash keyの全bitを比べると別の局面であった回数
+	MoveReject,         // TTEntryの指し手を32bit化できなかったので、hitしなかった扱いにした回数
+	Write,              // write()の呼び出し回数
+	WriteEmpty,         // 空のEntryに書き込んだ回数
+	WriteSameKey,       // 同じ局面のEntryを更新した回数
+	ReplaceByAge,       // 古い世代の別の局面のEntryを上書きした回数
+	ReplaceByDepth,     // 同じ世代の別の局面のEntryを上書きした回数
+	WriteKept,          // 元のEntryの方が価値が高いので書き込まなかった回数
+	TTMoveNotPseudoLegal, // 探索で、置換表の指し手がpseudo-legalではなかった回数
+	TTMoveNotLegal,       // 探索で、置換表の指し手がlegalではなかった回数
+	COUNTER_NB
+};
+
+#if defined(ENABLE_TT_STATS)
+
+struct Counters {
+	std::atomic<u64> count[COUNTER_NB];
+};
+
+// 呼び出したスレッドのカウンター
+Counters& local_counters();
+
+// hash keyの全bitから、collisionの検出用の64bitの値を得る。
+u64 full_key(const Key& key);
+
+// カウンターを1加算する。
+// 💡 スレッドごとのカウンターなので、書き込むのはそのスレッドだけ。atomicなfetch_addは要らない。
+inline void add(Counter c) {
+	auto& n = local_counters().count[c];
+	n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+constexpr bool enabled = true;
+
+#else
+
+inline void add(Counter) {}
+
+constexpr bool enabled = false;
+
+#endif
+
+// 全スレッドのカウンターを0にする。
+// ⚠ 探索中に呼び出さないこと。
+void reset();
+
+// 全スレッドのカウンターを合計して、表示用の文字列にする。1要素が1行。
+// ENABLE_TT_STATSがdefineされていなければ、その旨のメッセージを返す。
+std::vector<std::string> report();
+
+} // namespace TTStats
+
 // ============================================================
 //               置換表本体
 // ============================================================
@@ -106,7 +189,8 @@ typedef uint64_t TTE_KEY_TYPE;
 class TranspositionTable {
 
 public:
-	~TranspositionTable() { aligned_large_pages_free(table); }
+	TranspositionTable();
+	~TranspositionTable();
 
 	// Set TT size in MiB
 	// 置換表のサイズを変更する。mbSize == 確保するメモリサイズ。[MiB]単位。
@@ -186,6 +270,57 @@ public:
 	TTEntry* first_entry(const Key& key, Color side_to_move) const;
 #endif
 
+	// 🌈 置換表のsnapshot(やねうら王独自拡張)
+	//
+	// 置換表の全Clusterとgenerationをファイルに書き出し、それを読み戻す。
+	// 検討などでエンジンを再起動しても、それまでの探索結果を引き継ぐために用いる。
+	//
+	// ファイルは、64 bytesのheader(TTSnapshotHeader)のあとにCluster配列をそのまま並べたもの。
+	// 書き出し・読み込みは、置換表をスレッド数で等分して、スレッドごとに並列に行う。
+	//
+	// filename : 起動フォルダ相対のpath(絶対pathも可)。mmapで読み込むときも同じファイルを指す。
+	// useMmap  : ファイルをstreamで読む代わりにメモリにmapして、そこから置換表にcopyする。(mmap+copy)
+	//            置換表がmapしたファイルを直接参照するわけではないので、読み込み後のメモリ使用量は変わらない。
+	// evalHash : 評価関数の識別用のhash値。保存時と異なれば読み込まない。
+	//            (TTEntryにはevaluate()の値が格納されているため)
+	// 📝 読み込むときは、HASH_KEY_BITS, TT_CLUSTER_SIZE, 置換表のサイズ(Cluster数)が保存時と一致している必要がある。
+	//     一致しなければFileMismatchを返し、messageにその理由を格納する。
+
+	Tools::Result save(const std::string& filename, ThreadPool& threads, u64 evalHash) const;
+	Tools::Result load(const std::string& filename, ThreadPool& threads, u64 evalHash, bool useMmap, std::string& message);
+
+	// 置換表のサイズ[byte]
+	size_t size_in_bytes() const;
+
+	// 置換表のサイズがmbSize[MiB]で、すべてのEntryが埋まっているときに、
+	// 置換表に格納されていない局面をprobe()して、別の局面のEntryにhitしてしまう確率の見積もり。
+	// HASH_KEY_BITS, TT_CLUSTER_SIZEによって、TTEntryに格納されるkeyのうち、
+	// Clusterのindexを求めるのに使われていないbitの数が変わるので、それを元に計算する。
+	static double false_hit_rate(size_t mbSize);
+
+	// 置換表のメモリのNUMA nodeへの配置方針を設定する。
+	// 💡 変更した場合、次のresize()でメモリを確保しなおす。
+	void set_memory_policy(TTMemoryPolicy policy);
+	TTMemoryPolicy memory_policy() const { return memoryPolicy; }
+
+	// 🌈 複数プロセスでの置換表の共有(やねうら王独自拡張)
+	//
+	// nameを指定すると、次のresize()で、置換表をその名前の共有メモリ(POSIX shared memory)に配置する。
+	// 同じnameを指定した他のエンジンのプロセスと、1つの置換表を共有する。(同じ局面の兄弟局面を並列に検討するときなど)
+	// 空の文字列なら共有しない。(既定)
+	//
+	// 📝 共有するプロセス同士で、USI_HashとHASH_KEY_BITS, TT_CLUSTER_SIZEが一致している必要がある。
+	//     一致していない、あるいは共有メモリが使えない環境では、共有せずに通常のメモリに確保する。
+	//
+	//     置換表への読み書きは、スレッド間と同じく同期を取らない。(競合は探索側で許容している)
+	//     世代(generation)は共有メモリ上に置き、new_search()ではこれをCASで進める。
+	//     clear()は、他のプロセスが使っている置換表を消してしまうので、共有しているときは何もしない。
+	//     (作成されたときにゼロクリアされている)
+	void set_shared_memory_name(const std::string& name);
+
+	// 置換表を共有メモリに配置しているか。
+	bool is_shared() const { return shared != nullptr; }
+
 	static void UnitTest(Test::UnitTester& unittest, IEngine& engine);
 
 private:
@@ -204,6 +339,31 @@ private:
 
 	// ⇨ 世代カウンター。new_search()のごとに1ずつ加算する。TTEntry::save()で用いる。
 	uint8_t generation8 = 0;
+
+	// メモリのNUMA nodeへの配置方針
+	TTMemoryPolicy memoryPolicy = TTMemoryPolicy::Default;
+
+	// 置換表を配置する共有メモリの名前。空なら共有しない。
+	std::string sharedMemoryName;
+
+	// 置換表を共有メモリに配置しているときの、その共有メモリ。そうでなければnullptr。
+	std::unique_ptr<TTSharedMemory> shared;
+
+	// tableを解放する。(共有メモリなら、それを閉じる)
+	void free_table();
+
+#if defined(ENABLE_TT_STATS)
+	// 各TTEntryに最後に書き込んだ局面のhash key。[clusterCount * ClusterSize]
+	// 0なら不明。(tt_loadで読み込んだEntryなど)
+	u64* fullKeys = nullptr;
+
+	// fullKeysを確保しなおす。/ゼロクリアする。
+	void resize_full_keys();
+	void clear_full_keys(ThreadPool& threads);
+
+	// tteに対応するfullKeysの要素
+	u64* full_key_slot(const TTEntry* tte) const;
+#endif
 };
 
 } // namespace YaneuraOu
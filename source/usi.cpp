@@ -1,4 +1,7 @@
 ﻿#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
 #include <sstream>
 #include <queue>
 
@@ -12,6 +15,7 @@
 #include "benchmark.h"
 #include "engine.h"
 #include "movegen.h"
+#include "tt.h"
 
 #if defined(__EMSCRIPTEN__)
 // yaneuraou.wasm
@@ -209,9 +213,21 @@ bool USIEngine::usi_cmdexec(const std::string& cmd) {
         それを言えばstopにだって…。
 	*/
 #endif
+    {
         // "stop"コマンドが来るとEngine.stop()が呼び出され、その結果threads.stop = trueとなる。
         engine.stop();
 
+#if !STOCKFISH
+        // 🌈 探索のテレメトリ(今回の探索の分)を、探索の終了を待ってから出力する。
+        if (token == "stop" && Search::Telemetry::dump_on_stop)
+        {
+            engine.wait_for_search_finished();
+            for (const auto& line : Search::Telemetry::dump(0, true))
+                sync_cout << "info string " << line << sync_endl;
+        }
+#endif
+    }
+
     // The GUI sends 'ponderhit' to tell that the user has played the expected move.
     // So, 'ponderhit' is sent if pondering was done on the same move that the user
     // has played. The search should continue, but should also switch from pondering
@@ -411,6 +427,20 @@ bool USIEngine::usi_cmdexec(const std::string& cmd) {
     // .psv(PsvRecord列)の局面をqsearch PVのleafに置換する。
     else if (token == "qsearch_psv")
         qsearch_psv(is);
+    else if (token == "psv_transform")
+        psv_transform(is);
+    else if (token == "tt_save")
+        tt_save(is);
+    else if (token == "tt_load")
+        tt_load(is);
+    else if (token == "tt_stats")
+        tt_stats(is);
+    else if (token == "search_telemetry")
+        search_telemetry(is);
+
+    // Lazy SMPのスケーリング計測
+    else if (token == "scalingbench")
+        scaling_benchmark(is);
 
 #if defined(ENABLE_MAKEBOOK_CMD)
 	// 定跡コマンド
@@ -703,6 +733,11 @@ void USIEngine::bench(std::istream& args) {
 
     num = count_if(list.begin(), list.end(), [](const std::string& s) { return s.find("go ") == 0 || s.find("eval") == 0; });
 
+#if !STOCKFISH
+    // 🌈 bench全体での置換表の統計を出力するため、ここでリセットしておく。
+    TTStats::reset();
+#endif
+
     TimePoint elapsed = now();
 
     for (const auto& cmd : list)
@@ -761,6 +796,17 @@ void USIEngine::bench(std::istream& args) {
               << "\nNodes searched  : " << nodes    //
               << "\nNodes/second    : " << 1000 * nodes / elapsed << std::endl;
 
+#if !STOCKFISH
+    // 🌈 置換表の配置方針ごとに比較できるように、置換表の情報も出力しておく。
+    if (options.count("TTMemoryPolicy"))
+        std::cerr << "TT memory policy: " << std::string(options["TTMemoryPolicy"])  //
+                  << "\nHashfull        : " << engine.get_hashfull(0) << " (touched " << engine.get_hashfull(999) << ")" << std::endl;
+
+    if (TTStats::enabled)
+        for (const auto& line : TTStats::report())
+            std::cerr << line << std::endl;
+#endif
+
     // reset callback, to not capture a dangling reference to nodesSearched
     // コールバックをリセットする。nodesSearched へのダングリング参照を捕捉しないようにするため。
 
@@ -930,6 +976,10 @@ void USIEngine::benchmark(std::istream& args) {
               << "\nThread count               : " << setup.threads
               << "\nThread binding             : " << threadBinding
               << "\nTT size [MiB]              : " << setup.ttSize
+#if !STOCKFISH
+              << "\nTT memory policy           : "
+              << (engine.get_options().count("TTMemoryPolicy") ? std::string(engine.get_options()["TTMemoryPolicy"]) : std::string("-"))
+#endif
               << "\nHash max, avg [per mille]  : "
               << "\n    single search          : " << maxHashfull[0] << ", "
               << totalHashfull[0] / numHashfullReadings
@@ -1406,16 +1456,37 @@ void USIEngine::getoption(std::istringstream& is) {
 // USI拡張コマンド "qsearch_psv" のhandler。
 // input.psvの各PsvRecord局面をqsearchのPV leaf nodeで置換し、
 // output.psvへ同じPSV形式で書き出す処理をEngine側へ委譲する。
+// 書式 : qsearch_psv input.psv output.psv [workers] [mmap]
+//   input.psv, output.psvはworking directory相対。
+//   mmap を指定すると、input.psvをstreamで読む代わりにメモリにmapして読む。
 void USIEngine::qsearch_psv(std::istringstream& is) {
     std::string inputPath, outputPath;
     size_t      workerCount = 0;
+    bool        useMmap     = false;
 
     is >> inputPath >> outputPath;
-    if (!(is >> workerCount))
-        workerCount = 0;
+
+    std::string token;
+    while (is >> token)
+    {
+        if (token == "mmap")
+            useMmap = true;
+        else
+        {
+            // 💡 std::stoull()は例外を出すので使わない。(-fno-exceptionsでビルドしているとterminateしてしまう)
+            //     to_int()は"foo"を0、"8x"を8と解釈してしまうので、token全体が数値である時だけ受け付ける。
+            int n = -1;
+            if (!StringExtension::try_to_int(token, n) || n < 0)
+            {
+                sync_cout << "info string Error! : qsearch_psv : illegal workers = " << token << sync_endl;
+                return;
+            }
+            workerCount = size_t(n);
+        }
+    }
 
     std::string message;
-    const bool  ok = engine.qsearch_psv(inputPath, outputPath, workerCount, message);
+    const bool  ok = engine.qsearch_psv(inputPath, outputPath, workerCount, useMmap, message);
 
     if (!message.empty())
         sync_cout << "info string " << message << sync_endl;
@@ -1424,6 +1495,373 @@ void USIEngine::qsearch_psv(std::istringstream& is) {
         sync_cout << "info string qsearch_psv failed" << sync_endl;
 }
 
+// USI拡張コマンド "psv_transform" のhandler。
+// 書式 : psv_transform op input.psv output.psv [options...]
+// opとoptionsについては、YaneuraOuEngine::psv_transform()を参照のこと。
+void USIEngine::psv_transform(std::istringstream& is) {
+    std::string op;
+    is >> op;
+
+    std::string message;
+    const bool  ok = engine.psv_transform(op, is, message);
+
+    if (!message.empty())
+        sync_cout << "info string " << message << sync_endl;
+
+    if (!ok)
+        sync_cout << "info string psv_transform failed" << sync_endl;
+}
+
+// USI拡張コマンド "tt_save" のhandler。
+// 置換表の内容(全Clusterとgeneration)をファイルに保存する。
+// 書式 : tt_save filename
+void USIEngine::tt_save(std::istringstream& is) {
+    std::string filename;
+    is >> filename;
+
+    std::string message;
+    const bool  ok = engine.save_tt(filename, message);
+
+    if (!message.empty())
+        sync_cout << "info string " << message << sync_endl;
+
+    if (!ok)
+        sync_cout << "info string tt_save failed" << sync_endl;
+}
+
+// USI拡張コマンド "tt_load" のhandler。
+// tt_saveで保存した置換表を読み込む。
+// 書式 : tt_load filename [mmap]
+//   ⚠ "isready"や"usinewgame"で置換表はクリアされるので、それらのあとに送ること。
+//   mmap を指定すると、ファイルをstreamで読む代わりにメモリにmapして、そこから置換表にcopyする。(mmap+copy)
+void USIEngine::tt_load(std::istringstream& is) {
+    std::string filename, token;
+    bool        useMmap = false;
+
+    is >> filename;
+    while (is >> token)
+        if (token == "mmap")
+            useMmap = true;
+
+    std::string message;
+    const bool  ok = engine.load_tt(filename, useMmap, message);
+
+    if (!message.empty())
+        sync_cout << "info string " << message << sync_endl;
+
+    if (!ok)
+        sync_cout << "info string tt_load failed" << sync_endl;
+}
+
+// USI拡張コマンド "tt_stats" のhandler。
+// 置換表の統計(TTStats)を出力する。ENABLE_TT_STATSをdefineしてビルドしたときだけ有効。
+// 書式 : tt_stats [reset]
+//   reset を指定すると、出力したあとにカウンターを0にする。
+//   ⚠ 探索中に送らないこと。
+void USIEngine::tt_stats(std::istringstream& is) {
+    std::string token;
+    bool        reset = false;
+
+    while (is >> token)
+        if (token == "reset")
+            reset = true;
+
+    for (const auto& line : TTStats::report())
+        sync_cout << "info string " << line << sync_endl;
+
+    if (reset)
+        TTStats::reset();
+}
+
+// USI拡張コマンド "search_telemetry" のhandler。
+// 探索のテレメトリ(Search::Telemetry)を出力する。ENABLE_SEARCH_TELEMETRYをdefineしてビルドしたときだけ有効。
+// 書式 : search_telemetry [last N] [clear] [dump_on_stop on|off] [output filename]
+//   last N         : スレッドごとに直近N件だけ出力する。省略時は記録が残っているすべて。
+//   clear          : 出力したあとに記録を消去する。
+//   dump_on_stop   : "stop"を受け取った時に、探索の終了を待ってから出力するかを設定する。(このときは出力しない)
+//   output         : 標準出力ではなくファイルに出力する。
+//   ⚠ 探索中に送らないこと。
+void USIEngine::search_telemetry(std::istringstream& is) {
+    std::string token, outputFile;
+    size_t      last  = 0;
+    bool        clear = false;
+
+    while (is >> token)
+    {
+        if (token == "last")
+            is >> last;
+        else if (token == "clear")
+            clear = true;
+        else if (token == "output")
+            is >> outputFile;
+        else if (token == "dump_on_stop" && is >> token)
+        {
+            Search::Telemetry::dump_on_stop = token == "on" || token == "true";
+            sync_cout << "info string search telemetry : dump_on_stop = "
+                      << (Search::Telemetry::dump_on_stop ? "on" : "off") << sync_endl;
+            return;
+        }
+    }
+
+    const auto lines = Search::Telemetry::dump(last);
+
+    if (outputFile.empty())
+        for (const auto& line : lines)
+            sync_cout << "info string " << line << sync_endl;
+    else
+    {
+        std::ofstream ofs(outputFile);
+        for (const auto& line : lines)
+            ofs << line << '\n';
+
+        if (ofs)
+            sync_cout << "info string search telemetry : written to " << outputFile << sync_endl;
+        else
+            sync_cout << "info string Error! : can't write " << outputFile << sync_endl;
+    }
+
+    if (clear)
+        Search::Telemetry::clear();
+}
+
+// USI拡張コマンド "scalingbench" のhandler。
+// Threads(とUSI_Hash)を変えながら同じ局面を同じ時間だけ探索して、Lazy SMPのスケーリングを計測する。
+// 書式はBenchmark::setup_scaling_benchmark()のコメントを参照のこと。
+//
+// 出力する項目(スレッド数・置換表サイズの組み合わせごとに1行)
+//   nps_speedup  : 先頭のスレッド数に対するNPSの比
+//   ttd_ms       : 各局面で基準深さ(全計測で到達できた深さのうち最大のもの)に到達するまでの時間の合計
+//   ttd_speedup  : 先頭のスレッド数に対するttd_msの比。Lazy SMPの実効的な速度向上率。
+//   hashfull     : 各局面の探索後のhashfullの平均と最大
+//   bestmove_agreement : 先頭のスレッド数と同じ最善手を返した局面の割合。
+//                        スレッド間の探索の多様性(と、それによる探索結果の変化)の目安。
+void USIEngine::scaling_benchmark(std::istream& args) {
+
+    // 1局面の計測結果
+    struct PositionResult {
+        // depthごとに、それに初めて到達した時刻[ms]。到達していなければ-1。
+        std::vector<int64_t> depthTime;
+        uint64_t             nodes    = 0;
+        TimePoint            elapsed  = 0;
+        int                  hashfull = 0;
+        std::string          bestmove;
+    };
+
+    // スレッド数・置換表サイズの組み合わせ1つ分の計測結果
+    struct ConfigResult {
+        size_t                      threads;
+        size_t                      ttSize;
+        std::vector<PositionResult> positions;
+    };
+
+    PositionResult current;
+
+    engine.set_on_update_full([&](const Engine::InfoFull& i) {
+        current.nodes = i.nodes;
+
+        // 💡 fail high/lowのPVは、そのdepthを探索し終わったわけではないので除外する。
+        if (i.multiPV == 1 && i.bound.empty() && i.depth > 0)
+        {
+            if (current.depthTime.size() <= size_t(i.depth))
+                current.depthTime.resize(size_t(i.depth) + 1, -1);
+            if (current.depthTime[i.depth] < 0)
+                current.depthTime[i.depth] = int64_t(i.timeMs);
+        }
+    });
+    engine.set_on_bestmove([&](std::string_view bestmove, std::string_view) { current.bestmove = bestmove; });
+
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_verify_networks([](const auto&) {});
+
+    // USIEngine::isready()を呼び出してやらかないと"engine_options.txt"などの読み込みが行われない。
+    isready();
+
+    Benchmark::ScalingBenchmarkSetup setup = Benchmark::setup_scaling_benchmark(engine.sfen(), args);
+
+    if (setup.sfens.empty())
+    {
+        sync_cout << "info string Error! : no positions for scalingbench." << sync_endl;
+        init_search_update_listeners();
+        return;
+    }
+
+    std::vector<ConfigResult> results;
+    const size_t              total = setup.ttSizes.size() * setup.threads.size() * setup.sfens.size();
+    size_t                    cnt   = 1;
+
+    for (size_t ttSize : setup.ttSizes)
+        for (size_t threads : setup.threads)
+        {
+            auto ss = std::istringstream("name Threads value " + std::to_string(threads));
+            setoption(ss);
+            ss = std::istringstream("name USI_Hash value " + std::to_string(ttSize));
+            setoption(ss);
+
+            ConfigResult config{threads, ttSize, {}};
+
+            // 💡 局面ごとにクリアはしない。benchと同じく、1局の対局のように置換表を使い回す。
+            engine.search_clear();
+
+            for (const auto& sfen : setup.sfens)
+            {
+                std::cerr << "\rHash " << ttSize << " Threads " << threads << " Position " << cnt++ << '/' << total
+                          << std::flush;
+
+                std::istringstream iss("sfen " + sfen);
+                position(iss);
+
+                std::istringstream goArgs("movetime " + std::to_string(setup.movetime));
+                Search::LimitsType limits = parse_limits(goArgs);
+
+                // depthごとの到達時刻を得るため、PV出力間隔を無効化しておく。
+                limits.disablePvInterval = true;
+
+                current = PositionResult();
+
+                engine.go(limits);
+                engine.wait_for_search_finished();
+
+                current.elapsed  = std::max<TimePoint>(now() - limits.startTime, 1);
+                current.hashfull = engine.get_hashfull(0);
+                config.positions.push_back(current);
+            }
+
+            results.push_back(config);
+        }
+
+    std::cerr << std::endl;
+
+    // 集計した1行分
+    struct Row {
+        size_t   ttSize, threads, positions;
+        uint64_t nodes;
+        double   nps, npsSpeedup, refDepth, ttd, ttdSpeedup, avgDepth, hashfullAvg, bestmoveAgreement;
+        int      hashfullMax;
+    };
+    std::vector<Row> rows;
+
+    for (size_t ttSize : setup.ttSizes)
+    {
+        // この置換表サイズでの計測結果。先頭が基準となるスレッド数。
+        std::vector<const ConfigResult*> configs;
+        for (const auto& r : results)
+            if (r.ttSize == ttSize)
+                configs.push_back(&r);
+
+        const size_t numPositions = setup.sfens.size();
+
+        // 局面ごとの基準深さ = 全計測で到達できた深さの最小値
+        std::vector<int> refDepth(numPositions, 0);
+        for (size_t p = 0; p < numPositions; ++p)
+        {
+            int d = std::numeric_limits<int>::max();
+            for (auto c : configs)
+                d = std::min(d, int(c->positions[p].depthTime.size()) - 1);
+            refDepth[p] = std::max(d, 0);
+        }
+
+        // 基準深さに到達するまでの時間。到達していなければ思考時間全体とみなす。
+        auto time_to_depth = [&](const PositionResult& pr, int depth) {
+            for (size_t d = size_t(depth); d < pr.depthTime.size(); ++d)
+                if (pr.depthTime[d] >= 0)
+                    return std::max<int64_t>(pr.depthTime[d], 1);
+            return int64_t(pr.elapsed);
+        };
+
+        double baseNps = 0, baseTtd = 0;
+        for (auto c : configs)
+        {
+            Row row{};
+            row.ttSize    = ttSize;
+            row.threads   = c->threads;
+            row.positions = numPositions;
+
+            TimePoint elapsed = 0;
+            size_t    agree   = 0;
+            for (size_t p = 0; p < numPositions; ++p)
+            {
+                const auto& pr = c->positions[p];
+                row.nodes += pr.nodes;
+                elapsed += pr.elapsed;
+                row.refDepth += refDepth[p];
+                row.ttd += double(time_to_depth(pr, refDepth[p]));
+                row.avgDepth += std::max(int(pr.depthTime.size()) - 1, 0);
+                row.hashfullAvg += pr.hashfull;
+                row.hashfullMax = std::max(row.hashfullMax, pr.hashfull);
+                agree += pr.bestmove == configs[0]->positions[p].bestmove;
+            }
+
+            row.nps = 1000.0 * double(row.nodes) / double(std::max<TimePoint>(elapsed, 1));
+            row.refDepth /= double(numPositions);
+            row.avgDepth /= double(numPositions);
+            row.hashfullAvg /= double(numPositions);
+            row.bestmoveAgreement = double(agree) / double(numPositions);
+
+            if (c == configs[0])
+            {
+                baseNps = row.nps;
+                baseTtd = row.ttd;
+            }
+            row.npsSpeedup = baseNps > 0 ? row.nps / baseNps : 0;
+            row.ttdSpeedup = row.ttd > 0 ? baseTtd / row.ttd : 0;
+
+            rows.push_back(row);
+        }
+    }
+
+    // 結果の出力
+    std::ostringstream out;
+    out << std::fixed;
+    if (setup.format == "json")
+    {
+        out << "{\n  \"invocation\": \"scalingbench " << setup.filledInvocation << "\",\n"
+            << "  \"movetime_ms\": " << setup.movetime << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            const auto& r = rows[i];
+            out << std::setprecision(3) << "    {\"hash_mb\": " << r.ttSize << ", \"threads\": " << r.threads
+                << ", \"positions\": " << r.positions << ", \"nodes\": " << r.nodes
+                << ", \"nps\": " << std::setprecision(0) << r.nps << ", \"nps_speedup\": " << std::setprecision(3)
+                << r.npsSpeedup << ", \"ref_depth\": " << r.refDepth << ", \"ttd_ms\": " << std::setprecision(0)
+                << r.ttd << ", \"ttd_speedup\": " << std::setprecision(3) << r.ttdSpeedup
+                << ", \"avg_depth\": " << r.avgDepth << ", \"hashfull_avg\": " << std::setprecision(1)
+                << r.hashfullAvg << ", \"hashfull_max\": " << r.hashfullMax
+                << ", \"bestmove_agreement\": " << std::setprecision(3) << r.bestmoveAgreement << "}"
+                << (i + 1 < rows.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+    else
+    {
+        out << "hash_mb,threads,positions,movetime_ms,nodes,nps,nps_speedup,ref_depth,ttd_ms,ttd_speedup,"
+               "avg_depth,hashfull_avg,hashfull_max,bestmove_agreement\n";
+        for (const auto& r : rows)
+            out << r.ttSize << ',' << r.threads << ',' << r.positions << ',' << setup.movetime << ','
+                << r.nodes << ',' << std::setprecision(0) << r.nps << ',' << std::setprecision(3)
+                << r.npsSpeedup << ',' << r.refDepth << ',' << std::setprecision(0) << r.ttd << ','
+                << std::setprecision(3) << r.ttdSpeedup << ',' << r.avgDepth << ',' << std::setprecision(1)
+                << r.hashfullAvg << ',' << r.hashfullMax << ',' << std::setprecision(3)
+                << r.bestmoveAgreement << '\n';
+    }
+
+    if (setup.outputFile.empty())
+        sync_cout << out.str() << sync_endl;
+    else
+    {
+        std::ofstream ofs(setup.outputFile);
+        if (ofs)
+        {
+            ofs << out.str();
+            sync_cout << "info string scalingbench : results written to " << setup.outputFile << sync_endl;
+        }
+        else
+            sync_cout << "info string Error! : can't write " << setup.outputFile << sync_endl;
+    }
+
+    init_search_update_listeners();
+}
+
 // "unittest"コマンドのhandler
 void USIEngine::unittest(std::istringstream& is) { Test::UnitTest(is, engine); }
 
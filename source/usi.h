@@ -180,6 +180,12 @@ private:
     void moves();
     void getoption(std::istringstream& is);
     void qsearch_psv(std::istringstream& is);
+    void psv_transform(std::istringstream& is);
+    void tt_save(std::istringstream& is);
+    void tt_load(std::istringstream& is);
+    void tt_stats(std::istringstream& is);
+    void search_telemetry(std::istringstream& is);
+    void scaling_benchmark(std::istream& args);
     void unittest(std::istringstream& is);
 #endif
 